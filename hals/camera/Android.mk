@@ -33,6 +33,7 @@ emulator_camera_shared_libraries := \
     libutils \
     libcutils \
     libui \
+    libsync \
     libdl \
     libjpeg \
     libcamera_metadata \
@@ -53,12 +54,6 @@ endif
 
 emulator_camera_static_libraries += android.hardware.camera.common@1.0-helper
 
-ifeq (0, $(shell test $(PLATFORM_SDK_VERSION) -le 26; echo $$?))
-emulator_camera_static_libraries += libyuv_static
-else
-emulator_camera_static_libraries += libyuv
-endif
-
 emulator_camera_c_includes := \
     frameworks/native/include/media/hardware \
     $(call include-path-for, camera) \
@@ -75,6 +70,9 @@ emulator_camera_src := \
 		Exif.cpp \
 		Thumbnail.cpp \
 		Converters.cpp \
+		ConverterKernels.cpp \
+		CaptureWorkerPool.cpp \
+		fake-pipeline2/CaptureScheduler.cpp \
 		PreviewWindow.cpp \
 		CallbackNotifier.cpp \
 		JpegCompressor.cpp
@@ -82,8 +80,15 @@ emulated_camera2_src := \
 	VSoCEmulatedCameraHotplugThread.cpp \
 	EmulatedCamera2.cpp \
 		EmulatedFakeCamera2.cpp \
+		fake-pipeline2/AuxBufferPool.cpp \
+		fake-pipeline2/FramePacer.cpp \
+		fake-pipeline2/JpegCompressorPool.cpp \
+		fake-pipeline2/LatencyHistogram.cpp \
+		fake-pipeline2/MetadataPool.cpp \
+		fake-pipeline2/NoiseGenerator.cpp \
 		fake-pipeline2/Scene.cpp \
 		fake-pipeline2/Sensor.cpp \
+		fake-pipeline2/SensorKernels.cpp \
 		fake-pipeline2/JpegCompressor.cpp
 emulated_camera3_src := \
 	EmulatedCamera3.cpp \
@@ -144,6 +149,7 @@ jpeg_shared_libraries := \
     libexif \
     liblog \
     libjpeg \
+    libutils \
 
 jpeg_c_includes := external/libexif \
                    frameworks/native/include
@@ -156,6 +162,7 @@ endif
 jpeg_src := \
     Compressor.cpp \
     JpegStub.cpp \
+    CaptureWorkerPool.cpp \
 
 # JPEG stub - cuttlefish build####################################################
 
@@ -179,3 +186,265 @@ LOCAL_MODULE_TAGS := optional
 LOCAL_VENDOR_MODULE := true
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Sensor kernel tests and benchmarks############################################
+
+sensor_kernels_cflags := \
+    -std=gnu++11 \
+    -Wall \
+    -Werror
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_sensor_kernels_test
+LOCAL_CFLAGS := ${sensor_kernels_cflags}
+LOCAL_SRC_FILES := \
+    fake-pipeline2/SensorKernels.cpp \
+    fake-pipeline2/SensorKernels_test.cpp
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_sensor_kernels_benchmark
+LOCAL_CFLAGS := ${sensor_kernels_cflags}
+LOCAL_SRC_FILES := \
+    fake-pipeline2/SensorKernels.cpp \
+    fake-pipeline2/SensorKernels_benchmark.cpp
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_BENCHMARK)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_noise_generator_test
+LOCAL_CFLAGS := ${sensor_kernels_cflags}
+LOCAL_SRC_FILES := \
+    fake-pipeline2/NoiseGenerator.cpp \
+    fake-pipeline2/NoiseGenerator_test.cpp
+LOCAL_SHARED_LIBRARIES := liblog libutils
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_frame_pacer_test
+LOCAL_CFLAGS := ${sensor_kernels_cflags}
+LOCAL_SRC_FILES := \
+    fake-pipeline2/FramePacer.cpp \
+    fake-pipeline2/FramePacer_test.cpp
+LOCAL_SHARED_LIBRARIES := liblog libutils
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_latency_histogram_test
+LOCAL_CFLAGS := ${sensor_kernels_cflags}
+LOCAL_SRC_FILES := \
+    fake-pipeline2/LatencyHistogram.cpp \
+    fake-pipeline2/LatencyHistogram_test.cpp
+LOCAL_SHARED_LIBRARIES := libutils
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_object_pool_test
+LOCAL_CFLAGS := ${sensor_kernels_cflags}
+LOCAL_SRC_FILES := \
+    fake-pipeline2/ObjectPool_test.cpp
+LOCAL_SHARED_LIBRARIES := libutils
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_metadata_pool_test
+LOCAL_CFLAGS := ${sensor_kernels_cflags}
+LOCAL_SRC_FILES := \
+    fake-pipeline2/MetadataPool.cpp \
+    fake-pipeline2/MetadataPool_test.cpp
+LOCAL_SHARED_LIBRARIES := liblog libutils libcamera_metadata
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_capture_scheduler_test
+LOCAL_CFLAGS := ${sensor_kernels_cflags}
+LOCAL_SRC_FILES := \
+    CaptureWorkerPool.cpp \
+    fake-pipeline2/CaptureScheduler.cpp \
+    fake-pipeline2/CaptureScheduler_test.cpp
+LOCAL_SHARED_LIBRARIES := liblog libutils libcutils
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_converters_test
+LOCAL_CFLAGS := ${sensor_kernels_cflags}
+LOCAL_SRC_FILES := \
+    CaptureWorkerPool.cpp \
+    ConverterKernels.cpp \
+    Converters.cpp \
+    Converters_test.cpp
+LOCAL_SHARED_LIBRARIES := liblog libutils
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_converters_benchmark
+LOCAL_CFLAGS := ${sensor_kernels_cflags}
+LOCAL_SRC_FILES := \
+    CaptureWorkerPool.cpp \
+    ConverterKernels.cpp \
+    Converters.cpp \
+    Converters_benchmark.cpp
+LOCAL_SHARED_LIBRARIES := liblog libutils
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_BENCHMARK)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_compressor_test
+LOCAL_CFLAGS := ${jpeg_cflags}
+LOCAL_C_INCLUDES := ${jpeg_c_includes}
+LOCAL_SRC_FILES := \
+    CaptureWorkerPool.cpp \
+    Compressor.cpp \
+    Compressor_test.cpp
+LOCAL_SHARED_LIBRARIES := ${jpeg_shared_libraries}
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_compressor_benchmark
+LOCAL_CFLAGS := ${jpeg_cflags}
+LOCAL_C_INCLUDES := ${jpeg_c_includes}
+LOCAL_SRC_FILES := \
+    CaptureWorkerPool.cpp \
+    Compressor.cpp \
+    Compressor_benchmark.cpp
+LOCAL_SHARED_LIBRARIES := ${jpeg_shared_libraries}
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_BENCHMARK)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_thumbnail_test
+LOCAL_CFLAGS := ${jpeg_cflags}
+LOCAL_C_INCLUDES := ${jpeg_c_includes}
+LOCAL_SRC_FILES := \
+    JpegCompressor.cpp \
+    Thumbnail.cpp \
+    Thumbnail_test.cpp
+LOCAL_SHARED_LIBRARIES := ${jpeg_shared_libraries} libdl
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_qemu_client_test
+LOCAL_CFLAGS := ${sensor_kernels_cflags}
+LOCAL_SRC_FILES := \
+    QemuClient.cpp \
+    QemuClient_test.cpp
+LOCAL_SHARED_LIBRARIES := liblog libutils libcutils
+LOCAL_STATIC_LIBRARIES := libqemu_pipe
+LOCAL_HEADER_LIBRARIES := libhardware_headers
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+# VSoC shared memory tests and benchmarks#######################################
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_vsoc_circqueue_test
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+LOCAL_SRC_FILES := common/vsoc/lib/circqueue_test.cpp
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_vsoc_region_view_test
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+LOCAL_SRC_FILES := \
+    common/libs/auto_resources/auto_resources.cpp \
+    common/libs/fs/shared_fd.cpp \
+    common/vsoc/lib/region_view.cpp \
+    common/vsoc/lib/region_view_test.cpp
+LOCAL_SHARED_LIBRARIES := libbase
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_vsoc_circqueue_benchmark
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+LOCAL_SRC_FILES := common/vsoc/lib/circqueue_benchmark.cpp
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_NATIVE_BENCHMARK)
+
+# Host pipeline benchmark#######################################################
+#
+# Runs the fake-pipeline2 sensor, JPEG and preview stages on the build host
+# against the stubs in host/include. host/Makefile builds the same binary
+# outside of the Android tree.
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera.rpi3_pipeline_benchmark
+LOCAL_MODULE_HOST_OS := linux
+LOCAL_CFLAGS := \
+    ${sensor_kernels_cflags} \
+    -DVSOC_PLATFORM_SDK_VERSION=28 \
+    -D__unused='__attribute__((__unused__))'
+LOCAL_C_INCLUDES := \
+    $(LOCAL_PATH)/host/include \
+    $(LOCAL_PATH) \
+    external/libjpeg-turbo
+LOCAL_SRC_FILES := \
+    CaptureWorkerPool.cpp \
+    Compressor.cpp \
+    ConverterKernels.cpp \
+    Converters.cpp \
+    JpegStub.cpp \
+    Thumbnail.cpp \
+    fake-pipeline2/AuxBufferPool.cpp \
+    fake-pipeline2/CaptureScheduler.cpp \
+    fake-pipeline2/FramePacer.cpp \
+    fake-pipeline2/JpegCompressor.cpp \
+    fake-pipeline2/LatencyHistogram.cpp \
+    fake-pipeline2/NoiseGenerator.cpp \
+    fake-pipeline2/Scene.cpp \
+    fake-pipeline2/Sensor.cpp \
+    fake-pipeline2/SensorKernels.cpp \
+    host/HostJpegCompressor.cpp \
+    host/PipelineBenchmark.cpp
+LOCAL_SHARED_LIBRARIES := libjpeg
+LOCAL_LDLIBS := -lpthread
+
+include $(BUILD_HOST_EXECUTABLE)
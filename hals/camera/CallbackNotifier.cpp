@@ -24,6 +24,8 @@
 #include "CallbackNotifier.h"
 #include <MetadataBufferType.h>
 #include <cutils/log.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include "EmulatedCameraDevice.h"
 #include "JpegCompressor.h"
 #include "Exif.h"
@@ -87,14 +89,26 @@ CallbackNotifier::CallbackNotifier()
       mDataCBTimestamp(NULL),
       mGetMemoryCB(NULL),
       mCBOpaque(NULL),
+      mFrameRing(NULL),
+      mFrameRingBufferSize(0),
+      mFrameRingBusy(0),
+      mFrameRingNext(0),
+      mFrameRingHits(0),
+      mFrameRingMisses(0),
       mLastFrameTimestamp(0),
       mFrameRefreshFreq(0),
       mMessageEnabler(0),
       mJpegQuality(90),
       mVideoRecEnabled(false),
-      mTakingPicture(false) {}
+      mTakingPicture(false),
+      mPreviewThumbnailWidth(0),
+      mPreviewThumbnailHeight(0) {}
 
-CallbackNotifier::~CallbackNotifier() {}
+CallbackNotifier::~CallbackNotifier() {
+  if (mFrameRing != NULL) {
+    mFrameRing->release(mFrameRing);
+  }
+}
 
 /****************************************************************************
  * Camera API
@@ -107,12 +121,22 @@ void CallbackNotifier::setCallbacks(
   ALOGV("%s: %p, %p, %p, %p (%p)", __FUNCTION__, notify_cb, data_cb,
         data_cb_timestamp, get_memory, user);
 
-  Mutex::Autolock locker(&mObjectLock);
-  mNotifyCB = notify_cb;
-  mDataCB = data_cb;
-  mDataCBTimestamp = data_cb_timestamp;
-  mGetMemoryCB = get_memory;
-  mCBOpaque = user;
+  camera_memory_t* stale_ring = NULL;
+  {
+    Mutex::Autolock locker(&mObjectLock);
+    /* The ring was allocated for the previous client. */
+    if (mGetMemoryCB != get_memory || mCBOpaque != user) {
+      stale_ring = detachFrameRingLocked();
+    }
+    mNotifyCB = notify_cb;
+    mDataCB = data_cb;
+    mDataCBTimestamp = data_cb_timestamp;
+    mGetMemoryCB = get_memory;
+    mCBOpaque = user;
+  }
+  if (stale_ring != NULL) {
+    stale_ring->release(stale_ring);
+  }
 }
 
 void CallbackNotifier::enableMessage(uint msg_type) {
@@ -156,6 +180,18 @@ void CallbackNotifier::disableVideoRecording() {
 }
 
 void CallbackNotifier::releaseRecordingFrame(const void* opaque) {
+  {
+    Mutex::Autolock locker(&mObjectLock);
+    if (mFrameRing != NULL) {
+      const uint8_t* ring = static_cast<const uint8_t*>(mFrameRing->data);
+      const uint8_t* data = static_cast<const uint8_t*>(opaque);
+      if (data >= ring && data < ring + kFrameRingSize * mFrameRingBufferSize) {
+        mFrameRingBusy &= ~(1u << ((data - ring) / mFrameRingBufferSize));
+        return;
+      }
+    }
+  }
+
   List<camera_memory_t*>::iterator it = mCameraMemoryTs.begin();
   for (; it != mCameraMemoryTs.end(); ++it) {
     if ((*it)->data == opaque) {
@@ -176,43 +212,57 @@ status_t CallbackNotifier::storeMetaDataInBuffers(bool enable) {
  ***************************************************************************/
 
 void CallbackNotifier::cleanupCBNotifier() {
-  Mutex::Autolock locker(&mObjectLock);
-  mMessageEnabler = 0;
-  mNotifyCB = NULL;
-  mDataCB = NULL;
-  mDataCBTimestamp = NULL;
-  mGetMemoryCB = NULL;
-  mCBOpaque = NULL;
-  mLastFrameTimestamp = 0;
-  mFrameRefreshFreq = 0;
-  mJpegQuality = 90;
-  mVideoRecEnabled = false;
-  mTakingPicture = false;
+  camera_memory_t* ring = NULL;
+  {
+    Mutex::Autolock locker(&mObjectLock);
+    mMessageEnabler = 0;
+    mNotifyCB = NULL;
+    mDataCB = NULL;
+    mDataCBTimestamp = NULL;
+    mGetMemoryCB = NULL;
+    mCBOpaque = NULL;
+    mLastFrameTimestamp = 0;
+    mFrameRefreshFreq = 0;
+    mJpegQuality = 90;
+    mVideoRecEnabled = false;
+    mTakingPicture = false;
+    ring = detachFrameRingLocked();
+    mFrameRingHits = 0;
+    mFrameRingMisses = 0;
+  }
+  if (ring != NULL) {
+    ring->release(ring);
+  }
 }
 
 void CallbackNotifier::onNextFrameAvailable(const void* frame,
                                             nsecs_t timestamp,
                                             EmulatedCameraDevice* camera_dev) {
+  const size_t frame_size = camera_dev->getFrameBufferSize();
   if (isMessageEnabled(CAMERA_MSG_VIDEO_FRAME) && isVideoRecordingEnabled() &&
       isNewVideoFrameTime(timestamp)) {
-    camera_memory_t* cam_buff =
-        mGetMemoryCB(-1, camera_dev->getFrameBufferSize(), 1, mCBOpaque);
-    if (NULL != cam_buff && NULL != cam_buff->data) {
-      memcpy(cam_buff->data, frame, camera_dev->getFrameBufferSize());
-      mDataCBTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME, cam_buff, 0,
-                       mCBOpaque);
-
-      mCameraMemoryTs.push_back(cam_buff);
+    FrameBuffer cam_buff;
+    if (acquireFrameBuffer(frame_size, &cam_buff)) {
+      memcpy(cam_buff.data(frame_size), frame, frame_size);
+      mDataCBTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME, cam_buff.memory,
+                       cam_buff.index, mCBOpaque);
+
+      /* Ring slots are freed by releaseRecordingFrame without this list. */
+      if (!cam_buff.in_ring) {
+        mCameraMemoryTs.push_back(cam_buff.memory);
+      }
     } else {
       ALOGE("%s: Memory failure in CAMERA_MSG_VIDEO_FRAME", __FUNCTION__);
     }
   }
 
   if (isMessageEnabled(CAMERA_MSG_PREVIEW_FRAME)) {
-    camera_memory_t* cam_buff =
-        mGetMemoryCB(-1, camera_dev->getFrameBufferSize(), 1, mCBOpaque);
+    /* Preview frames are never handed back, and the client may hold on to
+     * one past the callback, so each gets memory of its own rather than a
+     * ring slot. */
+    camera_memory_t* cam_buff = mGetMemoryCB(-1, frame_size, 1, mCBOpaque);
     if (NULL != cam_buff && NULL != cam_buff->data) {
-      memcpy(cam_buff->data, frame, camera_dev->getFrameBufferSize());
+      memcpy(cam_buff->data, frame, frame_size);
       mDataCB(CAMERA_MSG_PREVIEW_FRAME, cam_buff, 0, NULL, mCBOpaque);
       cam_buff->release(cam_buff);
     } else {
@@ -256,14 +306,25 @@ void CallbackNotifier::onNextFrameAvailable(const void* frame,
       int thumbHeight = cameraParameters->getInt(
               CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT);
       if (thumbWidth > 0 && thumbHeight > 0) {
-          if (!createThumbnail(static_cast<const unsigned char*>(frame),
-                               width, height, thumbWidth, thumbHeight,
-                               mJpegQuality, exifData)) {
+          bool created;
+          if (mPreviewThumbnailWidth == thumbWidth &&
+              mPreviewThumbnailHeight == thumbHeight) {
+              created = compressThumbnail(&mPreviewThumbnail[0], thumbWidth,
+                                          thumbHeight, mJpegQuality, exifData);
+          } else {
+              created = createThumbnail(
+                      static_cast<const unsigned char*>(frame), width, height,
+                      thumbWidth, thumbHeight, mJpegQuality, exifData,
+                      &mThumbnailBuffer);
+          }
+          if (!created) {
               // Not really a fatal error, we'll just keep going
               ALOGE("%s: Failed to create thumbnail for image",
                     __FUNCTION__);
           }
       }
+      // A preview thumbnail only ever belongs to one picture
+      mPreviewThumbnailWidth = mPreviewThumbnailHeight = 0;
 
       status_t res = compressor.compressRawImage(frame, exifData, mJpegQuality, width, height);
       if (res == NO_ERROR) {
@@ -285,6 +346,32 @@ void CallbackNotifier::onNextFrameAvailable(const void* frame,
   }
 }
 
+void CallbackNotifier::setPreviewThumbnail(const void* frame, int width,
+                                           int height, int thumb_width,
+                                           int thumb_height) {
+  mPreviewThumbnailWidth = mPreviewThumbnailHeight = 0;
+  const size_t scratch_size = getNV21ScaleScratchSize(thumb_width);
+  if (mThumbnailBuffer.size() < scratch_size) {
+    mThumbnailBuffer.resize(scratch_size);
+  }
+  mPreviewThumbnail.resize((thumb_width * thumb_height * 12) / 8);
+  if (scaleNV21(static_cast<const unsigned char*>(frame), width, height,
+                &mPreviewThumbnail[0], thumb_width, thumb_height,
+                &mThumbnailBuffer[0])) {
+    mPreviewThumbnailWidth = thumb_width;
+    mPreviewThumbnailHeight = thumb_height;
+  }
+}
+
+void CallbackNotifier::dump(int fd) {
+  Mutex::Autolock locker(&mObjectLock);
+  dprintf(fd, "  Frame buffer ring: %u x %zu bytes, %d in use\n",
+          mFrameRing != NULL ? kFrameRingSize : 0, mFrameRingBufferSize,
+          __builtin_popcount(mFrameRingBusy));
+  dprintf(fd, "    Ring hits: %" PRIu64 ", misses: %" PRIu64 "\n",
+          mFrameRingHits, mFrameRingMisses);
+}
+
 void CallbackNotifier::onCameraDeviceError(int err) {
   if (isMessageEnabled(CAMERA_MSG_ERROR) && mNotifyCB != NULL) {
     mNotifyCB(CAMERA_MSG_ERROR, err, 0, mCBOpaque);
@@ -310,4 +397,81 @@ bool CallbackNotifier::isNewVideoFrameTime(nsecs_t timestamp) {
   return false;
 }
 
+bool CallbackNotifier::acquireFrameBuffer(size_t size, FrameBuffer* buffer) {
+  /* Only the frame delivery thread replaces the ring, so it can be
+   * allocated and released without holding the lock across the calls. */
+  camera_memory_t* stale_ring = NULL;
+  bool need_ring;
+  {
+    Mutex::Autolock locker(&mObjectLock);
+    /* A frame size change needs a new ring once the client has returned
+     * every slot of the old one. */
+    if (mFrameRing != NULL && mFrameRingBufferSize != size &&
+        mFrameRingBusy == 0) {
+      stale_ring = detachFrameRingLocked();
+    }
+    need_ring = mFrameRing == NULL;
+  }
+  if (stale_ring != NULL) {
+    stale_ring->release(stale_ring);
+  }
+  if (need_ring) {
+    camera_memory_t* ring = mGetMemoryCB(-1, size, kFrameRingSize, mCBOpaque);
+    if (ring != NULL && ring->data != NULL) {
+      ALOGV("%s: Allocated %u frame buffers of %zu bytes", __FUNCTION__,
+            kFrameRingSize, size);
+      Mutex::Autolock locker(&mObjectLock);
+      mFrameRing = ring;
+      mFrameRingBufferSize = size;
+      mFrameRingBusy = 0;
+      mFrameRingNext = 0;
+    } else {
+      ALOGE("%s: Unable to allocate %u frame buffers of %zu bytes",
+            __FUNCTION__, kFrameRingSize, size);
+      if (ring != NULL) {
+        ring->release(ring);
+      }
+    }
+  }
+
+  {
+    Mutex::Autolock locker(&mObjectLock);
+    if (mFrameRing != NULL && mFrameRingBufferSize == size) {
+      for (unsigned int n = 0; n < kFrameRingSize; n++) {
+        const unsigned int slot = (mFrameRingNext + n) % kFrameRingSize;
+        if ((mFrameRingBusy & (1u << slot)) == 0) {
+          mFrameRingBusy |= 1u << slot;
+          mFrameRingNext = slot + 1;
+          mFrameRingHits++;
+          buffer->memory = mFrameRing;
+          buffer->index = slot;
+          buffer->in_ring = true;
+          return true;
+        }
+      }
+    }
+    mFrameRingMisses++;
+  }
+
+  /* The ring is exhausted or of another size: fall back to a buffer of the
+   * frame's own. */
+  buffer->memory = mGetMemoryCB(-1, size, 1, mCBOpaque);
+  buffer->index = 0;
+  buffer->in_ring = false;
+  if (buffer->memory != NULL && buffer->memory->data == NULL) {
+    buffer->memory->release(buffer->memory);
+    buffer->memory = NULL;
+  }
+  return buffer->memory != NULL;
+}
+
+camera_memory_t* CallbackNotifier::detachFrameRingLocked() {
+  camera_memory_t* ring = mFrameRing;
+  mFrameRing = NULL;
+  mFrameRingBufferSize = 0;
+  mFrameRingBusy = 0;
+  mFrameRingNext = 0;
+  return ring;
+}
+
 }; /* namespace android */
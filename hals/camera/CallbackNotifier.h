@@ -27,6 +27,8 @@
 #include <utils/Mutex.h>
 #include <utils/Timers.h>
 
+#include <vector>
+
 namespace android {
 
 class EmulatedCameraDevice;
@@ -177,6 +179,21 @@ class CallbackNotifier {
   /* Sets JPEG quality used to compress frame during picture taking. */
   void setJpegQuality(int jpeg_quality) { mJpegQuality = jpeg_quality; }
 
+  /* Scales a preview frame down to thumbnail size, for the next picture
+   * taken to use as its thumbnail instead of scaling down the picture
+   * itself. The thumbnail is only used if the picture asks for one of the
+   * same size.
+   * Param:
+   *  frame - NV21 preview frame.
+   *  width, height - Preview frame dimensions.
+   *  thumb_width, thumb_height - Thumbnail dimensions.
+   */
+  void setPreviewThumbnail(const void* frame, int width, int height,
+                           int thumb_width, int thumb_height);
+
+  /* Prints the frame buffer ring and its hit/miss counters to fd. */
+  void dump(int fd);
+
   /****************************************************************************
    * Private API
    ***************************************************************************/
@@ -188,6 +205,32 @@ class CallbackNotifier {
    *  timestamp - Timestamp for the new frame. */
   bool isNewVideoFrameTime(nsecs_t timestamp);
 
+  /* A buffer that a video frame is passed to the client in. */
+  struct FrameBuffer {
+    camera_memory_t* memory;
+    /* Index of the buffer within memory, for the data callback. */
+    unsigned int index;
+    /* Whether it is a slot of mFrameRing or an allocation of its own. */
+    bool in_ring;
+
+    void* data(size_t size) const {
+      return static_cast<uint8_t*>(memory->data) + index * size;
+    }
+  };
+
+  /* Gets a buffer for a frame of the given size: a free slot of the frame
+   * ring if there is one, otherwise a separate allocation.
+   * Return:
+   *  true on success, or false if no memory could be allocated.
+   */
+  bool acquireFrameBuffer(size_t size, FrameBuffer* buffer);
+
+  /* Takes the frame ring out of use, for the caller to release once the
+   * lock is dropped. Must be called while object is locked.
+   * Return:
+   *  The ring, or NULL if there is none. */
+  camera_memory_t* detachFrameRingLocked();
+
   /****************************************************************************
    * Data members
    ***************************************************************************/
@@ -209,6 +252,22 @@ class CallbackNotifier {
   /* video frame queue for the CameraHeapMemory destruction */
   List<camera_memory_t*> mCameraMemoryTs;
 
+  /* Number of buffers in the frame ring. Video frames hold a slot until the
+   * recorder releases them. */
+  static const unsigned int kFrameRingSize = 8;
+
+  /* Frame buffers allocated once and reused for every video frame of the
+   * same size, or NULL until the first frame. */
+  camera_memory_t* mFrameRing;
+  size_t mFrameRingBufferSize;
+  /* One bit per ring slot that the client still holds. */
+  uint32_t mFrameRingBusy;
+  /* Slot to try first for the next frame. */
+  unsigned int mFrameRingNext;
+  /* Frames passed in a ring slot, and in a separate allocation. */
+  uint64_t mFrameRingHits;
+  uint64_t mFrameRingMisses;
+
   /* Timestamp when last frame has been delivered to the framework. */
   nsecs_t mLastFrameTimestamp;
 
@@ -226,6 +285,15 @@ class CallbackNotifier {
 
   /* Picture taking status. */
   bool mTakingPicture;
+
+  /* Raw thumbnail and scaling scratch memory, reused for every picture. */
+  std::vector<unsigned char> mThumbnailBuffer;
+
+  /* Thumbnail taken from the preview by setPreviewThumbnail, and its
+   * dimensions. Width and height are 0 when there is none. */
+  std::vector<unsigned char> mPreviewThumbnail;
+  int mPreviewThumbnailWidth;
+  int mPreviewThumbnailHeight;
 };
 
 }; /* namespace android */
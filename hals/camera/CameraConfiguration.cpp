@@ -50,6 +50,7 @@ namespace {
 //   {
 //     kCameraDefinitionOrientationKey: "back",
 //     kCameraDefinitionHalVersionKey: "1",
+//     kCameraDefinitionRenderPriorityKey: "1",
 //     kCameraDefinitionResolutionsKey: [
 //       {
 //         kCameraDefinitionResolutionWidthKey: "1024",
@@ -85,6 +86,11 @@ const char* const kCameraDefinitionOrientationKey = "orientation";
 // - 3 (Camera HALv3)
 const char* const kCameraDefinitionHalVersionKey = "hal_version";
 
+// Render priority of currently defined camera (int), optional.
+// When several cameras stream at once, frames of cameras with a higher
+// priority are rendered first. Defaults to 0.
+const char* const kCameraDefinitionRenderPriorityKey = "render_priority";
+
 // Array of resolutions supported by camera (array).
 const char* const kCameraDefinitionResolutionsKey = "resolutions";
 
@@ -145,6 +151,20 @@ bool ValueToCameraHalVersion(const std::string& value,
   return true;
 }
 
+// Convert string value to camera render priority.
+bool ValueToCameraRenderPriority(const std::string& value, int* priority) {
+  char* endptr;
+
+  *priority = strtol(value.c_str(), &endptr, 10);
+  if (value.empty() || endptr != value.c_str() + value.size()) {
+    ALOGE("%s: Invalid camera render priority. Expected number, got %s.",
+          __FUNCTION__, value.c_str());
+    return false;
+  }
+
+  return true;
+}
+
 bool ValueToCameraResolution(const std::string& width,
                              const std::string& height,
                              CameraDefinition::Resolution* resolution) {
@@ -228,6 +248,13 @@ bool ConfigureCameras(const Json::Value& value,
             &camera.hal_version))
       return false;
 
+    // Render priority is optional.
+    if (iter->isMember(kCameraDefinitionRenderPriorityKey) &&
+        !ValueToCameraRenderPriority(
+            (*iter)[kCameraDefinitionRenderPriorityKey].asString(),
+            &camera.render_priority))
+      return false;
+
     // Camera without resolutions -> invalid setting.
     if (!iter->isMember(kCameraDefinitionResolutionsKey)) {
       ALOGE("%s: Invalid camera definition: key %s is missing.", __FUNCTION__,
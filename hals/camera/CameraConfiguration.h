@@ -39,6 +39,9 @@ struct CameraDefinition {
   Orientation orientation;
   HalVersion hal_version;
   std::vector<Resolution> resolutions;
+  // Priority of this camera's frames on the render threads shared by all
+  // cameras. Higher values render first.
+  int render_priority = 0;
 };
 
 class CameraConfiguration {
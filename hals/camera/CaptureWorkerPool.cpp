@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_CaptureWorkerPool"
+
+#include <utils/Log.h>
+
+#include "CaptureWorkerPool.h"
+
+namespace android {
+
+CaptureWorkerPool::Job::~Job() {}
+
+CaptureWorkerPool::CaptureWorkerPool()
+    : mExiting(false),
+      mJob(NULL),
+      mRows(0),
+      mBandRows(0),
+      mBandCount(0),
+      mNextBand(0),
+      mBandsDone(0) {}
+
+CaptureWorkerPool::~CaptureWorkerPool() { shutDown(); }
+
+status_t CaptureWorkerPool::startUp(size_t workerCount) {
+  ALOGV("%s: Starting %zu capture workers", __FUNCTION__, workerCount);
+  if (!mWorkers.isEmpty()) {
+    ALOGE("%s: Already started!", __FUNCTION__);
+    return INVALID_OPERATION;
+  }
+
+  mExiting = false;
+  for (size_t i = 0; i < workerCount; i++) {
+    sp<Worker> worker = new Worker(this);
+    status_t res = worker->run("EmulatedFakeCamera2::CaptureWorker",
+                               ANDROID_PRIORITY_URGENT_DISPLAY);
+    if (res != OK) {
+      ALOGE("%s: Unable to start capture worker %zu: %d", __FUNCTION__, i,
+            res);
+      shutDown();
+      return res;
+    }
+    mWorkers.push_back(worker);
+  }
+  return OK;
+}
+
+status_t CaptureWorkerPool::shutDown() {
+  {
+    Mutex::Autolock lock(mMutex);
+    mExiting = true;
+    mWorkAvailable.broadcast();
+  }
+  for (size_t i = 0; i < mWorkers.size(); i++) {
+    mWorkers[i]->requestExitAndWait();
+  }
+  mWorkers.clear();
+  return OK;
+}
+
+size_t CaptureWorkerPool::getWorkerCount() const { return mWorkers.size(); }
+
+void CaptureWorkerPool::run(Job *job, uint32_t rows, uint32_t rowAlign) {
+  uint32_t bands = (mWorkers.size() + 1) * kBandsPerThread;
+  uint32_t bandRows = (rows + bands - 1) / bands;
+  bandRows = (bandRows + rowAlign - 1) / rowAlign * rowAlign;
+
+  if (mWorkers.isEmpty() || bandRows >= rows) {
+    job->renderRows(0, rows);
+    return;
+  }
+
+  Mutex::Autolock lock(mMutex);
+  mJob = job;
+  mRows = rows;
+  mBandRows = bandRows;
+  mBandCount = (rows + bandRows - 1) / bandRows;
+  mNextBand = 0;
+  mBandsDone = 0;
+  mWorkAvailable.broadcast();
+
+  while (renderNextBand()) {
+  }
+  while (mBandsDone < mBandCount) {
+    mWorkDone.wait(mMutex);
+  }
+  mJob = NULL;
+}
+
+bool CaptureWorkerPool::renderNextBand() {
+  if (mJob == NULL || mNextBand >= mBandCount) return false;
+
+  Job *job = mJob;
+  uint32_t beginRow = mNextBand * mBandRows;
+  uint32_t endRow = beginRow + mBandRows;
+  if (endRow > mRows) endRow = mRows;
+  mNextBand++;
+
+  mMutex.unlock();
+  job->renderRows(beginRow, endRow);
+  mMutex.lock();
+
+  mBandsDone++;
+  if (mBandsDone == mBandCount) mWorkDone.signal();
+  return true;
+}
+
+CaptureWorkerPool::Worker::Worker(CaptureWorkerPool *pool)
+    : Thread(false), mPool(pool) {}
+
+bool CaptureWorkerPool::Worker::threadLoop() {
+  Mutex::Autolock lock(mPool->mMutex);
+  while (!mPool->mExiting && !mPool->renderNextBand()) {
+    mPool->mWorkAvailable.wait(mPool->mMutex);
+  }
+  return !mPool->mExiting;
+}
+
+}  // namespace android
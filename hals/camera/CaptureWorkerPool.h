@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * A small pool of persistent render threads, used to process a frame as
+ * several horizontal bands in parallel: by the fake sensor to draw it, and by
+ * the format converters and the JPEG compressor. The thread that calls run()
+ * renders bands too, so a pool with N workers uses N + 1 cores per frame.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_CAPTURE_WORKER_POOL_H
+#define HW_EMULATOR_CAMERA_CAPTURE_WORKER_POOL_H
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+class CaptureWorkerPool {
+ public:
+  CaptureWorkerPool();
+  ~CaptureWorkerPool();
+
+  // A unit of work that can be split into independent ranges of rows.
+  struct Job {
+    // Render output rows [beginRow, endRow). Called concurrently for
+    // disjoint row ranges.
+    virtual void renderRows(uint32_t beginRow, uint32_t endRow) = 0;
+    virtual ~Job();
+  };
+
+  // Start workerCount helper threads. A count of zero makes run() render on
+  // the calling thread only.
+  status_t startUp(size_t workerCount);
+  status_t shutDown();
+
+  size_t getWorkerCount() const;
+
+  // Render rows [0, rows) of job and return once all of them are done. Band
+  // boundaries are multiples of rowAlign. Only one run() may be active at a
+  // time.
+  void run(Job *job, uint32_t rows, uint32_t rowAlign);
+
+ private:
+  // Bands per render thread; more than one evens out uneven row costs.
+  static const uint32_t kBandsPerThread = 2;
+
+  class Worker : public Thread {
+   public:
+    Worker(CaptureWorkerPool *pool);
+
+   private:
+    virtual bool threadLoop();
+    CaptureWorkerPool *mPool;
+  };
+
+  // Claim and render the next pending band. Must be called with mMutex held;
+  // the lock is dropped while rendering. Returns false if no band was left.
+  bool renderNextBand();
+
+  Mutex mMutex;
+  Condition mWorkAvailable;
+  Condition mWorkDone;
+  bool mExiting;
+
+  // Current job, guarded by mMutex
+  Job *mJob;
+  uint32_t mRows;
+  uint32_t mBandRows;
+  uint32_t mBandCount;
+  uint32_t mNextBand;
+  uint32_t mBandsDone;
+
+  Vector<sp<Worker> > mWorkers;
+};
+
+}  // namespace android
+
+#endif  // HW_EMULATOR_CAMERA_CAPTURE_WORKER_POOL_H
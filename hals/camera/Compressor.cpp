@@ -21,140 +21,359 @@
 #include <cutils/log.h>
 #include <libexif/exif-data.h>
 
+namespace {
+
+const uint8_t kMarkerSOF0 = 0xC0;
+const uint8_t kMarkerRST0 = 0xD0;
+const uint8_t kMarkerEOI = 0xD9;
+const uint8_t kMarkerSOS = 0xDA;
+
+// Two strips per thread, so one slow strip does not hold up the others
+const size_t kStripsPerThread = 2;
+
+/* Return the offset of the first |marker| segment in the headers of |jpeg|,
+ * or 0 if the scan data starts before one is found.
+ */
+size_t findSegment(const std::vector<uint8_t>& jpeg, uint8_t marker) {
+    size_t offset = 2;  // Skip SOI
+    while (offset + 4 <= jpeg.size() && jpeg[offset] == 0xFF) {
+        if (jpeg[offset + 1] == marker) {
+            return offset;
+        }
+        if (jpeg[offset + 1] == kMarkerSOS) {
+            break;
+        }
+        offset += 2 + ((jpeg[offset + 2] << 8) | jpeg[offset + 3]);
+    }
+    return 0;
+}
+
+bool endsWithEOI(const std::vector<uint8_t>& jpeg) {
+    return jpeg.size() >= 4 && jpeg[jpeg.size() - 2] == 0xFF &&
+           jpeg[jpeg.size() - 1] == kMarkerEOI;
+}
+
+}  // namespace
+
+class Compressor::StripJob : public android::CaptureWorkerPool::Job {
+public:
+    StripJob(Compressor* compressor, const unsigned char* data,
+             int width, int height, int quality, ExifData* exifData,
+             int stripRows, size_t stripCount)
+        : mCompressor(compressor), mData(data), mWidth(width),
+          mHeight(height), mQuality(quality), mExifData(exifData),
+          mStripRows(stripRows), mStripCount(stripCount) {}
+
+    // The pool's rows are strips here
+    virtual void renderRows(uint32_t beginRow, uint32_t endRow) {
+        for (uint32_t i = beginRow; i < endRow; ++i) {
+            mCompressor->mEncoders[i]->mSucceeded =
+                    mCompressor->compressStrip(i, mData, mWidth, mHeight,
+                                               mQuality, mExifData,
+                                               mStripRows, mStripCount);
+        }
+    }
+
+private:
+    Compressor* mCompressor;
+    const unsigned char* mData;
+    int mWidth;
+    int mHeight;
+    int mQuality;
+    ExifData* mExifData;
+    int mStripRows;
+    size_t mStripCount;
+};
+
 Compressor::Compressor() {
 
 }
 
+bool Compressor::setThreadCount(size_t threadCount) {
+    if (threadCount == 0) {
+        ALOGE("%s: Need at least one thread", __FUNCTION__);
+        return false;
+    }
+    if (mWorkers.getWorkerCount() == threadCount - 1) {
+        return true;
+    }
+    mWorkers.shutDown();
+    return mWorkers.startUp(threadCount - 1) == android::OK;
+}
+
 bool Compressor::compress(const unsigned char* data,
                           int width, int height, int quality,
                           ExifData* exifData) {
-    if (!configureCompressor(width, height, quality)) {
+    mOutput.clear();
+
+    // Strips are whole MCU rows, 16 pixel rows with 2x2 chroma subsampling
+    const int mcuRows = (height + 15) / 16;
+    const int mcusPerRow = (width + 15) / 16;
+    const size_t threads = mWorkers.getWorkerCount() + 1;
+    if (threads > 1 && mcuRows >= 2 * kMinStripMcuRows) {
+        int stripMcuRows = (mcuRows + threads * kStripsPerThread - 1) /
+                           (threads * kStripsPerThread);
+        if (stripMcuRows < kMinStripMcuRows) {
+            stripMcuRows = kMinStripMcuRows;
+        }
+        // A strip is one restart interval, whose length is a 16 bit count
+        if (stripMcuRows * mcusPerRow > 0xFFFF) {
+            stripMcuRows = 0xFFFF / mcusPerRow;
+        }
+        if (stripMcuRows > 0) {
+            size_t stripCount = (mcuRows + stripMcuRows - 1) / stripMcuRows;
+            return compressStrips(data, width, height, quality, exifData,
+                                  stripMcuRows * 16, stripCount);
+        }
+    }
+
+    if (mEncoders.empty()) {
+        mEncoders.emplace_back(new Encoder());
+    }
+    Encoder* encoder = mEncoders[0].get();
+    if (!configureCompressor(encoder, width, height, quality, 0)) {
         // The method will have logged a more detailed error message than we can
         // provide here so just return.
         return false;
     }
-
-    return compressData(data, exifData);
+    if (!compressData(encoder, data, data + width * height, exifData)) {
+        return false;
+    }
+    mOutput.swap(encoder->mDestManager.mBuffer);
+    return true;
 }
 
 const std::vector<uint8_t>& Compressor::getCompressedData() const {
-    return mDestManager.mBuffer;
+    return mOutput;
 }
 
-bool Compressor::configureCompressor(int width, int height, int quality) {
-    mCompressInfo.err = jpeg_std_error(&mErrorManager);
+bool Compressor::configureCompressor(Encoder* encoder, int width, int height,
+                                     int quality,
+                                     unsigned int restartInterval) {
+    jpeg_compress_struct& compressInfo = encoder->mCompressInfo;
+    compressInfo.err = jpeg_std_error(&encoder->mErrorManager);
     // NOTE! DANGER! Do not construct any non-trivial objects below setjmp!
     // The compiler will not generate code to destroy them during the return
     // below so they will leak. Additionally, do not place any calls to libjpeg
     // that can fail above this line or any error will cause undefined behavior.
-    if (setjmp(mErrorManager.mJumpBuffer)) {
+    if (setjmp(encoder->mErrorManager.mJumpBuffer)) {
         // This is where the error handler will jump in case setup fails
         // The error manager will ALOG an appropriate error message
         return false;
     }
 
-    jpeg_create_compress(&mCompressInfo);
+    jpeg_create_compress(&compressInfo);
 
-    mCompressInfo.image_width = width;
-    mCompressInfo.image_height = height;
-    mCompressInfo.input_components = 3;
-    mCompressInfo.in_color_space = JCS_YCbCr;
-    jpeg_set_defaults(&mCompressInfo);
+    compressInfo.image_width = width;
+    compressInfo.image_height = height;
+    compressInfo.input_components = 3;
+    compressInfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&compressInfo);
 
-    jpeg_set_quality(&mCompressInfo, quality, TRUE);
+    jpeg_set_quality(&compressInfo, quality, TRUE);
     // It may seem weird to set color space here again but this will also set
     // other fields. These fields might be overwritten by jpeg_set_defaults
-    jpeg_set_colorspace(&mCompressInfo, JCS_YCbCr);
-    mCompressInfo.raw_data_in = TRUE;
-    mCompressInfo.dct_method = JDCT_IFAST;
+    jpeg_set_colorspace(&compressInfo, JCS_YCbCr);
+    compressInfo.raw_data_in = TRUE;
+    compressInfo.dct_method = JDCT_IFAST;
+    compressInfo.restart_interval = restartInterval;
     // Set sampling factors
-    mCompressInfo.comp_info[0].h_samp_factor = 2;
-    mCompressInfo.comp_info[0].v_samp_factor = 2;
-    mCompressInfo.comp_info[1].h_samp_factor = 1;
-    mCompressInfo.comp_info[1].v_samp_factor = 1;
-    mCompressInfo.comp_info[2].h_samp_factor = 1;
-    mCompressInfo.comp_info[2].v_samp_factor = 1;
+    compressInfo.comp_info[0].h_samp_factor = 2;
+    compressInfo.comp_info[0].v_samp_factor = 2;
+    compressInfo.comp_info[1].h_samp_factor = 1;
+    compressInfo.comp_info[1].v_samp_factor = 1;
+    compressInfo.comp_info[2].h_samp_factor = 1;
+    compressInfo.comp_info[2].v_samp_factor = 1;
 
-    mCompressInfo.dest = &mDestManager;
+    compressInfo.dest = &encoder->mDestManager;
 
     return true;
 }
 
-static void deinterleave(const uint8_t* vuPlanar, std::vector<uint8_t>& uRows,
-                         std::vector<uint8_t>& vRows, int rowIndex, int width,
+/* Split up to 8 rows of interleaved VU into separate U and V rows. Written
+ * as plain indexed copies so that the compiler can vectorize the loop.
+ */
+static void deinterleave(const uint8_t* vuPlanar, uint8_t* uRows,
+                         uint8_t* vRows, int rowIndex, int width,
                          int height, int stride) {
     int numRows = (height - rowIndex) / 2;
     if (numRows > 8) numRows = 8;
+    const int chromaWidth = width >> 1;
     for (int row = 0; row < numRows; ++row) {
-        int offset = ((rowIndex >> 1) + row) * stride;
-        const uint8_t* vu = vuPlanar + offset;
-        for (int i = 0; i < (width >> 1); ++i) {
-            int index = row * (width >> 1) + i;
-            uRows[index] = vu[1];
-            vRows[index] = vu[0];
-            vu += 2;
+        const uint8_t* __restrict vu =
+                vuPlanar + ((rowIndex >> 1) + row) * stride;
+        uint8_t* __restrict u = uRows + row * chromaWidth;
+        uint8_t* __restrict v = vRows + row * chromaWidth;
+        for (int i = 0; i < chromaWidth; ++i) {
+            v[i] = vu[2 * i];
+            u[i] = vu[2 * i + 1];
         }
     }
 }
 
 
-bool Compressor::compressData(const unsigned char* data, ExifData* exifData) {
+bool Compressor::compressData(Encoder* encoder,
+                              const unsigned char* yPlanar,
+                              const unsigned char* vuPlanar,
+                              ExifData* exifData) {
     const uint8_t* y[16];
     const uint8_t* cb[8];
     const uint8_t* cr[8];
     const uint8_t** planes[3] = { y, cb, cr };
 
     int i, offset;
-    int width = mCompressInfo.image_width;
-    int height = mCompressInfo.image_height;
-    const uint8_t* yPlanar = data;
-    const uint8_t* vuPlanar = data + (width * height);
-    std::vector<uint8_t> uRows(8 * (width >> 1));
-    std::vector<uint8_t> vRows(8 * (width >> 1));
+    jpeg_compress_struct& compressInfo = encoder->mCompressInfo;
+    int width = compressInfo.image_width;
+    int height = compressInfo.image_height;
+    encoder->mURows.resize(8 * (width >> 1));
+    encoder->mVRows.resize(8 * (width >> 1));
+    uint8_t* uRows = &encoder->mURows[0];
+    uint8_t* vRows = &encoder->mVRows[0];
 
     // NOTE! DANGER! Do not construct any non-trivial objects below setjmp!
     // The compiler will not generate code to destroy them during the return
     // below so they will leak. Additionally, do not place any calls to libjpeg
     // that can fail above this line or any error will cause undefined behavior.
-    if (setjmp(mErrorManager.mJumpBuffer)) {
+    if (setjmp(encoder->mErrorManager.mJumpBuffer)) {
         // This is where the error handler will jump in case compression fails
         // The error manager will ALOG an appropriate error message
         return false;
     }
 
-    jpeg_start_compress(&mCompressInfo, TRUE);
+    jpeg_start_compress(&compressInfo, TRUE);
 
-    attachExifData(exifData);
+    attachExifData(encoder, exifData);
 
     // process 16 lines of Y and 8 lines of U/V each time.
-    while (mCompressInfo.next_scanline < mCompressInfo.image_height) {
+    while (compressInfo.next_scanline < compressInfo.image_height) {
         //deinterleave u and v
-        deinterleave(vuPlanar, uRows, vRows, mCompressInfo.next_scanline,
+        deinterleave(vuPlanar, uRows, vRows, compressInfo.next_scanline,
                      width, height, width);
 
         // Jpeg library ignores the rows whose indices are greater than height.
         for (i = 0; i < 16; i++) {
             // y row
-            y[i] = yPlanar + (mCompressInfo.next_scanline + i) * width;
+            y[i] = yPlanar + (compressInfo.next_scanline + i) * width;
 
             // construct u row and v row
             if ((i & 1) == 0) {
                 // height and width are both halved because of downsampling
                 offset = (i >> 1) * (width >> 1);
-                cb[i/2] = &uRows[offset];
-                cr[i/2] = &vRows[offset];
+                cb[i/2] = uRows + offset;
+                cr[i/2] = vRows + offset;
             }
           }
-        jpeg_write_raw_data(&mCompressInfo, const_cast<JSAMPIMAGE>(planes), 16);
+        jpeg_write_raw_data(&compressInfo, const_cast<JSAMPIMAGE>(planes), 16);
+    }
+
+    jpeg_finish_compress(&compressInfo);
+    jpeg_destroy_compress(&compressInfo);
+
+    return true;
+}
+
+bool Compressor::compressStrips(const unsigned char* data,
+                                int width, int height, int quality,
+                                ExifData* exifData, int stripRows,
+                                size_t stripCount) {
+    while (mEncoders.size() < stripCount) {
+        mEncoders.emplace_back(new Encoder());
+    }
+
+    StripJob job(this, data, width, height, quality, exifData,
+                 stripRows, stripCount);
+    mWorkers.run(&job, stripCount, 1);
+
+    for (size_t i = 0; i < stripCount; ++i) {
+        if (!mEncoders[i]->mSucceeded) {
+            ALOGE("%s: Failed to compress strip %zu of %zu", __FUNCTION__,
+                  i, stripCount);
+            return false;
+        }
+    }
+    return stitchStrips(stripCount, height);
+}
+
+bool Compressor::compressStrip(size_t index, const unsigned char* data,
+                               int width, int height, int quality,
+                               ExifData* exifData, int stripRows,
+                               size_t stripCount) {
+    Encoder* encoder = mEncoders[index].get();
+    const int firstRow = index * stripRows;
+    const int rows = index + 1 < stripCount ? stripRows : height - firstRow;
+
+    // The first strip supplies the headers of the joined image, including
+    // the restart interval, which is the MCU count of a full strip.
+    unsigned int restartInterval = 0;
+    if (index == 0) {
+        restartInterval = (stripRows / 16) * ((width + 15) / 16);
+    }
+    if (!configureCompressor(encoder, width, rows, quality,
+                             restartInterval)) {
+        return false;
+    }
+    if (index > 0) {
+        encoder->mCompressInfo.write_JFIF_header = FALSE;
+        exifData = nullptr;
+    }
+    // firstRow is a multiple of 16, so the chroma rows start at half of it
+    return compressData(encoder, data + firstRow * width,
+                        data + width * height + (firstRow / 2) * width,
+                        exifData);
+}
+
+/* Join the strip JPEGs into one image: the headers and scan data of the
+ * first strip, then the scan data of each other strip, each preceded by the
+ * next RSTn marker. Every strip starts with zeroed DC predictors and ends
+ * padded to a byte boundary, which is exactly what a restart requires.
+ */
+bool Compressor::stitchStrips(size_t stripCount, int height) {
+    std::vector<uint8_t>& first = mEncoders[0]->mDestManager.mBuffer;
+    const size_t frameHeader = findSegment(first, kMarkerSOF0);
+    if (frameHeader == 0 || !endsWithEOI(first)) {
+        ALOGE("%s: Unexpected layout of the first strip", __FUNCTION__);
+        return false;
     }
 
-    jpeg_finish_compress(&mCompressInfo);
-    jpeg_destroy_compress(&mCompressInfo);
+    std::vector<size_t> scanStart(stripCount, 0);
+    size_t totalSize = first.size();
+    for (size_t i = 1; i < stripCount; ++i) {
+        const std::vector<uint8_t>& strip = mEncoders[i]->mDestManager.mBuffer;
+        const size_t scanHeader = findSegment(strip, kMarkerSOS);
+        if (scanHeader != 0) {
+            scanStart[i] = scanHeader + 2 +
+                    ((strip[scanHeader + 2] << 8) | strip[scanHeader + 3]);
+        }
+        if (scanHeader == 0 || !endsWithEOI(strip) ||
+                scanStart[i] > strip.size() - 2) {
+            ALOGE("%s: Unexpected layout of strip %zu", __FUNCTION__, i);
+            return false;
+        }
+        // The RSTn marker replaces the EOI
+        totalSize += strip.size() - scanStart[i];
+    }
 
+    // The first strip was encoded as an image of its own rows only
+    first[frameHeader + 5] = height >> 8;
+    first[frameHeader + 6] = height & 0xFF;
+
+    // Take over the first strip's buffer, it usually has room for the rest
+    mOutput.swap(first);
+    mOutput.reserve(totalSize);
+    mOutput.resize(mOutput.size() - 2);
+    for (size_t i = 1; i < stripCount; ++i) {
+        const std::vector<uint8_t>& strip = mEncoders[i]->mDestManager.mBuffer;
+        mOutput.push_back(0xFF);
+        mOutput.push_back(kMarkerRST0 + ((i - 1) & 7));
+        mOutput.insert(mOutput.end(), strip.begin() + scanStart[i],
+                       strip.end() - 2);
+    }
+    mOutput.push_back(0xFF);
+    mOutput.push_back(kMarkerEOI);
     return true;
 }
 
-bool Compressor::attachExifData(ExifData* exifData) {
+bool Compressor::attachExifData(Encoder* encoder, ExifData* exifData) {
     if (exifData == nullptr) {
         // This is not an error, we don't require EXIF data
         return true;
@@ -169,7 +388,7 @@ bool Compressor::attachExifData(ExifData* exifData) {
         return false;
     }
 
-    jpeg_write_marker(&mCompressInfo, JPEG_APP0 + 1, rawData, size);
+    jpeg_write_marker(&encoder->mCompressInfo, JPEG_APP0 + 1, rawData, size);
     free(rawData);
     return true;
 }
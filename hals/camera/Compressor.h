@@ -18,14 +18,18 @@
 #define CUTTLEFISH_CAMERA_JPEG_STUB_COMPRESSOR_H
 
 #include <setjmp.h>
+#include <stdio.h>
 #include <stdlib.h>
 extern "C" {
 #include <jpeglib.h>
 #include <jerror.h>
 }
 
+#include <memory>
 #include <vector>
 
+#include "CaptureWorkerPool.h"
+
 struct _ExifData;
 typedef _ExifData ExifData;
 
@@ -33,6 +37,12 @@ class Compressor {
 public:
     Compressor();
 
+    /* Use |threadCount| threads for each compression. With more than one,
+     * the image is split into horizontal strips that are encoded in parallel
+     * as separate restart intervals and joined into one baseline JPEG.
+     */
+    bool setThreadCount(size_t threadCount);
+
     /* Compress |data| which represents raw NV21 encoded data of dimensions
      * |width| * |height|. |exifData| is optional EXIF data that will be
      * attached to the compressed data if present, set to null if not needed.
@@ -63,14 +73,39 @@ private:
 
         jmp_buf mJumpBuffer;
     };
-
-    jpeg_compress_struct mCompressInfo;
-    DestinationManager mDestManager;
-    ErrorManager mErrorManager;
-
-    bool configureCompressor(int width, int height, int quality);
-    bool compressData(const unsigned char* data, ExifData* exifData);
-    bool attachExifData(ExifData* exifData);
+    /* One libjpeg instance and its buffers. A strip encoder produces a
+     * complete JPEG of its rows, only the scan data of which is kept.
+     */
+    struct Encoder {
+        jpeg_compress_struct mCompressInfo;
+        DestinationManager mDestManager;
+        ErrorManager mErrorManager;
+        std::vector<uint8_t> mURows;
+        std::vector<uint8_t> mVRows;
+        bool mSucceeded;
+    };
+    class StripJob;
+
+    /* Images with fewer MCU rows than this per thread are encoded whole. */
+    static const int kMinStripMcuRows = 4;
+
+    std::vector<std::unique_ptr<Encoder>> mEncoders;
+    android::CaptureWorkerPool mWorkers;
+    std::vector<unsigned char> mOutput;
+
+    bool configureCompressor(Encoder* encoder, int width, int height,
+                             int quality, unsigned int restartInterval);
+    bool compressData(Encoder* encoder, const unsigned char* yPlanar,
+                      const unsigned char* vuPlanar, ExifData* exifData);
+    bool attachExifData(Encoder* encoder, ExifData* exifData);
+
+    bool compressStrips(const unsigned char* data, int width, int height,
+                        int quality, ExifData* exifData, int stripRows,
+                        size_t stripCount);
+    bool compressStrip(size_t index, const unsigned char* data, int width,
+                       int height, int quality, ExifData* exifData,
+                       int stripRows, size_t stripCount);
+    bool stitchStrips(size_t stripCount, int height);
 };
 
 #endif  // CUTTLEFISH_CAMERA_JPEG_STUB_COMPRESSOR_H
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "Compressor.h"
+
+namespace {
+
+const int kQuality = 90;
+
+// A full-resolution still, with state.range(0) threads
+void BM_Compress(benchmark::State& state, int width, int height) {
+  std::vector<uint8_t> frame(width * height * 3 / 2);
+  // Smooth content with some noise, closer to a photo than random bytes
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      frame[y * width + x] = (x + y) / 16 + (rand() & 15);
+    }
+  }
+  for (size_t i = width * height; i < frame.size(); i++) {
+    frame[i] = 120 + (rand() & 15);
+  }
+  Compressor compressor;
+  if (!compressor.setThreadCount(state.range(0))) {
+    state.SkipWithError("Unable to start compressor threads");
+    return;
+  }
+
+  for (auto _ : state) {
+    if (!compressor.compress(frame.data(), width, height, kQuality, NULL)) {
+      state.SkipWithError("Compression failed");
+      return;
+    }
+  }
+  state.counters["MPix/s"] =
+      benchmark::Counter(state.iterations() * width * height / 1e6,
+                         benchmark::Counter::kIsRate);
+  state.counters["bytes"] = compressor.getCompressedData().size();
+}
+
+BENCHMARK_CAPTURE(BM_Compress, 1280x960, 1280, 960)
+    ->DenseRange(1, 4)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_Compress, 2592x1944, 2592, 1944)
+    ->DenseRange(1, 4)
+    ->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
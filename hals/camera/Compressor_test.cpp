@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <math.h>
+#include <setjmp.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <libexif/exif-data.h>
+
+#include "Compressor.h"
+
+namespace {
+
+const int kQuality = 90;
+
+// A gradient with some texture, so that every MCU has real scan data
+std::vector<uint8_t> makeNV21(int width, int height) {
+  std::vector<uint8_t> image(width * height * 3 / 2);
+  uint32_t seed = 2018;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      seed = seed * 1103515245 + 12345;
+      image[y * width + x] = (x + y) / 8 + ((seed >> 16) & 63);
+    }
+  }
+  uint8_t* vu = &image[width * height];
+  for (int y = 0; y < height / 2; y++) {
+    for (int x = 0; x < width / 2; x++) {
+      vu[y * width + x * 2] = 128 + (x - y) / 8;
+      vu[y * width + x * 2 + 1] = 64 + y / 4;
+    }
+  }
+  return image;
+}
+
+struct DecodeErrorManager : jpeg_error_mgr {
+  jmp_buf jumpBuffer;
+};
+
+void onDecodeError(j_common_ptr cinfo) {
+  longjmp(reinterpret_cast<DecodeErrorManager*>(cinfo->err)->jumpBuffer, 1);
+}
+
+struct DecodedImage {
+  int width = 0;
+  int height = 0;
+  unsigned int restartInterval = 0;
+  // Interleaved YCbCr
+  std::vector<uint8_t> pixels;
+  // Each APPn marker in file order, as (n, first bytes)
+  std::vector<std::pair<int, std::string> > appMarkers;
+};
+
+bool decode(const std::vector<uint8_t>& jpeg, DecodedImage* image) {
+  jpeg_decompress_struct dinfo;
+  DecodeErrorManager errorManager;
+  dinfo.err = jpeg_std_error(&errorManager);
+  errorManager.error_exit = onDecodeError;
+  if (setjmp(errorManager.jumpBuffer)) {
+    jpeg_destroy_decompress(&dinfo);
+    return false;
+  }
+  jpeg_create_decompress(&dinfo);
+  jpeg_mem_src(&dinfo, const_cast<unsigned char*>(jpeg.data()), jpeg.size());
+  for (int i = 0; i < 16; i++) {
+    jpeg_save_markers(&dinfo, JPEG_APP0 + i, 0xFFFF);
+  }
+  jpeg_read_header(&dinfo, TRUE);
+  dinfo.out_color_space = JCS_YCbCr;
+  dinfo.dct_method = JDCT_ISLOW;
+  jpeg_start_decompress(&dinfo);
+
+  image->width = dinfo.output_width;
+  image->height = dinfo.output_height;
+  image->restartInterval = dinfo.restart_interval;
+  for (jpeg_saved_marker_ptr m = dinfo.marker_list; m != NULL; m = m->next) {
+    image->appMarkers.push_back(std::make_pair(
+        m->marker - JPEG_APP0,
+        std::string(reinterpret_cast<char*>(m->data),
+                    m->data_length < 6 ? m->data_length : 6)));
+  }
+  image->pixels.resize(image->width * image->height * 3);
+  while (dinfo.output_scanline < dinfo.output_height) {
+    JSAMPROW row = &image->pixels[dinfo.output_scanline * image->width * 3];
+    jpeg_read_scanlines(&dinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&dinfo);
+  jpeg_destroy_decompress(&dinfo);
+  return true;
+}
+
+int countRestartMarkers(const std::vector<uint8_t>& jpeg) {
+  int count = 0;
+  for (size_t i = 0; i + 1 < jpeg.size(); i++) {
+    if (jpeg[i] == 0xFF && (jpeg[i + 1] & 0xF8) == 0xD0) count++;
+  }
+  return count;
+}
+
+double lumaPSNR(const std::vector<uint8_t>& nv21, const DecodedImage& image) {
+  double sumSq = 0;
+  for (int i = 0; i < image.width * image.height; i++) {
+    double diff = double(nv21[i]) - image.pixels[i * 3];
+    sumSq += diff * diff;
+  }
+  double mse = sumSq / (image.width * image.height);
+  return 10 * log10(255.0 * 255.0 / mse);
+}
+
+class CompressorTest : public ::testing::TestWithParam<std::pair<int, int> > {
+};
+
+TEST_P(CompressorTest, StripsDecodeLikeWholeImage) {
+  const int width = GetParam().first;
+  const int height = GetParam().second;
+  std::vector<uint8_t> nv21 = makeNV21(width, height);
+
+  Compressor single;
+  ASSERT_TRUE(single.compress(nv21.data(), width, height, kQuality, NULL));
+  DecodedImage reference;
+  ASSERT_TRUE(decode(single.getCompressedData(), &reference));
+  EXPECT_EQ(width, reference.width);
+  EXPECT_EQ(height, reference.height);
+  EXPECT_EQ(0u, reference.restartInterval);
+  EXPECT_EQ(0, countRestartMarkers(single.getCompressedData()));
+  EXPECT_GT(lumaPSNR(nv21, reference), 30);
+
+  for (size_t threads = 2; threads <= 4; threads++) {
+    SCOPED_TRACE(threads);
+    Compressor parallel;
+    ASSERT_TRUE(parallel.setThreadCount(threads));
+    // Twice, to cover reuse of the strip encoders
+    for (int pass = 0; pass < 2; pass++) {
+      ASSERT_TRUE(
+          parallel.compress(nv21.data(), width, height, kQuality, NULL));
+      const std::vector<uint8_t>& jpeg = parallel.getCompressedData();
+      DecodedImage image;
+      ASSERT_TRUE(decode(jpeg, &image));
+      ASSERT_EQ(width, image.width);
+      ASSERT_EQ(height, image.height);
+      // Restarts only reset the DC predictors, the coefficients are the same
+      EXPECT_TRUE(image.pixels == reference.pixels);
+      // One restart interval per strip; strips are whole MCU rows
+      ASSERT_GT(image.restartInterval, 0u);
+      const unsigned int mcusPerRow = (width + 15) / 16;
+      EXPECT_EQ(0u, image.restartInterval % mcusPerRow);
+      const unsigned int mcus = mcusPerRow * ((height + 15) / 16);
+      EXPECT_EQ(int((mcus - 1) / image.restartInterval),
+                countRestartMarkers(jpeg));
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Sizes, CompressorTest,
+    ::testing::Values(std::make_pair(640, 480), std::make_pair(1280, 720),
+                      // Last strip shorter than 16 rows
+                      std::make_pair(1296, 972), std::make_pair(176, 2008),
+                      std::make_pair(2592, 1944)));
+
+TEST(CompressorExifTest, ExifFollowsJfifHeader) {
+  const int width = 1280, height = 960;
+  std::vector<uint8_t> nv21 = makeNV21(width, height);
+  ExifData* exifData = exif_data_new();
+  ASSERT_TRUE(exifData != NULL);
+
+  for (size_t threads = 1; threads <= 4; threads++) {
+    SCOPED_TRACE(threads);
+    Compressor compressor;
+    ASSERT_TRUE(compressor.setThreadCount(threads));
+    ASSERT_TRUE(
+        compressor.compress(nv21.data(), width, height, kQuality, exifData));
+    DecodedImage image;
+    ASSERT_TRUE(decode(compressor.getCompressedData(), &image));
+    ASSERT_EQ(2u, image.appMarkers.size());
+    EXPECT_EQ(0, image.appMarkers[0].first);
+    EXPECT_EQ(std::string("JFIF\0", 5),
+              image.appMarkers[0].second.substr(0, 5));
+    EXPECT_EQ(1, image.appMarkers[1].first);
+    EXPECT_EQ(std::string("Exif\0\0", 6), image.appMarkers[1].second);
+  }
+  exif_data_unref(exifData);
+}
+
+TEST(CompressorSetupTest, RejectsZeroThreads) {
+  Compressor compressor;
+  EXPECT_FALSE(compressor.setThreadCount(0));
+}
+
+}  // namespace
@@ -0,0 +1,461 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of the YUV -> RGB row kernels.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_ConverterKernels"
+
+#include <endian.h>
+
+#include <cutils/log.h>
+
+#include "ConverterKernels.h"
+
+/* The SIMD kernels store RGB565 words and RGB32 bytes in little endian order.
+ */
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERTER_KERNELS_NEON 1
+#include <arm_neon.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#define CONVERTER_KERNELS_SSE2 1
+#include <emmintrin.h>
+#endif
+#endif
+
+namespace android {
+
+namespace {
+
+/* Pixels of each row converted per SIMD step. */
+const uint32_t kStep = 16;
+
+/****************************************************************************
+ * Scalar reference
+ ***************************************************************************/
+
+inline uint8_t clampTo8(int x) {
+  if (x > 255) return 255;
+  if (x < 0) return 0;
+  return x;
+}
+
+/* Chroma terms shared by the four pixels of a 2x2 block, rounding included. */
+struct ChromaTerms {
+  int r;
+  int g;
+  int b;
+
+  inline ChromaTerms(uint8_t u, uint8_t v, const YUVCoefficients* c) {
+    const int d = u - 128;
+    const int e = v - 128;
+    r = c->rv * e + 128;
+    g = c->gu * d + c->gv * e + 128;
+    b = c->bu * d + 128;
+  }
+};
+
+inline void pixelToRGB32(uint8_t y, const ChromaTerms& t,
+                         const YUVCoefficients* c, uint8_t* rgb) {
+  const int luma = c->y * (y - c->yOffset);
+  rgb[0] = clampTo8((luma + t.r) >> 8);
+  rgb[1] = clampTo8((luma + t.g) >> 8);
+  rgb[2] = clampTo8((luma + t.b) >> 8);
+  rgb[3] = 255;
+}
+
+inline uint16_t pixelToRGB565(uint8_t y, const ChromaTerms& t,
+                              const YUVCoefficients* c) {
+  const int luma = c->y * (y - c->yOffset);
+  const uint16_t r = clampTo8((luma + t.r) >> 8) >> 3;
+  const uint16_t g = clampTo8((luma + t.g) >> 8) >> 2;
+  const uint16_t b = clampTo8((luma + t.b) >> 8) >> 3;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+  return (b << 11) | (g << 5) | r;
+#else
+  return (r << 11) | (g << 5) | b;
+#endif
+}
+
+void toRGB32Scalar(const uint8_t* y0, const uint8_t* y1, const uint8_t* u,
+                   const uint8_t* v, uint32_t uvStep, uint32_t width,
+                   const YUVCoefficients* c, uint32_t* rgb0, uint32_t* rgb1) {
+  uint8_t* out0 = reinterpret_cast<uint8_t*>(rgb0);
+  uint8_t* out1 = reinterpret_cast<uint8_t*>(rgb1);
+  for (uint32_t x = 0; x < width; x++) {
+    const ChromaTerms t(u[(x / 2) * uvStep], v[(x / 2) * uvStep], c);
+    pixelToRGB32(y0[x], t, c, out0 + x * 4);
+    pixelToRGB32(y1[x], t, c, out1 + x * 4);
+  }
+}
+
+void toRGB565Scalar(const uint8_t* y0, const uint8_t* y1, const uint8_t* u,
+                    const uint8_t* v, uint32_t uvStep, uint32_t width,
+                    const YUVCoefficients* c, uint16_t* rgb0, uint16_t* rgb1) {
+  for (uint32_t x = 0; x < width; x++) {
+    const ChromaTerms t(u[(x / 2) * uvStep], v[(x / 2) * uvStep], c);
+    rgb0[x] = pixelToRGB565(y0[x], t, c);
+    rgb1[x] = pixelToRGB565(y1[x], t, c);
+  }
+}
+
+const ConverterKernels kScalarKernels = {"scalar", toRGB32Scalar,
+                                         toRGB565Scalar};
+
+#if defined(CONVERTER_KERNELS_NEON)
+/****************************************************************************
+ * NEON
+ ***************************************************************************/
+
+/* Chroma terms of 16 pixels, each of the 8 samples duplicated for the two
+ * pixels that share it.
+ */
+struct ChromaTermsNeon {
+  int32x4_t r[4];
+  int32x4_t g[4];
+  int32x4_t b[4];
+};
+
+inline void duplicateNeon(int32x4_t lo, int32x4_t hi, int32x4_t out[4]) {
+  int32x4x2_t z = vzipq_s32(lo, lo);
+  out[0] = z.val[0];
+  out[1] = z.val[1];
+  z = vzipq_s32(hi, hi);
+  out[2] = z.val[0];
+  out[3] = z.val[1];
+}
+
+inline void loadChromaNeon(const uint8_t* u, const uint8_t* v, uint32_t uvStep,
+                           uint32_t x, const YUVCoefficients* c,
+                           ChromaTermsNeon* t) {
+  uint8x8_t u8, v8;
+  if (uvStep == 1) {
+    u8 = vld1_u8(u + x / 2);
+    v8 = vld1_u8(v + x / 2);
+  } else {
+    const uint8x8x2_t uv = vld2_u8((u < v ? u : v) + x);
+    u8 = u < v ? uv.val[0] : uv.val[1];
+    v8 = u < v ? uv.val[1] : uv.val[0];
+  }
+  const uint8x8_t half = vdup_n_u8(128);
+  const int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(u8, half));
+  const int16x8_t e = vreinterpretq_s16_u16(vsubl_u8(v8, half));
+  const int32x4_t round = vdupq_n_s32(128);
+
+  duplicateNeon(vmlal_n_s16(round, vget_low_s16(e), c->rv),
+                vmlal_n_s16(round, vget_high_s16(e), c->rv), t->r);
+  duplicateNeon(vmlal_n_s16(vmlal_n_s16(round, vget_low_s16(d), c->gu),
+                            vget_low_s16(e), c->gv),
+                vmlal_n_s16(vmlal_n_s16(round, vget_high_s16(d), c->gu),
+                            vget_high_s16(e), c->gv),
+                t->g);
+  duplicateNeon(vmlal_n_s16(round, vget_low_s16(d), c->bu),
+                vmlal_n_s16(round, vget_high_s16(d), c->bu), t->b);
+}
+
+/* Adds the chroma terms to the luma terms, then scales down and saturates. */
+inline uint8x16_t finishNeon(const int32x4_t luma[4],
+                             const int32x4_t chroma[4]) {
+  int16x4_t narrowed[4];
+  for (int i = 0; i < 4; i++) {
+    narrowed[i] = vqshrn_n_s32(vaddq_s32(luma[i], chroma[i]), 8);
+  }
+  return vcombine_u8(vqmovun_s16(vcombine_s16(narrowed[0], narrowed[1])),
+                     vqmovun_s16(vcombine_s16(narrowed[2], narrowed[3])));
+}
+
+inline void rowNeon(const uint8_t* y, const ChromaTermsNeon& t,
+                    const YUVCoefficients* c, uint8x16_t* r, uint8x16_t* g,
+                    uint8x16_t* b) {
+  const uint8x16_t y8 = vld1q_u8(y);
+  const int16x8_t offset = vdupq_n_s16(c->yOffset);
+  const int16x8_t lo =
+      vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y8))), offset);
+  const int16x8_t hi =
+      vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y8))), offset);
+  const int32x4_t luma[4] = {vmull_n_s16(vget_low_s16(lo), c->y),
+                             vmull_n_s16(vget_high_s16(lo), c->y),
+                             vmull_n_s16(vget_low_s16(hi), c->y),
+                             vmull_n_s16(vget_high_s16(hi), c->y)};
+  *r = finishNeon(luma, t.r);
+  *g = finishNeon(luma, t.g);
+  *b = finishNeon(luma, t.b);
+}
+
+inline void storeRGB32Neon(const uint8_t* y, const ChromaTermsNeon& t,
+                           const YUVCoefficients* c, uint8_t* out) {
+  uint8x16x4_t rgba;
+  rowNeon(y, t, c, &rgba.val[0], &rgba.val[1], &rgba.val[2]);
+  rgba.val[3] = vdupq_n_u8(255);
+  vst4q_u8(out, rgba);
+}
+
+inline uint16x8_t packRGB565Neon(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+  uint16x8_t out = vshll_n_u8(b, 8);
+  out = vsriq_n_u16(out, vshll_n_u8(g, 8), 5);
+  return vsriq_n_u16(out, vshll_n_u8(r, 8), 11);
+}
+
+inline void storeRGB565Neon(const uint8_t* y, const ChromaTermsNeon& t,
+                            const YUVCoefficients* c, uint16_t* out) {
+  uint8x16_t r, g, b;
+  rowNeon(y, t, c, &r, &g, &b);
+  vst1q_u16(out, packRGB565Neon(vget_low_u8(r), vget_low_u8(g),
+                                vget_low_u8(b)));
+  vst1q_u16(out + 8, packRGB565Neon(vget_high_u8(r), vget_high_u8(g),
+                                    vget_high_u8(b)));
+}
+
+void toRGB32Neon(const uint8_t* y0, const uint8_t* y1, const uint8_t* u,
+                 const uint8_t* v, uint32_t uvStep, uint32_t width,
+                 const YUVCoefficients* c, uint32_t* rgb0, uint32_t* rgb1) {
+  uint32_t x = 0;
+  ChromaTermsNeon t;
+  for (; x + kStep <= width; x += kStep) {
+    loadChromaNeon(u, v, uvStep, x, c, &t);
+    storeRGB32Neon(y0 + x, t, c, reinterpret_cast<uint8_t*>(rgb0 + x));
+    storeRGB32Neon(y1 + x, t, c, reinterpret_cast<uint8_t*>(rgb1 + x));
+  }
+  const uint32_t uvOffset = (x / 2) * uvStep;
+  toRGB32Scalar(y0 + x, y1 + x, u + uvOffset, v + uvOffset, uvStep, width - x,
+                c, rgb0 + x, rgb1 + x);
+}
+
+void toRGB565Neon(const uint8_t* y0, const uint8_t* y1, const uint8_t* u,
+                  const uint8_t* v, uint32_t uvStep, uint32_t width,
+                  const YUVCoefficients* c, uint16_t* rgb0, uint16_t* rgb1) {
+  uint32_t x = 0;
+  ChromaTermsNeon t;
+  for (; x + kStep <= width; x += kStep) {
+    loadChromaNeon(u, v, uvStep, x, c, &t);
+    storeRGB565Neon(y0 + x, t, c, rgb0 + x);
+    storeRGB565Neon(y1 + x, t, c, rgb1 + x);
+  }
+  const uint32_t uvOffset = (x / 2) * uvStep;
+  toRGB565Scalar(y0 + x, y1 + x, u + uvOffset, v + uvOffset, uvStep,
+                 width - x, c, rgb0 + x, rgb1 + x);
+}
+
+const ConverterKernels kNeonKernels = {"neon", toRGB32Neon, toRGB565Neon};
+#endif  // CONVERTER_KERNELS_NEON
+
+#if defined(CONVERTER_KERNELS_SSE2)
+/****************************************************************************
+ * SSE2
+ ***************************************************************************/
+
+/* See ChromaTermsNeon. */
+struct ChromaTermsSse2 {
+  __m128i r[4];
+  __m128i g[4];
+  __m128i b[4];
+};
+
+inline void duplicateSse2(__m128i lo, __m128i hi, __m128i out[4]) {
+  out[0] = _mm_unpacklo_epi32(lo, lo);
+  out[1] = _mm_unpackhi_epi32(lo, lo);
+  out[2] = _mm_unpacklo_epi32(hi, hi);
+  out[3] = _mm_unpackhi_epi32(hi, hi);
+}
+
+/* Packs two coefficients for _mm_madd_epi16 on interleaved 16-bit pairs. */
+inline __m128i coefficientPair(int16_t first, int16_t second) {
+  return _mm_set1_epi32((static_cast<uint16_t>(second) << 16) |
+                        static_cast<uint16_t>(first));
+}
+
+inline void loadChromaSse2(const uint8_t* u, const uint8_t* v, uint32_t uvStep,
+                           uint32_t x, const YUVCoefficients* c,
+                           ChromaTermsSse2* t) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i u16, v16;
+  if (uvStep == 1) {
+    u16 = _mm_unpacklo_epi8(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x / 2)), zero);
+    v16 = _mm_unpacklo_epi8(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x / 2)), zero);
+  } else {
+    const __m128i uv =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>((u < v ? u : v) + x));
+    const __m128i first = _mm_and_si128(uv, _mm_set1_epi16(0xff));
+    const __m128i second = _mm_srli_epi16(uv, 8);
+    u16 = u < v ? first : second;
+    v16 = u < v ? second : first;
+  }
+  const __m128i half = _mm_set1_epi16(128);
+  const __m128i d = _mm_sub_epi16(u16, half);
+  const __m128i e = _mm_sub_epi16(v16, half);
+  // Pair each sample with 1 so that the rounding term rides in the multiply
+  const __m128i one = _mm_set1_epi16(1);
+  const __m128i round = _mm_set1_epi32(128);
+
+  const __m128i rv = coefficientPair(c->rv, 128);
+  duplicateSse2(_mm_madd_epi16(_mm_unpacklo_epi16(e, one), rv),
+                _mm_madd_epi16(_mm_unpackhi_epi16(e, one), rv), t->r);
+  const __m128i guv = coefficientPair(c->gu, c->gv);
+  duplicateSse2(
+      _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(d, e), guv), round),
+      _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(d, e), guv), round),
+      t->g);
+  const __m128i bu = coefficientPair(c->bu, 128);
+  duplicateSse2(_mm_madd_epi16(_mm_unpacklo_epi16(d, one), bu),
+                _mm_madd_epi16(_mm_unpackhi_epi16(d, one), bu), t->b);
+}
+
+/* See finishNeon. */
+inline __m128i finishSse2(const __m128i luma[4], const __m128i chroma[4]) {
+  const __m128i lo =
+      _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(luma[0], chroma[0]), 8),
+                      _mm_srai_epi32(_mm_add_epi32(luma[1], chroma[1]), 8));
+  const __m128i hi =
+      _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(luma[2], chroma[2]), 8),
+                      _mm_srai_epi32(_mm_add_epi32(luma[3], chroma[3]), 8));
+  return _mm_packus_epi16(lo, hi);
+}
+
+inline void rowSse2(const uint8_t* y, const ChromaTermsSse2& t,
+                    const YUVCoefficients* c, __m128i* r, __m128i* g,
+                    __m128i* b) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y));
+  const __m128i offset = _mm_set1_epi16(c->yOffset);
+  const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(y8, zero), offset);
+  const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(y8, zero), offset);
+  // Pairing with zero turns madd into a plain 16 x 16 -> 32 bit multiply
+  const __m128i scale = coefficientPair(c->y, 0);
+  const __m128i luma[4] = {
+      _mm_madd_epi16(_mm_unpacklo_epi16(lo, zero), scale),
+      _mm_madd_epi16(_mm_unpackhi_epi16(lo, zero), scale),
+      _mm_madd_epi16(_mm_unpacklo_epi16(hi, zero), scale),
+      _mm_madd_epi16(_mm_unpackhi_epi16(hi, zero), scale)};
+  *r = finishSse2(luma, t.r);
+  *g = finishSse2(luma, t.g);
+  *b = finishSse2(luma, t.b);
+}
+
+inline void storeRGB32Sse2(const uint8_t* y, const ChromaTermsSse2& t,
+                           const YUVCoefficients* c, uint8_t* out) {
+  __m128i r, g, b;
+  rowSse2(y, t, c, &r, &g, &b);
+  const __m128i a = _mm_set1_epi8(-1);
+  const __m128i rgLo = _mm_unpacklo_epi8(r, g);
+  const __m128i rgHi = _mm_unpackhi_epi8(r, g);
+  const __m128i baLo = _mm_unpacklo_epi8(b, a);
+  const __m128i baHi = _mm_unpackhi_epi8(b, a);
+  __m128i* dst = reinterpret_cast<__m128i*>(out);
+  _mm_storeu_si128(dst, _mm_unpacklo_epi16(rgLo, baLo));
+  _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(rgLo, baLo));
+  _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(rgHi, baHi));
+  _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(rgHi, baHi));
+}
+
+inline __m128i packRGB565Sse2(__m128i r, __m128i g, __m128i b) {
+  const __m128i b5 =
+      _mm_and_si128(_mm_slli_epi16(b, 8), _mm_set1_epi16(0xf800));
+  const __m128i g6 =
+      _mm_and_si128(_mm_slli_epi16(g, 3), _mm_set1_epi16(0x07e0));
+  return _mm_or_si128(_mm_or_si128(b5, g6), _mm_srli_epi16(r, 3));
+}
+
+inline void storeRGB565Sse2(const uint8_t* y, const ChromaTermsSse2& t,
+                            const YUVCoefficients* c, uint16_t* out) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i r, g, b;
+  rowSse2(y, t, c, &r, &g, &b);
+  __m128i* dst = reinterpret_cast<__m128i*>(out);
+  _mm_storeu_si128(dst, packRGB565Sse2(_mm_unpacklo_epi8(r, zero),
+                                       _mm_unpacklo_epi8(g, zero),
+                                       _mm_unpacklo_epi8(b, zero)));
+  _mm_storeu_si128(dst + 1, packRGB565Sse2(_mm_unpackhi_epi8(r, zero),
+                                           _mm_unpackhi_epi8(g, zero),
+                                           _mm_unpackhi_epi8(b, zero)));
+}
+
+void toRGB32Sse2(const uint8_t* y0, const uint8_t* y1, const uint8_t* u,
+                 const uint8_t* v, uint32_t uvStep, uint32_t width,
+                 const YUVCoefficients* c, uint32_t* rgb0, uint32_t* rgb1) {
+  uint32_t x = 0;
+  ChromaTermsSse2 t;
+  for (; x + kStep <= width; x += kStep) {
+    loadChromaSse2(u, v, uvStep, x, c, &t);
+    storeRGB32Sse2(y0 + x, t, c, reinterpret_cast<uint8_t*>(rgb0 + x));
+    storeRGB32Sse2(y1 + x, t, c, reinterpret_cast<uint8_t*>(rgb1 + x));
+  }
+  const uint32_t uvOffset = (x / 2) * uvStep;
+  toRGB32Scalar(y0 + x, y1 + x, u + uvOffset, v + uvOffset, uvStep, width - x,
+                c, rgb0 + x, rgb1 + x);
+}
+
+void toRGB565Sse2(const uint8_t* y0, const uint8_t* y1, const uint8_t* u,
+                  const uint8_t* v, uint32_t uvStep, uint32_t width,
+                  const YUVCoefficients* c, uint16_t* rgb0, uint16_t* rgb1) {
+  uint32_t x = 0;
+  ChromaTermsSse2 t;
+  for (; x + kStep <= width; x += kStep) {
+    loadChromaSse2(u, v, uvStep, x, c, &t);
+    storeRGB565Sse2(y0 + x, t, c, rgb0 + x);
+    storeRGB565Sse2(y1 + x, t, c, rgb1 + x);
+  }
+  const uint32_t uvOffset = (x / 2) * uvStep;
+  toRGB565Scalar(y0 + x, y1 + x, u + uvOffset, v + uvOffset, uvStep,
+                 width - x, c, rgb0 + x, rgb1 + x);
+}
+
+const ConverterKernels kSse2Kernels = {"sse2", toRGB32Sse2, toRGB565Sse2};
+#endif  // CONVERTER_KERNELS_SSE2
+
+class KernelRegistry {
+ public:
+  KernelRegistry() : mCount(0) {
+    mKernels[mCount++] = &kScalarKernels;
+#if defined(CONVERTER_KERNELS_NEON)
+    mKernels[mCount++] = &kNeonKernels;
+#elif defined(CONVERTER_KERNELS_SSE2)
+    mKernels[mCount++] = &kSse2Kernels;
+#endif
+    ALOGV("Using %s converter kernels", mKernels[mCount - 1]->name);
+  }
+
+  const ConverterKernels* const* kernels() const { return mKernels; }
+  size_t count() const { return mCount; }
+
+ private:
+  const ConverterKernels* mKernels[2];
+  size_t mCount;
+};
+
+const KernelRegistry& getRegistry() {
+  static const KernelRegistry registry;
+  return registry;
+}
+
+}  // namespace
+
+const ConverterKernels& getConverterKernels() {
+  const KernelRegistry& registry = getRegistry();
+  return *registry.kernels()[registry.count() - 1];
+}
+
+size_t getAvailableConverterKernels(const ConverterKernels* const** kernels) {
+  const KernelRegistry& registry = getRegistry();
+  *kernels = registry.kernels();
+  return registry.count();
+}
+
+}; /* namespace android */
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_CONVERTER_KERNELS_H
+#define HW_EMULATOR_CAMERA_CONVERTER_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Contains declaration of the row kernels behind the YUV -> RGB converters.
+ *
+ * Each kernel converts two rows of a YUV 4:2:0 frame that share one row of
+ * chroma. The SIMD variants work on 16 pixels of both rows per step, and
+ * produce exactly the same bytes as the scalar one.
+ */
+
+namespace android {
+
+/* Fixed-point YUV -> RGB matrix, in units of 1/256:
+ *  C = Y - yOffset, D = U - 128, E = V - 128
+ *  R = clamp((y * C + rv * E + 128) >> 8)
+ *  G = clamp((y * C + gu * D + gv * E + 128) >> 8)
+ *  B = clamp((y * C + bu * D + 128) >> 8)
+ */
+struct YUVCoefficients {
+  int16_t yOffset;
+  int16_t y;
+  int16_t rv;
+  int16_t gu;
+  int16_t gv;
+  int16_t bu;
+};
+
+struct ConverterKernels {
+  /* Short name of the implementation, e.g. "scalar" or "neon" */
+  const char* name;
+
+  /* Converts rows y0 and y1 of width pixels to RGB32, written as R, G, B and
+   * an opaque alpha byte. Pixel x of either row uses chroma sample x / 2,
+   * read from u and v every uvStep bytes; uvStep is 1 for planar chroma, or 2
+   * for interleaved chroma, in which case u and v must be adjacent. y1 and
+   * rgb1 may alias y0 and rgb0 to convert a single row.
+   */
+  void (*toRGB32)(const uint8_t* y0, const uint8_t* y1, const uint8_t* u,
+                  const uint8_t* v, uint32_t uvStep, uint32_t width,
+                  const YUVCoefficients* c, uint32_t* rgb0, uint32_t* rgb1);
+  /* As toRGB32, to RGB565 words. */
+  void (*toRGB565)(const uint8_t* y0, const uint8_t* y1, const uint8_t* u,
+                   const uint8_t* v, uint32_t uvStep, uint32_t width,
+                   const YUVCoefficients* c, uint16_t* rgb0, uint16_t* rgb1);
+};
+
+/* Kernels best suited to the CPU we are running on. */
+const ConverterKernels& getConverterKernels();
+
+/* All kernel implementations the CPU supports, the scalar reference first.
+ * Returns the number of entries in *kernels.
+ */
+size_t getAvailableConverterKernels(const ConverterKernels* const** kernels);
+
+}; /* namespace android */
+
+#endif /* HW_EMULATOR_CAMERA_CONVERTER_KERNELS_H */
@@ -25,126 +25,178 @@
 
 namespace android {
 
-static void _YUV420SToRGB565(const uint8_t* Y, const uint8_t* U,
-                             const uint8_t* V, int dUV, uint16_t* rgb,
-                             int width, int height) {
-  const uint8_t* U_pos = U;
-  const uint8_t* V_pos = V;
-
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x += 2, U += dUV, V += dUV) {
-      const uint8_t nU = *U;
-      const uint8_t nV = *V;
-      *rgb = YUVToRGB565(*Y, nU, nV);
-      Y++;
-      rgb++;
-      *rgb = YUVToRGB565(*Y, nU, nV);
-      Y++;
-      rgb++;
+namespace {
+
+/* Indexed by YUVMatrix. Derived from the Kr/Kb constants of each standard,
+ * scaled by 255/219 for Y and 255/224 for chroma in limited range.
+ */
+const YUVCoefficients kMatrices[] = {
+    /* yOffset, y, rv, gu, gv, bu */
+    {16, 298, 409, -100, -208, 516}, /* YUV_BT601_LIMITED */
+    {0, 256, 359, -88, -183, 454},   /* YUV_BT601_FULL */
+    {16, 298, 459, -55, -136, 541},  /* YUV_BT709_LIMITED */
+    {0, 256, 403, -48, -120, 475},   /* YUV_BT709_FULL */
+};
+
+/* Converts rows of a frame two at a time; bands always start on an even row
+ * so that each pair shares a row of chroma.
+ */
+class ConvertJob : public CaptureWorkerPool::Job {
+ public:
+  ConvertJob(const ConverterKernels& kernels, const YUVCoefficients* c,
+             YUVLayout layout, const void* yuv, void* rgb, int width,
+             int height, bool rgb565)
+      : mKernels(kernels),
+        mCoefficients(c),
+        mY(reinterpret_cast<const uint8_t*>(yuv)),
+        mRgb(reinterpret_cast<uint8_t*>(rgb)),
+        mWidth(width),
+        mHeight(height),
+        mRgb565(rgb565) {
+    const int pix_total = width * height;
+    const uint8_t* chroma = mY + pix_total;
+    switch (layout) {
+      case YUV_LAYOUT_YV12:
+        mV = chroma;
+        mU = chroma + pix_total / 4;
+        mUVStep = 1;
+        break;
+      case YUV_LAYOUT_YU12:
+        mU = chroma;
+        mV = chroma + pix_total / 4;
+        mUVStep = 1;
+        break;
+      case YUV_LAYOUT_NV12:
+        mU = chroma;
+        mV = chroma + 1;
+        mUVStep = 2;
+        break;
+      case YUV_LAYOUT_NV21:
+      default:
+        mV = chroma;
+        mU = chroma + 1;
+        mUVStep = 2;
+        break;
     }
-    if (y & 0x1) {
-      U_pos = U;
-      V_pos = V;
-    } else {
-      U = U_pos;
-      V = V_pos;
+    mUVStride = width / 2 * mUVStep;
+  }
+
+  virtual void renderRows(uint32_t beginRow, uint32_t endRow) {
+    const size_t rgbStride = mWidth * (mRgb565 ? 2 : 4);
+    for (uint32_t row = beginRow; row < endRow; row += 2) {
+      const uint8_t* y0 = mY + row * mWidth;
+      uint8_t* rgb0 = mRgb + row * rgbStride;
+      /* An odd last row is converted on its own. */
+      const bool pair = row + 1 < mHeight;
+      const uint8_t* y1 = pair ? y0 + mWidth : y0;
+      uint8_t* rgb1 = pair ? rgb0 + rgbStride : rgb0;
+      const size_t uvOffset = (row / 2) * mUVStride;
+      if (mRgb565) {
+        mKernels.toRGB565(y0, y1, mU + uvOffset, mV + uvOffset, mUVStep,
+                          mWidth, mCoefficients,
+                          reinterpret_cast<uint16_t*>(rgb0),
+                          reinterpret_cast<uint16_t*>(rgb1));
+      } else {
+        mKernels.toRGB32(y0, y1, mU + uvOffset, mV + uvOffset, mUVStep, mWidth,
+                         mCoefficients, reinterpret_cast<uint32_t*>(rgb0),
+                         reinterpret_cast<uint32_t*>(rgb1));
+      }
     }
   }
+
+ private:
+  const ConverterKernels& mKernels;
+  const YUVCoefficients* mCoefficients;
+  const uint8_t* mY;
+  const uint8_t* mU;
+  const uint8_t* mV;
+  uint32_t mUVStep;
+  size_t mUVStride;
+  uint8_t* mRgb;
+  uint32_t mWidth;
+  uint32_t mHeight;
+  bool mRgb565;
+};
+
+YUVConverter& getDefaultConverter() {
+  static YUVConverter converter;
+  return converter;
 }
 
-static void _YUV420SToRGB32(const uint8_t* Y, const uint8_t* U,
-                            const uint8_t* V, int dUV, uint32_t* rgb, int width,
-                            int height) {
-  const uint8_t* U_pos = U;
-  const uint8_t* V_pos = V;
-
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x += 2, U += dUV, V += dUV) {
-      const uint8_t nU = *U;
-      const uint8_t nV = *V;
-      *rgb = YUVToRGB32(*Y, nU, nV);
-      Y++;
-      rgb++;
-      *rgb = YUVToRGB32(*Y, nU, nV);
-      Y++;
-      rgb++;
-    }
-    if (y & 0x1) {
-      U_pos = U;
-      V_pos = V;
-    } else {
-      U = U_pos;
-      V = V_pos;
-    }
+}  // namespace
+
+YUVConverter::YUVConverter(YUVMatrix matrix)
+    : mKernels(getConverterKernels()), mCoefficients(&kMatrices[matrix]) {}
+
+YUVConverter::~YUVConverter() { mWorkers.shutDown(); }
+
+void YUVConverter::setMatrix(YUVMatrix matrix) {
+  mCoefficients = &kMatrices[matrix];
+}
+
+status_t YUVConverter::setThreadCount(size_t threadCount) {
+  if (threadCount == 0) {
+    ALOGE("%s: Need at least one thread", __FUNCTION__);
+    return BAD_VALUE;
   }
+  Mutex::Autolock lock(mLock);
+  if (mWorkers.getWorkerCount() == threadCount - 1) return NO_ERROR;
+  mWorkers.shutDown();
+  return mWorkers.startUp(threadCount - 1);
 }
 
-void YV12ToRGB565(const void* yv12, void* rgb, int width, int height) {
-  const int pix_total = width * height;
-  const uint8_t* Y = reinterpret_cast<const uint8_t*>(yv12);
-  const uint8_t* U = Y + pix_total;
-  const uint8_t* V = U + pix_total / 4;
-  _YUV420SToRGB565(Y, U, V, 1, reinterpret_cast<uint16_t*>(rgb), width, height);
+void YUVConverter::toRGB32(YUVLayout layout, const void* yuv, void* rgb,
+                           int width, int height) {
+  convert(layout, yuv, rgb, width, height, false);
 }
 
-void YV12ToRGB32(const void* yv12, void* rgb, int width, int height) {
-  const int pix_total = width * height;
-  const uint8_t* Y = reinterpret_cast<const uint8_t*>(yv12);
-  const uint8_t* V = Y + pix_total;
-  const uint8_t* U = V + pix_total / 4;
-  _YUV420SToRGB32(Y, U, V, 1, reinterpret_cast<uint32_t*>(rgb), width, height);
+void YUVConverter::toRGB565(YUVLayout layout, const void* yuv, void* rgb,
+                            int width, int height) {
+  convert(layout, yuv, rgb, width, height, true);
 }
 
-void YU12ToRGB32(const void* yu12, void* rgb, int width, int height) {
-  const int pix_total = width * height;
-  const uint8_t* Y = reinterpret_cast<const uint8_t*>(yu12);
-  const uint8_t* U = Y + pix_total;
-  const uint8_t* V = U + pix_total / 4;
-  _YUV420SToRGB32(Y, U, V, 1, reinterpret_cast<uint32_t*>(rgb), width, height);
+void YUVConverter::convert(YUVLayout layout, const void* yuv, void* rgb,
+                           int width, int height, bool rgb565) {
+  ConvertJob job(mKernels, mCoefficients, layout, yuv, rgb, width, height,
+                 rgb565);
+  if (width * height < kMinBandedPixels) {
+    job.renderRows(0, height);
+    return;
+  }
+  Mutex::Autolock lock(mLock);
+  if (mWorkers.getWorkerCount() == 0) {
+    job.renderRows(0, height);
+  } else {
+    mWorkers.run(&job, height, 2);
+  }
 }
 
-/* Common converter for YUV 4:2:0 interleaved to RGB565.
- * y, u, and v point to Y,U, and V panes, where U and V values are interleaved.
- */
-static void _NVXXToRGB565(const uint8_t* Y, const uint8_t* U, const uint8_t* V,
-                          uint16_t* rgb, int width, int height) {
-  _YUV420SToRGB565(Y, U, V, 2, rgb, width, height);
+void YV12ToRGB565(const void* yv12, void* rgb, int width, int height) {
+  getDefaultConverter().toRGB565(YUV_LAYOUT_YV12, yv12, rgb, width, height);
 }
 
-/* Common converter for YUV 4:2:0 interleaved to RGB32.
- * y, u, and v point to Y,U, and V panes, where U and V values are interleaved.
- */
-static void _NVXXToRGB32(const uint8_t* Y, const uint8_t* U, const uint8_t* V,
-                         uint32_t* rgb, int width, int height) {
-  _YUV420SToRGB32(Y, U, V, 2, rgb, width, height);
+void YV12ToRGB32(const void* yv12, void* rgb, int width, int height) {
+  getDefaultConverter().toRGB32(YUV_LAYOUT_YV12, yv12, rgb, width, height);
+}
+
+void YU12ToRGB32(const void* yu12, void* rgb, int width, int height) {
+  getDefaultConverter().toRGB32(YUV_LAYOUT_YU12, yu12, rgb, width, height);
 }
 
 void NV12ToRGB565(const void* nv12, void* rgb, int width, int height) {
-  const int pix_total = width * height;
-  const uint8_t* y = reinterpret_cast<const uint8_t*>(nv12);
-  _NVXXToRGB565(y, y + pix_total, y + pix_total + 1,
-                reinterpret_cast<uint16_t*>(rgb), width, height);
+  getDefaultConverter().toRGB565(YUV_LAYOUT_NV12, nv12, rgb, width, height);
 }
 
 void NV12ToRGB32(const void* nv12, void* rgb, int width, int height) {
-  const int pix_total = width * height;
-  const uint8_t* y = reinterpret_cast<const uint8_t*>(nv12);
-  _NVXXToRGB32(y, y + pix_total, y + pix_total + 1,
-               reinterpret_cast<uint32_t*>(rgb), width, height);
+  getDefaultConverter().toRGB32(YUV_LAYOUT_NV12, nv12, rgb, width, height);
 }
 
 void NV21ToRGB565(const void* nv21, void* rgb, int width, int height) {
-  const int pix_total = width * height;
-  const uint8_t* y = reinterpret_cast<const uint8_t*>(nv21);
-  _NVXXToRGB565(y, y + pix_total + 1, y + pix_total,
-                reinterpret_cast<uint16_t*>(rgb), width, height);
+  getDefaultConverter().toRGB565(YUV_LAYOUT_NV21, nv21, rgb, width, height);
 }
 
 void NV21ToRGB32(const void* nv21, void* rgb, int width, int height) {
-  const int pix_total = width * height;
-  const uint8_t* y = reinterpret_cast<const uint8_t*>(nv21);
-  _NVXXToRGB32(y, y + pix_total + 1, y + pix_total,
-               reinterpret_cast<uint32_t*>(rgb), width, height);
+  getDefaultConverter().toRGB32(YUV_LAYOUT_NV21, nv21, rgb, width, height);
 }
 
 }; /* namespace android */
@@ -18,6 +18,15 @@
 #define HW_EMULATOR_CAMERA_CONVERTERS_H
 
 #include <endian.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include <utils/Errors.h>
+#include <utils/Mutex.h>
+
+#include "ConverterKernels.h"
+#include "CaptureWorkerPool.h"
 
 #ifndef __BYTE_ORDER
 #error "could not determine byte order"
@@ -189,6 +198,8 @@ static __inline__ void RGB32ToYUV(uint32_t rgb, uint8_t* y, uint8_t* u,
 
 /********************************************************************************
  * Basics of YUV -> RGB conversion.
+ * Whole frames go through YUVConverter below; these helpers are for single
+ * pixels.
  * Note that due to the fact that guest uses RGB only on preview window, and the
  * RGB format that is used is RGB565, we can limit YUV -> RGB conversions to
  * RGB565 only.
@@ -259,6 +270,76 @@ struct YUVPixel {
   }
 };
 
+/* Colour matrix and range of the YUV data read by YUVConverter. */
+enum YUVMatrix {
+  /* ITU-R BT.601, Y in [16, 235]. What the YUV2R/G/B macros implement. */
+  YUV_BT601_LIMITED,
+  /* ITU-R BT.601, Y in [0, 255], as used by JFIF. */
+  YUV_BT601_FULL,
+  /* ITU-R BT.709, Y in [16, 235]. */
+  YUV_BT709_LIMITED,
+  /* ITU-R BT.709, Y in [0, 255]. */
+  YUV_BT709_FULL,
+};
+
+/* YUV 4:2:0 framebuffer layouts read by YUVConverter. */
+enum YUVLayout {
+  /* Y plane, then V plane, then U plane. */
+  YUV_LAYOUT_YV12,
+  /* Y plane, then U plane, then V plane. */
+  YUV_LAYOUT_YU12,
+  /* Y plane, then interleaved U/V plane. */
+  YUV_LAYOUT_NV12,
+  /* Y plane, then interleaved V/U plane. */
+  YUV_LAYOUT_NV21,
+};
+
+/* Converts YUV 4:2:0 framebuffers to RGB with the fastest row kernels the CPU
+ * supports. Frames of at least kMinBandedPixels can be split into row bands
+ * that are converted on several threads at once.
+ */
+class YUVConverter {
+ public:
+  explicit YUVConverter(YUVMatrix matrix = YUV_BT601_LIMITED);
+  ~YUVConverter();
+
+  /* Selects the matrix used by subsequent conversions. */
+  void setMatrix(YUVMatrix matrix);
+
+  /* Converts large frames on threadCount threads, the calling one included.
+   * A count of 1 (the default) converts on the calling thread only.
+   */
+  status_t setThreadCount(size_t threadCount);
+
+  /* Converts a framebuffer of the given layout to RGB32 or RGB565. Both
+   * framebuffers have the given dimensions. Safe to call concurrently.
+   */
+  void toRGB32(YUVLayout layout, const void* yuv, void* rgb, int width,
+               int height);
+  void toRGB565(YUVLayout layout, const void* yuv, void* rgb, int width,
+                int height);
+
+  /* Frames smaller than this are not worth waking the worker threads for. */
+  static const int kMinBandedPixels = 640 * 480;
+
+ private:
+  void convert(YUVLayout layout, const void* yuv, void* rgb, int width,
+               int height, bool rgb565);
+
+  const ConverterKernels& mKernels;
+  /* Points into a static table, so it can be swapped at any time. */
+  std::atomic<const YUVCoefficients*> mCoefficients;
+
+  /* Serializes banded conversions, the pool runs one job at a time. */
+  Mutex mLock;
+  CaptureWorkerPool mWorkers;
+};
+
+/*
+ * The framebuffer conversions below share one single-threaded BT.601 limited
+ * range YUVConverter.
+ */
+
 /* Converts an YV12 framebuffer to RGB565 framebuffer.
  * Param:
  *  yv12 - YV12 framebuffer.
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "Converters.h"
+
+namespace {
+
+using android::ConverterKernels;
+using android::YUVConverter;
+
+// Two rows of a 640x480 preview frame
+const uint32_t kRowPixels = 640;
+const android::YUVCoefficients kBT601Limited = {16, 298, 409, -100, -208, 516};
+
+void BM_ConverterKernel(benchmark::State& state,
+                        const ConverterKernels* kernels, bool rgb565) {
+  std::vector<uint8_t> y(kRowPixels * 2), vu(kRowPixels);
+  for (size_t i = 0; i < y.size(); i++) y[i] = rand();
+  for (size_t i = 0; i < vu.size(); i++) vu[i] = rand();
+  std::vector<uint32_t> out(kRowPixels * 2);
+  uint16_t* out565 = reinterpret_cast<uint16_t*>(out.data());
+
+  for (auto _ : state) {
+    // NV21 chroma
+    if (rgb565) {
+      kernels->toRGB565(y.data(), y.data() + kRowPixels, vu.data() + 1,
+                        vu.data(), 2, kRowPixels, &kBT601Limited, out565,
+                        out565 + kRowPixels);
+    } else {
+      kernels->toRGB32(y.data(), y.data() + kRowPixels, vu.data() + 1,
+                       vu.data(), 2, kRowPixels, &kBT601Limited, out.data(),
+                       out.data() + kRowPixels);
+    }
+    benchmark::ClobberMemory();
+  }
+  state.counters["MPix/s"] = benchmark::Counter(
+      state.iterations() * kRowPixels * 2 / 1e6, benchmark::Counter::kIsRate);
+}
+
+// Whole frames through YUVConverter, with state.range(0) threads
+void BM_YUVConverter(benchmark::State& state, int width, int height) {
+  std::vector<uint8_t> frame(width * height * 3 / 2);
+  for (size_t i = 0; i < frame.size(); i++) frame[i] = rand();
+  std::vector<uint32_t> rgb(width * height);
+  YUVConverter converter;
+  if (converter.setThreadCount(state.range(0)) != android::NO_ERROR) {
+    state.SkipWithError("Unable to start converter threads");
+    return;
+  }
+
+  for (auto _ : state) {
+    converter.toRGB32(android::YUV_LAYOUT_NV21, frame.data(), rgb.data(),
+                      width, height);
+    benchmark::ClobberMemory();
+  }
+  state.counters["MPix/s"] =
+      benchmark::Counter(state.iterations() * width * height / 1e6,
+                         benchmark::Counter::kIsRate);
+}
+
+void RegisterBenchmarks() {
+  const ConverterKernels* const* kernels;
+  size_t count = android::getAvailableConverterKernels(&kernels);
+  for (size_t i = 0; i < count; i++) {
+    std::string name = kernels[i]->name;
+    benchmark::RegisterBenchmark(("BM_RGB32/" + name).c_str(),
+                                 BM_ConverterKernel, kernels[i], false);
+    benchmark::RegisterBenchmark(("BM_RGB565/" + name).c_str(),
+                                 BM_ConverterKernel, kernels[i], true);
+  }
+  benchmark::RegisterBenchmark("BM_Frame/640x480", BM_YUVConverter, 640, 480)
+      ->Arg(1)
+      ->Arg(2)
+      ->UseRealTime();
+  benchmark::RegisterBenchmark("BM_Frame/1920x1080", BM_YUVConverter, 1920,
+                               1080)
+      ->Arg(1)
+      ->Arg(2)
+      ->Arg(4)
+      ->UseRealTime();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  RegisterBenchmarks();
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Converters.h"
+
+namespace {
+
+using android::clamp;
+using android::ConverterKernels;
+using android::YUVCoefficients;
+using android::YUVConverter;
+
+// Row lengths around the 16 pixel vector width, odd ones included
+const uint32_t kWidths[] = {1, 2, 15, 16, 17, 31, 32, 33, 64, 100, 640};
+const android::YUVMatrix kMatrices[] = {
+    android::YUV_BT601_LIMITED, android::YUV_BT601_FULL,
+    android::YUV_BT709_LIMITED, android::YUV_BT709_FULL};
+const android::YUVLayout kLayouts[] = {
+    android::YUV_LAYOUT_YV12, android::YUV_LAYOUT_YU12,
+    android::YUV_LAYOUT_NV12, android::YUV_LAYOUT_NV21};
+
+// The kernels take the matrix directly; these match Converters.cpp.
+const YUVCoefficients kCoefficients[] = {{16, 298, 409, -100, -208, 516},
+                                         {0, 256, 359, -88, -183, 454},
+                                         {16, 298, 459, -55, -136, 541},
+                                         {0, 256, 403, -48, -120, 475}};
+
+std::vector<uint8_t> randomBytes(size_t size) {
+  std::vector<uint8_t> bytes(size);
+  for (size_t i = 0; i < size; i++) bytes[i] = rand();
+  return bytes;
+}
+
+// Chroma arrangements the kernels are called with
+enum Chroma { PLANAR, UV, VU };
+
+class ConverterKernelsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    srand(2011);
+    const ConverterKernels* const* kernels;
+    size_t count = android::getAvailableConverterKernels(&kernels);
+    ASSERT_GE(count, 1u);
+    reference_ = kernels[0];
+    kernels_.assign(kernels + 1, kernels + count);
+  }
+
+  // Fills two rows of luma and one of chroma, offset by one byte so vector
+  // loads are not always aligned, and points u and v into the chroma.
+  void Fill(uint32_t width, Chroma order, const uint8_t** u,
+            const uint8_t** v, uint32_t* uvStep) {
+    y_ = randomBytes(width * 2 + 1);
+    uv_ = randomBytes(width + 3);
+    const uint8_t* chroma = uv_.data() + 1;
+    *uvStep = order == PLANAR ? 1 : 2;
+    *u = order == VU ? chroma + 1 : chroma;
+    if (order == PLANAR) {
+      *v = chroma + (width + 1) / 2;
+    } else {
+      *v = order == UV ? chroma + 1 : chroma;
+    }
+  }
+
+  const uint8_t* y0() const { return y_.data() + 1; }
+  const uint8_t* y1() const { return y_.data() + 1 + y_.size() / 2; }
+
+  const ConverterKernels* reference_;
+  std::vector<const ConverterKernels*> kernels_;
+  std::vector<uint8_t> y_, uv_;
+};
+
+TEST_F(ConverterKernelsTest, ScalarIsReference) {
+  EXPECT_STREQ("scalar", reference_->name);
+}
+
+TEST_F(ConverterKernelsTest, ScalarMatchesLegacyMacros) {
+  const YUVCoefficients* c = &kCoefficients[android::YUV_BT601_LIMITED];
+  for (int y = 0; y < 256; y += 3) {
+    for (int u = 0; u < 256; u += 5) {
+      for (int v = 0; v < 256; v += 7) {
+        const uint8_t luma = y, cb = u, cr = v;
+        uint8_t rgb[4];
+        uint16_t rgb565;
+        reference_->toRGB32(&luma, &luma, &cb, &cr, 1, 1, c,
+                            reinterpret_cast<uint32_t*>(rgb),
+                            reinterpret_cast<uint32_t*>(rgb));
+        reference_->toRGB565(&luma, &luma, &cb, &cr, 1, 1, c, &rgb565,
+                             &rgb565);
+        ASSERT_EQ(YUV2R(y, u, v), rgb[0]) << y << " " << u << " " << v;
+        ASSERT_EQ(YUV2G(y, u, v), rgb[1]) << y << " " << u << " " << v;
+        ASSERT_EQ(YUV2B(y, u, v), rgb[2]) << y << " " << u << " " << v;
+        ASSERT_EQ(255, rgb[3]);
+        ASSERT_EQ(android::YUVToRGB565(y, u, v), rgb565)
+            << y << " " << u << " " << v;
+      }
+    }
+  }
+}
+
+TEST_F(ConverterKernelsTest, RGB32MatchesScalar) {
+  for (const ConverterKernels* kernels : kernels_) {
+    for (uint32_t width : kWidths) {
+      for (const YUVCoefficients& c : kCoefficients) {
+        for (Chroma order : {PLANAR, UV, VU}) {
+          const uint8_t *u, *v;
+          uint32_t uvStep;
+          Fill(width, order, &u, &v, &uvStep);
+          // One guard pixel past the end catches overruns
+          std::vector<uint32_t> expected(width * 2 + 1, 0x5a5a5a5a);
+          std::vector<uint32_t> actual(width * 2 + 1, 0x5a5a5a5a);
+          reference_->toRGB32(y0(), y1(), u, v, uvStep, width, &c,
+                              expected.data(), expected.data() + width);
+          kernels->toRGB32(y0(), y1(), u, v, uvStep, width, &c, actual.data(),
+                           actual.data() + width);
+          EXPECT_EQ(expected, actual) << kernels->name << " width " << width
+                                      << " chroma " << order;
+        }
+      }
+    }
+  }
+}
+
+TEST_F(ConverterKernelsTest, RGB565MatchesScalar) {
+  for (const ConverterKernels* kernels : kernels_) {
+    for (uint32_t width : kWidths) {
+      for (const YUVCoefficients& c : kCoefficients) {
+        for (Chroma order : {PLANAR, UV, VU}) {
+          const uint8_t *u, *v;
+          uint32_t uvStep;
+          Fill(width, order, &u, &v, &uvStep);
+          std::vector<uint16_t> expected(width * 2 + 1, 0x5a5a);
+          std::vector<uint16_t> actual(width * 2 + 1, 0x5a5a);
+          reference_->toRGB565(y0(), y1(), u, v, uvStep, width, &c,
+                               expected.data(), expected.data() + width);
+          kernels->toRGB565(y0(), y1(), u, v, uvStep, width, &c,
+                            actual.data(), actual.data() + width);
+          EXPECT_EQ(expected, actual) << kernels->name << " width " << width
+                                      << " chroma " << order;
+        }
+      }
+    }
+  }
+}
+
+// Chroma at (x, y) of a width x height frame in any of the layouts.
+void getChroma(android::YUVLayout layout, const uint8_t* frame, int width,
+               int height, int x, int y, uint8_t* u, uint8_t* v) {
+  const uint8_t* chroma = frame + width * height;
+  const int quarter = width * height / 4;
+  const int planar = (y / 2) * (width / 2) + x / 2;
+  const int interleaved = (y / 2) * width + (x / 2) * 2;
+  switch (layout) {
+    case android::YUV_LAYOUT_YV12:
+      *v = chroma[planar];
+      *u = chroma[quarter + planar];
+      break;
+    case android::YUV_LAYOUT_YU12:
+      *u = chroma[planar];
+      *v = chroma[quarter + planar];
+      break;
+    case android::YUV_LAYOUT_NV12:
+      *u = chroma[interleaved];
+      *v = chroma[interleaved + 1];
+      break;
+    case android::YUV_LAYOUT_NV21:
+      *v = chroma[interleaved];
+      *u = chroma[interleaved + 1];
+      break;
+  }
+}
+
+TEST(YUVConverterTest, LayoutsMatchPerPixelReference) {
+  const int width = 48, height = 10;
+  const std::vector<uint8_t> frame = randomBytes(width * height * 3 / 2);
+  YUVConverter converter(android::YUV_BT709_FULL);
+  const YUVCoefficients& c = kCoefficients[android::YUV_BT709_FULL];
+  const ConverterKernels* const* kernels;
+  android::getAvailableConverterKernels(&kernels);
+
+  for (android::YUVLayout layout : kLayouts) {
+    std::vector<uint32_t> rgb(width * height);
+    converter.toRGB32(layout, frame.data(), rgb.data(), width, height);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        const uint8_t luma = frame[y * width + x];
+        uint8_t u, v;
+        uint32_t expected;
+        getChroma(layout, frame.data(), width, height, x, y, &u, &v);
+        kernels[0]->toRGB32(&luma, &luma, &u, &v, 1, 1, &c, &expected,
+                            &expected);
+        ASSERT_EQ(expected, rgb[y * width + x])
+            << "layout " << layout << " at " << x << "," << y;
+      }
+    }
+  }
+}
+
+TEST(YUVConverterTest, BandsMatchSingleThread) {
+  // Odd height, so the last band ends on a lone row
+  const int width = 656, height = 493;
+  ASSERT_GE(width * height, YUVConverter::kMinBandedPixels);
+  const std::vector<uint8_t> frame = randomBytes(width * height * 3 / 2 + 2);
+  YUVConverter single, banded;
+  ASSERT_EQ(android::NO_ERROR, banded.setThreadCount(3));
+
+  for (android::YUVMatrix matrix : kMatrices) {
+    single.setMatrix(matrix);
+    banded.setMatrix(matrix);
+    for (android::YUVLayout layout : kLayouts) {
+      std::vector<uint32_t> expected32(width * height, 0);
+      std::vector<uint32_t> actual32(width * height, 1);
+      single.toRGB32(layout, frame.data(), expected32.data(), width, height);
+      banded.toRGB32(layout, frame.data(), actual32.data(), width, height);
+      EXPECT_EQ(expected32, actual32) << "matrix " << matrix << " layout "
+                                      << layout;
+
+      std::vector<uint16_t> expected565(width * height, 0);
+      std::vector<uint16_t> actual565(width * height, 1);
+      single.toRGB565(layout, frame.data(), expected565.data(), width, height);
+      banded.toRGB565(layout, frame.data(), actual565.data(), width, height);
+      EXPECT_EQ(expected565, actual565) << "matrix " << matrix << " layout "
+                                        << layout;
+    }
+  }
+}
+
+TEST(YUVConverterTest, RejectsZeroThreads) {
+  YUVConverter converter;
+  EXPECT_EQ(android::BAD_VALUE, converter.setThreadCount(0));
+  EXPECT_EQ(android::NO_ERROR, converter.setThreadCount(2));
+  EXPECT_EQ(android::NO_ERROR, converter.setThreadCount(1));
+}
+
+}  // namespace
@@ -28,6 +28,7 @@
 #define LOG_NDEBUG 0
 #define LOG_TAG "EmulatedCamera_Camera"
 #include <cutils/log.h>
+#include <cutils/properties.h>
 #include "EmulatedCamera.h"
 //#include "EmulatedFakeCameraDevice.h"
 #include "Converters.h"
@@ -37,6 +38,10 @@
 
 namespace android {
 namespace {
+/* Set to take picture thumbnails from the preview frames. */
+const char kThumbnailFromPreviewProperty[] =
+    "persist.camera.thumbnail_from_preview";
+
 const char* kSupportedFlashModes[] = {
     CameraParameters::FLASH_MODE_OFF,   CameraParameters::FLASH_MODE_AUTO,
     CameraParameters::FLASH_MODE_ON,    CameraParameters::FLASH_MODE_RED_EYE,
@@ -77,7 +82,8 @@ EmulatedCamera::EmulatedCamera(int cameraId, struct hw_module_t* module)
     : EmulatedBaseCamera(cameraId, HARDWARE_DEVICE_API_VERSION(1, 0), &common,
                          module),
       mPreviewWindow(),
-      mCallbackNotifier() {
+      mCallbackNotifier(),
+      mThumbnailFromPreview(false) {
   /* camera_device v1 fields. */
   common.close = EmulatedCamera::close;
   ops = &mDeviceOps;
@@ -91,6 +97,10 @@ EmulatedCamera::~EmulatedCamera() {}
  ***************************************************************************/
 
 status_t EmulatedCamera::Initialize(const cvd::CameraDefinition&) {
+  char prop[PROPERTY_VALUE_MAX];
+  property_get(kThumbnailFromPreviewProperty, prop, "0");
+  mThumbnailFromPreview = atoi(prop) != 0;
+
   /* Preview formats supported by this HAL. */
   char preview_formats[1024];
   snprintf(preview_formats, sizeof(preview_formats), "%s,%s,%s",
@@ -384,13 +394,22 @@ status_t EmulatedCamera::takePicture() {
    */
 
   const bool preview_on = mPreviewWindow.isPreviewEnabled();
-  if (preview_on) {
+  EmulatedCameraDevice* const camera_dev = getCameraDevice();
+  if (preview_on && mThumbnailFromPreview && camera_dev->isStarted()) {
+    /* Stop frames first so that the last one holds still while it is scaled
+     * down, then stop the preview as doStopPreview does. */
+    camera_dev->stopDeliveringFrames();
+    takePreviewThumbnail(width, height);
+    if (camera_dev->stopDevice() == NO_ERROR) {
+      /* Disable preview as well. */
+      mPreviewWindow.stopPreview();
+    }
+  } else if (preview_on) {
     doStopPreview();
   }
 
   /* Camera device should have been stopped when the shutter message has been
    * enabled. */
-  EmulatedCameraDevice* const camera_dev = getCameraDevice();
   if (camera_dev->isStarted()) {
     ALOGW("%s: Camera device is started", __FUNCTION__);
     camera_dev->stopDeliveringFrames();
@@ -560,11 +579,12 @@ void EmulatedCamera::releaseCamera() {
   cleanupCamera();
 }
 
-status_t EmulatedCamera::dumpCamera(int /*fd*/) {
+status_t EmulatedCamera::dumpCamera(int fd) {
   ALOGV("%s", __FUNCTION__);
 
-  /* TODO: Future enhancements. */
-  return -EINVAL;
+  mPreviewWindow.dump(fd);
+  mCallbackNotifier.dump(fd);
+  return NO_ERROR;
 }
 
 /****************************************************************************
@@ -683,6 +703,31 @@ status_t EmulatedCamera::doStopPreview() {
   return NO_ERROR;
 }
 
+void EmulatedCamera::takePreviewThumbnail(int width, int height) {
+  EmulatedCameraDevice* const camera_dev = getCameraDevice();
+  const int thumb_width =
+      mParameters.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH);
+  const int thumb_height =
+      mParameters.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT);
+  if (thumb_width <= 0 || thumb_height <= 0 ||
+      camera_dev->getOriginalPixelFormat() != V4L2_PIX_FMT_NV21) {
+    return;
+  }
+
+  /* A preview framed differently would not show what the picture does. */
+  const int preview_width = camera_dev->getFrameWidth();
+  const int preview_height = camera_dev->getFrameHeight();
+  if (preview_width * height != preview_height * width) {
+    ALOGV("%s: Preview %dx%d does not match picture %dx%d", __FUNCTION__,
+          preview_width, preview_height, width, height);
+    return;
+  }
+
+  mCallbackNotifier.setPreviewThumbnail(camera_dev->getCurrentFrame(),
+                                        preview_width, preview_height,
+                                        thumb_width, thumb_height);
+}
+
 /****************************************************************************
  * Private API.
  ***************************************************************************/
@@ -297,6 +297,14 @@ class EmulatedCamera : public camera_device, public EmulatedBaseCamera {
    */
   virtual status_t doStopPreview();
 
+  /* Hands the current preview frame to the callback notifier, to become the
+   * thumbnail of the picture about to be taken. Only NV21 previews framed
+   * like the picture are used.
+   * Param:
+   *  width, height - Picture dimensions.
+   */
+  void takePreviewThumbnail(int width, int height);
+
   /****************************************************************************
    * Private API.
    ***************************************************************************/
@@ -386,6 +394,10 @@ class EmulatedCamera : public camera_device, public EmulatedBaseCamera {
   /* Callback notifier. */
   CallbackNotifier mCallbackNotifier;
 
+  /* Whether picture thumbnails are taken from the preview, rather than
+   * scaled down from the picture. */
+  bool mThumbnailFromPreview;
+
  private:
   /* Registered callbacks implementing camera API. */
   static camera_device_ops_t mDeviceOps;
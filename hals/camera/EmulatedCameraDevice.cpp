@@ -27,6 +27,9 @@
 #define LOG_TAG "EmulatedCamera_Device"
 #include "EmulatedCameraDevice.h"
 #include <cutils/log.h>
+#include <cutils/properties.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/select.h>
 #include <algorithm>
 #include <cmath>
@@ -35,6 +38,10 @@
 namespace android {
 
 const float GAMMA_CORRECTION = 2.2f;
+/* Number of threads converting each preview frame to RGB. */
+static const char kConvertThreadsProperty[] = "persist.camera.convert_threads";
+static const int kMaxConvertThreads = 4;
+
 EmulatedCameraDevice::EmulatedCameraDevice(EmulatedCamera* camera_hal)
     : mObjectLock(),
       mCurFrameTimestamp(0),
@@ -76,6 +83,17 @@ status_t EmulatedCameraDevice::Initialize() {
     return ENOMEM;
   }
 
+  char prop[PROPERTY_VALUE_MAX];
+  if (property_get(kConvertThreadsProperty, prop, NULL) > 0) {
+    const int threads = atoi(prop);
+    if (threads >= 1 && threads <= kMaxConvertThreads) {
+      mPreviewConverter.setThreadCount(threads);
+    } else {
+      ALOGW("%s: Ignoring %s = %s", __FUNCTION__, kConvertThreadsProperty,
+            prop);
+    }
+  }
+
   mState = ECDS_INITIALIZED;
 
   return NO_ERROR;
@@ -175,16 +193,20 @@ status_t EmulatedCameraDevice::getCurrentPreviewFrame(void* buffer) {
   /* In emulation the framebuffer is never RGB. */
   switch (mPixelFormat) {
     case V4L2_PIX_FMT_YVU420:
-      YV12ToRGB32(mCurrentFrame, buffer, mFrameWidth, mFrameHeight);
+      mPreviewConverter.toRGB32(YUV_LAYOUT_YV12, mCurrentFrame, buffer,
+                                mFrameWidth, mFrameHeight);
       return NO_ERROR;
     case V4L2_PIX_FMT_YUV420:
-      YU12ToRGB32(mCurrentFrame, buffer, mFrameWidth, mFrameHeight);
+      mPreviewConverter.toRGB32(YUV_LAYOUT_YU12, mCurrentFrame, buffer,
+                                mFrameWidth, mFrameHeight);
       return NO_ERROR;
     case V4L2_PIX_FMT_NV21:
-      NV21ToRGB32(mCurrentFrame, buffer, mFrameWidth, mFrameHeight);
+      mPreviewConverter.toRGB32(YUV_LAYOUT_NV21, mCurrentFrame, buffer,
+                                mFrameWidth, mFrameHeight);
       return NO_ERROR;
     case V4L2_PIX_FMT_NV12:
-      NV12ToRGB32(mCurrentFrame, buffer, mFrameWidth, mFrameHeight);
+      mPreviewConverter.toRGB32(YUV_LAYOUT_NV12, mCurrentFrame, buffer,
+                                mFrameWidth, mFrameHeight);
       return NO_ERROR;
 
     default:
@@ -194,6 +216,87 @@ status_t EmulatedCameraDevice::getCurrentPreviewFrame(void* buffer) {
   }
 }
 
+status_t EmulatedCameraDevice::getCurrentPreviewFrameYUV(
+    const android_ycbcr& ycbcr) {
+  if (!isStarted()) {
+    ALOGE("%s: Device is not started", __FUNCTION__);
+    return EINVAL;
+  }
+  if (mCurrentFrame == NULL) {
+    ALOGE("%s: No framebuffer", __FUNCTION__);
+    return EINVAL;
+  }
+
+  /* Locate the chroma samples in the framebuffer. */
+  const uint8_t* Y = mCurrentFrame;
+  const uint8_t* U;
+  const uint8_t* V;
+  size_t uv_step, uv_stride;
+  switch (mPixelFormat) {
+    case V4L2_PIX_FMT_YVU420:
+      V = Y + mTotalPixels;
+      U = V + mTotalPixels / 4;
+      uv_step = 1;
+      uv_stride = mFrameWidth / 2;
+      break;
+    case V4L2_PIX_FMT_YUV420:
+      U = Y + mTotalPixels;
+      V = U + mTotalPixels / 4;
+      uv_step = 1;
+      uv_stride = mFrameWidth / 2;
+      break;
+    case V4L2_PIX_FMT_NV21:
+      V = Y + mTotalPixels;
+      U = V + 1;
+      uv_step = 2;
+      uv_stride = mFrameWidth;
+      break;
+    case V4L2_PIX_FMT_NV12:
+      U = Y + mTotalPixels;
+      V = U + 1;
+      uv_step = 2;
+      uv_stride = mFrameWidth;
+      break;
+
+    default:
+      ALOGE("%s: Unknown pixel format %.4s", __FUNCTION__,
+            reinterpret_cast<const char*>(&mPixelFormat));
+      return EINVAL;
+  }
+
+  uint8_t* dst_y = reinterpret_cast<uint8_t*>(ycbcr.y);
+  for (int row = 0; row < mFrameHeight; row++) {
+    memcpy(dst_y + row * ycbcr.ystride, Y + row * mFrameWidth, mFrameWidth);
+  }
+
+  uint8_t* dst_u = reinterpret_cast<uint8_t*>(ycbcr.cb);
+  uint8_t* dst_v = reinterpret_cast<uint8_t*>(ycbcr.cr);
+  const int chroma_width = mFrameWidth / 2;
+  /* Interleaved chroma in the same order goes in one copy per row. */
+  const bool same_interleave = uv_step == 2 && ycbcr.chroma_step == 2 &&
+                               (dst_v - dst_u) == (V - U);
+  for (int row = 0; row < mFrameHeight / 2; row++) {
+    const uint8_t* src_u = U + row * uv_stride;
+    const uint8_t* src_v = V + row * uv_stride;
+    uint8_t* row_u = dst_u + row * ycbcr.cstride;
+    uint8_t* row_v = dst_v + row * ycbcr.cstride;
+    if (uv_step == 1 && ycbcr.chroma_step == 1) {
+      memcpy(row_u, src_u, chroma_width);
+      memcpy(row_v, src_v, chroma_width);
+    } else if (same_interleave) {
+      memcpy(std::min(row_u, row_v), std::min(src_u, src_v),
+             chroma_width * 2);
+    } else {
+      for (int x = 0; x < chroma_width; x++) {
+        row_u[x * ycbcr.chroma_step] = src_u[x * uv_step];
+        row_v[x * ycbcr.chroma_step] = src_v[x * uv_step];
+      }
+    }
+  }
+
+  return NO_ERROR;
+}
+
 /****************************************************************************
  * Emulated camera device private API
  ***************************************************************************/
@@ -198,6 +198,17 @@ class EmulatedCameraDevice {
    */
   virtual status_t getCurrentPreviewFrame(void* buffer);
 
+  /* Copies current framebuffer into YUV 4:2:0 planes, without converting it.
+   * This is the counterpart of getCurrentPreviewFrame for preview windows
+   * that accept YUV buffers, and has the same requirements.
+   * Param:
+   *  ycbcr - Destination planes, as described by gralloc's lock_ycbcr. The
+   *      chroma planes may be separate or interleaved in either order.
+   * Return:
+   *  NO_ERROR on success, or an appropriate error status.
+   */
+  virtual status_t getCurrentPreviewFrameYUV(const android_ycbcr& ycbcr);
+
   /* Gets width of the frame obtained from the physical device.
    * Return:
    *  Width of the frame obtained from the physical device. Note that value
@@ -264,6 +275,17 @@ class EmulatedCameraDevice {
     return mPixelFormat;
   }
 
+  /* Gets current framebuffer, in the original pixel format.
+   * Return:
+   *  Current framebuffer. Note that value returned from this method is valid
+   *  only in case if camera device has been started, and that the worker
+   *  thread overwrites the framebuffer for every frame it captures.
+   */
+  inline const void* getCurrentFrame() const {
+    ALOGE_IF(!isStarted(), "%s: Device is not started", __FUNCTION__);
+    return mCurrentFrame;
+  }
+
   /* Gets image metadata (from HAL).
    * Return:
    *  Filled in ImageMetadata structure (in/out parameter).
@@ -536,6 +558,9 @@ class EmulatedCameraDevice {
 
   DefaultKeyedVector<String8, float*> mSupportedWhiteBalanceScale;
 
+  /* Converts the current frame for getCurrentPreviewFrame. */
+  YUVConverter mPreviewConverter;
+
   /* Defines possible states of the emulated camera device object.
    */
   enum EmulatedCameraDeviceState {
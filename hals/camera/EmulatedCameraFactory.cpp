@@ -61,6 +61,12 @@ EmulatedCameraFactory::EmulatedCameraFactory()
 
   ALOGV("%zu cameras are being emulated.", getEmulatedCameraNum());
 
+  if (mCaptureScheduler.startUp(
+          CaptureScheduler::getConfiguredWorkerCount()) != OK) {
+    ALOGE("%s: Unable to start capture scheduler, sensors will render alone",
+          __FUNCTION__);
+  }
+
 #if VSOC_PLATFORM_SDK_AFTER(J_MR2)
   /* Create hotplug thread */
   {
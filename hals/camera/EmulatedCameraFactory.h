@@ -23,6 +23,7 @@
 #include "CameraConfiguration.h"
 #include "EmulatedBaseCamera.h"
 #include "common/libs/threads/cuttlefish_thread.h"
+#include "fake-pipeline2/CaptureScheduler.h"
 #include "guest/libs/platform_support/api_level_fixes.h"
 
 namespace android {
@@ -151,6 +152,9 @@ class EmulatedCameraFactory {
 
   void onTorchModeStatusChanged(int cameraId, int newStatus);
 
+  /* Gets the render threads shared by all fake camera sensors. */
+  CaptureScheduler& getCaptureScheduler() { return mCaptureScheduler; }
+
   /****************************************************************************
    * Private API
    ***************************************************************************/
@@ -186,6 +190,10 @@ class EmulatedCameraFactory {
   cvd::CameraConfiguration mCameraConfiguration;
   Vector<cvd::CameraDefinition> mCameraDefinitions;
 
+  /* Render threads shared by all fake camera sensors, so that their number
+   * doesn't depend on how many cameras are open. */
+  CaptureScheduler mCaptureScheduler;
+
  public:
   /* Contains device open entry point, as required by HAL API. */
   static struct hw_module_methods_t mCameraModuleMethods;
@@ -89,7 +89,8 @@ EmulatedFakeCamera2::EmulatedFakeCamera2(int cameraId, bool facingBack,
                                          struct hw_module_t *module)
     : EmulatedCamera2(cameraId, module),
       mFacingBack(facingBack),
-      mIsConnected(false) {
+      mIsConnected(false),
+      mRenderPriority(0) {
   ALOGD("Constructing emulated fake camera 2 facing %s",
         facingBack ? "back" : "front");
 }
@@ -131,6 +132,7 @@ status_t EmulatedFakeCamera2::Initialize(const cvd::CameraDefinition &params) {
   }
   mSensorWidth = width;
   mSensorHeight = height;
+  mRenderPriority = params.render_priority;
 
   /* TODO(ender): probably should drop this. */
   std::copy(kAvailableRawSizes,
@@ -198,7 +200,9 @@ status_t EmulatedFakeCamera2::connectCamera(hw_device_t **device) {
   mConfigureThread = new ConfigureThread(this);
   mReadoutThread = new ReadoutThread(this);
   mControlThread = new ControlThread(this);
-  mSensor = new Sensor(mSensorWidth, mSensorHeight);
+  mSensor = new Sensor(mSensorWidth, mSensorHeight,
+                       &EmulatedCameraFactory::Instance().getCaptureScheduler());
+  mSensor->setCapturePriority(mRenderPriority);
   mJpegCompressor = new JpegCompressor();
 
   mNextStreamId = 1;
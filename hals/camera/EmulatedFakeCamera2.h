@@ -389,6 +389,8 @@ class EmulatedFakeCamera2 : public EmulatedCamera2 {
   bool mIsConnected;
 
   int32_t mSensorWidth, mSensorHeight;
+  /* Priority of this camera's frames on the shared render threads. */
+  int mRenderPriority;
 
   /** Stream manipulation */
   uint32_t mNextStreamId;
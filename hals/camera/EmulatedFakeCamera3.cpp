@@ -27,11 +27,15 @@
 #include <cutils/properties.h>
 #include <utils/Log.h>
 
-#include <ui/Fence.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sync/sync.h>
+#include <unistd.h>
 #include "EmulatedCameraFactory.h"
 #include "EmulatedFakeCamera3.h"
 #include "GrallocModule.h"
 
+#include <algorithm>
 #include <cmath>
 #include "fake-pipeline2/JpegCompressor.h"
 #include "fake-pipeline2/Sensor.h"
@@ -46,6 +50,36 @@
 
 namespace android {
 
+class EmulatedFakeCamera3::RequestReservations {
+ public:
+  explicit RequestReservations(EmulatedFakeCamera3 *parent)
+      : sensorBuffers(parent->mSensorBufferPool.acquire()),
+        buffers(parent->mHalBufferPool.acquire()),
+        mParent(parent) {}
+
+  ~RequestReservations() {
+    mParent->mSensorBufferPool.release(sensorBuffers);
+    mParent->mHalBufferPool.release(buffers);
+    if (jpegCompressor != NULL) {
+      mParent->mJpegCompressors.unreserve(jpegCompressor);
+    }
+  }
+
+  // The readout thread owns everything from here on
+  void dismiss() {
+    sensorBuffers = NULL;
+    buffers = NULL;
+    jpegCompressor.clear();
+  }
+
+  Buffers *sensorBuffers;
+  HalBufferVector *buffers;
+  sp<JpegCompressor> jpegCompressor;
+
+ private:
+  EmulatedFakeCamera3 *mParent;
+};
+
 /**
  * Constants for camera capabilities
  */
@@ -77,13 +111,41 @@ const int EmulatedFakeCamera3::kStableAeMaxFrames = 100;
 const float EmulatedFakeCamera3::kExposureWanderMin = -2;
 const float EmulatedFakeCamera3::kExposureWanderMax = 1;
 
+const char EmulatedFakeCamera3::kJpegCompressorCountProperty[] =
+    "persist.camera.jpeg_compressors";
+
+const char *const EmulatedFakeCamera3::kStageNames[NUM_STAGES] = {
+    "fence wait", "gralloc lock", "vsync wait",
+    "jpeg encode", "send result", "3A result lead", "total"};
+
+// Does what waiting on an sp<Fence> would, without allocating one for every
+// buffer of every request. Takes ownership of fd.
+static status_t waitAndCloseFence(int fd, uint32_t timeoutMs) {
+  if (fd < 0) return OK;
+  status_t res = OK;
+  if (sync_wait(fd, timeoutMs) < 0) {
+    res = (errno == ETIME) ? TIMED_OUT : -errno;
+  }
+  close(fd);
+  return res;
+}
+
 /**
  * Camera device lifecycle methods
  */
 
 EmulatedFakeCamera3::EmulatedFakeCamera3(int cameraId, bool facingBack,
                                          struct hw_module_t *module)
-    : EmulatedCamera3(cameraId, module), mFacingBack(facingBack) {
+    : EmulatedCamera3(cameraId, module),
+      mFacingBack(facingBack),
+      mRenderPriority(0),
+      mJpegCompressorCount(kDefaultJpegCompressorCount),
+      mHalBufferPool(kRequestPoolSize),
+      mSensorBufferPool(kRequestPoolSize),
+      mMetadataPool(kMetadataPoolSize),
+      mDroppedFrames(0),
+      mLateFrames(0),
+      mErrorBuffers(0) {
   ALOGI("Constructing emulated fake camera 3: ID %d, facing %s", mCameraID,
         facingBack ? "back" : "front");
 
@@ -116,6 +178,14 @@ status_t EmulatedFakeCamera3::Initialize(const cvd::CameraDefinition &params) {
     return res;
   }
 
+  char prop[PROPERTY_VALUE_MAX];
+  if (property_get(kJpegCompressorCountProperty, prop, NULL) > 0) {
+    int count = atoi(prop);
+    if (count < 1) count = 1;
+    mJpegCompressorCount = std::min<uint32_t>(count, kMaxJpegCompressorCount);
+  }
+  mRenderPriority = params.render_priority;
+
   res = constructStaticInfo(params);
   if (res != OK) {
     ALOGE("%s: Unable to allocate static info: %s (%d)", __FUNCTION__,
@@ -136,14 +206,17 @@ status_t EmulatedFakeCamera3::connectCamera(hw_device_t **device) {
     return INVALID_OPERATION;
   }
 
-  mSensor = new Sensor(mSensorWidth, mSensorHeight);
+  mSensor = new Sensor(mSensorWidth, mSensorHeight,
+                       &EmulatedCameraFactory::Instance().getCaptureScheduler());
   mSensor->setSensorListener(this);
+  mSensor->setCapturePriority(mRenderPriority);
 
   res = mSensor->startUp();
   if (res != NO_ERROR) return res;
 
   mReadoutThread = new ReadoutThread(this);
-  mJpegCompressor = new JpegCompressor();
+  res = mJpegCompressors.startUp(mJpegCompressorCount);
+  if (res != NO_ERROR) return res;
 
   res = mReadoutThread->run("EmuCam3::readoutThread");
   if (res != NO_ERROR) return res;
@@ -184,6 +257,15 @@ status_t EmulatedFakeCamera3::closeCamera() {
   }
 
   mReadoutThread->join();
+  mReadoutThread->joinDispatch();
+
+  // JPEG results go out through the readout thread, so it has to outlive
+  // any compression still running
+  if (!mJpegCompressors.waitForDone(kJpegTimeoutNs)) {
+    ALOGE("%s: Timed out waiting for JPEG compression to finish",
+          __FUNCTION__);
+  }
+  mJpegCompressors.shutDown();
 
   {
     Mutex::Autolock l(mLock);
@@ -718,6 +800,7 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
     camera3_capture_request *request) {
   Mutex::Autolock l(mLock);
   status_t res;
+  nsecs_t requestTime = systemTime();
 
   /** Validation */
 
@@ -816,7 +899,7 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
   if (request->settings == NULL) {
     settings.acquire(mPrevSettings);
   } else {
-    settings = request->settings;
+    settings.acquire(mMetadataPool.acquire(request->settings));
   }
 
   res = process3A(settings);
@@ -851,11 +934,17 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
     settings.update(ANDROID_SENSOR_FRAME_DURATION, &frameDuration, 1);
   }
 
-  Buffers *sensorBuffers = new Buffers();
-  HalBufferVector *buffers = new HalBufferVector();
+  RequestReservations reserved(this);
+  Buffers *sensorBuffers = reserved.sensorBuffers;
+  HalBufferVector *buffers = reserved.buffers;
 
-  sensorBuffers->setCapacity(request->num_output_buffers);
-  buffers->setCapacity(request->num_output_buffers);
+  // A recycled list usually has room already; setCapacity always reallocates
+  if (sensorBuffers->capacity() < request->num_output_buffers) {
+    sensorBuffers->setCapacity(request->num_output_buffers);
+  }
+  if (buffers->capacity() < request->num_output_buffers) {
+    buffers->setCapacity(request->num_output_buffers);
+  }
 
   // Process all the buffers we got for output, constructing internal buffer
   // structures for them, and lock them for writing.
@@ -874,13 +963,17 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
     destBuf.dataSpace = srcBuf.stream->data_space;
     destBuf.buffer = srcBuf.buffer;
 
-    if (destBuf.format == HAL_PIXEL_FORMAT_BLOB) {
+    if (destBuf.format == HAL_PIXEL_FORMAT_BLOB &&
+        destBuf.dataSpace != HAL_DATASPACE_DEPTH) {
       needJpeg = true;
     }
 
     // Wait on fence
-    sp<Fence> bufferAcquireFence = new Fence(srcBuf.acquire_fence);
-    res = bufferAcquireFence->wait(kFenceTimeoutMs);
+    nsecs_t stageStart = systemTime();
+    res = waitAndCloseFence(srcBuf.acquire_fence, kFenceTimeoutMs);
+    nsecs_t stageEnd = systemTime();
+    mStageLatency[STAGE_FENCE_WAIT].record(stageEnd - stageStart);
+    stageStart = stageEnd;
     if (res == TIMED_OUT) {
       ALOGE("%s: Request %d: Buffer %zu: Fence timed out after %d ms",
             __FUNCTION__, frameNumber, i, kFenceTimeoutMs);
@@ -910,6 +1003,7 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
         ALOGE("%s: Request %d: Buffer %zu: Unable to lock buffer", __FUNCTION__,
               frameNumber, i);
       }
+      mStageLatency[STAGE_GRALLOC_LOCK].record(systemTime() - stageStart);
     }
 
     if (res != OK) {
@@ -919,8 +1013,7 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
         GrallocModule::getInstance().unlock(
             *(request->output_buffers[i].buffer));
       }
-      delete sensorBuffers;
-      delete buffers;
+      mDroppedFrames++;
       return NO_INIT;
     }
 
@@ -929,19 +1022,14 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
   }
 
   /**
-   * Wait for JPEG compressor to not be busy, if needed
+   * Wait for a JPEG compressor to be free, if needed
    */
   if (needJpeg) {
-    bool ready = mJpegCompressor->waitForDone(kJpegTimeoutNs);
-    if (!ready) {
+    reserved.jpegCompressor = mJpegCompressors.reserve(kJpegTimeoutNs);
+    if (reserved.jpegCompressor == NULL) {
       ALOGE("%s: Timeout waiting for JPEG compression to complete!",
             __FUNCTION__);
-      return NO_INIT;
-    }
-    res = mJpegCompressor->reserve();
-    if (res != OK) {
-      ALOGE("%s: Error managing JPEG compressor resources, can't reserve it!",
-            __FUNCTION__);
+      mDroppedFrames++;
       return NO_INIT;
     }
   }
@@ -953,6 +1041,7 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
   if (res != OK) {
     ALOGE("%s: Timeout waiting for previous requests to complete!",
           __FUNCTION__);
+    mDroppedFrames++;
     return NO_INIT;
   }
 
@@ -962,18 +1051,22 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
    * the HAL by the framework while process_capture_request is happening.
    */
   int syncTimeoutCount = 0;
+  nsecs_t vsyncWaitStart = systemTime();
   while (!mSensor->waitForVSync(kSyncWaitTimeout)) {
     if (mStatus == STATUS_ERROR) {
+      mDroppedFrames++;
       return NO_INIT;
     }
     if (syncTimeoutCount == kMaxSyncTimeoutCount) {
       ALOGE("%s: Request %d: Sensor sync timed out after %" PRId64 " ms",
             __FUNCTION__, frameNumber,
             kSyncWaitTimeout * kMaxSyncTimeoutCount / 1000000);
+      mDroppedFrames++;
       return NO_INIT;
     }
     syncTimeoutCount++;
   }
+  mStageLatency[STAGE_VSYNC_WAIT].record(systemTime() - vsyncWaitStart);
 
   /**
    * Configure sensor and queue up the request to the readout thread
@@ -986,14 +1079,22 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
 
   ReadoutThread::Request r;
   r.frameNumber = request->frame_number;
-  r.settings = settings;
+  const camera_metadata_t *src = settings.getAndLock();
+  r.settings.acquire(mMetadataPool.acquire(src));
+  settings.unlock(src);
   r.sensorBuffers = sensorBuffers;
   r.buffers = buffers;
+  r.jpegCompressor = reserved.jpegCompressor;
+  r.requestTime = requestTime;
+  r.frameDuration = frameDuration;
+  r.earlyResultTime = 0;
 
+  reserved.dismiss();
   mReadoutThread->queueCaptureRequest(r);
   ALOGVV("%s: Queued frame %d", __FUNCTION__, request->frame_number);
 
   // Cache the settings for next time
+  mMetadataPool.release(mPrevSettings.release());
   mPrevSettings.acquire(settings);
 
   return OK;
@@ -1006,7 +1107,35 @@ status_t EmulatedFakeCamera3::flush() {
 
 /** Debug methods */
 
-void EmulatedFakeCamera3::dump(int /*fd*/) {}
+void EmulatedFakeCamera3::dump(int fd) {
+  sp<Sensor> sensor;
+  {
+    Mutex::Autolock l(mLock);
+    sensor = mSensor;
+  }
+  if (sensor != NULL) {
+    dprintf(fd, "  Sensor: %" PRIu64 " frames, %" PRIu64
+                " missed deadlines\n",
+            sensor->getFrameCount(), sensor->getMissedDeadlines());
+  }
+  dprintf(fd, "  Frames: %" PRIu64 " dropped, %" PRIu64 " late, %" PRIu64
+              " error buffers\n",
+          mDroppedFrames.load(), mLateFrames.load(), mErrorBuffers.load());
+  dprintf(fd, "  Stage latency:\n");
+  for (int i = 0; i < NUM_STAGES; i++) {
+    mStageLatency[i].dump(fd, kStageNames[i]);
+  }
+  if (sensor != NULL) {
+    sensor->getCaptureLatency().dump(fd, "sensor capture");
+  }
+  dprintf(fd, "  Request pools (hits / misses):\n");
+  dprintf(fd, "    HAL buffer lists: %" PRIu64 " / %" PRIu64 "\n",
+          mHalBufferPool.getHits(), mHalBufferPool.getMisses());
+  dprintf(fd, "    Sensor buffer lists: %" PRIu64 " / %" PRIu64 "\n",
+          mSensorBufferPool.getHits(), mSensorBufferPool.getMisses());
+  dprintf(fd, "    Metadata: %" PRIu64 " / %" PRIu64 "\n",
+          mMetadataPool.getHits(), mMetadataPool.getMisses());
+}
 
 /**
  * Private methods
@@ -1441,11 +1570,16 @@ status_t EmulatedFakeCamera3::constructStaticInfo(
                      availableMinFrameDurations.size());
   }
 
+  // Compressors share the CPU, so with all of them busy a JPEG can take a
+  // frame per compressor to come back
+  const int64_t jpegStallDuration =
+      Sensor::kFrameDurationRange[0] * mJpegCompressorCount;
+
   const std::vector<int64_t> availableStallDurationsBasic = {
       HAL_PIXEL_FORMAT_BLOB,
       width,
       height,
-      Sensor::kFrameDurationRange[0],
+      jpegStallDuration,
       HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED,
       320,
       240,
@@ -1473,7 +1607,7 @@ status_t EmulatedFakeCamera3::constructStaticInfo(
       HAL_PIXEL_FORMAT_BLOB,
       640,
       480,
-      Sensor::kFrameDurationRange[0]};
+      jpegStallDuration};
 
   const std::vector<int64_t> availableStallDurationsRaw = {
       HAL_PIXEL_FORMAT_RAW16, width, height, Sensor::kFrameDurationRange[0]};
@@ -1805,10 +1939,12 @@ status_t EmulatedFakeCamera3::constructStaticInfo(
   ADD_STATIC_ENTRY(ANDROID_REQUEST_MAX_NUM_OUTPUT_STREAMS, maxNumOutputStreams,
                    3);
 
-  static const uint8_t maxPipelineDepth = kMaxBufferCount;
+  // Each JPEG compressor can hold on to one more frame at the end of the
+  // pipeline
+  const uint8_t maxPipelineDepth = kMaxBufferCount - 1 + mJpegCompressorCount;
   ADD_STATIC_ENTRY(ANDROID_REQUEST_PIPELINE_MAX_DEPTH, &maxPipelineDepth, 1);
 
-  static const int32_t partialResultCount = 1;
+  static const int32_t partialResultCount = kFinalPartialResult;
   ADD_STATIC_ENTRY(ANDROID_REQUEST_PARTIAL_RESULT_COUNT, &partialResultCount,
                    /*count*/ 1);
 
@@ -2394,7 +2530,16 @@ void EmulatedFakeCamera3::onSensorEvent(uint32_t frameNumber, Event e,
 }
 
 EmulatedFakeCamera3::ReadoutThread::ReadoutThread(EmulatedFakeCamera3 *parent)
-    : mParent(parent), mJpegWaiting(false) {}
+    : mParent(parent),
+      mThreadActive(false),
+      mDispatchActive(false),
+      mDispatchThread(new DispatchThread(this)),
+      mCurrentReadout(false) {
+  mCurrentRequest.buffers = NULL;
+  mCurrentRequest.sensorBuffers = NULL;
+  mDispatchRequest.buffers = NULL;
+  mDispatchRequest.sensorBuffers = NULL;
+}
 
 EmulatedFakeCamera3::ReadoutThread::~ReadoutThread() {
   for (List<Request>::iterator i = mInFlightQueue.begin();
@@ -2402,18 +2547,34 @@ EmulatedFakeCamera3::ReadoutThread::~ReadoutThread() {
     delete i->buffers;
     delete i->sensorBuffers;
   }
+  for (List<Request>::iterator i = mDispatchQueue.begin();
+       i != mDispatchQueue.end(); i++) {
+    delete i->buffers;
+  }
+  delete mCurrentRequest.buffers;
+  delete mCurrentRequest.sensorBuffers;
+  delete mDispatchRequest.buffers;
 }
 
-void EmulatedFakeCamera3::ReadoutThread::queueCaptureRequest(const Request &r) {
+void EmulatedFakeCamera3::ReadoutThread::queueCaptureRequest(Request &r) {
   Mutex::Autolock l(mLock);
 
-  mInFlightQueue.push_back(r);
+  List<Request>::iterator i =
+      mInFlightQueue.insert(mInFlightQueue.end(), Request());
+  i->frameNumber = r.frameNumber;
+  i->settings.acquire(r.settings);
+  i->buffers = r.buffers;
+  i->sensorBuffers = r.sensorBuffers;
+  i->jpegCompressor = r.jpegCompressor;
+  i->requestTime = r.requestTime;
+  i->frameDuration = r.frameDuration;
   mInFlightSignal.signal();
 }
 
 bool EmulatedFakeCamera3::ReadoutThread::isIdle() {
   Mutex::Autolock l(mLock);
-  return mInFlightQueue.empty() && !mThreadActive;
+  return mInFlightQueue.empty() && !mThreadActive && mDispatchQueue.empty() &&
+         !mDispatchActive;
 }
 
 status_t EmulatedFakeCamera3::ReadoutThread::waitForReadout() {
@@ -2436,9 +2597,30 @@ status_t EmulatedFakeCamera3::ReadoutThread::waitForReadout() {
   return OK;
 }
 
+void EmulatedFakeCamera3::ReadoutThread::requestExit() {
+  Thread::requestExit();
+  mDispatchThread->requestExit();
+}
+
+void EmulatedFakeCamera3::ReadoutThread::joinDispatch() {
+  mDispatchThread->join();
+}
+
+status_t EmulatedFakeCamera3::ReadoutThread::readyToRun() {
+  status_t res = mDispatchThread->run("EmuCam3::dispatchThread");
+  if (res != OK) {
+    ALOGE("%s: Unable to start result dispatch thread: %s (%d)", __FUNCTION__,
+          strerror(-res), res);
+  }
+  return res;
+}
+
 bool EmulatedFakeCamera3::ReadoutThread::threadLoop() {
   status_t res;
 
+  // A frame that is already read out only needs to be handed over
+  if (mCurrentReadout) return queueResult();
+
   ALOGVV("%s: ReadoutThread waiting for request", __FUNCTION__);
 
   // First wait for a request from the in-flight queue
@@ -2460,6 +2642,10 @@ bool EmulatedFakeCamera3::ReadoutThread::threadLoop() {
     mCurrentRequest.settings.acquire(mInFlightQueue.begin()->settings);
     mCurrentRequest.buffers = mInFlightQueue.begin()->buffers;
     mCurrentRequest.sensorBuffers = mInFlightQueue.begin()->sensorBuffers;
+    mCurrentRequest.jpegCompressor = mInFlightQueue.begin()->jpegCompressor;
+    mCurrentRequest.requestTime = mInFlightQueue.begin()->requestTime;
+    mCurrentRequest.frameDuration = mInFlightQueue.begin()->frameDuration;
+    mCurrentRequest.earlyResultTime = 0;
     mInFlightQueue.erase(mInFlightQueue.begin());
     mInFlightSignal.signal();
     mThreadActive = true;
@@ -2482,35 +2668,44 @@ bool EmulatedFakeCamera3::ReadoutThread::threadLoop() {
   ALOGVV("Sensor done with readout for frame %d, captured at %lld ",
          mCurrentRequest.frameNumber, captureTime);
 
+  // The framework can act on the 3A state while the buffers are finished
+  sendEarlyResult();
+
   // Check if we need to JPEG encode a buffer, and send it for async
   // compression if so. Otherwise prepare the buffer for return.
-  bool needJpeg = false;
+  size_t pendingJpegs = 0;
   HalBufferVector::iterator buf = mCurrentRequest.buffers->begin();
   while (buf != mCurrentRequest.buffers->end()) {
     bool goodBuffer = true;
     if (buf->stream->format == HAL_PIXEL_FORMAT_BLOB &&
         buf->stream->data_space != HAL_DATASPACE_DEPTH) {
       Mutex::Autolock jl(mJpegLock);
-      if (mJpegWaiting) {
+      if (mCurrentRequest.jpegCompressor == NULL) {
         // This shouldn't happen, because processCaptureRequest should
-        // be stalling until JPEG compressor is free.
-        ALOGE("%s: Already processing a JPEG!", __FUNCTION__);
+        // have reserved a compressor for this frame.
+        ALOGE("%s: No JPEG compressor for frame %d!", __FUNCTION__,
+              mCurrentRequest.frameNumber);
         goodBuffer = false;
       }
       if (goodBuffer) {
-        // Compressor takes ownership of sensorBuffers here
-        res = mParent->mJpegCompressor->start(mCurrentRequest.sensorBuffers,
-                                              this);
+        PendingJpeg pending;
+        pending.frameNumber = mCurrentRequest.frameNumber;
+        pending.halBuffer = *buf;
+        pending.startTime = systemTime();
+        pending.done = false;
+        mPendingJpegs.push_back(pending);
+
+        // Compressor takes sensorBuffers here, and gives them back through
+        // onJpegBuffersDone()
+        res = mCurrentRequest.jpegCompressor->start(
+            mCurrentRequest.sensorBuffers, this);
+        mCurrentRequest.sensorBuffers = NULL;
         goodBuffer = (res == OK);
+        if (!goodBuffer) mPendingJpegs.erase(--mPendingJpegs.end());
       }
       if (goodBuffer) {
-        needJpeg = true;
-
-        mJpegHalBuffer = *buf;
-        mJpegFrameNumber = mCurrentRequest.frameNumber;
-        mJpegWaiting = true;
+        pendingJpegs = mPendingJpegs.size();
 
-        mCurrentRequest.sensorBuffers = NULL;
         buf = mCurrentRequest.buffers->erase(buf);
 
         continue;
@@ -2521,6 +2716,7 @@ bool EmulatedFakeCamera3::ReadoutThread::threadLoop() {
     }
     GrallocModule::getInstance().unlock(*(buf->buffer));
 
+    if (!goodBuffer) mParent->mErrorBuffers++;
     buf->status =
         goodBuffer ? CAMERA3_BUFFER_STATUS_OK : CAMERA3_BUFFER_STATUS_ERROR;
     buf->acquire_fence = -1;
@@ -2531,8 +2727,6 @@ bool EmulatedFakeCamera3::ReadoutThread::threadLoop() {
 
   // Construct result for all completed buffers and results
 
-  camera3_capture_result result;
-
   if (mParent->hasCapability(BACKWARD_COMPATIBLE)) {
     static const uint8_t sceneFlicker = ANDROID_STATISTICS_SCENE_FLICKER_NONE;
     mCurrentRequest.settings.update(ANDROID_STATISTICS_SCENE_FLICKER,
@@ -2576,44 +2770,151 @@ bool EmulatedFakeCamera3::ReadoutThread::threadLoop() {
 
   mCurrentRequest.settings.update(ANDROID_SENSOR_TIMESTAMP, &captureTime, 1);
 
-  // JPEGs take a stage longer
-  const uint8_t pipelineDepth =
-      needJpeg ? kMaxBufferCount : kMaxBufferCount - 1;
+  // JPEGs take a stage longer, plus one for each JPEG queued ahead of them
+  const uint8_t pipelineDepth = kMaxBufferCount - 1 + pendingJpegs;
   mCurrentRequest.settings.update(ANDROID_REQUEST_PIPELINE_DEPTH,
                                   &pipelineDepth, 1);
 
-  result.frame_number = mCurrentRequest.frameNumber;
-  result.result = mCurrentRequest.settings.getAndLock();
-  result.num_output_buffers = mCurrentRequest.buffers->size();
-  result.output_buffers = mCurrentRequest.buffers->array();
+  // The sensor is done with its buffers, and any JPEG compressor has taken
+  // the ones it needs
+  mParent->mSensorBufferPool.release(mCurrentRequest.sensorBuffers);
+  mCurrentRequest.sensorBuffers = NULL;
+  mCurrentRequest.jpegCompressor.clear();
+
+  mCurrentReadout = true;
+  return queueResult();
+}
+
+void EmulatedFakeCamera3::ReadoutThread::sendEarlyResult() {
+  static const uint32_t kEarlyResultTags[] = {
+      ANDROID_CONTROL_AE_STATE, ANDROID_CONTROL_AF_STATE,
+      ANDROID_CONTROL_AWB_STATE};
+
+  // Each key goes out in only one partial result, so it is moved out of the
+  // final one
+  CameraMetadata early(mParent->mMetadataPool.acquire(NULL));
+  for (size_t i = 0; i < sizeof(kEarlyResultTags) / sizeof(uint32_t); i++) {
+    camera_metadata_entry_t e =
+        mCurrentRequest.settings.find(kEarlyResultTags[i]);
+    if (e.count == 0) continue;
+    early.update(kEarlyResultTags[i], e.data.u8, e.count);
+    mCurrentRequest.settings.erase(kEarlyResultTags[i]);
+  }
+  if (!early.isEmpty()) {
+    camera3_capture_result result;
+    result.frame_number = mCurrentRequest.frameNumber;
+    result.result = early.getAndLock();
+    result.num_output_buffers = 0;
+    result.output_buffers = NULL;
+    result.input_buffer = nullptr;
+    result.partial_result = kEarlyPartialResult;
+    ALOGVV("%s: Send early result for frame %d", __FUNCTION__,
+           mCurrentRequest.frameNumber);
+    mParent->sendCaptureResult(&result);
+    early.unlock(result.result);
+    mCurrentRequest.earlyResultTime = systemTime();
+  }
+  mParent->mMetadataPool.release(early.release());
+}
+
+bool EmulatedFakeCamera3::ReadoutThread::queueResult() {
+  Mutex::Autolock l(mLock);
+  if (mDispatchQueue.size() >= kMaxDispatchQueueSize) {
+    status_t res = mDispatchSignal.waitRelative(mLock, kWaitPerLoop);
+    if (res != OK && res != TIMED_OUT) {
+      ALOGE("%s: Error waiting for dispatch queue to shrink", __FUNCTION__);
+      return false;
+    }
+    // Retry on the next loop, so that an exit request is not missed
+    if (mDispatchQueue.size() >= kMaxDispatchQueueSize) return true;
+  }
+
+  List<Request>::iterator r =
+      mDispatchQueue.insert(mDispatchQueue.end(), Request());
+  r->frameNumber = mCurrentRequest.frameNumber;
+  r->settings.acquire(mCurrentRequest.settings);
+  r->buffers = mCurrentRequest.buffers;
+  r->sensorBuffers = NULL;
+  r->requestTime = mCurrentRequest.requestTime;
+  r->frameDuration = mCurrentRequest.frameDuration;
+  r->earlyResultTime = mCurrentRequest.earlyResultTime;
+  mDispatchSignal.broadcast();
+
+  mCurrentRequest.buffers = NULL;
+  mCurrentReadout = false;
+  // The queued result keeps isIdle() false until it has been sent
+  mThreadActive = false;
+  ALOGVV("%s: Queued result for frame %d", __FUNCTION__, r->frameNumber);
+  return true;
+}
+
+bool EmulatedFakeCamera3::ReadoutThread::dispatchLoop() {
+  status_t res;
+
+  {
+    Mutex::Autolock l(mLock);
+    if (mDispatchQueue.empty()) {
+      res = mDispatchSignal.waitRelative(mLock, kWaitPerLoop);
+      if (res != OK && res != TIMED_OUT) {
+        ALOGE("%s: Error waiting for results: %d", __FUNCTION__, res);
+        return false;
+      }
+      if (mDispatchQueue.empty()) return true;
+    }
+    List<Request>::iterator r = mDispatchQueue.begin();
+    mDispatchRequest.frameNumber = r->frameNumber;
+    mDispatchRequest.settings.acquire(r->settings);
+    mDispatchRequest.buffers = r->buffers;
+    mDispatchRequest.requestTime = r->requestTime;
+    mDispatchRequest.frameDuration = r->frameDuration;
+    mDispatchRequest.earlyResultTime = r->earlyResultTime;
+    mDispatchQueue.erase(r);
+    mDispatchSignal.broadcast();
+    mDispatchActive = true;
+  }
+
+  camera3_capture_result result;
+  result.frame_number = mDispatchRequest.frameNumber;
   result.input_buffer = nullptr;
-  result.partial_result = 1;
 
-  // Go idle if queue is empty, before sending result
+  result.result = mDispatchRequest.settings.getAndLock();
+  result.num_output_buffers = mDispatchRequest.buffers->size();
+  result.output_buffers = mDispatchRequest.buffers->array();
+  result.partial_result = kFinalPartialResult;
+
+  // Go idle if nothing else is in the pipeline, before sending result
   bool signalIdle = false;
   {
     Mutex::Autolock l(mLock);
-    if (mInFlightQueue.empty()) {
-      mThreadActive = false;
-      signalIdle = true;
-    }
+    mDispatchActive = false;
+    signalIdle = mInFlightQueue.empty() && !mThreadActive &&
+                 mDispatchQueue.empty();
   }
   if (signalIdle) mParent->signalReadoutIdle();
 
   // Send it off to the framework
-  ALOGVV("%s: ReadoutThread: Send result to framework", __FUNCTION__);
+  ALOGVV("%s: DispatchThread: Send result to framework", __FUNCTION__);
+  nsecs_t sendStart = systemTime();
   mParent->sendCaptureResult(&result);
+  nsecs_t sendEnd = systemTime();
+  mParent->mStageLatency[STAGE_SEND_RESULT].record(sendEnd - sendStart);
+  if (mDispatchRequest.earlyResultTime != 0) {
+    mParent->mStageLatency[STAGE_EARLY_RESULT_LEAD].record(
+        sendStart - mDispatchRequest.earlyResultTime);
+  }
+
+  nsecs_t totalLatency = sendEnd - mDispatchRequest.requestTime;
+  mParent->mStageLatency[STAGE_TOTAL].record(totalLatency);
+  if (totalLatency > kLateFrameDurations * mDispatchRequest.frameDuration) {
+    mParent->mLateFrames++;
+  }
 
   // Clean up
-  mCurrentRequest.settings.unlock(result.result);
+  mDispatchRequest.settings.unlock(result.result);
 
-  delete mCurrentRequest.buffers;
-  mCurrentRequest.buffers = NULL;
-  if (!needJpeg) {
-    delete mCurrentRequest.sensorBuffers;
-    mCurrentRequest.sensorBuffers = NULL;
-  }
-  mCurrentRequest.settings.clear();
+  mParent->mHalBufferPool.release(mDispatchRequest.buffers);
+  mDispatchRequest.buffers = NULL;
+  mParent->mMetadataPool.release(mDispatchRequest.settings.release());
 
   return true;
 }
@@ -2624,32 +2925,57 @@ void EmulatedFakeCamera3::ReadoutThread::onJpegDone(
 
   GrallocModule::getInstance().unlock(*(jpegBuffer.buffer));
 
-  mJpegHalBuffer.status =
-      success ? CAMERA3_BUFFER_STATUS_OK : CAMERA3_BUFFER_STATUS_ERROR;
-  mJpegHalBuffer.acquire_fence = -1;
-  mJpegHalBuffer.release_fence = -1;
-  mJpegWaiting = false;
-
-  camera3_capture_result result;
+  List<PendingJpeg>::iterator jpeg = mPendingJpegs.begin();
+  while (jpeg != mPendingJpegs.end() &&
+         jpeg->halBuffer.buffer != jpegBuffer.buffer) {
+    jpeg++;
+  }
+  if (jpeg == mPendingJpegs.end()) {
+    ALOGE("%s: Unexpected JPEG buffer %p from compressor!", __FUNCTION__,
+          jpegBuffer.buffer);
+    return;
+  }
 
-  result.frame_number = mJpegFrameNumber;
-  result.result = NULL;
-  result.num_output_buffers = 1;
-  result.output_buffers = &mJpegHalBuffer;
-  result.input_buffer = nullptr;
-  result.partial_result = 0;
+  jpeg->halBuffer.status =
+      success ? CAMERA3_BUFFER_STATUS_OK : CAMERA3_BUFFER_STATUS_ERROR;
+  jpeg->halBuffer.acquire_fence = -1;
+  jpeg->halBuffer.release_fence = -1;
+  jpeg->done = true;
+  mParent->mStageLatency[STAGE_JPEG].record(systemTime() - jpeg->startTime);
 
   if (!success) {
+    mParent->mErrorBuffers++;
     ALOGE(
-        "%s: Compression failure, returning error state buffer to"
-        " framework",
-        __FUNCTION__);
+        "%s: Compression failure for frame %d, returning error state buffer"
+        " to framework",
+        __FUNCTION__, jpeg->frameNumber);
   } else {
-    ALOGV("%s: Compression complete, returning buffer to framework",
-          __FUNCTION__);
+    ALOGV("%s: Compression complete for frame %d", __FUNCTION__,
+          jpeg->frameNumber);
   }
 
-  mParent->sendCaptureResult(&result);
+  // Return every finished JPEG that is no longer waiting on an earlier frame
+  while (!mPendingJpegs.empty() && mPendingJpegs.begin()->done) {
+    jpeg = mPendingJpegs.begin();
+
+    camera3_capture_result result;
+
+    result.frame_number = jpeg->frameNumber;
+    result.result = NULL;
+    result.num_output_buffers = 1;
+    result.output_buffers = &jpeg->halBuffer;
+    result.input_buffer = nullptr;
+    result.partial_result = 0;
+
+    ALOGV("%s: Returning JPEG for frame %d to framework", __FUNCTION__,
+          jpeg->frameNumber);
+    nsecs_t sendStart = systemTime();
+    mParent->sendCaptureResult(&result);
+    mParent->mStageLatency[STAGE_SEND_RESULT].record(systemTime() -
+                                                     sendStart);
+
+    mPendingJpegs.erase(jpeg);
+  }
 }
 
 void EmulatedFakeCamera3::ReadoutThread::onJpegInputDone(
@@ -2659,4 +2985,8 @@ void EmulatedFakeCamera3::ReadoutThread::onJpegInputDone(
   ALOGE("%s: Unexpected input buffer from JPEG compressor!", __FUNCTION__);
 }
 
+void EmulatedFakeCamera3::ReadoutThread::onJpegBuffersDone(Buffers *buffers) {
+  mParent->mSensorBufferPool.release(buffers);
+}
+
 };  // namespace android
@@ -32,12 +32,18 @@
 using ::android::hardware::camera::common::V1_0::helper::CameraMetadata;
 #endif
 
+#include <atomic>
+
 #include <utils/List.h>
 #include <utils/Mutex.h>
 #include <utils/SortedVector.h>
 #include "EmulatedCamera3.h"
 #include "fake-pipeline2/Base.h"
 #include "fake-pipeline2/JpegCompressor.h"
+#include "fake-pipeline2/JpegCompressorPool.h"
+#include "fake-pipeline2/LatencyHistogram.h"
+#include "fake-pipeline2/MetadataPool.h"
+#include "fake-pipeline2/ObjectPool.h"
 #include "fake-pipeline2/Sensor.h"
 
 namespace android {
@@ -138,6 +144,22 @@ class EmulatedFakeCamera3 : public EmulatedCamera3,
   static const uint32_t kMaxJpegStreamCount = 1;
   static const uint32_t kMaxReprocessStreamCount = 2;
   static const uint32_t kMaxBufferCount = 4;
+  // Number of still captures that can be compressed at once. Defaults to
+  // kDefaultJpegCompressorCount, and can be set with the
+  // kJpegCompressorCountProperty system property up to
+  // kMaxJpegCompressorCount.
+  static const uint32_t kDefaultJpegCompressorCount = 2;
+  static const uint32_t kMaxJpegCompressorCount = 4;
+  static const char kJpegCompressorCountProperty[];
+  // Buffer lists kept for reuse: enough for every request in the readout
+  // pipeline, plus the one being set up
+  static const size_t kRequestPoolSize = 8;
+  // A request holds up to two metadata buffers at a time, and the last
+  // request's settings are cached as well
+  static const size_t kMetadataPoolSize = 2 * kRequestPoolSize + 1;
+  // A result is late if it is sent more than this many frame durations
+  // after its request came in
+  static const int kLateFrameDurations = kMaxBufferCount;
   // We need a positive stream ID to distinguish external buffers from
   // sensor-generated buffers which use a nonpositive ID. Otherwise, HAL3 has
   // no concept of a stream id.
@@ -148,6 +170,9 @@ class EmulatedFakeCamera3 : public EmulatedCamera3,
   static const int32_t kMaxSyncTimeoutCount = 1000;   // 1000 kSyncWaitTimeouts
   static const uint32_t kFenceTimeoutMs = 2000;       // 2 s
   static const nsecs_t kJpegTimeoutNs = 5000000000l;  // 5 s
+  // Each capture result goes out in two parts: the 3A state as soon as the
+  // frame is read out, then the rest of the metadata with the buffers.
+  enum { kEarlyPartialResult = 1, kFinalPartialResult = 2 };
 
   /****************************************************************************
    * Data members.
@@ -160,6 +185,9 @@ class EmulatedFakeCamera3 : public EmulatedCamera3,
   bool mFacingBack;
   int32_t mSensorWidth;
   int32_t mSensorHeight;
+  /* Priority of this camera's frames on the shared render threads. */
+  int mRenderPriority;
+  uint32_t mJpegCompressorCount;
 
   SortedVector<AvailableCapabilities> mCapabilities;
 
@@ -189,11 +217,43 @@ class EmulatedFakeCamera3 : public EmulatedCamera3,
   // Cached settings from latest submitted request
   CameraMetadata mPrevSettings;
 
+  // Per-request allocations, recycled once the request's result is sent
+  ObjectPool<HalBufferVector> mHalBufferPool;
+  ObjectPool<Buffers> mSensorBufferPool;
+  MetadataPool mMetadataPool;
+
+  /** Latency and error statistics, printed by dump() */
+
+  enum Stage {
+    STAGE_FENCE_WAIT,
+    STAGE_GRALLOC_LOCK,
+    STAGE_VSYNC_WAIT,
+    STAGE_JPEG,
+    STAGE_SEND_RESULT,
+    // From the early 3A partial result to the final one
+    STAGE_EARLY_RESULT_LEAD,
+    // From processCaptureRequest to the final result
+    STAGE_TOTAL,
+    NUM_STAGES
+  };
+  static const char *const kStageNames[NUM_STAGES];
+  LatencyHistogram mStageLatency[NUM_STAGES];
+  // Requests that failed before reaching the sensor
+  std::atomic<uint64_t> mDroppedFrames;
+  // Results sent more than kLateFrameDurations after their request
+  std::atomic<uint64_t> mLateFrames;
+  // Buffers returned in the error state
+  std::atomic<uint64_t> mErrorBuffers;
+
   /** Fake hardware interfaces */
   sp<Sensor> mSensor;
-  sp<JpegCompressor> mJpegCompressor;
+  JpegCompressorPool mJpegCompressors;
   friend class JpegCompressor;
 
+  // What processCaptureRequest() has reserved for a request, handed back if
+  // it fails before the request is queued to the readout thread
+  class RequestReservations;
+
   /** Processing thread for sending out results */
 
   class ReadoutThread : public Thread, private JpegCompressor::JpegListener {
@@ -206,14 +266,23 @@ class EmulatedFakeCamera3 : public EmulatedCamera3,
       CameraMetadata settings;
       HalBufferVector *buffers;
       Buffers *sensorBuffers;
+      // Reserved by processCaptureRequest if the request has a JPEG output
+      sp<JpegCompressor> jpegCompressor;
+      // When processCaptureRequest got the request, and the frame duration
+      // it was given, to track late results
+      nsecs_t requestTime;
+      nsecs_t frameDuration;
+      // When the early partial result was sent, or 0 if there was none
+      nsecs_t earlyResultTime;
     };
 
     /**
      * Interface to parent class
      */
 
-    // Place request in the in-flight queue to wait for sensor capture
-    void queueCaptureRequest(const Request &r);
+    // Place request in the in-flight queue to wait for sensor capture. Takes
+    // over r.settings, leaving it empty.
+    void queueCaptureRequest(Request &r);
 
     // Test if the readout thread is idle (no in-flight requests, not
     // currently reading out anything
@@ -222,10 +291,16 @@ class EmulatedFakeCamera3 : public EmulatedCamera3,
     // Wait until isIdle is true
     status_t waitForReadout();
 
+    // Also stops the result dispatch thread
+    virtual void requestExit();
+    // Wait for the result dispatch thread to exit, after requestExit()
+    void joinDispatch();
+
    private:
     static const nsecs_t kWaitPerLoop = 10000000L;  // 10 ms
     static const nsecs_t kMaxWaitLoops = 1000;
     static const size_t kMaxQueueSize = 2;
+    static const size_t kMaxDispatchQueueSize = 2;
 
     EmulatedFakeCamera3 *mParent;
     Mutex mLock;
@@ -234,20 +309,65 @@ class EmulatedFakeCamera3 : public EmulatedCamera3,
     Condition mInFlightSignal;
     bool mThreadActive;
 
+    // Readout runs as a pipeline so that a slow framework callback does not
+    // hold up the sensor. threadLoop takes each frame from the sensor and
+    // finalizes its buffers, then queues the result for the dispatch thread,
+    // which sends it to the framework.
+
+    class DispatchThread : public Thread {
+     public:
+      DispatchThread(ReadoutThread *parent) : mParent(parent) {}
+
+     private:
+      virtual bool threadLoop() { return mParent->dispatchLoop(); }
+      ReadoutThread *mParent;
+    };
+
+    // Results waiting to be sent, with their sensor buffers already released
+    List<Request> mDispatchQueue;
+    // Signaled when a result is queued or taken off mDispatchQueue
+    Condition mDispatchSignal;
+    bool mDispatchActive;
+    sp<DispatchThread> mDispatchThread;
+
+    virtual status_t readyToRun();
     virtual bool threadLoop();
+    bool dispatchLoop();
+
+    // Send the 3A state of the current request as an early partial result,
+    // as soon as its frame is read out
+    void sendEarlyResult();
+    // Hand the current request over to the dispatch thread
+    bool queueResult();
 
     // Only accessed by threadLoop
 
     Request mCurrentRequest;
+    // mCurrentRequest has been read out, and is waiting for room in
+    // mDispatchQueue
+    bool mCurrentReadout;
+
+    // Only accessed by dispatchLoop
+
+    Request mDispatchRequest;
 
     // Jpeg completion callbacks
 
+    struct PendingJpeg {
+      uint32_t frameNumber;
+      camera3_stream_buffer halBuffer;
+      nsecs_t startTime;
+      bool done;
+    };
+
     Mutex mJpegLock;
-    bool mJpegWaiting;
-    camera3_stream_buffer mJpegHalBuffer;
-    uint32_t mJpegFrameNumber;
+    // JPEG outputs still owed to the framework, in frame order. Compressors
+    // can finish out of order, so a finished JPEG waits here until all the
+    // ones ahead of it are done too.
+    List<PendingJpeg> mPendingJpegs;
     virtual void onJpegDone(const StreamBuffer &jpegBuffer, bool success);
     virtual void onJpegInputDone(const StreamBuffer &inputBuffer);
+    virtual void onJpegBuffersDone(Buffers *buffers);
   };
 
   sp<ReadoutThread> mReadoutThread;
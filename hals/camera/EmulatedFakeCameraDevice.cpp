@@ -38,7 +38,9 @@ EmulatedFakeCameraDevice::EmulatedFakeCameraDevice(
       mLastRedrawn(0),
       mCheckX(0),
       mCheckY(0),
-      mCcounter(0)
+      mCcounter(0),
+      mCheckerPairs(0),
+      mCheckerSize(0)
 #if EFCD_ROTATE_FRAME
       ,
       mLastRotatedAt(0),
@@ -121,7 +123,7 @@ status_t EmulatedFakeCameraDevice::startDevice(int width, int height,
     switch (mPixelFormat) {
       case V4L2_PIX_FMT_YVU420:
         mFrameV = mCurrentFrame + mTotalPixels;
-        mFrameU = mFrameU + mTotalPixels / 4;
+        mFrameU = mFrameV + mTotalPixels / 4;
         mUVStep = 1;
         mUVTotalNum = mTotalPixels / 4;
         break;
@@ -156,6 +158,8 @@ status_t EmulatedFakeCameraDevice::startDevice(int width, int height,
     }
     /* Number of items in a single row inside U/V panes. */
     mUVInRow = (width / 2) * mUVStep;
+    /* The checker rows depend on the frame width and layout. */
+    mCheckerSize = 0;
     mState = ECDS_STARTED;
     mCurFrameTimestamp = 0;
   } else {
@@ -234,6 +238,10 @@ bool EmulatedFakeCameraDevice::inWorkerThread() {
  * Fake camera device private API
  ***************************************************************************/
 
+static bool isSameColor(const YUVPixel& a, const YUVPixel& b) {
+  return a.Y == b.Y && a.U == b.U && a.V == b.V;
+}
+
 void EmulatedFakeCameraDevice::drawCheckerboard() {
   const int size = mFrameWidth / 10;
   bool black = true;
@@ -247,44 +255,39 @@ void EmulatedFakeCameraDevice::drawCheckerboard() {
   if ((mCheckX / size) & 1) black = false;
   if ((mCheckY / size) & 1) black = !black;
 
-  int county = mCheckY % size;
-  int checkxremainder = mCheckX % size;
-  uint8_t* Y = mCurrentFrame;
-  uint8_t* U_pos = mFrameU;
-  uint8_t* V_pos = mFrameV;
-  uint8_t* U = U_pos;
-  uint8_t* V = V_pos;
-
   YUVPixel adjustedWhite = YUVPixel(mWhiteYUV);
   changeWhiteBalance(adjustedWhite.Y, adjustedWhite.U, adjustedWhite.V);
+  adjustedWhite.Y = changeExposure(adjustedWhite.Y);
+  YUVPixel adjustedBlack = mBlackYUV;
+  adjustedBlack.Y = changeExposure(adjustedBlack.Y);
+  updateCheckerRows(size, adjustedBlack, adjustedWhite);
+
+  /* Each row starts with a square cut short by the horizontal phase, and
+   * is copied from the checker rows at the pair offset that leaves exactly
+   * that much of the first square. */
+  const int square_pairs = (size + 1) / 2;
+  const int first_pairs = (size - mCheckX % size + 1) / 2;
+  const int black_offset = square_pairs - first_pairs;
+  const int white_offset = 2 * square_pairs - first_pairs;
+  const bool planar = mUVStep == 1;
+  uint8_t* const UV = planar ? mFrameU : std::min(mFrameU, mFrameV);
 
-  for (int y = 0; y < mFrameHeight; y++) {
-    int countx = checkxremainder;
-    bool current = black;
-    for (int x = 0; x < mFrameWidth; x += 2) {
-      if (current) {
-        mBlackYUV.get(Y, U, V);
+  int county = mCheckY % size;
+  uint8_t* Y = mCurrentFrame;
+  for (int y = 0; y < mFrameHeight; y++, Y += mFrameWidth) {
+    const int offset = black ? black_offset : white_offset;
+    memcpy(Y, &mCheckerY[offset * 2], mFrameWidth);
+    /* A chroma row takes the colors of the second of its two luma rows. */
+    if (y & 0x1) {
+      const int uv_off = (y / 2) * mUVInRow;
+      if (planar) {
+        memcpy(mFrameU + uv_off, &mCheckerUV[offset], mUVInRow);
+        memcpy(mFrameV + uv_off, &mCheckerUV[mCheckerPairs + offset],
+               mUVInRow);
       } else {
-        adjustedWhite.get(Y, U, V);
-      }
-      *Y = changeExposure(*Y);
-      Y[1] = *Y;
-      Y += 2;
-      U += mUVStep;
-      V += mUVStep;
-      countx += 2;
-      if (countx >= size) {
-        countx = 0;
-        current = !current;
+        memcpy(UV + uv_off, &mCheckerUV[offset * 2], mUVInRow);
       }
     }
-    if (y & 0x1) {
-      U_pos = U;
-      V_pos = V;
-    } else {
-      U = U_pos;
-      V = V_pos;
-    }
     if (county++ >= size) {
       county = 0;
       black = !black;
@@ -304,28 +307,71 @@ void EmulatedFakeCameraDevice::drawCheckerboard() {
   mCcounter++;
 }
 
+void EmulatedFakeCameraDevice::updateCheckerRows(int size,
+                                                 const YUVPixel& black,
+                                                 const YUVPixel& white) {
+  if (size == mCheckerSize && isSameColor(black, mCheckerBlack) &&
+      isSameColor(white, mCheckerWhite)) {
+    return;
+  }
+
+  const int square_pairs = (size + 1) / 2;
+  mCheckerPairs = (mFrameWidth + 1) / 2 + 2 * square_pairs;
+  mCheckerY.resize(mCheckerPairs * 2);
+  mCheckerUV.resize(mCheckerPairs * 2);
+  uint8_t* U;
+  uint8_t* V;
+  if (mUVStep == 1) {
+    U = &mCheckerUV[0];
+    V = U + mCheckerPairs;
+  } else {
+    U = &mCheckerUV[mFrameU < mFrameV ? 0 : 1];
+    V = &mCheckerUV[mFrameU < mFrameV ? 1 : 0];
+  }
+  for (int pair = 0; pair < mCheckerPairs; pair++) {
+    const YUVPixel& color = ((pair / square_pairs) & 1) ? white : black;
+    mCheckerY[pair * 2] = color.Y;
+    mCheckerY[pair * 2 + 1] = color.Y;
+    U[pair * mUVStep] = color.U;
+    V[pair * mUVStep] = color.V;
+  }
+
+  mCheckerSize = size;
+  mCheckerBlack = black;
+  mCheckerWhite = white;
+  ALOGV("%s: Rebuilt for %d pixel squares", __FUNCTION__, size);
+}
+
 void EmulatedFakeCameraDevice::drawSquare(int x, int y, int size,
                                           const YUVPixel* color) {
   const int square_xstop = std::min(mFrameWidth, x + size);
   const int square_ystop = std::min(mFrameHeight, y + size);
+  /* Pixels are drawn in pairs that share their chroma. */
+  const int pairs = (square_xstop - x + 1) / 2;
+  if (pairs <= 0) {
+    return;
+  }
+  const int y_bytes = std::min(pairs * 2, mFrameWidth - x);
   uint8_t* Y_pos = mCurrentFrame + y * mFrameWidth + x;
 
   YUVPixel adjustedColor = *color;
   changeWhiteBalance(adjustedColor.Y, adjustedColor.U, adjustedColor.V);
+  const uint8_t adjustedY = changeExposure(adjustedColor.Y);
 
   // Draw the square.
   for (; y < square_ystop; y++) {
+    memset(Y_pos, adjustedY, y_bytes);
     const int iUV = (y / 2) * mUVInRow + (x / 2) * mUVStep;
     uint8_t* sqU = mFrameU + iUV;
     uint8_t* sqV = mFrameV + iUV;
-    uint8_t* sqY = Y_pos;
-    for (int i = x; i < square_xstop; i += 2) {
-      adjustedColor.get(sqY, sqU, sqV);
-      *sqY = changeExposure(*sqY);
-      sqY[1] = *sqY;
-      sqY += 2;
-      sqU += mUVStep;
-      sqV += mUVStep;
+    if (mUVStep == 1) {
+      memset(sqU, adjustedColor.U, pairs);
+      memset(sqV, adjustedColor.V, pairs);
+    } else {
+      for (int i = 0; i < pairs; i++, sqU += 2, sqV += 2) {
+        *sqU = adjustedColor.U;
+        *sqV = adjustedColor.V;
+      }
     }
     Y_pos += mFrameWidth;
   }
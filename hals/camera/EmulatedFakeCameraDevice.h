@@ -22,6 +22,8 @@
  * a fake camera device.
  */
 
+#include <vector>
+
 #include "Converters.h"
 #include "EmulatedCameraDevice.h"
 
@@ -102,6 +104,15 @@ class EmulatedFakeCameraDevice : public EmulatedCameraDevice {
   /* Draws a black and white checker board in the current frame buffer. */
   void drawCheckerboard();
 
+  /* Rebuilds mCheckerY and mCheckerUV for the given square size and
+   * colors, unless they were built for these already.
+   * Param:
+   *  size - Size of the checker board squares.
+   *  black, white - Square colors, with exposure applied to Y.
+   */
+  void updateCheckerRows(int size, const YUVPixel& black,
+                         const YUVPixel& white);
+
   /* Draws a square of the given color in the current frame buffer.
    * Param:
    *  x, y - Coordinates of the top left corner of the square in the buffer.
@@ -163,6 +174,21 @@ class EmulatedFakeCameraDevice : public EmulatedCameraDevice {
   int mCheckY;
   int mCcounter;
 
+  /* A row of alternating black and white squares, two squares longer than
+   * a frame row, so that a frame row at any horizontal phase of the pattern
+   * is a single copy out of it. Luma has two bytes per pixel pair, chroma
+   * has the U and V rows one after the other for planar formats, or one
+   * interleaved row in frame order for semi-planar ones. */
+  std::vector<uint8_t> mCheckerY;
+  std::vector<uint8_t> mCheckerUV;
+  /* Pixel pairs in each row above. */
+  int mCheckerPairs;
+  /* Square size and colors mCheckerY and mCheckerUV were built for. The
+   * size is 0 when they need to be rebuilt. */
+  int mCheckerSize;
+  YUVPixel mCheckerBlack;
+  YUVPixel mCheckerWhite;
+
   /* Defines time (in nanoseconds) between redrawing the checker board.
    * We will redraw the checker board every 15 milliseconds. */
   static const nsecs_t mRedrawAfter = 15000000LL;
@@ -20,12 +20,29 @@
 #define LOG_TAG "EmulatedCamera_JPEGStub"
 #include <errno.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 #include <stdlib.h>
 
 #include "Compressor.h"
 
+/* Number of threads encoding each picture, as strips of the image. */
+static const char kJpegThreadsProperty[] = "persist.camera.jpeg_threads";
+static const int kMaxJpegThreads = 4;
+
 extern "C" void JpegStub_init(JpegStub* stub) {
-    stub->mCompressor = static_cast<void*>(new Compressor());
+    Compressor* compressor = new Compressor();
+
+    char prop[PROPERTY_VALUE_MAX];
+    if (property_get(kJpegThreadsProperty, prop, NULL) > 0) {
+        const int threads = atoi(prop);
+        if (threads >= 1 && threads <= kMaxJpegThreads) {
+            compressor->setThreadCount(threads);
+        } else {
+            ALOGW("%s: Ignoring %s = %s", __FUNCTION__, kJpegThreadsProperty,
+                  prop);
+        }
+    }
+    stub->mCompressor = static_cast<void*>(compressor);
 }
 
 extern "C" void JpegStub_cleanup(JpegStub* stub) {
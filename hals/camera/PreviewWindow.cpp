@@ -24,16 +24,59 @@
 #include "PreviewWindow.h"
 #include <cutils/log.h>
 #include <hardware/camera.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include "EmulatedCameraDevice.h"
 #include "GrallocModule.h"
 
 namespace android {
 
+/* Preview window format that takes camera frames of the given V4L2 format
+ * with a plain copy, or 0 if there is none. */
+static int getYUVBufferFormat(uint32_t pixel_format) {
+#ifdef GRALLOC_MODULE_API_VERSION_0_2
+  switch (pixel_format) {
+    case V4L2_PIX_FMT_YVU420:
+    case V4L2_PIX_FMT_YUV420:
+      return HAL_PIXEL_FORMAT_YV12;
+    case V4L2_PIX_FMT_NV21:
+    case V4L2_PIX_FMT_NV12:
+      return HAL_PIXEL_FORMAT_YCrCb_420_SP;
+  }
+#else
+  (void)pixel_format;
+#endif
+  return 0;
+}
+
+#ifdef GRALLOC_MODULE_API_VERSION_0_2
+/* Whether a locked preview window buffer has a 4:2:0 layout that camera
+ * frames can be copied into. */
+static bool isYUV420Layout(const android_ycbcr& ycbcr, int width) {
+  if (ycbcr.y == NULL || ycbcr.cb == NULL || ycbcr.cr == NULL ||
+      ycbcr.ystride < static_cast<size_t>(width)) {
+    return false;
+  }
+  switch (ycbcr.chroma_step) {
+    case 1:
+      return ycbcr.cstride >= static_cast<size_t>(width / 2);
+    case 2:
+      return ycbcr.cstride >= static_cast<size_t>(width);
+  }
+  return false;
+}
+#endif
+
 PreviewWindow::PreviewWindow()
     : mPreviewWindow(NULL),
       mLastPreviewed(0),
       mPreviewFrameWidth(0),
       mPreviewFrameHeight(0),
+      mPreviewPixelFormat(0),
+      mPreviewBufferFormat(0),
+      mYUVRejected(false),
+      mCopiedFrames(0),
+      mConvertedFrames(0),
       mPreviewEnabled(false) {}
 
 PreviewWindow::~PreviewWindow() {}
@@ -51,6 +94,10 @@ status_t PreviewWindow::setPreviewWindow(struct preview_stream_ops* window,
 
   /* Reset preview info. */
   mPreviewFrameWidth = mPreviewFrameHeight = 0;
+  mPreviewPixelFormat = 0;
+  mPreviewBufferFormat = 0;
+  mYUVRejected = false;
+  mCopiedFrames = mConvertedFrames = 0;
   mPreviewAfter = 0;
   mLastPreviewed = 0;
 
@@ -88,6 +135,8 @@ void PreviewWindow::stopPreview() {
 
   Mutex::Autolock locker(&mObjectLock);
   mPreviewEnabled = false;
+  ALOGV("%s: %" PRIu64 " frames copied, %" PRIu64 " converted", __FUNCTION__,
+        mCopiedFrames, mConvertedFrames);
 }
 
 /****************************************************************************
@@ -106,17 +155,10 @@ void PreviewWindow::onNextFrameAvailable(const void* /*frame*/,
 
   /* Make sure that preview window dimensions are OK with the camera device */
   if (adjustPreviewDimensions(camera_dev)) {
-    /* Need to set / adjust buffer geometry for the preview window.
-     * Note that in the emulator preview window uses only RGB for pixel
-     * formats. */
-    ALOGV("%s: Adjusting preview windows %p geometry to %dx%d", __FUNCTION__,
-          mPreviewWindow, mPreviewFrameWidth, mPreviewFrameHeight);
-    res = mPreviewWindow->set_buffers_geometry(
-        mPreviewWindow, mPreviewFrameWidth, mPreviewFrameHeight,
-        HAL_PIXEL_FORMAT_RGBA_8888);
-    if (res != NO_ERROR) {
-      ALOGE("%s: Error in set_buffers_geometry %d -> %s", __FUNCTION__, -res,
-            strerror(-res));
+    /* Need to set / adjust buffer geometry for the preview window. */
+    if (setPreviewGeometry(camera_dev) != NO_ERROR) {
+      /* Try again with the next frame. */
+      mPreviewFrameWidth = mPreviewFrameHeight = 0;
       return;
     }
   }
@@ -145,21 +187,50 @@ void PreviewWindow::onNextFrameAvailable(const void* /*frame*/,
   }
 
   /* Now let the graphics framework to lock the buffer, and provide
-   * us with the framebuffer data address. */
-  void* img = NULL;
-  res = GrallocModule::getInstance().lock(*buffer, GRALLOC_USAGE_SW_WRITE_OFTEN,
-                                          0, 0, mPreviewFrameWidth,
-                                          mPreviewFrameHeight, &img);
-  if (res != NO_ERROR) {
-    ALOGE("%s: gralloc.lock failure: %d -> %s", __FUNCTION__, res,
-          strerror(res));
-    mPreviewWindow->cancel_buffer(mPreviewWindow, buffer);
-    return;
+   * us with the framebuffer data address. Frames come in in YV12/YU12/NV12/
+   * NV21 format, and are copied as they are if the window took a YUV format,
+   * or converted to RGBA otherwise. */
+  if (mPreviewBufferFormat != HAL_PIXEL_FORMAT_RGBA_8888) {
+#ifdef GRALLOC_MODULE_API_VERSION_0_2
+    android_ycbcr ycbcr = android_ycbcr();
+    res = GrallocModule::getInstance().lock_ycbcr(
+        *buffer, GRALLOC_USAGE_SW_WRITE_OFTEN, 0, 0, mPreviewFrameWidth,
+        mPreviewFrameHeight, &ycbcr);
+    if (res == NO_ERROR && !isYUV420Layout(ycbcr, mPreviewFrameWidth)) {
+      GrallocModule::getInstance().unlock(*buffer);
+      res = INVALID_OPERATION;
+    }
+    if (res != NO_ERROR) {
+      /* Many windows take any format in set_buffers_geometry, so only the
+       * buffers tell whether YUV really was allocated. Go back to RGBA
+       * with the next frame. */
+      ALOGW("%s: Preview window buffer is not YUV 0x%x: %d", __FUNCTION__,
+            mPreviewBufferFormat, res);
+      mYUVRejected = true;
+      mPreviewFrameWidth = mPreviewFrameHeight = 0;
+      mPreviewWindow->cancel_buffer(mPreviewWindow, buffer);
+      return;
+    }
+    res = camera_dev->getCurrentPreviewFrameYUV(ycbcr);
+    if (res == NO_ERROR) mCopiedFrames++;
+#else
+    /* Never negotiated without lock_ycbcr. */
+    res = INVALID_OPERATION;
+#endif
+  } else {
+    void* img = NULL;
+    res = GrallocModule::getInstance().lock(
+        *buffer, GRALLOC_USAGE_SW_WRITE_OFTEN, 0, 0, mPreviewFrameWidth,
+        mPreviewFrameHeight, &img);
+    if (res != NO_ERROR) {
+      ALOGE("%s: gralloc.lock failure: %d -> %s", __FUNCTION__, res,
+            strerror(res));
+      mPreviewWindow->cancel_buffer(mPreviewWindow, buffer);
+      return;
+    }
+    res = camera_dev->getCurrentPreviewFrame(img);
+    if (res == NO_ERROR) mConvertedFrames++;
   }
-
-  /* Frames come in in YV12/NV12/NV21 format. Since preview window doesn't
-   * supports those formats, we need to obtain the frame in RGB565. */
-  res = camera_dev->getCurrentPreviewFrame(img);
   if (res == NO_ERROR) {
     /* Show it. */
     mPreviewWindow->set_timestamp(mPreviewWindow, timestamp);
@@ -171,6 +242,15 @@ void PreviewWindow::onNextFrameAvailable(const void* /*frame*/,
   GrallocModule::getInstance().unlock(*buffer);
 }
 
+void PreviewWindow::dump(int fd) {
+  Mutex::Autolock locker(&mObjectLock);
+  dprintf(fd, "  Preview window %p: %dx%d, buffer format 0x%x%s\n",
+          mPreviewWindow, mPreviewFrameWidth, mPreviewFrameHeight,
+          mPreviewBufferFormat, mYUVRejected ? " (YUV rejected)" : "");
+  dprintf(fd, "    Frames copied: %" PRIu64 ", converted to RGBA: %" PRIu64
+          "\n", mCopiedFrames, mConvertedFrames);
+}
+
 /***************************************************************************
  * Private API
  **************************************************************************/
@@ -178,7 +258,8 @@ void PreviewWindow::onNextFrameAvailable(const void* /*frame*/,
 bool PreviewWindow::adjustPreviewDimensions(EmulatedCameraDevice* camera_dev) {
   /* Match the cached frame dimensions against the actual ones. */
   if (mPreviewFrameWidth == camera_dev->getFrameWidth() &&
-      mPreviewFrameHeight == camera_dev->getFrameHeight()) {
+      mPreviewFrameHeight == camera_dev->getFrameHeight() &&
+      mPreviewPixelFormat == camera_dev->getOriginalPixelFormat()) {
     /* They match. */
     return false;
   }
@@ -186,10 +267,45 @@ bool PreviewWindow::adjustPreviewDimensions(EmulatedCameraDevice* camera_dev) {
   /* They don't match: adjust the cache. */
   mPreviewFrameWidth = camera_dev->getFrameWidth();
   mPreviewFrameHeight = camera_dev->getFrameHeight();
+  mPreviewPixelFormat = camera_dev->getOriginalPixelFormat();
 
   return true;
 }
 
+status_t PreviewWindow::setPreviewGeometry(EmulatedCameraDevice* camera_dev) {
+  const int yuv_format =
+      getYUVBufferFormat(camera_dev->getOriginalPixelFormat());
+  int res;
+  if (yuv_format != 0 && !mYUVRejected) {
+    ALOGV("%s: Adjusting preview windows %p geometry to %dx%d, format 0x%x",
+          __FUNCTION__, mPreviewWindow, mPreviewFrameWidth,
+          mPreviewFrameHeight, yuv_format);
+    res = mPreviewWindow->set_buffers_geometry(
+        mPreviewWindow, mPreviewFrameWidth, mPreviewFrameHeight, yuv_format);
+    if (res == NO_ERROR) {
+      mPreviewBufferFormat = yuv_format;
+      return NO_ERROR;
+    }
+    ALOGW("%s: Preview window rejected format 0x%x: %d -> %s", __FUNCTION__,
+          yuv_format, -res, strerror(-res));
+    mYUVRejected = true;
+  }
+
+  ALOGV("%s: Adjusting preview windows %p geometry to %dx%d, RGBA",
+        __FUNCTION__, mPreviewWindow, mPreviewFrameWidth, mPreviewFrameHeight);
+  res = mPreviewWindow->set_buffers_geometry(
+      mPreviewWindow, mPreviewFrameWidth, mPreviewFrameHeight,
+      HAL_PIXEL_FORMAT_RGBA_8888);
+  if (res != NO_ERROR) {
+    ALOGE("%s: Error in set_buffers_geometry %d -> %s", __FUNCTION__, -res,
+          strerror(-res));
+    mPreviewBufferFormat = 0;
+    return res;
+  }
+  mPreviewBufferFormat = HAL_PIXEL_FORMAT_RGBA_8888;
+  return NO_ERROR;
+}
+
 bool PreviewWindow::isPreviewTime() {
   timeval cur_time;
   gettimeofday(&cur_time, NULL);
@@ -103,13 +103,16 @@ class PreviewWindow {
   void onNextFrameAvailable(const void* frame, nsecs_t timestamp,
                             EmulatedCameraDevice* camera_dev);
 
+  /* Prints the preview buffer format and frame counters to fd. */
+  void dump(int fd);
+
   /***************************************************************************
    * Private API
    **************************************************************************/
 
  protected:
-  /* Adjusts cached dimensions of the preview window frame according to the
-   * frame dimensions used by the camera device.
+  /* Adjusts cached dimensions and pixel format of the preview window frame
+   * according to the ones used by the camera device.
    *
    * When preview is started, it's not known (hard to define) what are going
    * to be the dimensions of the frames that are going to be displayed. Plus,
@@ -127,6 +130,19 @@ class PreviewWindow {
    */
   bool adjustPreviewDimensions(EmulatedCameraDevice* camera_dev);
 
+  /* Sets the preview window buffer geometry for the cached frame dimensions.
+   * The window is first offered the YUV format matching the camera frames, so
+   * that they can be copied without conversion, then RGBA. A YUV format is
+   * only kept once the dequeued buffers lock with a YUV layout.
+   * Note that this method must be called while object is locked.
+   * Param:
+   *  camera_dev - Camera device, providing frames displayed in the preview
+   *      window.
+   * Return:
+   *  NO_ERROR on success, or an appropriate error status.
+   */
+  status_t setPreviewGeometry(EmulatedCameraDevice* camera_dev);
+
   /* Checks if it's the time to push new frame to the preview window.
    * Note that this method must be called while object is locked. */
   bool isPreviewTime();
@@ -155,6 +171,24 @@ class PreviewWindow {
 
   int mPreviewFrameWidth;
   int mPreviewFrameHeight;
+  uint32_t mPreviewPixelFormat;
+
+  /* HAL_PIXEL_FORMAT_XXX of the preview window buffers, or 0 if not set. */
+  int mPreviewBufferFormat;
+
+  /* Set when the preview window rejects YUV buffers, or hands out buffers
+   * that do not lock as YUV, so that they are not offered again until the
+   * window changes. */
+  bool mYUVRejected;
+
+  /*
+   * Frames pushed to the preview window, by path.
+   */
+
+  /* Copied plane by plane into a YUV buffer. */
+  uint64_t mCopiedFrames;
+  /* Converted to RGBA. */
+  uint64_t mConvertedFrames;
 
   /* Preview status. */
   bool mPreviewEnabled;
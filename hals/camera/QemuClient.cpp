@@ -23,7 +23,11 @@
 #define LOG_TAG "EmulatedCamera_QemuClient"
 #include "QemuClient.h"
 #include <cutils/log.h>
-#include "EmulatedCamera.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #define LOG_QUERIES 0
 #if LOG_QUERIES
@@ -264,6 +268,31 @@ status_t QemuClient::receiveMessage(void** data, size_t* data_size) {
   *data = NULL;
   *data_size = 0;
 
+  size_t payload_size;
+  status_t res = receivePayloadSize(&payload_size);
+  if (res != NO_ERROR) {
+    return res;
+  }
+
+  /* Allocate payload data buffer, and read the payload there. */
+  *data = malloc(payload_size);
+  if (*data == NULL) {
+    ALOGE("%s: Unable to allocate %zu bytes payload buffer", __FUNCTION__,
+          payload_size);
+    return ENOMEM;
+  }
+  struct iovec iov = {*data, payload_size};
+  res = receivePayload(&iov, 1);
+  if (res == NO_ERROR) {
+    *data_size = payload_size;
+  } else {
+    free(*data);
+    *data = NULL;
+  }
+  return res;
+}
+
+status_t QemuClient::receivePayloadSize(size_t* payload_size) {
   if (mPipeFD < 0) {
     ALOGE("%s: Qemu client is not connected", __FUNCTION__);
     return EINVAL;
@@ -273,7 +302,6 @@ status_t QemuClient::receiveMessage(void** data, size_t* data_size) {
    * then it sends the payload itself. Note that payload size is sent as a
    * string, containing 8 characters representing a hexadecimal payload size
    * value. Note also, that the string doesn't contain zero-terminator. */
-  size_t payload_size;
   char payload_size_str[9];
   int rd_res = qemud_fd_read(mPipeFD, payload_size_str, 8);
   if (rd_res != 8) {
@@ -285,30 +313,50 @@ status_t QemuClient::receiveMessage(void** data, size_t* data_size) {
   /* Convert payload size. */
   errno = 0;
   payload_size_str[8] = '\0';
-  payload_size = strtol(payload_size_str, NULL, 16);
+  *payload_size = strtol(payload_size_str, NULL, 16);
   if (errno) {
     ALOGE("%s: Invalid payload size '%s'", __FUNCTION__, payload_size_str);
     return EIO;
   }
+  return NO_ERROR;
+}
 
-  /* Allocate payload data buffer, and read the payload there. */
-  *data = malloc(payload_size);
-  if (*data == NULL) {
-    ALOGE("%s: Unable to allocate %zu bytes payload buffer", __FUNCTION__,
-          payload_size);
-    return ENOMEM;
+status_t QemuClient::receivePayload(struct iovec* iov, int iov_count) {
+  if (mPipeFD < 0) {
+    ALOGE("%s: Qemu client is not connected", __FUNCTION__);
+    return EINVAL;
   }
-  rd_res = qemud_fd_read(mPipeFD, *data, payload_size);
-  if (static_cast<size_t>(rd_res) == payload_size) {
-    *data_size = payload_size;
-    return NO_ERROR;
-  } else {
-    ALOGE("%s: Read size %d doesnt match expected payload size %zu: %s",
-          __FUNCTION__, rd_res, payload_size, strerror(errno));
-    free(*data);
-    *data = NULL;
-    return errno ? errno : EIO;
+
+  while (iov_count > 0) {
+    if (iov->iov_len == 0) {
+      iov++;
+      iov_count--;
+      continue;
+    }
+    const ssize_t rd_res = readv(mPipeFD, iov, iov_count);
+    if (rd_res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rd_res <= 0) {
+      ALOGE("%s: Unable to read payload: %s", __FUNCTION__,
+            rd_res < 0 ? strerror(errno) : "Connection closed");
+      return (rd_res < 0 && errno) ? errno : EIO;
+    }
+
+    /* Skip the buffers this read has filled, and advance into the next one
+     * if it was filled in part. */
+    size_t filled = rd_res;
+    while (iov_count > 0 && filled >= iov->iov_len) {
+      filled -= iov->iov_len;
+      iov++;
+      iov_count--;
+    }
+    if (filled != 0) {
+      iov->iov_base = reinterpret_cast<uint8_t*>(iov->iov_base) + filled;
+      iov->iov_len -= filled;
+    }
   }
+  return NO_ERROR;
 }
 
 status_t QemuClient::doQuery(QemuQuery* query) {
@@ -409,7 +457,17 @@ const char CameraQemuClient::mQueryStop[] = "stop";
 /* Get next video frame from the camera device. */
 const char CameraQemuClient::mQueryFrame[] = "frame";
 
-CameraQemuClient::CameraQemuClient() : QemuClient() {}
+CameraQemuClient::CameraQemuClient()
+    : QemuClient(),
+      mFrameQuerySize(0),
+      mFrameQueryVideoSize(0),
+      mFrameQueryPreviewSize(0),
+      mFrameQueryExposureComp(0) {
+  mFrameQuery[0] = '\0';
+  mFrameQueryWhiteBalance[0] = 0;
+  mFrameQueryWhiteBalance[1] = 0;
+  mFrameQueryWhiteBalance[2] = 0;
+}
 
 CameraQemuClient::~CameraQemuClient() {}
 
@@ -467,50 +525,97 @@ status_t CameraQemuClient::queryFrame(void* vframe, void* pframe,
                                       float b_scale, float exposure_comp) {
   ALOGV("%s", __FUNCTION__);
 
-  char query_str[256];
-  snprintf(query_str, sizeof(query_str),
-           "%s video=%zu preview=%zu whiteb=%g,%g,%g expcomp=%g", mQueryFrame,
-           (vframe && vframe_size) ? vframe_size : 0,
-           (pframe && pframe_size) ? pframe_size : 0, r_scale, g_scale, b_scale,
-           exposure_comp);
-  QemuQuery query(query_str);
-  doQuery(&query);
-  const status_t res = query.getCompletionStatus();
+  if (vframe == NULL) vframe_size = 0;
+  if (pframe == NULL) pframe_size = 0;
+
+  /* Parameters rarely change between frames, so reuse the last query text
+   * when they don't. */
+  if (mFrameQuerySize == 0 || vframe_size != mFrameQueryVideoSize ||
+      pframe_size != mFrameQueryPreviewSize ||
+      r_scale != mFrameQueryWhiteBalance[0] ||
+      g_scale != mFrameQueryWhiteBalance[1] ||
+      b_scale != mFrameQueryWhiteBalance[2] ||
+      exposure_comp != mFrameQueryExposureComp) {
+    const int len = snprintf(
+        mFrameQuery, sizeof(mFrameQuery),
+        "%s video=%zu preview=%zu whiteb=%g,%g,%g expcomp=%g", mQueryFrame,
+        vframe_size, pframe_size, r_scale, g_scale, b_scale, exposure_comp);
+    if (len < 0 || static_cast<size_t>(len) >= sizeof(mFrameQuery)) {
+      ALOGE("%s: Unable to format frame query", __FUNCTION__);
+      mFrameQuerySize = 0;
+      return EINVAL;
+    }
+    mFrameQuerySize = len + 1;
+    mFrameQueryVideoSize = vframe_size;
+    mFrameQueryPreviewSize = pframe_size;
+    mFrameQueryWhiteBalance[0] = r_scale;
+    mFrameQueryWhiteBalance[1] = g_scale;
+    mFrameQueryWhiteBalance[2] = b_scale;
+    mFrameQueryExposureComp = exposure_comp;
+  }
+
+  LOGQ("Send query '%s'", mFrameQuery);
+  status_t res = sendMessage(mFrameQuery, mFrameQuerySize);
+  if (res != NO_ERROR) {
+    ALOGE("%s: Send query '%s' failed: %s", __FUNCTION__, mFrameQuery,
+          strerror(res));
+    return res;
+  }
+  size_t payload_size;
+  res = receivePayloadSize(&payload_size);
   if (res != NO_ERROR) {
-    ALOGE("%s: Query failed: %s", __FUNCTION__,
-          query.mReplyData ? query.mReplyData : "No error message");
     return res;
   }
 
-  /* Copy requested frames. */
-  size_t cur_offset = 0;
-  const uint8_t* frame = reinterpret_cast<const uint8_t*>(query.mReplyData);
-  /* Video frame is always first. */
-  if (vframe != NULL && vframe_size != 0) {
-    /* Make sure that video frame is in. */
-    if ((query.mReplyDataSize - cur_offset) >= vframe_size) {
-      memcpy(vframe, frame, vframe_size);
-      cur_offset += vframe_size;
-    } else {
-      ALOGE("%s: Reply %zu bytes is to small to contain %zu bytes video frame",
-            __FUNCTION__, query.mReplyDataSize - cur_offset, vframe_size);
-      return EINVAL;
+  /* A reply with frames is 'ok:' followed by the video frame, and then the
+   * preview frame. The status is read on its own first, so that a failure
+   * the size of the frames doesn't land in the caller's buffers. */
+  const size_t frames_size = vframe_size + pframe_size;
+  char status[3];
+  size_t status_size = 0;
+  if (payload_size == sizeof(status) + frames_size) {
+    struct iovec iov = {status, sizeof(status)};
+    res = receivePayload(&iov, 1);
+    if (res != NO_ERROR) {
+      return res;
     }
-  }
-  if (pframe != NULL && pframe_size != 0) {
-    /* Make sure that preview frame is in. */
-    if ((query.mReplyDataSize - cur_offset) >= pframe_size) {
-      memcpy(pframe, frame + cur_offset, pframe_size);
-      cur_offset += pframe_size;
-    } else {
-      ALOGE(
-          "%s: Reply %zu bytes is to small to contain %zu bytes preview frame",
-          __FUNCTION__, query.mReplyDataSize - cur_offset, pframe_size);
-      return EINVAL;
+    status_size = sizeof(status);
+    if (memcmp(status, "ok", 2) == 0 &&
+        status[2] == (frames_size != 0 ? ':' : '\0')) {
+      /* Video frame is always first. */
+      struct iovec frames[2] = {{vframe, vframe_size}, {pframe, pframe_size}};
+      return receivePayload(frames, 2);
     }
   }
 
-  return NO_ERROR;
+  /* Anything else is most likely a failure: receive the rest of it as a
+   * regular query reply to report the error. */
+  QemuQuery query(mFrameQuery);
+  query.mReplyBuffer = reinterpret_cast<char*>(malloc(payload_size));
+  if (query.mReplyBuffer == NULL) {
+    ALOGE("%s: Unable to allocate %zu bytes payload buffer", __FUNCTION__,
+          payload_size);
+    return ENOMEM;
+  }
+  memcpy(query.mReplyBuffer, status, status_size);
+  struct iovec iov = {query.mReplyBuffer + status_size,
+                      payload_size - status_size};
+  res = receivePayload(&iov, 1);
+  query.mReplySize = payload_size;
+  query.completeQuery(res);
+  res = query.getCompletionStatus();
+  if (res != NO_ERROR) {
+    ALOGE("%s: Query failed: %s", __FUNCTION__,
+          query.mReplyData ? query.mReplyData : "No error message");
+    return res;
+  }
+  if (status_size != 0) {
+    ALOGE("%s: Invalid query reply: '%.3s'", __FUNCTION__, status);
+  } else {
+    ALOGE("%s: Reply %zu bytes doesn't match %zu bytes of requested frames",
+          __FUNCTION__, query.mReplyDataSize, frames_size);
+  }
+  return EINVAL;
 }
 
 }; /* namespace android */
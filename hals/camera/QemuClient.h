@@ -23,6 +23,8 @@
  */
 
 #include <hardware/qemud.h>
+#include <sys/uio.h>
+#include <utils/Errors.h>
 
 namespace android {
 
@@ -264,6 +266,28 @@ class QemuClient {
    */
   virtual status_t receiveMessage(void** data, size_t* data_size);
 
+  /* Receives the payload size of the next reply from the service.
+   * This is the first of the two chunks read by receiveMessage(). The payload
+   * that follows must then be read with receivePayload().
+   * Param:
+   *  payload_size - Upon success contains size of the payload that follows.
+   * Return:
+   *  NO_ERROR on success, or an appropriate error status on failure.
+   */
+  virtual status_t receivePayloadSize(size_t* payload_size);
+
+  /* Receives a payload from the service straight into caller-provided
+   * buffers, filling them in order. This lets the caller read frames without
+   * an intermediate buffer.
+   * Param:
+   *  iov, iov_count - Buffers to receive the payload. Their total size must
+   *      match the size returned by receivePayloadSize(). Entries of the iov
+   *      array are updated as the buffers are filled.
+   * Return:
+   *  NO_ERROR on success, or an appropriate error status on failure.
+   */
+  virtual status_t receivePayload(struct iovec* iov, int iov_count);
+
   /* Sends a query, and receives a response from the service.
    * Param:
    *  query - Query to send to the service. When this method returns, the query
@@ -395,6 +419,8 @@ class CameraQemuClient : public QemuClient {
   status_t queryStop();
 
   /* Queries camera for the next video frame.
+   * Frames are received straight into the given buffers. The query text is
+   * only formatted again when its parameters change from the previous frame.
    * Param:
    *  vframe, vframe_size - Define buffer, allocated to receive a video frame.
    *      Any of these parameters can be 0, indicating that the caller is
@@ -426,6 +452,21 @@ class CameraQemuClient : public QemuClient {
   static const char mQueryStop[];
   /* Query frame(s). */
   static const char mQueryFrame[];
+
+  /****************************************************************************
+   * Frame query cache
+   ***************************************************************************/
+
+ private:
+  /* Text of the last frame query, including the zero-terminator. Zero size
+   * means there is no query yet. */
+  char mFrameQuery[256];
+  size_t mFrameQuerySize;
+  /* Parameters mFrameQuery was formatted with. */
+  size_t mFrameQueryVideoSize;
+  size_t mFrameQueryPreviewSize;
+  float mFrameQueryWhiteBalance[3];
+  float mFrameQueryExposureComp;
 };
 
 }; /* namespace android */
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "QemuClient.h"
+
+namespace {
+
+using android::CameraQemuClient;
+using android::NO_ERROR;
+
+// Stands in for the emulator's 'emulated camera' service on one end of a
+// socketpair. Frame replies are written in small chunks, so the client sees
+// the partial reads a pipe may return.
+class FakeCameraService {
+ public:
+  FakeCameraService()
+      : mFailFrames(false), mPadFailures(false), mShortFrames(false) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0) {
+      mClientFD = fds[0];
+      mServiceFD = fds[1];
+      mThread = std::thread(&FakeCameraService::serve, this);
+    } else {
+      mClientFD = mServiceFD = -1;
+    }
+  }
+
+  ~FakeCameraService() {
+    if (mServiceFD >= 0) {
+      // The service sees end of file once the client end is closed
+      shutdown(mServiceFD, SHUT_RD);
+      mThread.join();
+      close(mServiceFD);
+    }
+  }
+
+  // The client end, owned by whoever attaches to it
+  int getClientFD() const { return mClientFD; }
+
+  std::vector<std::string> getQueries() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mQueries;
+  }
+
+  // Reply 'ko' to frame queries
+  void setFailFrames(bool fail) { mFailFrames = fail; }
+  // Pad 'ko' replies to the size of a reply with the requested frames
+  void setPadFailures(bool pad) { mPadFailures = pad; }
+  // Reply to frame queries with one byte less than requested
+  void setShortFrames(bool shorten) { mShortFrames = shorten; }
+
+  // Byte i of a frame of the given size
+  static uint8_t framePattern(size_t size, size_t i) {
+    return static_cast<uint8_t>(size * 7 + i * 13 + (i >> 8));
+  }
+
+ private:
+  static const size_t kChunkSize = 4093;
+
+  void serve() {
+    std::string query;
+    char c;
+    while (read(mServiceFD, &c, 1) == 1) {
+      if (c != '\0') {
+        query.push_back(c);
+        continue;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueries.push_back(query);
+      }
+      reply(query);
+      query.clear();
+    }
+  }
+
+  void reply(const std::string& query) {
+    size_t video = 0, preview = 0;
+    if (sscanf(query.c_str(), "frame video=%zu preview=%zu", &video,
+               &preview) != 2) {
+      send(std::string("ok", 3));
+      return;
+    }
+    if (mFailFrames) {
+      std::string payload("ko:No frame", 12);
+      if (mPadFailures) payload.resize(3 + video + preview, '\0');
+      send(payload);
+      return;
+    }
+    std::string payload("ok:");
+    appendFrame(video, &payload);
+    appendFrame(preview, &payload);
+    if (mShortFrames) payload.resize(payload.size() - 1);
+    send(payload);
+  }
+
+  static void appendFrame(size_t size, std::string* payload) {
+    for (size_t i = 0; i < size; i++) {
+      payload->push_back(static_cast<char>(framePattern(size, i)));
+    }
+  }
+
+  void send(const std::string& payload) {
+    char size[9];
+    snprintf(size, sizeof(size), "%08zx", payload.size());
+    writeAll(size, 8);
+    for (size_t i = 0; i < payload.size(); i += kChunkSize) {
+      writeAll(payload.data() + i, std::min(kChunkSize, payload.size() - i));
+    }
+  }
+
+  void writeAll(const char* data, size_t size) {
+    while (size > 0) {
+      ssize_t written = write(mServiceFD, data, size);
+      if (written <= 0) return;
+      data += written;
+      size -= written;
+    }
+  }
+
+  int mClientFD;
+  int mServiceFD;
+  std::atomic<bool> mFailFrames;
+  std::atomic<bool> mPadFailures;
+  std::atomic<bool> mShortFrames;
+  std::thread mThread;
+  std::mutex mMutex;
+  std::vector<std::string> mQueries;
+};
+
+// Talks to the stand-in service instead of a qemu pipe
+class TestQemuClient : public CameraQemuClient {
+ public:
+  void attach(int fd) { mPipeFD = fd; }
+};
+
+class QemuClientTest : public ::testing::Test {
+ protected:
+  static const size_t kVideoSize = 640 * 480 * 3 / 2;
+  static const size_t kPreviewSize = 640 * 480 * 4;
+
+  void SetUp() {
+    ASSERT_GE(mService.getClientFD(), 0);
+    mClient.attach(mService.getClientFD());
+    mVideo.resize(kVideoSize);
+    mPreview.resize(kPreviewSize);
+  }
+
+  android::status_t queryFrame(float exposure_comp) {
+    return mClient.queryFrame(mVideo.data(), mPreview.data(), kVideoSize,
+                              kPreviewSize, 1.0f, 1.0f, 1.0f, exposure_comp);
+  }
+
+  static bool matchesPattern(const std::vector<uint8_t>& frame) {
+    for (size_t i = 0; i < frame.size(); i++) {
+      if (frame[i] != FakeCameraService::framePattern(frame.size(), i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  FakeCameraService mService;
+  TestQemuClient mClient;
+  std::vector<uint8_t> mVideo;
+  std::vector<uint8_t> mPreview;
+};
+
+TEST_F(QemuClientTest, FramesLandInCallerBuffers) {
+  ASSERT_EQ(NO_ERROR, mClient.queryStart(0, 640, 480));
+  for (int i = 0; i < 3; i++) {
+    std::fill(mVideo.begin(), mVideo.end(), 0);
+    std::fill(mPreview.begin(), mPreview.end(), 0);
+    ASSERT_EQ(NO_ERROR, queryFrame(0));
+    EXPECT_TRUE(matchesPattern(mVideo));
+    EXPECT_TRUE(matchesPattern(mPreview));
+  }
+  EXPECT_EQ(NO_ERROR, mClient.queryStop());
+}
+
+TEST_F(QemuClientTest, PreviewOnlyFrame) {
+  ASSERT_EQ(NO_ERROR, mClient.queryFrame(NULL, mPreview.data(), kVideoSize,
+                                         kPreviewSize, 1.0f, 1.0f, 1.0f, 0));
+  EXPECT_TRUE(matchesPattern(mPreview));
+  std::vector<std::string> queries = mService.getQueries();
+  ASSERT_EQ(1u, queries.size());
+  EXPECT_EQ(0u, queries[0].find("frame video=0 preview=1228800 "));
+}
+
+TEST_F(QemuClientTest, FrameQueryFollowsParameters) {
+  ASSERT_EQ(NO_ERROR, queryFrame(0));
+  ASSERT_EQ(NO_ERROR, queryFrame(0));
+  ASSERT_EQ(NO_ERROR, queryFrame(0.5f));
+  std::vector<std::string> queries = mService.getQueries();
+  ASSERT_EQ(3u, queries.size());
+  EXPECT_EQ(
+      "frame video=460800 preview=1228800 whiteb=1,1,1 expcomp=0",
+      queries[0]);
+  EXPECT_EQ(queries[0], queries[1]);
+  EXPECT_EQ(
+      "frame video=460800 preview=1228800 whiteb=1,1,1 expcomp=0.5",
+      queries[2]);
+}
+
+TEST_F(QemuClientTest, FailedFrameKeepsConnectionInSync) {
+  mService.setFailFrames(true);
+  EXPECT_NE(NO_ERROR, queryFrame(0));
+  mService.setFailFrames(false);
+  mService.setShortFrames(true);
+  EXPECT_NE(NO_ERROR, queryFrame(0));
+  mService.setShortFrames(false);
+  ASSERT_EQ(NO_ERROR, queryFrame(0));
+  EXPECT_TRUE(matchesPattern(mVideo));
+  EXPECT_TRUE(matchesPattern(mPreview));
+}
+
+TEST_F(QemuClientTest, FailureOfFrameSizeLeavesBuffersAlone) {
+  mService.setFailFrames(true);
+  mService.setPadFailures(true);
+  std::fill(mVideo.begin(), mVideo.end(), 0x5a);
+  std::fill(mPreview.begin(), mPreview.end(), 0x5a);
+  EXPECT_NE(NO_ERROR, queryFrame(0));
+  EXPECT_EQ(mVideo.end(), std::find_if(mVideo.begin(), mVideo.end(),
+                                       [](uint8_t b) { return b != 0x5a; }));
+  EXPECT_EQ(mPreview.end(),
+            std::find_if(mPreview.begin(), mPreview.end(),
+                         [](uint8_t b) { return b != 0x5a; }));
+  mService.setFailFrames(false);
+  ASSERT_EQ(NO_ERROR, queryFrame(0));
+  EXPECT_TRUE(matchesPattern(mVideo));
+  EXPECT_TRUE(matchesPattern(mPreview));
+}
+
+}  // namespace
@@ -20,12 +20,10 @@
 #define LOG_TAG "EmulatedCamera_Thumbnail"
 #include <cutils/log.h>
 #include <libexif/exif-data.h>
-#include <libyuv.h>
+#include <stdint.h>
 
 #include "JpegCompressor.h"
 
-#include <vector>
-
 /*
  * The NV21 format is a YUV format with an 8-bit Y-component and the U and V
  * components are stored as 8 bits each but they are shared between a block of
@@ -65,85 +63,174 @@
 
 namespace android {
 
-static bool createRawThumbnail(const unsigned char* sourceImage,
-                               int sourceWidth, int sourceHeight,
-                               int thumbnailWidth, int thumbnailHeight,
-                               std::vector<unsigned char>* thumbnail) {
-    // Deinterleave the U and V planes into separate planes, this is because
-    // libyuv requires the planes to be separate when scaling
-    const size_t sourceUVPlaneSize = (sourceWidth * sourceHeight) / 4;
-    // Put both U and V planes in one buffer, one after the other, to reduce
-    // memory fragmentation and number of allocations
-    std::vector<unsigned char> sourcePlanes(sourceUVPlaneSize * 2);
-    const unsigned char* ySourcePlane = sourceImage;
-    unsigned char* uSourcePlane = &sourcePlanes[0];
-    unsigned char* vSourcePlane = &sourcePlanes[sourceUVPlaneSize];
-
-    for (size_t i = 0; i < sourceUVPlaneSize; ++i) {
-        vSourcePlane[i] = sourceImage[sourceWidth * sourceHeight + i * 2 + 0];
-        uSourcePlane[i] = sourceImage[sourceWidth * sourceHeight + i * 2 + 1];
+// Weights of the bilinear filter are 8-bit fractions
+static const int kBilinearShift = 8;
+static const int kBilinearOne = 1 << kBilinearShift;
+
+// First source sample of each destination sample along one axis, for the box
+// filter. Entry |dstSize| is |srcSize|, so entries n and n + 1 bound the
+// footprint of destination sample n. Every footprint is at least one sample.
+static void boxSpans(int srcSize, int dstSize, uint32_t* spans) {
+    for (int i = 0; i <= dstSize; ++i) {
+        spans[i] = static_cast<uint32_t>(
+                static_cast<int64_t>(i) * srcSize / dstSize);
     }
+}
 
-    // Create enough space in the output vector for the result
-    thumbnail->resize((thumbnailWidth * thumbnailHeight * 12) / 8);
-
-    // The downscaled U and V planes will also be linear instead of interleaved,
-    // allocate space for them here
-    const size_t destUVPlaneSize = (thumbnailWidth * thumbnailHeight) / 4;
-    std::vector<unsigned char> destPlanes(destUVPlaneSize * 2);
-    unsigned char* yDestPlane = &(*thumbnail)[0];
-    unsigned char* uDestPlane = &destPlanes[0];
-    unsigned char* vDestPlane = &destPlanes[destUVPlaneSize];
-
-    // The strides for the U and V planes are half the width because the U and V
-    // components are common to 2x2 pixel blocks
-    int result = libyuv::I420Scale(ySourcePlane, sourceWidth,
-                                   uSourcePlane, sourceWidth / 2,
-                                   vSourcePlane, sourceWidth / 2,
-                                   sourceWidth, sourceHeight,
-                                   yDestPlane, thumbnailWidth,
-                                   uDestPlane, thumbnailWidth / 2,
-                                   vDestPlane, thumbnailWidth / 2,
-                                   thumbnailWidth, thumbnailHeight,
-                                   libyuv::kFilterBilinear);
-    if (result != 0) {
-        ALOGE("Unable to create thumbnail, downscaling failed with error: %d",
-              result);
-        return false;
+// Bilinear tap of destination sample |i| along one axis, with sample centres
+// aligned: the first source sample in the high bits, and the weight of the
+// one after it in the low kBilinearShift bits.
+static uint32_t bilinearTap(int srcSize, int dstSize, int i) {
+    int64_t pos = ((2 * static_cast<int64_t>(i) + 1) * srcSize
+                   << kBilinearShift) / (2 * dstSize) - kBilinearOne / 2;
+    if (pos < 0) pos = 0;
+    uint32_t index = static_cast<uint32_t>(pos >> kBilinearShift);
+    uint32_t weight = static_cast<uint32_t>(pos) & (kBilinearOne - 1);
+    if (index >= static_cast<uint32_t>(srcSize - 1)) {
+        // Past the last sample centre there is nothing to blend with
+        index = srcSize - 1;
+        weight = 0;
+    }
+    return (index << kBilinearShift) | weight;
+}
+
+// Average every source sample under each destination sample. |channels|
+// samples are interleaved per pixel, 1 for luma and 2 for NV21 chroma.
+// |scratch| holds dstWidth + 1 span entries and dstWidth * channels sums.
+static void boxScalePlane(const unsigned char* src, int srcWidth, int srcHeight,
+                          unsigned char* dst, int dstWidth, int dstHeight,
+                          int channels, uint32_t* scratch) {
+    uint32_t* spans = scratch;
+    uint32_t* sums = scratch + dstWidth + 1;
+    const int srcStride = srcWidth * channels;
+    const int dstStride = dstWidth * channels;
+    boxSpans(srcWidth, dstWidth, spans);
+
+    for (int dy = 0; dy < dstHeight; ++dy) {
+        const int y0 = static_cast<int64_t>(dy) * srcHeight / dstHeight;
+        const int y1 = static_cast<int64_t>(dy + 1) * srcHeight / dstHeight;
+        for (int i = 0; i < dstStride; ++i) {
+            sums[i] = 0;
+        }
+        for (int sy = y0; sy < y1; ++sy) {
+            const unsigned char* row = src + sy * srcStride;
+            for (int dx = 0; dx < dstWidth; ++dx) {
+                for (int c = 0; c < channels; ++c) {
+                    uint32_t sum = 0;
+                    for (uint32_t sx = spans[dx]; sx < spans[dx + 1]; ++sx) {
+                        sum += row[sx * channels + c];
+                    }
+                    sums[dx * channels + c] += sum;
+                }
+            }
+        }
+        unsigned char* out = dst + dy * dstStride;
+        for (int dx = 0; dx < dstWidth; ++dx) {
+            const uint32_t area = (spans[dx + 1] - spans[dx]) * (y1 - y0);
+            for (int c = 0; c < channels; ++c) {
+                out[dx * channels + c] =
+                        (sums[dx * channels + c] + area / 2) / area;
+            }
+        }
+    }
+}
+
+// Interpolate between the four source samples nearest to each destination
+// sample. |scratch| holds dstWidth column taps.
+static void bilinearScalePlane(const unsigned char* src, int srcWidth,
+                               int srcHeight, unsigned char* dst, int dstWidth,
+                               int dstHeight, int channels, uint32_t* scratch) {
+    uint32_t* taps = scratch;
+    const int srcStride = srcWidth * channels;
+    for (int dx = 0; dx < dstWidth; ++dx) {
+        taps[dx] = bilinearTap(srcWidth, dstWidth, dx);
+    }
+
+    const uint32_t round = 1 << (2 * kBilinearShift - 1);
+    for (int dy = 0; dy < dstHeight; ++dy) {
+        const uint32_t rowTap = bilinearTap(srcHeight, dstHeight, dy);
+        const uint32_t fy = rowTap & (kBilinearOne - 1);
+        const unsigned char* top = src + (rowTap >> kBilinearShift) * srcStride;
+        const unsigned char* bottom = fy ? top + srcStride : top;
+        unsigned char* out = dst + dy * dstWidth * channels;
+        for (int dx = 0; dx < dstWidth; ++dx) {
+            const uint32_t fx = taps[dx] & (kBilinearOne - 1);
+            const uint32_t x0 = (taps[dx] >> kBilinearShift) * channels;
+            const uint32_t x1 = fx ? x0 + channels : x0;
+            for (int c = 0; c < channels; ++c) {
+                const uint32_t upper = top[x0 + c] * (kBilinearOne - fx) +
+                                       top[x1 + c] * fx;
+                const uint32_t lower = bottom[x0 + c] * (kBilinearOne - fx) +
+                                       bottom[x1 + c] * fx;
+                out[dx * channels + c] =
+                        (upper * (kBilinearOne - fy) + lower * fy + round) >>
+                        (2 * kBilinearShift);
+            }
+        }
     }
+}
+
+size_t getNV21ScaleScratchSize(int dstWidth) {
+    // Span table and sums of the box filter, the larger of the two filters
+    return (2 * static_cast<size_t>(dstWidth) + 1) * sizeof(uint32_t);
+}
 
-    // Now we need to interleave the downscaled U and V planes into the
-    // output buffer to make it NV21 encoded
-    const size_t uvPlanesOffset = thumbnailWidth * thumbnailHeight;
-    for (size_t i = 0; i < destUVPlaneSize; ++i) {
-        (*thumbnail)[uvPlanesOffset + i * 2 + 0] = vDestPlane[i];
-        (*thumbnail)[uvPlanesOffset + i * 2 + 1] = uDestPlane[i];
+bool scaleNV21(const unsigned char* src, int srcWidth, int srcHeight,
+               unsigned char* dst, int dstWidth, int dstHeight, void* scratch) {
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0 ||
+        (srcWidth | srcHeight | dstWidth | dstHeight) & 1) {
+        ALOGE("%s: Cannot scale %dx%d to %dx%d", __FUNCTION__, srcWidth,
+              srcHeight, dstWidth, dstHeight);
+        return false;
     }
 
+    const bool box = srcWidth >= 2 * dstWidth && srcHeight >= 2 * dstHeight;
+    void (*scalePlane)(const unsigned char*, int, int, unsigned char*, int,
+                       int, int, uint32_t*) =
+            box ? boxScalePlane : bilinearScalePlane;
+    uint32_t* words = static_cast<uint32_t*>(scratch);
+    // Luma, then the interleaved V/U pairs of each 2x2 block as one plane
+    scalePlane(src, srcWidth, srcHeight, dst, dstWidth, dstHeight, 1, words);
+    scalePlane(src + srcWidth * srcHeight, srcWidth / 2, srcHeight / 2,
+               dst + dstWidth * dstHeight, dstWidth / 2, dstHeight / 2, 2,
+               words);
     return true;
 }
 
 bool createThumbnail(const unsigned char* sourceImage,
                      int sourceWidth, int sourceHeight,
                      int thumbWidth, int thumbHeight, int quality,
-                     ExifData* exifData) {
+                     ExifData* exifData, std::vector<unsigned char>* buffer) {
     if (thumbWidth <= 0 || thumbHeight <= 0) {
         ALOGE("%s: Invalid thumbnail width=%d or height=%d, must be > 0",
               __FUNCTION__, thumbWidth, thumbHeight);
         return false;
     }
 
-    // First downscale the source image into a thumbnail-sized raw image
-    std::vector<unsigned char> rawThumbnail;
-    if (!createRawThumbnail(sourceImage, sourceWidth, sourceHeight,
-                            thumbWidth, thumbHeight, &rawThumbnail)) {
-        // The thumbnail function will log an appropriate error if needed
+    // First downscale the source image into a thumbnail-sized raw image. The
+    // scratch words go first so that they are aligned.
+    const size_t scratchSize = getNV21ScaleScratchSize(thumbWidth);
+    const size_t thumbSize = (thumbWidth * thumbHeight * 12) / 8;
+    if (buffer->size() < scratchSize + thumbSize) {
+        buffer->resize(scratchSize + thumbSize);
+    }
+    unsigned char* rawThumbnail = buffer->data() + scratchSize;
+    if (!scaleNV21(sourceImage, sourceWidth, sourceHeight, rawThumbnail,
+                   thumbWidth, thumbHeight, buffer->data())) {
+        // The scaling function will log an appropriate error if needed
         return false;
     }
 
-    // And then compress it into JPEG format without any EXIF data
+    return compressThumbnail(rawThumbnail, thumbWidth, thumbHeight, quality,
+                             exifData);
+}
+
+bool compressThumbnail(const unsigned char* thumbnail,
+                       int thumbWidth, int thumbHeight, int quality,
+                       ExifData* exifData) {
+    // Compress it into JPEG format without any EXIF data
     NV21JpegCompressor compressor;
-    status_t result = compressor.compressRawImage(&rawThumbnail[0],
+    status_t result = compressor.compressRawImage(thumbnail,
                                                   nullptr /* EXIF */,
                                                   quality, thumbWidth, thumbHeight);
     if (result != NO_ERROR) {
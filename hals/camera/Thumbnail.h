@@ -17,19 +17,46 @@
 #ifndef GOLDFISH_CAMERA_THUMBNAIL_H
 #define GOLDFISH_CAMERA_THUMBNAIL_H
 
+#include <stddef.h>
+
+#include <vector>
+
 struct _ExifData;
 typedef struct _ExifData ExifData;
 
 namespace android {
 
+/* Bytes of scratch memory scaleNV21 needs for a destination |dstWidth| wide.
+ */
+size_t getNV21ScaleScratchSize(int dstWidth);
+
+/* Downscale the NV21 image in |src| into the NV21 image |dst|, working on the
+ * interleaved chroma directly. Shrinking by 2x or more in both directions
+ * averages every source pixel (box filter), smaller ratios interpolate
+ * (bilinear). |scratch| must hold getNV21ScaleScratchSize(dstWidth) bytes and
+ * be suitably aligned for uint32_t; no memory is allocated. All dimensions
+ * must be even.
+ */
+bool scaleNV21(const unsigned char* src, int srcWidth, int srcHeight,
+               unsigned char* dst, int dstWidth, int dstHeight, void* scratch);
+
 /* Create a thumbnail from NV21 source data in |sourceImage| with the given
  * dimensions. The resulting thumbnail is JPEG compressed and a pointer and size
  * is placed in |exifData| which takes ownership of the allocated memory.
+ * |buffer| holds the raw thumbnail and scaling scratch memory; it only grows,
+ * so reusing it across calls avoids allocating for every thumbnail.
  */
 bool createThumbnail(const unsigned char* sourceImage,
                      int sourceWidth, int sourceHeight,
                      int thumbnailWidth, int thumbnailHeight, int quality,
-                     ExifData* exifData);
+                     ExifData* exifData, std::vector<unsigned char>* buffer);
+
+/* Compress an NV21 image already at thumbnail size into |exifData|, as
+ * createThumbnail does.
+ */
+bool compressThumbnail(const unsigned char* thumbnail,
+                       int thumbnailWidth, int thumbnailHeight, int quality,
+                       ExifData* exifData);
 
 }  // namespace android
 
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Thumbnail.h"
+
+namespace {
+
+// An NV21 image; chroma coordinates address the 2x2 blocks
+class NV21Image {
+ public:
+  NV21Image(int width, int height)
+      : width_(width), height_(height), data_(width * height * 3 / 2) {}
+
+  unsigned char* data() { return data_.data(); }
+  const unsigned char* data() const { return data_.data(); }
+
+  unsigned char& y(int x, int y) { return data_[y * width_ + x]; }
+  unsigned char& v(int x, int y) { return chroma(x, y)[0]; }
+  unsigned char& u(int x, int y) { return chroma(x, y)[1]; }
+
+ private:
+  unsigned char* chroma(int x, int y) {
+    return &data_[width_ * height_ + (y * (width_ / 2) + x) * 2];
+  }
+
+  int width_;
+  int height_;
+  std::vector<unsigned char> data_;
+};
+
+NV21Image scale(const NV21Image& src, int srcWidth, int srcHeight,
+                int dstWidth, int dstHeight) {
+  NV21Image dst(dstWidth, dstHeight);
+  std::vector<uint32_t> scratch(
+      android::getNV21ScaleScratchSize(dstWidth) / sizeof(uint32_t));
+  EXPECT_TRUE(android::scaleNV21(src.data(), srcWidth, srcHeight, dst.data(),
+                                 dstWidth, dstHeight, scratch.data()));
+  return dst;
+}
+
+TEST(ScaleNV21Test, BoxFilterAveragesWholeFootprint) {
+  // 4x shrink horizontally, 2x vertically
+  NV21Image src(8, 4);
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 8; x++) src.y(x, y) = 10 * x + 40 * y;
+  }
+  for (int y = 0; y < 2; y++) {
+    for (int x = 0; x < 4; x++) {
+      src.v(x, y) = 16 * (x + 4 * y);
+      src.u(x, y) = 255 - 16 * (x + 4 * y);
+    }
+  }
+
+  NV21Image dst = scale(src, 8, 4, 2, 2);
+  EXPECT_EQ(35, dst.y(0, 0));
+  EXPECT_EQ(75, dst.y(1, 0));
+  EXPECT_EQ(115, dst.y(0, 1));
+  EXPECT_EQ(155, dst.y(1, 1));
+  // The single chroma block averages all eight source blocks
+  EXPECT_EQ(56, dst.v(0, 0));
+  EXPECT_EQ(199, dst.u(0, 0));
+}
+
+TEST(ScaleNV21Test, ExactlyHalfSizeUsesBoxFilterAndRoundsHalfUp) {
+  NV21Image src(4, 4);
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 4; x++) src.y(x, y) = 10 * (y * 4 + x);
+  }
+  const unsigned char v[] = {10, 20, 30, 41};
+  const unsigned char u[] = {200, 201, 202, 203};
+  for (int i = 0; i < 4; i++) {
+    src.v(i % 2, i / 2) = v[i];
+    src.u(i % 2, i / 2) = u[i];
+  }
+
+  NV21Image dst = scale(src, 4, 4, 2, 2);
+  EXPECT_EQ(25, dst.y(0, 0));
+  EXPECT_EQ(45, dst.y(1, 0));
+  EXPECT_EQ(105, dst.y(0, 1));
+  EXPECT_EQ(125, dst.y(1, 1));
+  // 25.25 and 201.5
+  EXPECT_EQ(25, dst.v(0, 0));
+  EXPECT_EQ(202, dst.u(0, 0));
+}
+
+TEST(ScaleNV21Test, JustUnderHalfSizeInterpolates) {
+  // 2x horizontally but only 1.5x vertically, so the bilinear filter runs.
+  // Box filtering would give rows 0, 1.5, 3 and 4.5 rather than 0.25, 1.75,
+  // 3.25 and 4.75.
+  NV21Image src(8, 6);
+  for (int y = 0; y < 6; y++) {
+    for (int x = 0; x < 8; x++) src.y(x, y) = 10 * x + 20 * y;
+  }
+  for (int y = 0; y < 3; y++) {
+    for (int x = 0; x < 4; x++) {
+      src.v(x, y) = 20 * x + 40 * y;
+      src.u(x, y) = 250 - 20 * x - 40 * y;
+    }
+  }
+
+  NV21Image dst = scale(src, 8, 6, 4, 4);
+  EXPECT_EQ(10, dst.y(0, 0));
+  EXPECT_EQ(70, dst.y(3, 0));
+  EXPECT_EQ(40, dst.y(0, 1));
+  EXPECT_EQ(70, dst.y(0, 2));
+  EXPECT_EQ(160, dst.y(3, 3));
+  // The last chroma row and column blend in the bottom and right edge blocks
+  EXPECT_EQ(20, dst.v(0, 0));
+  EXPECT_EQ(60, dst.v(1, 0));
+  EXPECT_EQ(80, dst.v(0, 1));
+  EXPECT_EQ(120, dst.v(1, 1));
+  EXPECT_EQ(230, dst.u(0, 0));
+  EXPECT_EQ(130, dst.u(1, 1));
+}
+
+TEST(ScaleNV21Test, OddChromaPlaneClampsAtEdges) {
+  // The 3x3 chroma plane has a centre sample on the middle row and column,
+  // and its last row and column sit past the last source block centres.
+  NV21Image src(4, 4);
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 4; x++) src.y(x, y) = 10 * (y * 4 + x);
+  }
+  const unsigned char v[] = {10, 50, 90, 130};
+  for (int i = 0; i < 4; i++) {
+    src.v(i % 2, i / 2) = v[i];
+    src.u(i % 2, i / 2) = 255 - v[i];
+  }
+
+  NV21Image dst = scale(src, 4, 4, 6, 6);
+  EXPECT_EQ(0, dst.y(0, 0));
+  EXPECT_EQ(30, dst.y(5, 0));
+  EXPECT_EQ(120, dst.y(0, 5));
+  EXPECT_EQ(150, dst.y(5, 5));
+  EXPECT_EQ(10, dst.v(0, 0));
+  EXPECT_EQ(30, dst.v(1, 0));
+  EXPECT_EQ(50, dst.v(2, 0));
+  EXPECT_EQ(70, dst.v(1, 1));
+  EXPECT_EQ(90, dst.v(2, 1));
+  EXPECT_EQ(90, dst.v(0, 2));
+  EXPECT_EQ(110, dst.v(1, 2));
+  EXPECT_EQ(130, dst.v(2, 2));
+  EXPECT_EQ(125, dst.u(2, 2));
+}
+
+TEST(ScaleNV21Test, StaysWithinScratchSize) {
+  const int kDstWidth = 6;
+  const size_t scratchSize = android::getNV21ScaleScratchSize(kDstWidth);
+  const size_t kCanarySize = 64;
+  // uint32_t words keep the scratch aligned
+  std::vector<uint32_t> scratch(
+      (scratchSize + kCanarySize) / sizeof(uint32_t));
+  unsigned char* bytes = reinterpret_cast<unsigned char*>(scratch.data());
+  memset(bytes, 0xa5, scratchSize + kCanarySize);
+
+  // Box filtered, the filter with the larger scratch
+  NV21Image src(12, 12);
+  for (int y = 0; y < 6; y++) {
+    for (int x = 0; x < 6; x++) {
+      src.v(x, y) = 10 * (x + y);
+      src.u(x, y) = 200 - 10 * (x + y);
+    }
+  }
+  NV21Image dst(kDstWidth, 6);
+  ASSERT_TRUE(android::scaleNV21(src.data(), 12, 12, dst.data(), kDstWidth, 6,
+                                 scratch.data()));
+  for (size_t i = scratchSize; i < scratchSize + kCanarySize; i++) {
+    ASSERT_EQ(0xa5, bytes[i]) << "at byte " << i;
+  }
+  // The bottom right chroma block averages source blocks (4, 4) to (5, 5)
+  EXPECT_EQ(90, dst.v(2, 2));
+  EXPECT_EQ(110, dst.u(2, 2));
+}
+
+TEST(ScaleNV21Test, RejectsOddDimensions) {
+  NV21Image src(6, 6);
+  NV21Image dst(4, 4);
+  memset(dst.data(), 0x5a, 4 * 4 * 3 / 2);
+  std::vector<uint32_t> scratch(
+      android::getNV21ScaleScratchSize(4) / sizeof(uint32_t));
+  EXPECT_FALSE(android::scaleNV21(src.data(), 5, 6, dst.data(), 4, 4,
+                                  scratch.data()));
+  EXPECT_FALSE(android::scaleNV21(src.data(), 6, 5, dst.data(), 4, 4,
+                                  scratch.data()));
+  EXPECT_FALSE(android::scaleNV21(src.data(), 6, 6, dst.data(), 3, 4,
+                                  scratch.data()));
+  EXPECT_FALSE(android::scaleNV21(src.data(), 6, 6, dst.data(), 4, 0,
+                                  scratch.data()));
+  for (int i = 0; i < 4 * 4 * 3 / 2; i++) ASSERT_EQ(0x5a, dst.data()[i]);
+}
+
+}  // namespace
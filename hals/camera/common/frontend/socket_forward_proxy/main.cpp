@@ -14,18 +14,27 @@
  * limitations under the License.
  */
 
+#include <cerrno>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <list>
 #include <memory>
-#include <mutex>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 #include <glog/logging.h>
 #include <gflags/gflags.h>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "common/libs/fs/shared_fd.h"
@@ -37,7 +46,6 @@
 #include "host/libs/adb_connection_maintainer/adb_connection_maintainer.h"
 #endif
 
-using vsoc::socket_forward::Packet;
 using vsoc::socket_forward::SocketForwardRegionView;
 
 #ifdef CUTTLEFISH_HOST
@@ -48,113 +56,159 @@ DEFINE_string(host_ports, "",
               "Comma-separated list of ports on which to run TCP servers on "
               "the host.");
 #endif
+DEFINE_int32(signal_batching_us, 0,
+             "While the other side signals the region faster than this, "
+             "wait up to this long for more signals before handling them.");
+DEFINE_int32(signal_stats_interval_s, 300,
+             "How often to log the region's signal counters, 0 for never.");
 
 namespace {
-// Sends packets, Shutdown(SHUT_WR) on destruction
-class SocketSender {
+// Every connection is served by the main thread, which multiplexes the
+// sockets and the shm queues with epoll, so the number of threads doesn't
+// grow with the number of connections. The region's worker thread wakes the
+// loop through an eventfd whenever the other side signals the region.
+constexpr int kMaxEvents = 16;
+// How often to retry what can't be noticed through a socket or a signal
+constexpr std::chrono::milliseconds kRetryInterval{1000};
+
+bool WouldBlock(int error) { return error == EAGAIN || error == EWOULDBLOCK; }
+
+// Something with an fd in the epoll set
+class EventHandler {
  public:
-  explicit SocketSender(cvd::SharedFD socket) : socket_{std::move(socket)} {}
-
-  SocketSender(SocketSender&&) = default;
-  SocketSender& operator=(SocketSender&&) = default;
-
-  SocketSender(const SocketSender&&) = delete;
-  SocketSender& operator=(const SocketSender&) = delete;
-
-  ~SocketSender() {
-    if (socket_.operator->()) {  // check that socket_ was not moved-from
-      socket_->Shutdown(SHUT_WR);
-    }
-  }
+  virtual ~EventHandler() = default;
+  virtual void OnEvent(uint32_t events) = 0;
+};
 
-  ssize_t SendAll(const Packet& packet) {
-    ssize_t written{};
-    while (written < static_cast<ssize_t>(packet.payload_length())) {
-      if (!socket_->IsOpen()) {
-        return -1;
-      }
-      auto just_written =
-          socket_->Send(packet.payload() + written,
-                        packet.payload_length() - written, MSG_NOSIGNAL);
-      if (just_written <= 0) {
-        LOG(INFO) << "Couldn't write to client: "
-                  << strerror(socket_->GetErrno());
-        return just_written;
-      }
-      written += just_written;
-    }
-    return written;
+// Adds fd to the epoll set, changes the events it is watched for, or removes
+// it if events is 0. watched holds the events it is currently watched for.
+void Watch(cvd::SharedFD epoll, cvd::SharedFD fd, EventHandler* handler,
+           uint32_t events, uint32_t* watched) {
+  if (events == *watched) {
+    return;
   }
+  epoll_event event{};
+  event.events = events;
+  event.data.ptr = handler;
+  int op = !*watched ? EPOLL_CTL_ADD : events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+  CHECK_EQ(epoll->EpollCtl(op, fd, &event), 0)
+      << "epoll_ctl failed: " << epoll->StrError();
+  *watched = events;
+}
 
- private:
-  cvd::SharedFD socket_;
-};
-
-class SocketReceiver {
+// Forwards a socket over an shm connection in both directions. Nothing
+// blocks: each direction moves data until one of its ends would block, then
+// waits for the socket to become readable or writable, or for the other side
+// to signal the region. The payloads are received straight into, and sent
+// straight out of, the shm queues.
+class ForwardedConnection : public EventHandler {
  public:
-  explicit SocketReceiver(cvd::SharedFD socket) : socket_{std::move(socket)} {}
-
-  SocketReceiver(SocketReceiver&&) = default;
-  SocketReceiver& operator=(SocketReceiver&&) = default;
-
-  SocketReceiver(const SocketReceiver&&) = delete;
-  SocketReceiver& operator=(const SocketReceiver&) = delete;
+  ForwardedConnection(
+      cvd::SharedFD epoll, cvd::SharedFD socket,
+      std::unique_ptr<SocketForwardRegionView::Connection> shm)
+      : epoll_{std::move(epoll)},
+        socket_{std::move(socket)},
+        shm_{std::move(shm)} {}
+
+  ForwardedConnection(const ForwardedConnection&) = delete;
+  ForwardedConnection& operator=(const ForwardedConnection&) = delete;
+
+  ~ForwardedConnection() { Watch(epoll_, socket_, this, 0, &watched_); }
+
+  void OnEvent(uint32_t) override { Pump(); }
+
+  // Moves as much data as it can without blocking, in both directions.
+  void Pump() {
+    wanted_ = 0;
+    PumpSocketToShm();
+    PumpShmToSocket();
+    Watch(epoll_, socket_, this, done() ? 0 : wanted_, &watched_);
+  }
 
-  // *packet will be empty if Read returns 0 or error
-  void Recv(Packet* packet) {
-    auto size = socket_->Read(packet->payload(), sizeof packet->payload());
-    if (size < 0) {
-      size = 0;
-    }
-    packet->set_payload_length(size);
+  // Both directions are closed, the connection may be destroyed
+  bool done() const {
+    return to_shm_ == State::CLOSED && to_socket_ == State::CLOSED;
   }
 
  private:
-  cvd::SharedFD socket_;
-};
-
-void SocketToShm(SocketReceiver socket_receiver,
-                 SocketForwardRegionView::Sender shm_sender) {
-  auto packet = Packet::MakeData();
-  while (true) {
-    socket_receiver.Recv(&packet);
-    if (packet.empty()) {
-      break;
+  enum class State { OPEN, CLOSING, CLOSED };
+
+  void PumpSocketToShm() {
+    while (to_shm_ == State::OPEN) {
+      bool would_block = false;
+      auto fill = [this, &would_block](const iovec* iov, int iov_count) {
+        msghdr msg{};
+        msg.msg_iov = const_cast<iovec*>(iov);
+        msg.msg_iovlen = iov_count;
+        auto received = socket_->RecvMsg(&msg, MSG_DONTWAIT);
+        would_block = received < 0 && WouldBlock(socket_->GetErrno());
+        return received;
+      };
+      auto sent = shm_->Send(fill);
+      if (sent == -EWOULDBLOCK) {
+        // The queue is full, leave the data in the socket until the other
+        // side signals that it made room
+        return;
+      }
+      if (would_block) {
+        wanted_ |= EPOLLIN;
+        return;
+      }
+      if (sent <= 0) {
+        LOG(INFO) << "Socket to shm exiting";
+        to_shm_ = State::CLOSING;
+      }
     }
-    if (!shm_sender.Send(packet)) {
-      break;
+    if (to_shm_ == State::CLOSING && shm_->CloseSend() == 0) {
+      to_shm_ = State::CLOSED;
     }
   }
-  LOG(INFO) << "Socket to shm exiting";
-}
 
-void ShmToSocket(SocketSender socket_sender,
-                 SocketForwardRegionView::Receiver shm_receiver) {
-  Packet packet{};
-  while (true) {
-    shm_receiver.Recv(&packet);
-    if (packet.IsEnd()) {
-      break;
+  void PumpShmToSocket() {
+    while (to_socket_ == State::OPEN) {
+      bool would_block = false;
+      auto drain = [this, &would_block](const iovec* iov, int iov_count) {
+        msghdr msg{};
+        msg.msg_iov = const_cast<iovec*>(iov);
+        msg.msg_iovlen = iov_count;
+        auto sent = socket_->SendMsg(&msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        would_block = sent < 0 && WouldBlock(socket_->GetErrno());
+        return sent;
+      };
+      auto received = shm_->Recv(drain);
+      if (received == -EWOULDBLOCK) {
+        return;
+      }
+      if (would_block) {
+        // What the socket didn't take stays in the queue
+        wanted_ |= EPOLLOUT;
+        return;
+      }
+      if (received < 0 || shm_->recv_ended()) {
+        if (received < 0) {
+          LOG(INFO) << "Couldn't write to client: "
+                    << strerror(socket_->GetErrno());
+        }
+        LOG(INFO) << "Shm to socket exiting";
+        socket_->Shutdown(SHUT_WR);
+        to_socket_ = State::CLOSING;
+      }
     }
-    if (socket_sender.SendAll(packet) < 0) {
-      break;
+    if (to_socket_ == State::CLOSING && shm_->CloseRecv() == 0) {
+      to_socket_ = State::CLOSED;
     }
   }
-  LOG(INFO) << "Shm to socket exiting";
-}
 
-// One thread for reading from shm and writing into a socket.
-// One thread for reading from a socket and writing into shm.
-void LaunchWorkers(std::pair<SocketForwardRegionView::Sender,
-                             SocketForwardRegionView::Receiver>
-                       conn,
-                   cvd::SharedFD socket) {
-  // TODO create the SocketSender/Receiver in their respective threads?
-  std::thread(
-      SocketToShm, SocketReceiver{socket}, std::move(conn.first)).detach();
-  std::thread(
-      ShmToSocket, SocketSender{socket}, std::move(conn.second)).detach();
-}
+  cvd::SharedFD epoll_;
+  cvd::SharedFD socket_;
+  std::unique_ptr<SocketForwardRegionView::Connection> shm_;
+  State to_shm_ = State::OPEN;
+  State to_socket_ = State::OPEN;
+  // The socket events the directions are waiting for, and the ones in the
+  // epoll set
+  uint32_t wanted_{};
+  uint32_t watched_{};
+};
 
 #ifdef CUTTLEFISH_HOST
 struct PortPair {
@@ -166,38 +220,6 @@ void LaunchConnectionMaintainer(int port) {
   std::thread(cvd::EstablishAndMaintainConnection, port).detach();
 }
 
-
-[[noreturn]] void host_impl(SocketForwardRegionView* shm,
-                            std::vector<PortPair> ports, std::size_t index) {
-  // launch a worker for the following port before handling the current port.
-  // recursion (instead of a loop) removes the need fore any join() or having
-  // the main thread do no work.
-  if (index + 1 < ports.size()) {
-    std::thread(host_impl, shm, ports, index + 1).detach();
-  }
-  auto guest_port = ports[index].guest_port;
-  auto host_port = ports[index].host_port;
-  LOG(INFO) << "starting server on " << host_port
-            << " for guest port " << guest_port;
-  auto server = cvd::SharedFD::SocketLocalServer(host_port, SOCK_STREAM);
-  CHECK(server->IsOpen()) << "Could not start server on port " << host_port;
-  LaunchConnectionMaintainer(host_port);
-  while (true) {
-    auto client_socket = cvd::SharedFD::Accept(*server);
-    CHECK(client_socket->IsOpen()) << "error creating client socket";
-    LOG(INFO) << "client socket accepted";
-    auto conn = shm->OpenConnection(guest_port);
-    LOG(INFO) << "shm connection opened";
-    LaunchWorkers(std::move(conn), std::move(client_socket));
-  }
-}
-
-[[noreturn]] void host(SocketForwardRegionView* shm,
-                       std::vector<PortPair> ports) {
-  CHECK(!ports.empty());
-  host_impl(shm, ports, 0);
-}
-
 std::vector<PortPair> ParsePortsList(const std::string& guest_ports_str,
                                 const std::string& host_ports_str) {
   std::vector<PortPair> ports{};
@@ -210,33 +232,205 @@ std::vector<PortPair> ParsePortsList(const std::string& guest_ports_str,
   return ports;
 
 }
+#endif
+
+// The event loop. Its own events come from the eventfd the region's worker
+// signals.
+class Forwarder : public EventHandler {
+ public:
+  explicit Forwarder(SocketForwardRegionView* shm)
+      : shm_{shm},
+        epoll_{cvd::SharedFD::Epoll()},
+        signal_event_{cvd::SharedFD::Event(0, EFD_NONBLOCK)} {
+    CHECK(epoll_->IsOpen()) << "epoll_create failed: " << epoll_->StrError();
+    CHECK(signal_event_->IsOpen())
+        << "eventfd failed: " << signal_event_->StrError();
+    Watch(epoll_, signal_event_, this, EPOLLIN, &signal_watched_);
+  }
+
+  // To be passed to RegionView::SetSignalEventFd()
+  cvd::SharedFD signal_event() const { return signal_event_; }
+
+#ifdef CUTTLEFISH_HOST
+  void Listen(const PortPair& ports) {
+    LOG(INFO) << "starting server on " << ports.host_port
+              << " for guest port " << ports.guest_port;
+    auto server =
+        cvd::SharedFD::SocketLocalServer(ports.host_port, SOCK_STREAM);
+    CHECK(server->IsOpen())
+        << "Could not start server on port " << ports.host_port;
+    LaunchConnectionMaintainer(ports.host_port);
+    listeners_.emplace_back(new Listener(this, server, ports.guest_port));
+    listeners_.back()->Watch(unforwarded_.empty());
+  }
+#endif
+
+  [[noreturn]] void Run() {
+    LOG(INFO) << "Starting mainloop";
+    auto last_retry = std::chrono::steady_clock::now();
+    auto last_stats = last_retry;
+    epoll_event events[kMaxEvents];
+    while (true) {
+      int count =
+          epoll_->EpollWait(events, kMaxEvents, kRetryInterval.count());
+      CHECK(count >= 0 || epoll_->GetErrno() == EINTR)
+          << "epoll_wait failed: " << epoll_->StrError();
+      for (int i = 0; i < count; ++i) {
+        static_cast<EventHandler*>(events[i].data.ptr)
+            ->OnEvent(events[i].events);
+      }
+      auto now = std::chrono::steady_clock::now();
+      if (now - last_retry >= kRetryInterval) {
+        last_retry = now;
+        Retry();
+      }
+      if (FLAGS_signal_stats_interval_s > 0 &&
+          now - last_stats >=
+              std::chrono::seconds(FLAGS_signal_stats_interval_s)) {
+        last_stats = now;
+        LogSignalStats();
+      }
+      // Only destroyed here, as later events in the batch may point to them
+      connections_.remove_if(
+          [](const std::unique_ptr<ForwardedConnection>& connection) {
+            return connection->done();
+          });
+    }
+  }
 
+  // The other side signaled the region: any queue may have changed.
+  void OnEvent(uint32_t) override {
+    uint64_t signals{};
+    signal_event_->Read(&signals, sizeof signals);
+    PumpAll();
+#ifndef CUTTLEFISH_HOST
+    bool accepted = false;
+    while (auto shm = shm_->TryAcceptConnection()) {
+      LOG(INFO) << "shm connection accepted";
+      unconnected_.push_back(std::move(shm));
+      accepted = true;
+    }
+    if (accepted) {
+      ConnectSockets();
+    }
+#endif
+  }
+
+ private:
+  void LogSignalStats() {
+    auto stats = shm_->GetSignalStats();
+    LOG(INFO) << "signals sent: " << stats.signals_sent
+              << ", interrupts raised: " << stats.interrupts_raised
+              << ", collisions: " << stats.collisions
+              << ", table scans: " << stats.scans
+              << ", nodes scanned: " << stats.nodes_scanned;
+  }
+
+  void PumpAll() {
+    for (auto& connection : connections_) {
+      connection->Pump();
+    }
+  }
+
+  // Picks up what had to wait for something that isn't signaled: the host
+  // closing a connection the guest hasn't accepted yet, a queue becoming
+  // free, or a guest service starting to listen.
+  void Retry() {
+    PumpAll();
+#ifdef CUTTLEFISH_HOST
+    ForwardSockets();
 #else
-cvd::SharedFD OpenSocketConnection(int port) {
-  while (true) {
-    auto sock = cvd::SharedFD::SocketLocalClient(port, SOCK_STREAM);
-    if (sock->IsOpen()) {
-      return sock;
+    ConnectSockets();
+#endif
+  }
+
+  void Forward(cvd::SharedFD socket,
+               std::unique_ptr<SocketForwardRegionView::Connection> shm) {
+    connections_.emplace_back(
+        new ForwardedConnection(epoll_, std::move(socket), std::move(shm)));
+    connections_.back()->Pump();
+  }
+
+#ifdef CUTTLEFISH_HOST
+  class Listener : public EventHandler {
+   public:
+    Listener(Forwarder* forwarder, cvd::SharedFD server, int guest_port)
+        : forwarder_{forwarder},
+          server_{std::move(server)},
+          guest_port_{guest_port} {}
+
+    void OnEvent(uint32_t) override {
+      auto client_socket = cvd::SharedFD::Accept(*server_);
+      if (!client_socket->IsOpen()) {
+        LOG(ERROR) << "error creating client socket: "
+                   << client_socket->StrError();
+        return;
+      }
+      LOG(INFO) << "client socket accepted";
+      forwarder_->unforwarded_.push_back({client_socket, guest_port_});
+      forwarder_->ForwardSockets();
+    }
+
+    // While there are no free queues new clients are left in the backlog
+    void Watch(bool accepting) {
+      ::Watch(forwarder_->epoll_, server_, this, accepting ? EPOLLIN : 0,
+              &watched_);
+    }
+
+   private:
+    Forwarder* forwarder_;
+    cvd::SharedFD server_;
+    int guest_port_;
+    uint32_t watched_{};
+  };
+
+  void ForwardSockets() {
+    while (!unforwarded_.empty()) {
+      auto shm = shm_->TryOpenConnection(unforwarded_.front().second);
+      if (!shm) {
+        LOG(ERROR) << "no remaining shm queues for connection, waiting.";
+        break;
+      }
+      LOG(INFO) << "shm connection opened";
+      Forward(std::move(unforwarded_.front().first), std::move(shm));
+      unforwarded_.pop_front();
+    }
+    for (auto& listener : listeners_) {
+      listener->Watch(unforwarded_.empty());
     }
-    LOG(WARNING) << "could not connect on port " << port
-                 << ". sleeping for 1 second";
-    sleep(1);
   }
-}
 
-[[noreturn]] void guest(SocketForwardRegionView* shm) {
-  LOG(INFO) << "Starting guest mainloop";
-  while (true) {
-    auto conn = shm->AcceptConnection();
-    LOG(INFO) << "shm connection accepted";
-    auto sock = OpenSocketConnection(conn.first.port());
-    CHECK(sock->IsOpen());
-    LOG(INFO) << "socket opened to " << conn.first.port();
-    LaunchWorkers(std::move(conn), std::move(sock));
+  std::vector<std::unique_ptr<Listener>> listeners_;
+  // Accepted sockets waiting for a free queue, with their guest ports
+  std::deque<std::pair<cvd::SharedFD, int>> unforwarded_;
+#else
+  void ConnectSockets() {
+    while (!unconnected_.empty()) {
+      auto port = unconnected_.front()->port();
+      auto sock = cvd::SharedFD::SocketLocalClient(port, SOCK_STREAM);
+      if (!sock->IsOpen()) {
+        LOG(WARNING) << "could not connect on port " << port
+                     << ". retrying in 1 second";
+        break;
+      }
+      LOG(INFO) << "socket opened to " << port;
+      Forward(std::move(sock), std::move(unconnected_.front()));
+      unconnected_.pop_front();
+    }
   }
-}
+
+  // Accepted shm connections waiting for their guest service to listen
+  std::deque<std::unique_ptr<SocketForwardRegionView::Connection>>
+      unconnected_;
 #endif
 
+  SocketForwardRegionView* shm_;
+  cvd::SharedFD epoll_;
+  cvd::SharedFD signal_event_;
+  uint32_t signal_watched_{};
+  std::list<std::unique_ptr<ForwardedConnection>> connections_;
+};
+
 SocketForwardRegionView* GetShm() {
   auto shm = SocketForwardRegionView::GetInstance(
 #ifdef CUTTLEFISH_HOST
@@ -264,13 +458,25 @@ int main(int argc, char* argv[]) {
   assert_correct_user();
 
   auto shm = GetShm();
+  Forwarder forwarder{shm};
+  shm->SetSignalEventFd(forwarder.signal_event());
+  // Every connection is served by one loop, so there is no point in waking
+  // it again for signals posted while it is already draining the table.
+  vsoc::RegionView::SignalCoalescing coalescing;
+  coalescing.batching_window =
+      std::chrono::microseconds(FLAGS_signal_batching_us);
+  coalescing.suppress_while_draining = true;
+  shm->SetSignalCoalescing(coalescing);
   auto worker = shm->StartWorker();
 
 #ifdef CUTTLEFISH_HOST
   CHECK(!FLAGS_guest_ports.empty()) << "Must specify --guest_ports flag";
   CHECK(!FLAGS_host_ports.empty()) << "Must specify --host_ports flag";
-  host(shm, ParsePortsList(FLAGS_guest_ports, FLAGS_host_ports));
-#else
-  guest(shm);
+  auto ports = ParsePortsList(FLAGS_guest_ports, FLAGS_host_ports);
+  CHECK(!ports.empty());
+  for (const auto& port_pair : ports) {
+    forwarder.Listen(port_pair);
+  }
 #endif
+  forwarder.Run();
 }
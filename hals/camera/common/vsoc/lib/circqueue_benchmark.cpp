@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "common/vsoc/lib/circqueue_impl.h"
+#include "common/vsoc/lib/mock_region_view.h"
+
+namespace {
+
+constexpr int kQueueSizeLog2 = 16;
+constexpr int kMaxPacketSize = 8192;
+
+struct BenchmarkRegionLayout : public vsoc::layout::RegionLayout {
+  vsoc::layout::CircularPacketQueue<kQueueSizeLog2, kMaxPacketSize> queue;
+};
+
+// Counts the signals sent, each of which may raise an interrupt on the peer.
+class CountingRegionView
+    : public vsoc::test::MockRegionView<BenchmarkRegionLayout> {
+ public:
+  void SendSignal(vsoc::layout::Sides sides_to_signal,
+                  std::atomic<uint32_t>* uaddr) override {
+    ++signals_;
+    MockRegionView::SendSignal(sides_to_signal, uaddr);
+  }
+
+  uint64_t signals() const { return signals_; }
+
+ private:
+  uint64_t signals_{};
+};
+
+void SetCounters(benchmark::State& state, const CountingRegionView& region,
+                 int64_t burst) {
+  double packets = state.iterations() * burst;
+  state.counters["packets/s"] =
+      benchmark::Counter(packets, benchmark::Counter::kIsRate);
+  state.counters["signals/packet"] = region.signals() / packets;
+}
+
+// Writes a burst of packets, then reads it back, one packet per call.
+// Args: packet size, packets per burst.
+void BM_SinglePacket(benchmark::State& state) {
+  CountingRegionView region;
+  region.Open();
+  auto* queue = &region.data()->queue;
+  const int64_t size = state.range(0);
+  const int64_t burst = state.range(1);
+  std::vector<char> buffer(size);
+
+  for (auto _ : state) {
+    for (int64_t i = 0; i < burst; ++i) {
+      queue->Write(&region, buffer.data(), size);
+    }
+    for (int64_t i = 0; i < burst; ++i) {
+      queue->Read(&region, buffer.data(), size);
+    }
+  }
+  SetCounters(state, region, burst);
+}
+
+// As above, with WriteMany() and ReadMany().
+void BM_ManyPackets(benchmark::State& state) {
+  CountingRegionView region;
+  region.Open();
+  auto* queue = &region.data()->queue;
+  const int64_t size = state.range(0);
+  const int64_t burst = state.range(1);
+  std::vector<char> buffers(size * burst);
+  std::vector<iovec> packets(burst);
+
+  for (auto _ : state) {
+    for (int64_t i = 0; i < burst; ++i) {
+      packets[i].iov_base = buffers.data() + i * size;
+      packets[i].iov_len = size;
+    }
+    for (int64_t i = 0; i < burst;) {
+      i += queue->WriteMany(&region, packets.data() + i, burst - i);
+    }
+    for (int64_t i = 0; i < burst;) {
+      i += queue->ReadMany(&region, packets.data() + i, burst - i);
+    }
+  }
+  SetCounters(state, region, burst);
+}
+
+// Touch events, small control messages and wifi frames
+BENCHMARK(BM_SinglePacket)->Args({16, 32})->Args({256, 32})->Args({1500, 32});
+BENCHMARK(BM_ManyPackets)->Args({16, 32})->Args({256, 32})->Args({1500, 32});
+
+}  // namespace
+
+BENCHMARK_MAIN();
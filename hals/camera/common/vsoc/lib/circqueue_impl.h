@@ -16,6 +16,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cassert>
 #include <cerrno>
 #include <cstring>
 
@@ -34,9 +36,9 @@ namespace vsoc {
 class RegionSignalingInterface;
 namespace layout {
 
-template <uint32_t SizeLog2>
-void CircularQueueBase<SizeLog2>::CopyInRange(const char* buffer_in,
-                                              const Range& t) {
+template <uint32_t SizeLog2, QueueAccess Access>
+void CircularQueueBase<SizeLog2, Access>::CopyInRange(const char* buffer_in,
+                                                      const Range& t) {
   size_t bytes = t.end_idx - t.start_idx;
   uint32_t index = t.start_idx & (BufferSize - 1);
   if (index + bytes <= BufferSize) {
@@ -49,9 +51,9 @@ void CircularQueueBase<SizeLog2>::CopyInRange(const char* buffer_in,
   }
 }
 
-template <uint32_t SizeLog2>
-void CircularQueueBase<SizeLog2>::CopyOutRange(const Range& t,
-                                               char* buffer_out) {
+template <uint32_t SizeLog2, QueueAccess Access>
+void CircularQueueBase<SizeLog2, Access>::CopyOutRange(const Range& t,
+                                                       char* buffer_out) {
   uint32_t index = t.start_idx & (BufferSize - 1);
   size_t total_size = t.end_idx - t.start_idx;
   if (index + total_size <= BufferSize) {
@@ -64,31 +66,49 @@ void CircularQueueBase<SizeLog2>::CopyOutRange(const Range& t,
   }
 }
 
-template <uint32_t SizeLog2>
-void CircularQueueBase<SizeLog2>::WaitForDataLocked(
+template <uint32_t SizeLog2, QueueAccess Access>
+void CircularQueueBase<SizeLog2, Access>::RangeToSpans(const Range& t,
+                                                       iovec* spans) {
+  uint32_t index = t.start_idx & (BufferSize - 1);
+  size_t total_size = t.end_idx - t.start_idx;
+  spans[0].iov_base = buffer_ + index;
+  if (index + total_size <= BufferSize) {
+    spans[0].iov_len = total_size;
+    spans[1].iov_base = buffer_;
+    spans[1].iov_len = 0;
+  } else {
+    spans[0].iov_len = BufferSize - index;
+    spans[1].iov_base = buffer_;
+    spans[1].iov_len = total_size - spans[0].iov_len;
+  }
+}
+
+template <uint32_t SizeLog2, QueueAccess Access>
+void CircularQueueBase<SizeLog2, Access>::WaitForDataLocked(
     RegionSignalingInterface* r) {
   while (1) {
-    uint32_t o_w_pub = w_pub_;
+    uint32_t o_w_pub = w_pub_.load(std::memory_order_acquire);
     // We don't have data. Wait until some appears and try again
-    if (r_released_ != o_w_pub) {
+    if (r_released_.load(std::memory_order_relaxed) != o_w_pub) {
       return;
     }
-    lock_.Unlock();
+    Unlock();
     r->WaitForSignal(&w_pub_, o_w_pub);
-    lock_.Lock();
+    Lock();
   }
 }
 
-template <uint32_t SizeLog2>
-intptr_t CircularQueueBase<SizeLog2>::WriteReserveLocked(
+template <uint32_t SizeLog2, QueueAccess Access>
+intptr_t CircularQueueBase<SizeLog2, Access>::WriteReserveLocked(
     RegionSignalingInterface* r, size_t bytes, Range* t, bool non_blocking) {
   // Can't write more than the buffer will hold
   if (bytes > BufferSize) {
     return -ENOSPC;
   }
   while (true) {
-    uint32_t o_w_pub = w_pub_;
-    uint32_t o_r_release = r_released_;
+    uint32_t o_w_pub = w_pub_.load(std::memory_order_relaxed);
+    // Acquire, so the reader is done with the space before it is reused
+    uint32_t o_r_release = r_released_.load(std::memory_order_acquire);
     uint32_t bytes_in_use = o_w_pub - o_r_release;
     size_t available = BufferSize - bytes_in_use;
     if (available >= bytes) {
@@ -101,82 +121,81 @@ intptr_t CircularQueueBase<SizeLog2>::WriteReserveLocked(
     }
     // If we can't write at the moment wait for a reader to release
     // some bytes.
-    lock_.Unlock();
+    Unlock();
     r->WaitForSignal(&r_released_, o_r_release);
-    lock_.Lock();
+    Lock();
   }
   return t->end_idx - t->start_idx;
 }
 
-template <uint32_t SizeLog2>
-intptr_t CircularByteQueue<SizeLog2>::Read(RegionSignalingInterface* r,
-                                           char* buffer_out, size_t max_size) {
-  this->lock_.Lock();
+template <uint32_t SizeLog2, QueueAccess Access>
+intptr_t CircularByteQueue<SizeLog2, Access>::Read(RegionSignalingInterface* r,
+                                                   char* buffer_out,
+                                                   size_t max_size) {
+  this->Lock();
   this->WaitForDataLocked(r);
   Range t;
-  t.start_idx = this->r_released_;
-  t.end_idx = this->w_pub_;
+  t.start_idx = this->r_released_.load(std::memory_order_relaxed);
+  t.end_idx = this->w_pub_.load(std::memory_order_acquire);
   // The lock is still held here...
   // Trim the range if we got more than the reader wanted
   if ((t.end_idx - t.start_idx) > max_size) {
     t.end_idx = t.start_idx + max_size;
   }
   this->CopyOutRange(t, buffer_out);
-  this->r_released_ = t.end_idx;
-  this->lock_.Unlock();
+  this->r_released_.store(t.end_idx, std::memory_order_release);
+  this->Unlock();
   r->SendSignal(layout::Sides::Both, &this->r_released_);
   return t.end_idx - t.start_idx;
 }
 
-template <uint32_t SizeLog2>
-intptr_t CircularByteQueue<SizeLog2>::Write(RegionSignalingInterface* r,
-                                            const char* buffer_in, size_t bytes,
-                                            bool non_blocking) {
+template <uint32_t SizeLog2, QueueAccess Access>
+intptr_t CircularByteQueue<SizeLog2, Access>::Write(RegionSignalingInterface* r,
+                                                    const char* buffer_in,
+                                                    size_t bytes,
+                                                    bool non_blocking) {
   Range range;
-  this->lock_.Lock();
+  this->Lock();
   intptr_t rval = this->WriteReserveLocked(r, bytes, &range, non_blocking);
   if (rval < 0) {
-    this->lock_.Unlock();
+    this->Unlock();
     return rval;
   }
   this->CopyInRange(buffer_in, range);
   // We can't publish until all of the previous write allocations where
   // published.
-  this->w_pub_ = range.end_idx;
-  this->lock_.Unlock();
+  this->w_pub_.store(range.end_idx, std::memory_order_release);
+  this->Unlock();
   r->SendSignal(layout::Sides::Both, &this->w_pub_);
   return bytes;
 }
 
-template <uint32_t SizeLog2, uint32_t MaxPacketSize>
-intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize>::CalculateBufferedSize(
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+intptr_t
+CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::CalculateBufferedSize(
     size_t payload) {
   return align<uint32_t>(sizeof(uint32_t) + payload);
 }
 
-template <uint32_t SizeLog2, uint32_t MaxPacketSize>
-intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize>::Read(
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::Read(
     RegionSignalingInterface* r, char* buffer_out, size_t max_size) {
-  this->lock_.Lock();
-  this->WaitForDataLocked(r);
-  uint32_t packet_size = *reinterpret_cast<uint32_t*>(
-      this->buffer_ + (this->r_released_ & (this->BufferSize - 1)));
+  PacketSpans spans;
+  uint32_t packet_size = PeekRead(r, &spans);
   if (packet_size > max_size) {
-    this->lock_.Unlock();
+    // Leave the packet in the queue
+    this->Unlock();
     return -ENOSPC;
   }
-  Range t;
-  t.start_idx = this->r_released_ + sizeof(uint32_t);
-  t.end_idx = t.start_idx + packet_size;
-  this->CopyOutRange(t, buffer_out);
-  this->r_released_ += this->CalculateBufferedSize(packet_size);
-  this->lock_.Unlock();
-  r->SendSignal(layout::Sides::Both, &this->r_released_);
+  std::memcpy(buffer_out, spans.iov[0].iov_base, spans.iov[0].iov_len);
+  std::memcpy(buffer_out + spans.iov[0].iov_len, spans.iov[1].iov_base,
+              spans.iov[1].iov_len);
+  ReleaseRead(r, spans);
   return packet_size;
 }
 
-template <uint32_t SizeLog2, uint32_t MaxPacketSize>
-intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize>::Write(
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::Write(
     RegionSignalingInterface* r, const char* buffer_in, uint32_t bytes,
     bool non_blocking) {
   iovec iov;
@@ -185,8 +204,8 @@ intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize>::Write(
   return Writev(r, &iov, 1 /* iov_count */, non_blocking);
 }
 
-template <uint32_t SizeLog2, uint32_t MaxPacketSize>
-intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize>::Writev(
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::Writev(
       RegionSignalingInterface *r,
       const iovec *iov,
       size_t iov_count,
@@ -200,23 +219,14 @@ intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize>::Writev(
     return -ENOSPC;
   }
 
-  Range range;
-  size_t buffered_size = this->CalculateBufferedSize(bytes);
-  this->lock_.Lock();
-  intptr_t rval =
-      this->WriteReserveLocked(r, buffered_size, &range, non_blocking);
+  PacketSpans spans;
+  intptr_t rval = ReserveWrite(r, bytes, &spans, non_blocking);
   if (rval < 0) {
-    this->lock_.Unlock();
     return rval;
   }
-  Range header = range;
-  header.end_idx = header.start_idx + sizeof(uint32_t);
-  Range payload{
-      static_cast<uint32_t>(range.start_idx + sizeof(uint32_t)),
-      static_cast<uint32_t>(range.start_idx + sizeof(uint32_t) + bytes)};
-  this->CopyInRange(reinterpret_cast<const char*>(&bytes), header);
 
-  Range subRange = payload;
+  Range subRange;
+  subRange.start_idx = spans.start_idx + sizeof(uint32_t);
   for (size_t i = 0; i < iov_count; ++i) {
     subRange.end_idx = subRange.start_idx + iov[i].iov_len;
     this->CopyInRange(static_cast<const char *>(iov[i].iov_base), subRange);
@@ -224,11 +234,200 @@ intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize>::Writev(
     subRange.start_idx = subRange.end_idx;
   }
 
-  this->w_pub_ = range.end_idx;
-  this->lock_.Unlock();
+  CommitWrite(r, spans, bytes);
+  return bytes;
+}
+
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::ReadMany(
+    RegionSignalingInterface* r, iovec* packets, size_t packet_count) {
+  if (!packet_count) {
+    return 0;
+  }
+  this->Lock();
+  this->WaitForDataLocked(r);
+  uint32_t o_r_released = this->r_released_.load(std::memory_order_relaxed);
+  uint32_t o_w_pub = this->w_pub_.load(std::memory_order_acquire);
+  uint32_t r_idx = o_r_released;
+  size_t count = 0;
+  while (count < packet_count && r_idx != o_w_pub) {
+    uint32_t packet_size = *reinterpret_cast<uint32_t*>(
+        this->buffer_ + (r_idx & (this->BufferSize - 1)));
+    if (packet_size > packets[count].iov_len) {
+      break;
+    }
+    Range t;
+    t.start_idx = r_idx + sizeof(uint32_t);
+    t.end_idx = t.start_idx + packet_size;
+    this->CopyOutRange(t, static_cast<char*>(packets[count].iov_base));
+    packets[count].iov_len = packet_size;
+    r_idx += this->CalculateBufferedSize(packet_size);
+    ++count;
+  }
+  if (!count) {
+    this->Unlock();
+    return -ENOSPC;
+  }
+  this->r_released_.store(r_idx, std::memory_order_release);
+  this->Unlock();
+  r->SendSignal(layout::Sides::Both, &this->r_released_);
+  return count;
+}
+
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::WriteMany(
+    RegionSignalingInterface* r, const iovec* packets, size_t packet_count,
+    bool non_blocking) {
+  if (!packet_count) {
+    return 0;
+  }
+  if (packets[0].iov_len > MaxPacketSize) {
+    return -ENOSPC;
+  }
+
+  Range range;
+  this->Lock();
+  // Wait for room for the first packet, then take whatever else fits
+  intptr_t rval = this->WriteReserveLocked(
+      r, CalculateBufferedSize(packets[0].iov_len), &range, non_blocking);
+  if (rval < 0) {
+    this->Unlock();
+    return rval;
+  }
+  uint32_t o_r_release = this->r_released_.load(std::memory_order_acquire);
+  size_t count = 0;
+  uint32_t w_idx = range.start_idx;
+  while (count < packet_count) {
+    uint32_t bytes = packets[count].iov_len;
+    uint32_t buffered_size = CalculateBufferedSize(bytes);
+    if (bytes > MaxPacketSize ||
+        w_idx + buffered_size - o_r_release > this->BufferSize) {
+      break;
+    }
+    *reinterpret_cast<uint32_t*>(
+        this->buffer_ + (w_idx & (this->BufferSize - 1))) = bytes;
+    Range payload;
+    payload.start_idx = w_idx + sizeof(uint32_t);
+    payload.end_idx = payload.start_idx + bytes;
+    this->CopyInRange(static_cast<const char*>(packets[count].iov_base),
+                      payload);
+    w_idx += buffered_size;
+    ++count;
+  }
+  this->w_pub_.store(w_idx, std::memory_order_release);
+  this->Unlock();
   r->SendSignal(layout::Sides::Both, &this->w_pub_);
+  return count;
+}
+
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::ReserveWrite(
+    RegionSignalingInterface* r, uint32_t bytes, PacketSpans* spans,
+    bool non_blocking) {
+  if (bytes > MaxPacketSize) {
+    return -ENOSPC;
+  }
+
+  Range range;
+  this->Lock();
+  intptr_t rval = this->WriteReserveLocked(r, CalculateBufferedSize(bytes),
+                                           &range, non_blocking);
+  if (rval < 0) {
+    this->Unlock();
+    return rval;
+  }
+  // The header is naturally aligned, so only the payload may wrap around
+  spans->start_idx = range.start_idx;
+  Range payload{static_cast<uint32_t>(range.start_idx + sizeof(uint32_t)),
+                static_cast<uint32_t>(range.start_idx + sizeof(uint32_t) +
+                                      bytes)};
+  this->RangeToSpans(payload, spans->iov);
   return bytes;
 }
 
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::ReserveWriteUpTo(
+    RegionSignalingInterface* r, uint32_t min_bytes, uint32_t max_bytes,
+    PacketSpans* spans, bool non_blocking) {
+  if (min_bytes > max_bytes || max_bytes > MaxPacketSize) {
+    return -ENOSPC;
+  }
+
+  Range range;
+  this->Lock();
+  intptr_t rval = this->WriteReserveLocked(r, CalculateBufferedSize(min_bytes),
+                                           &range, non_blocking);
+  if (rval < 0) {
+    this->Unlock();
+    return rval;
+  }
+  // Grow the packet into whatever else is free. Packets are aligned, so
+  // the free space is too.
+  uint32_t o_r_release = this->r_released_.load(std::memory_order_acquire);
+  uint32_t available = this->BufferSize - (range.start_idx - o_r_release);
+  uint32_t bytes = std::min<uint32_t>(max_bytes,
+                                      available - sizeof(uint32_t));
+  spans->start_idx = range.start_idx;
+  Range payload{static_cast<uint32_t>(range.start_idx + sizeof(uint32_t)),
+                static_cast<uint32_t>(range.start_idx + sizeof(uint32_t) +
+                                      bytes)};
+  this->RangeToSpans(payload, spans->iov);
+  return bytes;
+}
+
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+void CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::CommitWrite(
+    RegionSignalingInterface* r, const PacketSpans& spans, uint32_t bytes) {
+  assert(bytes <= spans.iov[0].iov_len + spans.iov[1].iov_len);
+  *reinterpret_cast<uint32_t*>(
+      this->buffer_ + (spans.start_idx & (this->BufferSize - 1))) = bytes;
+  this->w_pub_.store(spans.start_idx + CalculateBufferedSize(bytes),
+                     std::memory_order_release);
+  this->Unlock();
+  r->SendSignal(layout::Sides::Both, &this->w_pub_);
+}
+
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+void CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::CancelWrite() {
+  this->Unlock();
+}
+
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+intptr_t CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::PeekRead(
+    RegionSignalingInterface* r, PacketSpans* spans, bool non_blocking) {
+  this->Lock();
+  if (non_blocking && this->r_released_.load(std::memory_order_relaxed) ==
+                          this->w_pub_.load(std::memory_order_acquire)) {
+    this->Unlock();
+    return -EWOULDBLOCK;
+  }
+  this->WaitForDataLocked(r);
+  uint32_t o_r_released = this->r_released_.load(std::memory_order_relaxed);
+  uint32_t packet_size = *reinterpret_cast<uint32_t*>(
+      this->buffer_ + (o_r_released & (this->BufferSize - 1)));
+  spans->start_idx = o_r_released;
+  Range payload{static_cast<uint32_t>(o_r_released + sizeof(uint32_t)),
+                static_cast<uint32_t>(o_r_released + sizeof(uint32_t) +
+                                      packet_size)};
+  this->RangeToSpans(payload, spans->iov);
+  return packet_size;
+}
+
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+void CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::ReleaseRead(
+    RegionSignalingInterface* r, const PacketSpans& spans) {
+  uint32_t packet_size = spans.iov[0].iov_len + spans.iov[1].iov_len;
+  this->r_released_.store(
+      spans.start_idx + CalculateBufferedSize(packet_size),
+      std::memory_order_release);
+  this->Unlock();
+  r->SendSignal(layout::Sides::Both, &this->r_released_);
+}
+
+template <uint32_t SizeLog2, uint32_t MaxPacketSize, QueueAccess Access>
+void CircularPacketQueue<SizeLog2, MaxPacketSize, Access>::CancelRead() {
+  this->Unlock();
+}
+
 }  // namespace layout
 }  // namespace vsoc
@@ -13,7 +13,11 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
+#include <cstring>
+#include <string>
 #include <thread>
+#include <type_traits>
 #include <unistd.h>
 
 #include <gtest/gtest.h>
@@ -324,4 +328,425 @@ TEST_F(CircQueueTest, PacketQueueMultipleReadWrite) {
   std::for_each(writing_threads.begin(), writing_threads.end(), [](std::thread& t) { t.join(); });
 }
 
+// Stress tests, run against both kinds of queue synchronization. The queues
+// are small so that the indexes wrap around many times.
+
+constexpr int kStressQueueSizeLog2 = 10;
+constexpr int kStressQueueCapacity = 1 << kStressQueueSizeLog2;
+constexpr int kStressMaxPacketSize = 256;
+constexpr int kStressTotalBytes = 256 * kStressQueueCapacity;
+constexpr int kStressNumPackets = 20000;
+constexpr int kStressBatchSize = 8;
+
+template <vsoc::layout::QueueAccess Access>
+struct StressTestRegionLayout : public vsoc::layout::RegionLayout {
+  vsoc::layout::CircularByteQueue<kStressQueueSizeLog2, Access> byte_queue;
+  vsoc::layout::CircularPacketQueue<kStressQueueSizeLog2, kStressMaxPacketSize,
+                                    Access>
+      packet_queue;
+};
+
+template <typename AccessConstant>
+class CircQueueStressTest : public ::testing::Test {
+ protected:
+  typedef StressTestRegionLayout<AccessConstant::value> Layout;
+  typedef vsoc::test::MockRegionView<Layout> RegionView;
+
+  virtual void SetUp() {
+    region_.Open();
+  }
+
+  // Sizes of consecutive writes and reads, never 0 and not aligned to the
+  // queue size.
+  static int ChunkSize(int i, int max_size) {
+    return 1 + (i * 37 + (i >> 3)) % max_size;
+  }
+
+  static char ByteAt(int offset) {
+    return static_cast<char>(offset * 7 + (offset >> 8));
+  }
+
+  RegionView region_;
+};
+
+typedef ::testing::Types<
+    std::integral_constant<vsoc::layout::QueueAccess,
+                           vsoc::layout::QueueAccess::Locked>,
+    std::integral_constant<
+        vsoc::layout::QueueAccess,
+        vsoc::layout::QueueAccess::SingleProducerSingleConsumer>>
+    QueueAccessTypes;
+TYPED_TEST_CASE(CircQueueStressTest, QueueAccessTypes);
+
+// Stream bytes through the queue in odd sized chunks, checking their order.
+// Every other write is non blocking, so the writer also spins on a full
+// queue.
+TYPED_TEST(CircQueueStressTest, ByteQueueStreamWrapsAround) {
+  auto* region = &this->region_;
+  auto* queue = &region->data()->byte_queue;
+  std::thread writer([region, queue]() {
+    char buffer_in[kStressQueueCapacity];
+    int offset = 0;
+    for (int i = 0; offset < kStressTotalBytes; i++) {
+      int bytes = std::min(TestFixture::ChunkSize(i, kStressQueueCapacity),
+                           kStressTotalBytes - offset);
+      for (int j = 0; j < bytes; j++) {
+        buffer_in[j] = TestFixture::ByteAt(offset + j);
+      }
+      bool non_blocking = i & 1;
+      intptr_t ret;
+      while ((ret = queue->Write(region, buffer_in, bytes, non_blocking)) ==
+             -EWOULDBLOCK) {
+        std::this_thread::yield();
+      }
+      ASSERT_EQ(bytes, ret);
+      offset += bytes;
+    }
+  });
+
+  char buffer_out[kStressQueueCapacity];
+  int offset = 0;
+  int mismatches = 0;
+  for (int i = 0; offset < kStressTotalBytes; i++) {
+    intptr_t ret = queue->Read(region, buffer_out,
+                               TestFixture::ChunkSize(i * 5, 300));
+    ASSERT_GT(ret, 0);
+    for (int j = 0; j < ret; j++) {
+      mismatches += buffer_out[j] != TestFixture::ByteAt(offset + j);
+    }
+    offset += ret;
+  }
+  writer.join();
+  EXPECT_EQ(kStressTotalBytes, offset);
+  EXPECT_EQ(0, mismatches);
+}
+
+// Stream packets of varying sizes through the queue, checking that each one
+// comes out whole and in order.
+TYPED_TEST(CircQueueStressTest, PacketQueueStreamWrapsAround) {
+  auto* region = &this->region_;
+  auto* queue = &region->data()->packet_queue;
+  std::thread writer([region, queue]() {
+    char buffer_in[kStressMaxPacketSize];
+    for (int i = 0; i < kStressNumPackets; i++) {
+      int bytes = TestFixture::ChunkSize(i, kStressMaxPacketSize);
+      for (int j = 0; j < bytes; j++) {
+        buffer_in[j] = TestFixture::ByteAt(i + j);
+      }
+      bool non_blocking = i & 1;
+      intptr_t ret;
+      while ((ret = queue->Write(region, buffer_in, bytes, non_blocking)) ==
+             -EWOULDBLOCK) {
+        std::this_thread::yield();
+      }
+      ASSERT_EQ(bytes, ret);
+    }
+  });
+
+  char buffer_out[kStressMaxPacketSize];
+  int mismatches = 0;
+  for (int i = 0; i < kStressNumPackets; i++) {
+    intptr_t ret = queue->Read(region, buffer_out, sizeof(buffer_out));
+    ASSERT_EQ(TestFixture::ChunkSize(i, kStressMaxPacketSize), ret);
+    for (int j = 0; j < ret; j++) {
+      mismatches += buffer_out[j] != TestFixture::ByteAt(i + j);
+    }
+  }
+  writer.join();
+  EXPECT_EQ(0, mismatches);
+}
+
+// Fill the queue with its read index in the middle of the buffer, then check
+// that a writer can neither overrun nor lose the reader.
+TYPED_TEST(CircQueueStressTest, ByteQueueFullAfterWrap) {
+  auto* region = &this->region_;
+  auto* queue = &region->data()->byte_queue;
+  const int offset = kStressQueueCapacity / 2 + 3;
+  char buffer[kStressQueueCapacity];
+  for (int i = 0; i < kStressQueueCapacity; i++) {
+    buffer[i] = TestFixture::ByteAt(i);
+  }
+  ASSERT_EQ(offset, queue->Write(region, buffer, offset));
+  ASSERT_EQ(offset, queue->Read(region, buffer, offset));
+
+  for (int i = 0; i < kStressQueueCapacity; i++) {
+    buffer[i] = TestFixture::ByteAt(i);
+  }
+  ASSERT_EQ(kStressQueueCapacity,
+            queue->Write(region, buffer, kStressQueueCapacity));
+  EXPECT_EQ(-EWOULDBLOCK, queue->Write(region, buffer, 1, true));
+
+  // A blocking write waits for the reader to make room
+  const char extra = 'x';
+  std::thread writing_thread([region, queue, &extra]() {
+    EXPECT_EQ(1, queue->Write(region, &extra, 1));
+  });
+  EXPECT_BLOCK(this->region_, writing_thread.get_id());
+
+  char buffer_out[kStressQueueCapacity];
+  ASSERT_EQ(kStressQueueCapacity,
+            queue->Read(region, buffer_out, kStressQueueCapacity));
+  writing_thread.join();
+  for (int i = 0; i < kStressQueueCapacity; i++) {
+    EXPECT_EQ(TestFixture::ByteAt(i), buffer_out[i]) << "at " << i;
+  }
+  ASSERT_EQ(1, queue->Read(region, buffer_out, kStressQueueCapacity));
+  EXPECT_EQ(extra, buffer_out[0]);
+}
+
+// Drain the queue after a wrap, then check that a reader waits for the next
+// packet.
+TYPED_TEST(CircQueueStressTest, PacketQueueEmptyAfterWrap) {
+  auto* region = &this->region_;
+  auto* queue = &region->data()->packet_queue;
+  char buffer[kStressMaxPacketSize] = {};
+  for (int i = 0; i < 3 * kStressQueueCapacity / kStressMaxPacketSize; i++) {
+    ASSERT_EQ(kStressMaxPacketSize - 1,
+              queue->Write(region, buffer, kStressMaxPacketSize - 1));
+    ASSERT_EQ(kStressMaxPacketSize - 1,
+              queue->Read(region, buffer, kStressMaxPacketSize));
+  }
+
+  std::thread reading_thread([region, queue]() {
+    char buffer_out[kStressMaxPacketSize];
+    EXPECT_EQ(5, queue->Read(region, buffer_out, sizeof(buffer_out)));
+    EXPECT_EQ(0, memcmp("hello", buffer_out, 5));
+  });
+  EXPECT_BLOCK(this->region_, reading_thread.get_id());
+  EXPECT_EQ(5, queue->Write(region, "hello", 5));
+  reading_thread.join();
+}
+
+// Stream packets through the queue, filling and reading their payloads in
+// place. Each packet is reserved at the maximum size and committed shorter.
+TYPED_TEST(CircQueueStressTest, PacketQueueInPlaceWrapsAround) {
+  typedef typename TestFixture::Layout Layout;
+  typedef decltype(Layout::packet_queue) PacketQueue;
+  auto* region = &this->region_;
+  auto* queue = &region->data()->packet_queue;
+  std::thread writer([region, queue]() {
+    for (int i = 0; i < kStressNumPackets; i++) {
+      typename PacketQueue::PacketSpans spans;
+      ASSERT_EQ(kStressMaxPacketSize,
+                queue->ReserveWrite(region, kStressMaxPacketSize, &spans));
+      int bytes = TestFixture::ChunkSize(i, kStressMaxPacketSize);
+      int offset = 0;
+      for (const iovec& span : spans.iov) {
+        char* data = static_cast<char*>(span.iov_base);
+        for (size_t j = 0; j < span.iov_len && offset < bytes; j++) {
+          data[j] = TestFixture::ByteAt(i + offset++);
+        }
+      }
+      queue->CommitWrite(region, spans, bytes);
+    }
+  });
+
+  int mismatches = 0;
+  int wrapped = 0;
+  for (int i = 0; i < kStressNumPackets; i++) {
+    typename PacketQueue::PacketSpans spans;
+    intptr_t ret = queue->PeekRead(region, &spans);
+    ASSERT_EQ(TestFixture::ChunkSize(i, kStressMaxPacketSize), ret);
+    ASSERT_EQ(static_cast<size_t>(ret),
+              spans.iov[0].iov_len + spans.iov[1].iov_len);
+    wrapped += spans.iov[1].iov_len > 0;
+    int offset = 0;
+    for (const iovec& span : spans.iov) {
+      const char* data = static_cast<const char*>(span.iov_base);
+      for (size_t j = 0; j < span.iov_len; j++) {
+        mismatches += data[j] != TestFixture::ByteAt(i + offset++);
+      }
+    }
+    queue->ReleaseRead(region, spans);
+  }
+  writer.join();
+  EXPECT_EQ(0, mismatches);
+  EXPECT_GT(wrapped, 0);
+}
+
+// A cancelled reservation takes no room, and a full queue refuses
+// non-blocking reservations.
+TYPED_TEST(CircQueueStressTest, PacketQueueCancelWrite) {
+  typedef typename TestFixture::Layout Layout;
+  typedef decltype(Layout::packet_queue) PacketQueue;
+  auto* region = &this->region_;
+  auto* queue = &region->data()->packet_queue;
+  typename PacketQueue::PacketSpans spans;
+  const int packets = kStressQueueCapacity / (kStressMaxPacketSize + 4);
+  for (int i = 0; i < 2 * packets; i++) {
+    ASSERT_EQ(kStressMaxPacketSize,
+              queue->ReserveWrite(region, kStressMaxPacketSize, &spans));
+    queue->CancelWrite();
+  }
+  for (int i = 0; i < packets; i++) {
+    ASSERT_EQ(kStressMaxPacketSize,
+              queue->ReserveWrite(region, kStressMaxPacketSize, &spans));
+    queue->CommitWrite(region, spans, kStressMaxPacketSize);
+  }
+  EXPECT_EQ(-EWOULDBLOCK,
+            queue->ReserveWrite(region, kStressMaxPacketSize, &spans, true));
+  EXPECT_EQ(-ENOSPC,
+            queue->ReserveWrite(region, kStressMaxPacketSize + 1, &spans));
+
+  char buffer_out[kStressMaxPacketSize];
+  EXPECT_EQ(kStressMaxPacketSize,
+            queue->Read(region, buffer_out, sizeof(buffer_out)));
+  EXPECT_EQ(kStressMaxPacketSize,
+            queue->ReserveWrite(region, kStressMaxPacketSize, &spans, true));
+  queue->CancelWrite();
+}
+
+// A reservation of up to some size waits only for its minimum, then takes
+// what is free.
+TYPED_TEST(CircQueueStressTest, PacketQueueReserveUpTo) {
+  typedef typename TestFixture::Layout Layout;
+  typedef decltype(Layout::packet_queue) PacketQueue;
+  auto* region = &this->region_;
+  auto* queue = &region->data()->packet_queue;
+  typename PacketQueue::PacketSpans spans;
+  ASSERT_EQ(kStressMaxPacketSize,
+            queue->ReserveWriteUpTo(region, 1, kStressMaxPacketSize, &spans));
+  queue->CancelWrite();
+
+  // Leave 244 bytes free: room for the size word and 240 bytes of payload
+  char buffer[kStressMaxPacketSize] = {};
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(kStressMaxPacketSize,
+              queue->Write(region, buffer, kStressMaxPacketSize));
+  }
+  ASSERT_EQ(240,
+            queue->ReserveWriteUpTo(region, 1, kStressMaxPacketSize, &spans));
+  EXPECT_EQ(240u, spans.iov[0].iov_len + spans.iov[1].iov_len);
+  std::memset(spans.iov[0].iov_base, 'x', spans.iov[0].iov_len);
+  std::memset(spans.iov[1].iov_base, 'x', spans.iov[1].iov_len);
+  queue->CommitWrite(region, spans, 100);
+
+  // The committed packet took 104 bytes
+  EXPECT_EQ(136, queue->ReserveWriteUpTo(region, 1, kStressMaxPacketSize,
+                                         &spans, true));
+  queue->CancelWrite();
+  EXPECT_EQ(-EWOULDBLOCK, queue->ReserveWriteUpTo(
+                              region, 200, kStressMaxPacketSize, &spans, true));
+  EXPECT_EQ(-ENOSPC, queue->ReserveWriteUpTo(region, 1,
+                                             kStressMaxPacketSize + 1, &spans));
+  EXPECT_EQ(-ENOSPC, queue->ReserveWriteUpTo(region, 10, 5, &spans));
+
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(kStressMaxPacketSize,
+              queue->Read(region, buffer, sizeof(buffer)));
+  }
+  ASSERT_EQ(100, queue->Read(region, buffer, sizeof(buffer)));
+  EXPECT_EQ(std::string(100, 'x'), std::string(buffer, 100));
+}
+
+// A non-blocking peek on an empty queue fails, and a cancelled peek leaves
+// the packet for the next one.
+TYPED_TEST(CircQueueStressTest, PacketQueueCancelRead) {
+  typedef typename TestFixture::Layout Layout;
+  typedef decltype(Layout::packet_queue) PacketQueue;
+  auto* region = &this->region_;
+  auto* queue = &region->data()->packet_queue;
+  typename PacketQueue::PacketSpans spans;
+  EXPECT_EQ(-EWOULDBLOCK, queue->PeekRead(region, &spans, true));
+
+  const char packet[] = "packet";
+  ASSERT_EQ(static_cast<intptr_t>(sizeof(packet)),
+            queue->Write(region, packet, sizeof(packet)));
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(static_cast<intptr_t>(sizeof(packet)),
+              queue->PeekRead(region, &spans, true));
+    EXPECT_EQ(0, std::memcmp(packet, spans.iov[0].iov_base, sizeof(packet)));
+    queue->CancelRead();
+  }
+  ASSERT_EQ(static_cast<intptr_t>(sizeof(packet)),
+            queue->PeekRead(region, &spans, true));
+  queue->ReleaseRead(region, spans);
+  EXPECT_EQ(-EWOULDBLOCK, queue->PeekRead(region, &spans, true));
+}
+
+// Stream batches of packets through the queue, checking that each one comes
+// out whole and in order however the batches are split.
+TYPED_TEST(CircQueueStressTest, PacketQueueBatchesWrapAround) {
+  auto* region = &this->region_;
+  auto* queue = &region->data()->packet_queue;
+  std::thread writer([region, queue]() {
+    char buffers_in[kStressBatchSize][kStressMaxPacketSize];
+    iovec packets[kStressBatchSize];
+    int written = 0;
+    while (written < kStressNumPackets) {
+      int batch = std::min(kStressBatchSize, kStressNumPackets - written);
+      for (int i = 0; i < batch; i++) {
+        int bytes =
+            TestFixture::ChunkSize(written + i, kStressMaxPacketSize);
+        for (int j = 0; j < bytes; j++) {
+          buffers_in[i][j] = TestFixture::ByteAt(written + i + j);
+        }
+        packets[i].iov_base = buffers_in[i];
+        packets[i].iov_len = bytes;
+      }
+      bool non_blocking = written & 1;
+      intptr_t ret;
+      while ((ret = queue->WriteMany(region, packets, batch, non_blocking)) ==
+             -EWOULDBLOCK) {
+        std::this_thread::yield();
+      }
+      ASSERT_GT(ret, 0);
+      ASSERT_LE(ret, batch);
+      written += ret;
+    }
+  });
+
+  char buffers_out[kStressBatchSize][kStressMaxPacketSize];
+  iovec packets[kStressBatchSize];
+  int read = 0;
+  int mismatches = 0;
+  while (read < kStressNumPackets) {
+    for (int i = 0; i < kStressBatchSize; i++) {
+      packets[i].iov_base = buffers_out[i];
+      packets[i].iov_len = kStressMaxPacketSize;
+    }
+    intptr_t ret =
+        queue->ReadMany(region, packets, 1 + read % kStressBatchSize);
+    ASSERT_GT(ret, 0);
+    for (int i = 0; i < ret; i++) {
+      ASSERT_EQ(static_cast<size_t>(
+                    TestFixture::ChunkSize(read + i, kStressMaxPacketSize)),
+                packets[i].iov_len);
+      for (size_t j = 0; j < packets[i].iov_len; j++) {
+        mismatches += buffers_out[i][j] != TestFixture::ByteAt(read + i + j);
+      }
+    }
+    read += ret;
+  }
+  writer.join();
+  EXPECT_EQ(kStressNumPackets, read);
+  EXPECT_EQ(0, mismatches);
+}
+
+// Batches stop at the first packet that doesn't fit, in the queue or in the
+// reader's buffer.
+TYPED_TEST(CircQueueStressTest, PacketQueueBatchesStopWhenFull) {
+  auto* region = &this->region_;
+  auto* queue = &region->data()->packet_queue;
+  char buffer[kStressMaxPacketSize] = {};
+  iovec packets[6];
+  for (auto& packet : packets) {
+    packet.iov_base = buffer;
+    packet.iov_len = kStressMaxPacketSize;
+  }
+  // Only 3 maximum sized packets fit
+  EXPECT_EQ(3, queue->WriteMany(region, packets, 6));
+  EXPECT_EQ(-EWOULDBLOCK, queue->WriteMany(region, packets, 6, true));
+
+  packets[1].iov_len = kStressMaxPacketSize - 1;
+  EXPECT_EQ(1, queue->ReadMany(region, packets, 3));
+  EXPECT_EQ(static_cast<size_t>(kStressMaxPacketSize), packets[0].iov_len);
+  packets[0].iov_len = 8;
+  EXPECT_EQ(-ENOSPC, queue->ReadMany(region, packets, 3));
+
+  packets[0].iov_len = packets[1].iov_len = kStressMaxPacketSize;
+  EXPECT_EQ(2, queue->ReadMany(region, packets, 6));
+  EXPECT_EQ(0, queue->ReadMany(region, packets, 0));
+}
+
 }  // namespace
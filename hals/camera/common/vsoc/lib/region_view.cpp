@@ -2,11 +2,34 @@
 
 #include <sys/mman.h>
 
+#include <algorithm>
+
 #include "common/libs/glog/logging.h"
 
 namespace {
 const uint32_t UADDR_OFFSET_MASK = 0xFFFFFFFC;
 const uint32_t UADDR_OFFSET_ROUND_TRIP_FLAG = 1;
+
+// The interrupt_signalled word of a signal table is a bitmap of pending work.
+// Bit 0 asks for a scan of the whole table. It is what older peers and the
+// kernel's self-interrupt store, and what MaybeInterruptPeer() posts.
+const uint32_t SCAN_ALL_SIGNALS = 1;
+// Bits 1 to 16 each flag a sixteenth of the table as holding new signals.
+const uint32_t FIRST_CHUNK_BIT = 1;
+const uint32_t NUM_CHUNKS_LG2 = 4;
+// Set while the owner of the table drains it, so the peer doesn't raise
+// interrupts that the drain will pick up anyway.
+const uint32_t DRAINING_SIGNALS = 1u << 31;
+// How often the batching window checks for more signals. The peer doesn't
+// interrupt while one is pending, so there is nothing to block on.
+const std::chrono::microseconds BATCHING_POLL_INTERVAL{10};
+
+// Returns how many nodes of a table share a pending signals bit
+uint32_t ChunkSizeLg2(const vsoc_signal_table_layout& table) {
+  return table.num_nodes_lg2 > NUM_CHUNKS_LG2
+             ? table.num_nodes_lg2 - NUM_CHUNKS_LG2
+             : 0;
+}
 }  // namespace
 
 using vsoc::layout::Sides;
@@ -24,13 +47,14 @@ void vsoc::RegionWorker::start() {
 
 void vsoc::RegionWorker::Work() {
   while (!stopping_) {
-    region_->WaitForInterrupt();
+    uint32_t pending_signals = region_->WaitForInterrupt();
     if (stopping_) {
       return;
     }
     region_->ProcessSignalsFromPeer([this](uint32_t offset) {
         control_->SignalSelf(offset);
-    });
+    }, pending_signals);
+    region_->NotifySignalEventFd();
   }
 }
 
@@ -71,45 +95,145 @@ bool vsoc::RegionView::Open(const char* name) {
 
 // Interrupt our peer, causing it to scan the outgoing_signal_table
 bool vsoc::RegionView::MaybeInterruptPeer() {
+  return MaybeInterruptPeer(SCAN_ALL_SIGNALS);
+}
+
+bool vsoc::RegionView::MaybeInterruptPeer(uint32_t pending_signals) {
   if (region_offset_to_pointer<std::atomic<uint32_t>>(
           outgoing_signal_table().interrupt_signalled_offset)
-          ->exchange(1)) {
+          ->fetch_or(pending_signals)) {
     return false;
   }
+  interrupts_raised_.fetch_add(1, std::memory_order_relaxed);
   return control_->InterruptPeer();
 }
 
 // Wait for an interrupt from our peer
-void vsoc::RegionView::WaitForInterrupt() {
+uint32_t vsoc::RegionView::WaitForInterrupt() {
+  std::atomic<uint32_t>* signalled =
+      region_offset_to_pointer<std::atomic<uint32_t>>(
+          incoming_signal_table().interrupt_signalled_offset);
   while (1) {
-    if (region_offset_to_pointer<std::atomic<uint32_t>>(
-            incoming_signal_table().interrupt_signalled_offset)
-            ->exchange(0)) {
-      return;
+    uint32_t pending_signals = signalled->load();
+    if (pending_signals) {
+      auto now = std::chrono::steady_clock::now();
+      if (now - last_interrupt_ < coalescing_.batching_window) {
+        // Interrupts are coming in fast. Leave this one pending for a while,
+        // so the signals posted meanwhile don't raise more.
+        WaitForMoreSignals(signalled, pending_signals,
+                           now + coalescing_.batching_window);
+      }
+      last_interrupt_ = now;
+      if (coalescing_.suppress_while_draining) {
+        return signalled->exchange(DRAINING_SIGNALS) | DRAINING_SIGNALS;
+      }
+      return signalled->exchange(0);
     }
     control_->WaitForInterrupt();
   }
 }
 
+// Returns once the peer flags more of the table, InterruptSelf() is called or
+// the deadline passes, whichever comes first.
+void vsoc::RegionView::WaitForMoreSignals(
+    std::atomic<uint32_t>* signalled, uint32_t pending_signals,
+    std::chrono::steady_clock::time_point deadline) {
+  uint32_t self_interrupts = self_interrupts_.load();
+  while (signalled->load() == pending_signals &&
+         self_interrupts_.load() == self_interrupts) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      return;
+    }
+    std::this_thread::sleep_for(
+        std::min<std::chrono::steady_clock::duration>(BATCHING_POLL_INTERVAL,
+                                                      deadline - now));
+  }
+}
+
 void vsoc::RegionView::ProcessSignalsFromPeer(
     std::function<void(uint32_t)> signal_handler) {
+  ScanSignalTable(signal_handler, SCAN_ALL_SIGNALS);
+}
+
+void vsoc::RegionView::ProcessSignalsFromPeer(
+    std::function<void(uint32_t)> signal_handler, uint32_t pending_signals) {
+  ScanSignalTable(signal_handler, pending_signals);
+  if (!(pending_signals & DRAINING_SIGNALS)) {
+    return;
+  }
+  // The peer kept posting without interrupting while we were draining.
+  // Stop draining, unless there is more to pick up.
+  std::atomic<uint32_t>* signalled =
+      region_offset_to_pointer<std::atomic<uint32_t>>(
+          incoming_signal_table().interrupt_signalled_offset);
+  while (true) {
+    uint32_t expected = DRAINING_SIGNALS;
+    if (signalled->compare_exchange_strong(expected, 0)) {
+      return;
+    }
+    ScanSignalTable(signal_handler, signalled->exchange(DRAINING_SIGNALS));
+  }
+}
+
+void vsoc::RegionView::ScanSignalTable(
+    const std::function<void(uint32_t)>& signal_handler,
+    uint32_t pending_signals) {
   const vsoc_signal_table_layout& table = incoming_signal_table();
   const size_t num_offsets = (1 << table.num_nodes_lg2);
+  const uint32_t chunk_size_lg2 = ChunkSizeLg2(table);
   std::atomic<uint32_t>* offsets =
       region_offset_to_pointer<std::atomic<uint32_t>>(
           table.futex_uaddr_table_offset);
-  for (size_t i = 0; i < num_offsets; ++i) {
-    uint32_t raw_offset = offsets[i].exchange(0);
-    if (raw_offset) {
-      bool round_trip = raw_offset & UADDR_OFFSET_ROUND_TRIP_FLAG;
-      uint32_t offset = raw_offset & UADDR_OFFSET_MASK;
-      signal_handler(offset);
-      if (round_trip) {
-        SendSignalToPeer(
-            region_offset_to_pointer<std::atomic<uint32_t>>(offset), false);
+  uint64_t nodes_scanned = 0;
+  for (size_t chunk = 0; chunk < (num_offsets >> chunk_size_lg2); ++chunk) {
+    if (!(pending_signals & SCAN_ALL_SIGNALS) &&
+        !(pending_signals & (1u << (FIRST_CHUNK_BIT + chunk)))) {
+      continue;
+    }
+    size_t end = (chunk + 1) << chunk_size_lg2;
+    for (size_t i = chunk << chunk_size_lg2; i < end; ++i) {
+      ++nodes_scanned;
+      // Most nodes are empty. Only write to the ones that aren't, so the
+      // scan doesn't take every cache line of the table from the peer.
+      if (!offsets[i].load()) {
+        continue;
+      }
+      uint32_t raw_offset = offsets[i].exchange(0);
+      if (raw_offset) {
+        bool round_trip = raw_offset & UADDR_OFFSET_ROUND_TRIP_FLAG;
+        uint32_t offset = raw_offset & UADDR_OFFSET_MASK;
+        signal_handler(offset);
+        if (round_trip) {
+          SendSignalToPeer(
+              region_offset_to_pointer<std::atomic<uint32_t>>(offset), false);
+        }
       }
     }
   }
+  scans_.fetch_add(1, std::memory_order_relaxed);
+  nodes_scanned_.fetch_add(nodes_scanned, std::memory_order_relaxed);
+}
+
+void vsoc::RegionView::NotifySignalEventFd() {
+  if (!signal_event_fd_->IsOpen()) {
+    return;
+  }
+  uint64_t one = 1;
+  if (signal_event_fd_->Write(&one, sizeof one) != sizeof one) {
+    LOG(ERROR) << "unable to notify signal eventfd: "
+               << signal_event_fd_->StrError();
+  }
+}
+
+vsoc::RegionView::SignalStats vsoc::RegionView::GetSignalStats() const {
+  SignalStats stats;
+  stats.signals_sent = signals_sent_.load(std::memory_order_relaxed);
+  stats.interrupts_raised = interrupts_raised_.load(std::memory_order_relaxed);
+  stats.collisions = collisions_.load(std::memory_order_relaxed);
+  stats.scans = scans_.load(std::memory_order_relaxed);
+  stats.nodes_scanned = nodes_scanned_.load(std::memory_order_relaxed);
+  return stats;
 }
 
 void vsoc::RegionView::SendSignal(Sides sides_to_signal,
@@ -140,6 +264,7 @@ void vsoc::RegionView::SendSignalToPeer(std::atomic<uint32_t>* uaddr,
   if (offset & ~UADDR_OFFSET_MASK) {
     LOG(FATAL) << "uaddr offset is not naturally aligned " << uaddr;
   }
+  signals_sent_.fetch_add(1, std::memory_order_relaxed);
   // Guess at where this offset should go in the table.
   // Do this before we set the round-trip flag.
   size_t hash = (offset >> 2) & max_index;
@@ -149,8 +274,10 @@ void vsoc::RegionView::SendSignalToPeer(std::atomic<uint32_t>* uaddr,
   while (1) {
     uint32_t expected = 0;
     if (offsets[hash].compare_exchange_strong(expected, offset)) {
-      // We stored the offset. Send the interrupt.
-      this->MaybeInterruptPeer();
+      // We stored the offset. Send the interrupt, flagging the part of the
+      // table that holds it.
+      this->MaybeInterruptPeer(
+          1u << (FIRST_CHUNK_BIT + (hash >> ChunkSizeLg2(table))));
       break;
     }
     // We didn't store, but the value was already in the table with our flag.
@@ -160,6 +287,7 @@ void vsoc::RegionView::SendSignalToPeer(std::atomic<uint32_t>* uaddr,
     }
     // Hash collision. Try again in a different node
     if ((expected & UADDR_OFFSET_MASK) != (offset & UADDR_OFFSET_MASK)) {
+      collisions_.fetch_add(1, std::memory_order_relaxed);
       hash = (hash + 1) & max_index;
       continue;
     }
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 
 #include <functional>
@@ -70,6 +71,32 @@ class RegionWorker {
  */
 class RegionView : public RegionSignalingInterface {
  public:
+  // How incoming interrupts are coalesced. Neither is enabled by default.
+  struct SignalCoalescing {
+    // While interrupts arrive less than this apart, wait up to this long
+    // after one arrives, or until the peer posts another signal, before
+    // draining the signal table. Signals posted meanwhile ride on the pending
+    // interrupt instead of raising new ones. 0 disables it.
+    std::chrono::microseconds batching_window{0};
+    // Keep the incoming interrupt flagged while the signal table is drained,
+    // so the peer posts signals without raising interrupts until it is done.
+    bool suppress_while_draining{false};
+  };
+
+  // Counters for the signals that went through this view, for debugging.
+  struct SignalStats {
+    // Signals posted to the peer
+    uint64_t signals_sent;
+    // Interrupts raised on the peer. Other signals were coalesced into an
+    // interrupt that was already pending.
+    uint64_t interrupts_raised;
+    // Table nodes skipped over because of hash collisions
+    uint64_t collisions;
+    // Scans of the incoming signal table, and the nodes they visited
+    uint64_t scans;
+    uint64_t nodes_scanned;
+  };
+
   virtual ~RegionView();
 
 #if defined(CUTTLEFISH_HOST)
@@ -92,7 +119,10 @@ class RegionView : public RegionSignalingInterface {
 
   // Wake any threads waiting for an interrupt. This is generally used during
   // shutdown.
-  void InterruptSelf() { control_->InterruptSelf(); }
+  void InterruptSelf() {
+    self_interrupts_.fetch_add(1);
+    control_->InterruptSelf();
+  }
 
   // Interrupt our peer if an interrupt is not already on the way.
   // Returns true if the interrupt was sent, false if an interrupt was already
@@ -109,6 +139,11 @@ class RegionView : public RegionSignalingInterface {
   void ProcessSignalsFromPeer(
       std::function<void(uint32_t)> signal_handler);
 
+  // As above, but only scans the parts of the table flagged in
+  // pending_signals, as returned by WaitForInterrupt().
+  void ProcessSignalsFromPeer(
+      std::function<void(uint32_t)> signal_handler, uint32_t pending_signals);
+
   // Post a signal to the guest, the host, or both.
   // See futex(2) FUTEX_WAKE for details.
   //
@@ -128,8 +163,27 @@ class RegionView : public RegionSignalingInterface {
   void SendSignalToPeer(std::atomic<uint32_t>* signal_addr, bool round_trip);
 
   // Waits until an interrupt appears on this region, then clears the
-  // interrupted flag and returns.
-  void WaitForInterrupt();
+  // interrupted flag and returns which parts of the incoming signal table
+  // have pending signals.
+  uint32_t WaitForInterrupt();
+
+  // Sets how incoming interrupts are coalesced. Call before StartWorker().
+  void SetSignalCoalescing(const SignalCoalescing& coalescing) {
+    coalescing_ = coalescing;
+  }
+
+  // Sets an eventfd that the worker increments each time it has processed
+  // signals from the peer, so an event loop can poll it instead of blocking
+  // in WaitForSignal(). Call before StartWorker().
+  void SetSignalEventFd(cvd::SharedFD event_fd) {
+    signal_event_fd_ = event_fd;
+  }
+
+  // Increments the eventfd set by SetSignalEventFd(), if any.
+  void NotifySignalEventFd();
+
+  // Returns the signal counters for this view.
+  SignalStats GetSignalStats() const;
 
   // This implements the following:
   // if (*signal_addr == last_observed_value)
@@ -209,6 +263,26 @@ class RegionView : public RegionSignalingInterface {
 
   std::shared_ptr<RegionControl> control_;
   void* region_base_{};
+
+ private:
+  bool MaybeInterruptPeer(uint32_t pending_signals);
+  void ScanSignalTable(const std::function<void(uint32_t)>& signal_handler,
+                       uint32_t pending_signals);
+  void WaitForMoreSignals(std::atomic<uint32_t>* signalled,
+                          uint32_t pending_signals,
+                          std::chrono::steady_clock::time_point deadline);
+
+  SignalCoalescing coalescing_;
+  // Only used by the thread that waits for interrupts
+  std::chrono::steady_clock::time_point last_interrupt_;
+  std::atomic<uint32_t> self_interrupts_{};
+  cvd::SharedFD signal_event_fd_;
+
+  std::atomic<uint64_t> signals_sent_{};
+  std::atomic<uint64_t> interrupts_raised_{};
+  std::atomic<uint64_t> collisions_{};
+  std::atomic<uint64_t> scans_{};
+  std::atomic<uint64_t> nodes_scanned_{};
 };
 
 }  // namespace vsoc
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "common/vsoc/lib/region_view.h"
+
+namespace {
+
+constexpr uint32_t kRegionSize = 64 * 1024;
+constexpr uint32_t kNumNodesLg2 = 8;
+constexpr uint32_t kNumNodes = 1 << kNumNodesLg2;
+// The table is split in 16 chunks, each with its own pending signals bit
+constexpr uint32_t kNodesPerChunk = kNumNodes / 16;
+constexpr uint32_t kGuestToHostNodes = 0x1000;
+constexpr uint32_t kGuestToHostSignalled = 0x100;
+constexpr uint32_t kHostToGuestNodes = 0x2000;
+constexpr uint32_t kHostToGuestSignalled = 0x104;
+// Signal addresses start here. An address kNumNodes words further on hashes
+// to the same node.
+constexpr uint32_t kSignalsOffset = 0x8000;
+constexpr uint32_t kCollidingStride = kNumNodes * sizeof(uint32_t);
+
+// The bits of interrupt_signalled, as set by RegionView
+constexpr uint32_t kScanAllSignals = 1;
+constexpr uint32_t kDrainingSignals = 1u << 31;
+constexpr uint32_t ChunkBit(uint32_t chunk) { return 1u << (1 + chunk); }
+
+// Returns the offset of a signal address that hashes to the given node
+constexpr uint32_t SignalOffset(uint32_t node) {
+  return kSignalsOffset + node * sizeof(uint32_t);
+}
+
+// Two of these, one for each side, share the same memory. Interrupts are
+// left to the interrupt_signalled words.
+class FakeRegionControl : public vsoc::RegionControl {
+ public:
+  FakeRegionControl(void* base, bool host) : host_(host) {
+    region_base_ = base;
+    region_desc_.region_end_offset = kRegionSize;
+    region_desc_.offset_of_region_data = kSignalsOffset;
+    region_desc_.guest_to_host_signal_table = {
+        kNumNodesLg2, kGuestToHostNodes, kGuestToHostSignalled};
+    region_desc_.host_to_guest_signal_table = {
+        kNumNodesLg2, kHostToGuestNodes, kHostToGuestSignalled};
+  }
+
+  // The memory belongs to the test
+  ~FakeRegionControl() { region_base_ = nullptr; }
+
+  const vsoc_signal_table_layout& incoming_signal_table() const {
+    return host_ ? region_desc_.guest_to_host_signal_table
+                 : region_desc_.host_to_guest_signal_table;
+  }
+
+  const vsoc_signal_table_layout& outgoing_signal_table() const {
+    return host_ ? region_desc_.host_to_guest_signal_table
+                 : region_desc_.guest_to_host_signal_table;
+  }
+
+  int CreateFdScopedPermission(const char*, uint32_t, uint32_t, uint32_t,
+                               uint32_t) override {
+    return -1;
+  }
+  bool InterruptPeer() override { return true; }
+  void InterruptSelf() override {}
+  void* Map() override { return region_base_; }
+  void WaitForInterrupt() override {}
+  int SignalSelf(uint32_t) override { return 0; }
+  int WaitForSignal(uint32_t, uint32_t) override { return 0; }
+
+ private:
+  bool host_;
+};
+
+class TestRegionView : public vsoc::RegionView {
+ public:
+  explicit TestRegionView(std::shared_ptr<FakeRegionControl> control) {
+    control_ = control;
+    region_base_ = control->Map();
+  }
+
+  std::atomic<uint32_t>* At(uint32_t offset) {
+    return region_offset_to_pointer<std::atomic<uint32_t>>(offset);
+  }
+};
+
+}  // namespace
+
+// The host and the guest each define these alongside their RegionControl.
+// The views here are built around FakeRegionControl instead.
+#if defined(CUTTLEFISH_HOST)
+std::shared_ptr<vsoc::RegionControl> vsoc::RegionControl::Open(const char*,
+                                                               const char*) {
+  return nullptr;
+}
+#else
+std::shared_ptr<vsoc::RegionControl> vsoc::RegionControl::Open(const char*) {
+  return nullptr;
+}
+#endif
+
+const vsoc_signal_table_layout& vsoc::RegionView::incoming_signal_table() {
+  return static_cast<FakeRegionControl*>(control_.get())
+      ->incoming_signal_table();
+}
+
+const vsoc_signal_table_layout& vsoc::RegionView::outgoing_signal_table() {
+  return static_cast<FakeRegionControl*>(control_.get())
+      ->outgoing_signal_table();
+}
+
+namespace {
+
+// The host posts signals, the guest scans for them.
+class RegionViewSignalTest : public ::testing::Test {
+ protected:
+  RegionViewSignalTest()
+      : memory_(kRegionSize / sizeof(uint32_t)),
+        host_(std::make_shared<FakeRegionControl>(memory_.data(), true)),
+        guest_(std::make_shared<FakeRegionControl>(memory_.data(), false)) {}
+
+  std::atomic<uint32_t>* GuestSignalled() {
+    return guest_.At(kHostToGuestSignalled);
+  }
+
+  std::atomic<uint32_t>* GuestNode(uint32_t node) {
+    return guest_.At(kHostToGuestNodes + node * sizeof(uint32_t));
+  }
+
+  void Post(uint32_t offset) {
+    host_.SendSignalToPeer(host_.At(offset), false /* round_trip */);
+  }
+
+  // Handles the pending signals the way the guest's worker does, returning
+  // the offsets that were signalled
+  std::vector<uint32_t> Drain() {
+    std::vector<uint32_t> offsets;
+    guest_.ProcessSignalsFromPeer(
+        [&offsets](uint32_t offset) { offsets.push_back(offset); },
+        guest_.WaitForInterrupt());
+    std::sort(offsets.begin(), offsets.end());
+    return offsets;
+  }
+
+  std::vector<uint32_t> memory_;
+  TestRegionView host_;
+  TestRegionView guest_;
+};
+
+TEST_F(RegionViewSignalTest, ScansOnlyFlaggedChunks) {
+  const uint32_t first = SignalOffset(3 * kNodesPerChunk + 5);
+  const uint32_t second = SignalOffset(3 * kNodesPerChunk + 9);
+  Post(first);
+  EXPECT_EQ(ChunkBit(3), GuestSignalled()->load());
+  // The interrupt is still pending, so this one doesn't raise another
+  Post(second);
+  auto host_stats = host_.GetSignalStats();
+  EXPECT_EQ(2u, host_stats.signals_sent);
+  EXPECT_EQ(1u, host_stats.interrupts_raised);
+
+  // Nothing flags the chunk this is in, so the scan leaves it alone
+  const uint32_t unflagged_node = 9 * kNodesPerChunk;
+  GuestNode(unflagged_node)->store(SignalOffset(unflagged_node));
+
+  EXPECT_EQ((std::vector<uint32_t>{first, second}), Drain());
+  EXPECT_EQ(0u, GuestSignalled()->load());
+  EXPECT_EQ(SignalOffset(unflagged_node), GuestNode(unflagged_node)->load());
+  auto guest_stats = guest_.GetSignalStats();
+  EXPECT_EQ(1u, guest_stats.scans);
+  EXPECT_EQ(kNodesPerChunk, guest_stats.nodes_scanned);
+}
+
+TEST_F(RegionViewSignalTest, CollisionSpillsIntoNextChunk) {
+  // Both hash to the last node of chunk 2, the second one moves on to the
+  // first node of chunk 3
+  const uint32_t first = SignalOffset(3 * kNodesPerChunk - 1);
+  const uint32_t second = first + kCollidingStride;
+  Post(first);
+  Post(second);
+  EXPECT_EQ(ChunkBit(2) | ChunkBit(3), GuestSignalled()->load());
+  EXPECT_EQ(1u, host_.GetSignalStats().collisions);
+  EXPECT_EQ(second, GuestNode(3 * kNodesPerChunk)->load());
+
+  EXPECT_EQ((std::vector<uint32_t>{first, second}), Drain());
+  EXPECT_EQ(2 * kNodesPerChunk, guest_.GetSignalStats().nodes_scanned);
+}
+
+TEST_F(RegionViewSignalTest, CollisionWrapsToFirstChunk) {
+  const uint32_t first = SignalOffset(kNumNodes - 1);
+  const uint32_t second = first + kCollidingStride;
+  Post(first);
+  Post(second);
+  EXPECT_EQ(ChunkBit(15) | ChunkBit(0), GuestSignalled()->load());
+  EXPECT_EQ(second, GuestNode(0)->load());
+
+  EXPECT_EQ((std::vector<uint32_t>{first, second}), Drain());
+}
+
+TEST_F(RegionViewSignalTest, OldPeerSettingOnlyBitZeroGetsFullScan) {
+  // An older peer stores the offset and only sets bit 0
+  const uint32_t node = 7 * kNodesPerChunk + 2;
+  GuestNode(node)->store(SignalOffset(node));
+  GuestSignalled()->store(kScanAllSignals);
+
+  EXPECT_EQ((std::vector<uint32_t>{SignalOffset(node)}), Drain());
+  EXPECT_EQ(0u, GuestSignalled()->load());
+  EXPECT_EQ(kNumNodes, guest_.GetSignalStats().nodes_scanned);
+}
+
+TEST_F(RegionViewSignalTest, DrainingPicksUpSignalsPostedMeanwhile) {
+  vsoc::RegionView::SignalCoalescing coalescing;
+  coalescing.suppress_while_draining = true;
+  guest_.SetSignalCoalescing(coalescing);
+
+  const uint32_t first = SignalOffset(1 * kNodesPerChunk);
+  const uint32_t second = SignalOffset(6 * kNodesPerChunk);
+  const uint32_t third = SignalOffset(0);
+  Post(first);
+  uint32_t pending = guest_.WaitForInterrupt();
+  EXPECT_EQ(ChunkBit(1) | kDrainingSignals, pending);
+  EXPECT_EQ(kDrainingSignals, GuestSignalled()->load());
+
+  // The host keeps posting while the guest drains: second during the first
+  // scan, third during the re-scan that picks up second
+  std::vector<uint32_t> offsets;
+  guest_.ProcessSignalsFromPeer(
+      [&](uint32_t offset) {
+        offsets.push_back(offset);
+        if (offset == first) {
+          Post(second);
+        } else if (offset == second) {
+          Post(third);
+        }
+      },
+      pending);
+  EXPECT_EQ((std::vector<uint32_t>{first, second, third}), offsets);
+  // None of them raised an interrupt of its own
+  EXPECT_EQ(1u, host_.GetSignalStats().interrupts_raised);
+  EXPECT_EQ(0u, GuestSignalled()->load());
+  EXPECT_EQ(3u, guest_.GetSignalStats().scans);
+}
+
+TEST_F(RegionViewSignalTest, BatchingWindowEndsOnNextSignal) {
+  vsoc::RegionView::SignalCoalescing coalescing;
+  coalescing.batching_window = std::chrono::seconds(2);
+  guest_.SetSignalCoalescing(coalescing);
+
+  // The first interrupt is handled right away
+  Post(SignalOffset(0));
+  Drain();
+
+  Post(SignalOffset(4 * kNodesPerChunk));
+  std::thread peer([this] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    Post(SignalOffset(5 * kNodesPerChunk));
+  });
+  auto start = std::chrono::steady_clock::now();
+  uint32_t pending = guest_.WaitForInterrupt();
+  auto waited = std::chrono::steady_clock::now() - start;
+  peer.join();
+  EXPECT_EQ(ChunkBit(4) | ChunkBit(5), pending);
+  EXPECT_LT(waited, std::chrono::seconds(1));
+}
+
+TEST_F(RegionViewSignalTest, InterruptSelfEndsBatchingWindow) {
+  vsoc::RegionView::SignalCoalescing coalescing;
+  coalescing.batching_window = std::chrono::seconds(2);
+  guest_.SetSignalCoalescing(coalescing);
+
+  Post(SignalOffset(0));
+  Drain();
+
+  Post(SignalOffset(4 * kNodesPerChunk));
+  std::thread stopper([this] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    guest_.InterruptSelf();
+  });
+  auto start = std::chrono::steady_clock::now();
+  uint32_t pending = guest_.WaitForInterrupt();
+  auto waited = std::chrono::steady_clock::now() - start;
+  stopper.join();
+  EXPECT_EQ(ChunkBit(4), pending);
+  EXPECT_LT(waited, std::chrono::seconds(1));
+}
+
+}  // namespace
@@ -16,5 +16,9 @@
 
 #include "common/vsoc/shm/socket_forward_layout.h"
 
+// Region versions are deprecated, so the name carries the queue protocol
+// instead: it changed when the queues became single producer, single
+// consumer, and builds on either side of that fail to find each other's
+// region rather than share it.
 const char* vsoc::layout::socket_forward::SocketForwardLayout::region_name =
-  "socket_forward";
+  "socket_forward2";
@@ -14,7 +14,9 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
 #include "common/vsoc/lib/circqueue_impl.h"
 #include "common/vsoc/lib/lock_guard.h"
@@ -72,16 +74,8 @@ bool SocketForwardRegionView::Send(int connection_id, const Packet& packet) {
   CHECK(!packet.empty());
   CHECK_LE(packet.payload_length(), kMaxPayloadSize);
 
-  // NOTE this is check-then-act but I think that it's okay. Worst case is that
-  // we send one-too-many packets.
-  auto& queue_pair = data()->queues_[connection_id];
-  {
-    auto guard = make_lock_guard(&queue_pair.queue_state_lock_);
-    if ((queue_pair.*WriteDirection).queue_state_ == kOtherSideClosed) {
-      LOG(INFO) << "connection closed, not sending\n";
-      return false;
-    }
-    CHECK((queue_pair.*WriteDirection).queue_state_ != QueueState::INACTIVE);
+  if (!CanSend(connection_id)) {
+    return false;
   }
   // TODO(haining) set packet generation number
   (data()->queues_[connection_id].*WriteDirection)
@@ -89,6 +83,139 @@ bool SocketForwardRegionView::Send(int connection_id, const Packet& packet) {
   return true;
 }
 
+int SocketForwardRegionView::TrySend(int connection_id, const Packet& packet) {
+  if (!CanSend(connection_id)) {
+    return -1;
+  }
+  auto rval =
+      (data()->queues_[connection_id].*WriteDirection)
+          .queue.Write(this, packet.raw_data(), packet.raw_data_length(),
+                       true /* non_blocking */);
+  return rval < 0 ? rval : 0;
+}
+
+namespace {
+using PacketSpans = decltype(Queue::queue)::PacketSpans;
+
+// Splits spans at offset into the part before it, which must fit in head,
+// and the part after it, which goes to tail. Returns the number of iovecs
+// used in tail; the unused ones are left empty.
+int SplitSpans(const iovec* spans, size_t offset, iovec* head, iovec* tail) {
+  int tail_count = 0;
+  size_t head_size = offset;
+  for (int i = 0; i < 2; ++i) {
+    auto* base = static_cast<char*>(spans[i].iov_base);
+    size_t len = spans[i].iov_len;
+    size_t in_head = std::min(head_size, len);
+    head[i].iov_base = base;
+    head[i].iov_len = in_head;
+    head_size -= in_head;
+    if (len > in_head) {
+      tail[tail_count].iov_base = base + in_head;
+      tail[tail_count].iov_len = len - in_head;
+      ++tail_count;
+    }
+  }
+  for (int i = tail_count; i < 2; ++i) {
+    tail[i].iov_base = nullptr;
+    tail[i].iov_len = 0;
+  }
+  return tail_count;
+}
+
+// Copies the header of the packet of the given size out of spans, as it may
+// wrap around the end of the queue too, and points payload at the rest.
+// Returns the number of iovecs used in payload.
+int ReadHeader(const PacketSpans& spans, intptr_t size,
+               vsoc::socket_forward::Header* header, iovec* payload) {
+  CHECK_GE(size, static_cast<intptr_t>(sizeof *header))
+      << "invalid packet size";
+  iovec header_spans[2];
+  int payload_count =
+      SplitSpans(spans.iov, sizeof *header, header_spans, payload);
+  memcpy(header, header_spans[0].iov_base, header_spans[0].iov_len);
+  memcpy(reinterpret_cast<char*>(header) + header_spans[0].iov_len,
+         header_spans[1].iov_base, header_spans[1].iov_len);
+  return payload_count;
+}
+}  // namespace
+
+bool SocketForwardRegionView::RecvInPlace(int connection_id,
+                                          const PayloadFunction& drain) {
+  auto& queue = (data()->queues_[connection_id].*ReadDirection).queue;
+  while (true) {
+    PacketSpans spans;
+    auto size = queue.PeekRead(this, &spans);
+    Header header;
+    iovec payload_spans[2];
+    int payload_count = ReadHeader(spans, size, &header, payload_spans);
+    if (header.message_type == Header::BEGIN) {
+      queue.ReleaseRead(this, spans);
+      continue;
+    }
+    if (header.message_type == Header::END) {
+      queue.ReleaseRead(this, spans);
+      return false;
+    }
+    CHECK_NE(header.payload_length, 0u) << "zero-size data message received";
+    CHECK_EQ(header.payload_length, static_cast<size_t>(size) - sizeof header)
+        << "invalid size";
+    drain(payload_spans, payload_count);
+    queue.ReleaseRead(this, spans);
+    return true;
+  }
+}
+
+ssize_t SocketForwardRegionView::SendInPlace(int connection_id,
+                                             const PayloadFunction& fill,
+                                             bool non_blocking) {
+  if (!CanSend(connection_id)) {
+    return -1;
+  }
+  auto& queue = (data()->queues_[connection_id].*WriteDirection).queue;
+  PacketSpans spans;
+  // Only wait for room for a byte of payload, fill gets whatever is free
+  auto reserved = queue.ReserveWriteUpTo(this, sizeof(Header) + 1,
+                                         sizeof(Packet), &spans, non_blocking);
+  if (reserved == -EWOULDBLOCK) {
+    return reserved;
+  }
+  CHECK_GT(reserved, static_cast<intptr_t>(sizeof(Header)));
+  iovec header_spans[2];
+  iovec payload_spans[2];
+  int payload_count =
+      SplitSpans(spans.iov, sizeof(Header), header_spans, payload_spans);
+  auto size = fill(payload_spans, payload_count);
+  if (size <= 0) {
+    queue.CancelWrite();
+    return size;
+  }
+  CHECK_LE(size, static_cast<ssize_t>(reserved - sizeof(Header)));
+  // TODO(haining) set packet generation number
+  Header header{};
+  header.payload_length = size;
+  header.message_type = Header::DATA;
+  memcpy(header_spans[0].iov_base, &header, header_spans[0].iov_len);
+  memcpy(header_spans[1].iov_base,
+         reinterpret_cast<char*>(&header) + header_spans[0].iov_len,
+         header_spans[1].iov_len);
+  queue.CommitWrite(this, spans, sizeof header + size);
+  return size;
+}
+
+bool SocketForwardRegionView::CanSend(int connection_id) {
+  // NOTE this is check-then-act but I think that it's okay. Worst case is that
+  // we send one-too-many packets.
+  auto& queue_pair = data()->queues_[connection_id];
+  auto guard = make_lock_guard(&queue_pair.queue_state_lock_);
+  if ((queue_pair.*WriteDirection).queue_state_ == kOtherSideClosed) {
+    LOG(INFO) << "connection closed, not sending\n";
+    return false;
+  }
+  CHECK((queue_pair.*WriteDirection).queue_state_ != QueueState::INACTIVE);
+  return true;
+}
+
 void SocketForwardRegionView::IgnoreUntilBegin(int connection_id,
                                                std::uint32_t generation) {
   Packet packet{};
@@ -173,27 +300,30 @@ void SocketForwardRegionView::CleanUpPreviousConnections() {
 
 void SocketForwardRegionView::MarkQueueDisconnected(
     int connection_id, Queue QueuePair::*direction) {
-  auto& queue_pair = data()->queues_[connection_id];
-  auto& queue = queue_pair.*direction;
-
-#ifdef CUTTLEFISH_HOST
   // if the host has connected but the guest hasn't seen it yet, wait for the
   // guest to connect so the protocol can follow the normal state transition.
-  while (true) {
-    auto guard = make_lock_guard(&queue_pair.queue_state_lock_);
-    if (queue.queue_state_ != QueueState::HOST_CONNECTED) {
-      break;
-    }
+  while (!TryMarkQueueDisconnected(connection_id, direction)) {
     LOG(WARNING) << "closing queue in HOST_CONNECTED state. waiting";
     sleep(1);
   }
-#endif
+}
 
+bool SocketForwardRegionView::TryMarkQueueDisconnected(
+    int connection_id, Queue QueuePair::*direction) {
+  auto& queue_pair = data()->queues_[connection_id];
+  auto& queue = queue_pair.*direction;
   auto guard = make_lock_guard(&queue_pair.queue_state_lock_);
 
+#ifdef CUTTLEFISH_HOST
+  if (queue.queue_state_ == QueueState::HOST_CONNECTED) {
+    return false;
+  }
+#endif
+
   queue.queue_state_ = queue.queue_state_ == kOtherSideClosed
                            ? QueueState::INACTIVE
                            : kThisSideClosed;
+  return true;
 }
 
 void SocketForwardRegionView::MarkSendQueueDisconnected(int connection_id) {
@@ -215,28 +345,36 @@ std::uint32_t SocketForwardRegionView::generation() {
 #ifdef CUTTLEFISH_HOST
 int SocketForwardRegionView::AcquireConnectionID(int port) {
   while (true) {
-    int id = 0;
-    for (auto&& queue_pair : data()->queues_) {
-      LOG(DEBUG) << "locking and checking queue at index " << id;
-      auto guard = make_lock_guard(&queue_pair.queue_state_lock_);
-      if (queue_pair.host_to_guest.queue_state_ == QueueState::INACTIVE &&
-          queue_pair.guest_to_host.queue_state_ == QueueState::INACTIVE) {
-        queue_pair.port_ = port;
-        queue_pair.host_to_guest.queue_state_ = QueueState::HOST_CONNECTED;
-        queue_pair.guest_to_host.queue_state_ = QueueState::HOST_CONNECTED;
-        LOG(DEBUG) << "acquired queue " << id
-                   << ". current seq_num: " << data()->seq_num;
-        ++data()->seq_num;
-        SendSignal(layout::Sides::Peer, &data()->seq_num);
-        return id;
-      }
-      ++id;
+    int id = TryAcquireConnectionID(port);
+    if (id >= 0) {
+      return id;
     }
     LOG(ERROR) << "no remaining shm queues for connection, sleeping.";
     sleep(10);
   }
 }
 
+int SocketForwardRegionView::TryAcquireConnectionID(int port) {
+  int id = 0;
+  for (auto&& queue_pair : data()->queues_) {
+    LOG(DEBUG) << "locking and checking queue at index " << id;
+    auto guard = make_lock_guard(&queue_pair.queue_state_lock_);
+    if (queue_pair.host_to_guest.queue_state_ == QueueState::INACTIVE &&
+        queue_pair.guest_to_host.queue_state_ == QueueState::INACTIVE) {
+      queue_pair.port_ = port;
+      queue_pair.host_to_guest.queue_state_ = QueueState::HOST_CONNECTED;
+      queue_pair.guest_to_host.queue_state_ = QueueState::HOST_CONNECTED;
+      LOG(DEBUG) << "acquired queue " << id
+                 << ". current seq_num: " << data()->seq_num;
+      ++data()->seq_num;
+      SendSignal(layout::Sides::Peer, &data()->seq_num);
+      return id;
+    }
+    ++id;
+  }
+  return -1;
+}
+
 std::pair<SocketForwardRegionView::Sender, SocketForwardRegionView::Receiver>
 SocketForwardRegionView::OpenConnection(int port) {
   int connection_id = AcquireConnectionID(port);
@@ -245,12 +383,38 @@ SocketForwardRegionView::OpenConnection(int port) {
   return {Sender{this, connection_id, current_generation},
           Receiver{this, connection_id, current_generation}};
 }
+
+std::unique_ptr<SocketForwardRegionView::Connection>
+SocketForwardRegionView::TryOpenConnection(int port) {
+  int connection_id = TryAcquireConnectionID(port);
+  if (connection_id < 0) {
+    return nullptr;
+  }
+  LOG(INFO) << "Acquired connection with id " << connection_id;
+  return std::unique_ptr<Connection>(
+      new Connection(this, connection_id, generation()));
+}
 #else
 int SocketForwardRegionView::GetWaitingConnectionID() {
   while (data()->seq_num == last_seq_number_) {
     WaitForSignal(&data()->seq_num, last_seq_number_);
   }
   ++last_seq_number_;
+  return FindWaitingConnectionID();
+}
+
+int SocketForwardRegionView::TryGetWaitingConnectionID() {
+  while (data()->seq_num != last_seq_number_) {
+    ++last_seq_number_;
+    int id = FindWaitingConnectionID();
+    if (id >= 0) {
+      return id;
+    }
+  }
+  return -1;
+}
+
+int SocketForwardRegionView::FindWaitingConnectionID() {
   int id = 0;
   for (auto&& queue_pair : data()->queues_) {
     LOG(DEBUG) << "locking and checking queue at index " << id;
@@ -280,6 +444,17 @@ SocketForwardRegionView::AcceptConnection() {
   return {Sender{this, connection_id, current_generation},
           Receiver{this, connection_id, current_generation}};
 }
+
+std::unique_ptr<SocketForwardRegionView::Connection>
+SocketForwardRegionView::TryAcceptConnection() {
+  int connection_id = TryGetWaitingConnectionID();
+  if (connection_id < 0) {
+    return nullptr;
+  }
+  LOG(INFO) << "Accepted connection with id " << connection_id;
+  return std::unique_ptr<Connection>(
+      new Connection(this, connection_id, generation()));
+}
 #endif
 
 // --- Connection ---- //
@@ -291,6 +466,15 @@ void SocketForwardRegionView::Receiver::Recv(Packet* packet) {
   return view_->Recv(connection_id_, packet);
 }
 
+bool SocketForwardRegionView::Receiver::RecvInPlace(
+    const PayloadFunction& drain) {
+  if (!got_begin_) {
+    view_->IgnoreUntilBegin(connection_id_, generation_);
+    got_begin_ = true;
+  }
+  return view_->RecvInPlace(connection_id_, drain);
+}
+
 bool SocketForwardRegionView::Sender::closed() const {
   return view_->IsOtherSideRecvClosed(connection_id_);
 }
@@ -298,3 +482,116 @@ bool SocketForwardRegionView::Sender::closed() const {
 bool SocketForwardRegionView::Sender::Send(const Packet& packet) {
   return view_->Send(connection_id_, packet);
 }
+
+ssize_t SocketForwardRegionView::Sender::SendInPlace(
+    const PayloadFunction& fill) {
+  return view_->SendInPlace(connection_id_, fill);
+}
+
+SocketForwardRegionView::Connection::~Connection() {
+  if (!send_closed_) {
+    view_->MarkSendQueueDisconnected(connection_id_);
+  }
+  if (!recv_closed_) {
+    view_->MarkRecvQueueDisconnected(connection_id_);
+  }
+}
+
+ssize_t SocketForwardRegionView::Connection::Send(
+    const PayloadFunction& fill) {
+  if (!sent_begin_) {
+    auto packet = Packet::MakeBegin();
+    packet.set_generation(generation_);
+    auto rval = view_->TrySend(connection_id_, packet);
+    if (rval < 0) {
+      return rval;
+    }
+    sent_begin_ = true;
+  }
+  return view_->SendInPlace(connection_id_, fill, true /* non_blocking */);
+}
+
+int SocketForwardRegionView::Connection::CloseSend() {
+  if (send_closed_) {
+    return 0;
+  }
+  // The other side waits for a BEGIN before it looks for the END. Neither
+  // needs to be sent if the other side is closed already.
+  auto send_marker = [this](Packet packet, bool* sent) {
+    if (!*sent) {
+      packet.set_generation(generation_);
+      if (view_->TrySend(connection_id_, packet) == -EWOULDBLOCK) {
+        return false;
+      }
+      *sent = true;
+    }
+    return true;
+  };
+  if (!send_marker(Packet::MakeBegin(), &sent_begin_) ||
+      !send_marker(Packet::MakeEnd(), &sent_end_)) {
+    return -EWOULDBLOCK;
+  }
+  if (!view_->TryMarkQueueDisconnected(connection_id_, WriteDirection)) {
+    return -EWOULDBLOCK;
+  }
+  send_closed_ = true;
+  return 0;
+}
+
+ssize_t SocketForwardRegionView::Connection::Recv(
+    const PayloadFunction& drain) {
+  auto& queue = (view_->data()->queues_[connection_id_].*ReadDirection).queue;
+  while (!got_end_) {
+    PacketSpans spans;
+    auto size = queue.PeekRead(view_, &spans, true /* non_blocking */);
+    if (size == -EWOULDBLOCK) {
+      return size;
+    }
+    Header header;
+    iovec payload_spans[2];
+    ReadHeader(spans, size, &header, payload_spans);
+    if (header.message_type == Header::BEGIN) {
+      got_begin_ = got_begin_ || header.generation >= generation_;
+      queue.ReleaseRead(view_, spans);
+      continue;
+    }
+    if (!got_begin_) {
+      // Left over from an earlier connection on this queue
+      queue.ReleaseRead(view_, spans);
+      continue;
+    }
+    if (header.message_type == Header::END) {
+      queue.ReleaseRead(view_, spans);
+      got_end_ = true;
+      break;
+    }
+    CHECK_NE(header.payload_length, 0u) << "zero-size data message received";
+    CHECK_EQ(header.payload_length, static_cast<size_t>(size) - sizeof header)
+        << "invalid size";
+    iovec drained[2];
+    iovec rest[2];
+    int rest_count = SplitSpans(payload_spans, recv_offset_, drained, rest);
+    auto rval = drain(rest, rest_count);
+    if (rval > 0) {
+      recv_offset_ += rval;
+    }
+    if (rval < 0 || recv_offset_ < header.payload_length) {
+      queue.CancelRead();
+      return rval;
+    }
+    recv_offset_ = 0;
+    queue.ReleaseRead(view_, spans);
+    return rval;
+  }
+  return 0;
+}
+
+int SocketForwardRegionView::Connection::CloseRecv() {
+  if (!recv_closed_) {
+    if (!view_->TryMarkQueueDisconnected(connection_id_, ReadDirection)) {
+      return -EWOULDBLOCK;
+    }
+    recv_closed_ = true;
+  }
+  return 0;
+}
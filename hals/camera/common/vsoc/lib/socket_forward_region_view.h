@@ -15,6 +15,9 @@
  */
 #pragma once
 
+#include <sys/uio.h>
+
+#include <functional>
 #include <utility>
 #include <vector>
 #include <memory>
@@ -100,17 +103,45 @@ static_assert(std::is_pod<Packet>{}, "");
 class SocketForwardRegionView
     : public TypedRegionView<SocketForwardRegionView,
                              layout::socket_forward::SocketForwardLayout> {
+ public:
+  // Fills or consumes a data payload in place in shared memory. Like
+  // readv()/writev(), it is given up to two iovecs and returns the number of
+  // bytes it handled, or a negative value on error. It runs with the packet
+  // reserved in the queue, so it must not block: wait for the data, e.g.
+  // with poll(), before sending.
+  using PayloadFunction = std::function<ssize_t(const iovec* iov,
+                                                int iov_count)>;
+
  private:
 #ifdef CUTTLEFISH_HOST
   int AcquireConnectionID(int port);
+  // Returns -1 instead of waiting if all the queues are in use
+  int TryAcquireConnectionID(int port);
 #else
   int GetWaitingConnectionID();
+  // Returns -1 instead of waiting if the host hasn't opened a connection
+  int TryGetWaitingConnectionID();
+  int FindWaitingConnectionID();
 #endif
 
   // Returns an empty data packet if the other side is closed.
   void Recv(int connection_id, Packet* packet);
   // Returns true on success
   bool Send(int connection_id, const Packet& packet);
+  // Non-blocking Send(). Returns 0 on success, -1 if the other side is
+  // closed, or -EWOULDBLOCK if the queue has no room for the packet.
+  int TrySend(int connection_id, const Packet& packet);
+
+  // Zero-copy versions of Recv() and Send(), see Receiver::RecvInPlace() and
+  // Sender::SendInPlace(). SendInPlace() only waits for room for one byte of
+  // payload, and hands fill as much room as is free. With non_blocking it
+  // returns -EWOULDBLOCK instead, without calling fill.
+  bool RecvInPlace(int connection_id, const PayloadFunction& drain);
+  ssize_t SendInPlace(int connection_id, const PayloadFunction& fill,
+                      bool non_blocking = false);
+
+  // Returns false if the other side has closed the connection
+  bool CanSend(int connection_id);
 
   // skip everything in the connection queue until seeing a BEGIN for the
   // current generation
@@ -123,6 +154,12 @@ class SocketForwardRegionView
   void MarkQueueDisconnected(int connection_id,
                              layout::socket_forward::Queue
                                  layout::socket_forward::QueuePair::*direction);
+  // Returns false instead of waiting if the guest hasn't seen the connection
+  // yet
+  bool TryMarkQueueDisconnected(
+      int connection_id,
+      layout::socket_forward::Queue
+          layout::socket_forward::QueuePair::*direction);
 
  public:
   // Helper class that will send a ConnectionBegin marker when constructed and a
@@ -147,6 +184,11 @@ class SocketForwardRegionView
 
     // Returns true on success
     bool Send(const Packet& packet);
+    // Sends a data packet whose payload fill writes straight into the queue,
+    // at most kMaxPayloadSize bytes, or less if the queue is fuller. Returns
+    // what fill returned. Nothing is sent if that is 0 or less, or -1 if the
+    // connection is closed.
+    ssize_t SendInPlace(const PayloadFunction& fill);
     int port() const { return view_->port(connection_id_); }
 
    private:
@@ -186,6 +228,10 @@ class SocketForwardRegionView
     ~Receiver() = default;
 
     void Recv(Packet* packet);
+    // Hands the payload of the next data packet to drain in place in the
+    // queue, then drops the packet. Returns false, without calling drain, on
+    // the end of the connection.
+    bool RecvInPlace(const PayloadFunction& drain);
     int port() const { return view_->port(connection_id_); }
 
    private:
@@ -207,6 +253,58 @@ class SocketForwardRegionView
     bool got_begin_ = false;
   };
 
+  // Both directions of a connection, for a thread that serves many of them
+  // from an event loop. Calls never wait for the other side: they return
+  // -EWOULDBLOCK instead, and should be retried once the other side signals
+  // the region, see RegionView::SetSignalEventFd().
+  class Connection {
+   public:
+    Connection(SocketForwardRegionView* view, int connection_id,
+               std::uint32_t generation)
+        : view_{view}, connection_id_{connection_id}, generation_{generation} {}
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+    // Marks the directions that are still open as disconnected, without
+    // sending the END marker
+    ~Connection();
+
+    // Sends a data packet whose payload fill writes in place, like
+    // Sender::SendInPlace(), preceded by the BEGIN marker the first time.
+    // Returns what fill returned, -1 if the other side is closed, or
+    // -EWOULDBLOCK without calling fill if the queue is full.
+    ssize_t Send(const PayloadFunction& fill);
+    // Sends the END marker and marks the sending side disconnected. Returns
+    // 0, or -EWOULDBLOCK if either can't be done yet.
+    int CloseSend();
+    // Hands the payload of the next data packet to drain in place, like
+    // Receiver::RecvInPlace(). drain may take only the first part of it, in
+    // which case the rest is handed to it again by the next call, and the
+    // packet stays in the queue until then. Returns what drain returned, 0
+    // on the END marker, after which recv_ended() is true, or -EWOULDBLOCK
+    // if there is no packet.
+    ssize_t Recv(const PayloadFunction& drain);
+    // Marks the receiving side disconnected. Returns 0, or -EWOULDBLOCK if
+    // that can't be done yet.
+    int CloseRecv();
+
+    bool recv_ended() const { return got_end_; }
+    int port() const { return view_->port(connection_id_); }
+
+   private:
+    SocketForwardRegionView* view_;
+    int connection_id_;
+    std::uint32_t generation_;
+    bool sent_begin_ = false;
+    bool sent_end_ = false;
+    bool got_begin_ = false;
+    bool got_end_ = false;
+    bool send_closed_ = false;
+    bool recv_closed_ = false;
+    // How much of the payload of the packet at the head of the receive queue
+    // drain has already taken
+    std::uint32_t recv_offset_ = 0;
+  };
+
   SocketForwardRegionView() = default;
   ~SocketForwardRegionView() = default;
   SocketForwardRegionView(const SocketForwardRegionView&) = delete;
@@ -214,8 +312,12 @@ class SocketForwardRegionView
 
 #ifdef CUTTLEFISH_HOST
   std::pair<Sender, Receiver> OpenConnection(int port);
+  // Returns nullptr if all the queues are in use
+  std::unique_ptr<Connection> TryOpenConnection(int port);
 #else
   std::pair<Sender, Receiver> AcceptConnection();
+  // Returns nullptr if the host has no new connection waiting
+  std::unique_ptr<Connection> TryAcceptConnection();
 #endif
 
   int port(int connection_id);
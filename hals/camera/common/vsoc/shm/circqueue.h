@@ -18,23 +18,38 @@
 
 // Memory layout for byte-oriented circular queues
 
+#include <sys/uio.h>
+
 #include <atomic>
 #include <cstdint>
 #include "common/vsoc/shm/base.h"
 #include "common/vsoc/shm/lock.h"
 
-struct iovec;
-
 namespace vsoc {
 class RegionSignalingInterface;
 namespace layout {
 
 /**
- * Base classes for all spinlock protected circular queues.
+ * How the readers and writers of a circular queue are synchronized. This is
+ * part of the queue's type, so it is chosen in the layout headers. The
+ * guest and the host must agree on it, and both layouts have the same size.
+ */
+enum class QueueAccess : uint32_t {
+  // Any number of readers and writers on either side, serialized by the
+  // queue's spinlock.
+  Locked,
+  // At most one writer and one reader at a time, typically one on each side.
+  // The indexes are published with acquire/release atomics and the spinlock
+  // is never taken, so a preempted vCPU can't stall the other side.
+  SingleProducerSingleConsumer,
+};
+
+/**
+ * Base classes for all circular queues.
  * This class should be embedded in the per-region data structure that is used
  * as the parameter to TypedRegion.
  */
-template <uint32_t SizeLog2>
+template <uint32_t SizeLog2, QueueAccess Access = QueueAccess::Locked>
 class CircularQueueBase {
  public:
   static constexpr size_t layout_size = (1 << SizeLog2) + 12;
@@ -58,6 +73,21 @@ class CircularQueueBase {
   };
   static const uintptr_t BufferSize = (1 << SizeLog2);
 
+  /**
+   * Serialize the readers and writers of a Locked queue. These do nothing
+   * for a SingleProducerSingleConsumer queue.
+   */
+  void Lock() {
+    if (Access == QueueAccess::Locked) {
+      lock_.Lock();
+    }
+  }
+  void Unlock() {
+    if (Access == QueueAccess::Locked) {
+      lock_.Unlock();
+    }
+  }
+
   /**
    * Copy bytes from buffer_in into the part of the queue specified by Range.
    */
@@ -69,6 +99,13 @@ class CircularQueueBase {
    */
   void CopyOutRange(const Range& t, char* buffer_out);
 
+  /**
+   * Point spans[0] and spans[1] at the part of the queue specified by Range.
+   * spans[1] is only used when the range wraps around the end of the buffer,
+   * otherwise it is left empty.
+   */
+  void RangeToSpans(const Range& t, iovec* spans);
+
   /**
    * Wait until data becomes available in the queue. The caller must have
    * called Lock() before invoking this. The caller must call Unlock()
@@ -95,28 +132,36 @@ class CircularQueueBase {
   // Note: Both of these fields may hold values larger than the buffer size,
   // they should be interpreted modulo the buffer size. This fact along with the
   // buffer size being a power of two greatly simplyfies the index calculations.
-  // Advances when a reader has finished with buffer space
+  // Advances when a reader has finished with buffer space. Stored with
+  // release semantics after the reader is done with the space, and loaded
+  // with acquire semantics by writers.
   std::atomic<uint32_t> r_released_;
-  // Advances when buffer space is filled and ready for a reader
+  // Advances when buffer space is filled and ready for a reader. Stored with
+  // release semantics after the data is written, and loaded with acquire
+  // semantics by readers.
   std::atomic<uint32_t> w_pub_;
-  // Spinlock that protects the region. 0 means unlocked
+  // Spinlock that protects the region. 0 means unlocked. Unused, but kept
+  // in the layout, for SingleProducerSingleConsumer queues.
   SpinLock lock_;
   // The actual memory in the buffer
   char buffer_[BufferSize];
 };
 using CircularQueueBase64k = CircularQueueBase<16>;
 ASSERT_SHM_COMPATIBLE(CircularQueueBase64k);
+using SpscCircularQueueBase64k =
+    CircularQueueBase<16, QueueAccess::SingleProducerSingleConsumer>;
+ASSERT_SHM_COMPATIBLE(SpscCircularQueueBase64k);
 
 /**
  * Byte oriented circular queue. Reads will always return some data, but
  * may return less data than requested. Writes will always write all of the
  * data or return an error.
  */
-template <uint32_t SizeLog2>
-class CircularByteQueue : public CircularQueueBase<SizeLog2> {
+template <uint32_t SizeLog2, QueueAccess Access = QueueAccess::Locked>
+class CircularByteQueue : public CircularQueueBase<SizeLog2, Access> {
  public:
   static constexpr size_t layout_size =
-      CircularQueueBase<SizeLog2>::layout_size;
+      CircularQueueBase<SizeLog2, Access>::layout_size;
   /**
    * Read at most max_size bytes from the qeueue, placing them in buffer_out
    */
@@ -138,21 +183,25 @@ class CircularByteQueue : public CircularQueueBase<SizeLog2> {
   }
 
  protected:
-  using Range = typename CircularQueueBase<SizeLog2>::Range;
+  using Range = typename CircularQueueBase<SizeLog2, Access>::Range;
 };
 using CircularByteQueue64k = CircularByteQueue<16>;
 ASSERT_SHM_COMPATIBLE(CircularByteQueue64k);
+using SpscCircularByteQueue64k =
+    CircularByteQueue<16, QueueAccess::SingleProducerSingleConsumer>;
+ASSERT_SHM_COMPATIBLE(SpscCircularByteQueue64k);
 
 /**
  * Packet oriented circular queue. Reads will either return data or an error.
  * Each return from read corresponds to a call to write and returns all of the
  * data from that corresponding Write().
  */
-template <uint32_t SizeLog2, uint32_t MaxPacketSize>
-class CircularPacketQueue : public CircularQueueBase<SizeLog2> {
+template <uint32_t SizeLog2, uint32_t MaxPacketSize,
+          QueueAccess Access = QueueAccess::Locked>
+class CircularPacketQueue : public CircularQueueBase<SizeLog2, Access> {
  public:
   static constexpr size_t layout_size =
-      CircularQueueBase<SizeLog2>::layout_size;
+      CircularQueueBase<SizeLog2, Access>::layout_size;
 
   /**
    * Read a single packet from the queue, placing its data into buffer_out.
@@ -186,18 +235,111 @@ class CircularPacketQueue : public CircularQueueBase<SizeLog2> {
           size_t iov_count,
           bool non_blocking = false);
 
+  /**
+   * Reads up to packet_count packets with a single signal to the writers.
+   * packets[i] is the buffer for the i-th packet, and its iov_len is set to
+   * the size of the packet read into it. Waits until there is at least one
+   * packet, then reads the ones that are already in the queue.
+   * Returns the number of packets read. If the first packet doesn't fit in
+   * packets[0] this returns -ENOSPC and leaves it in the queue; a later
+   * packet that doesn't fit ends the batch instead.
+   */
+  intptr_t ReadMany(RegionSignalingInterface* r, iovec* packets,
+                    size_t packet_count);
+
+  /**
+   * Writes packets[0], packets[1], ... as separate packets, publishing them
+   * with a single signal to the readers. Writes as many as there is room for,
+   * waiting for room for the first one unless non_blocking is set.
+   * Returns the number of packets written. The first packet fails like
+   * Write(); a later packet that is too large ends the batch instead.
+   */
+  intptr_t WriteMany(RegionSignalingInterface* r, const iovec* packets,
+                     size_t packet_count, bool non_blocking = false);
+
+  /**
+   * A packet's payload, in place in the queue. The payload is split between
+   * iov[0] and iov[1] when it wraps around the end of the buffer, otherwise
+   * iov[1] is empty.
+   */
+  struct PacketSpans {
+    iovec iov[2];
+    // Where the packet starts in the queue, for the matching CommitWrite()
+    // or ReleaseRead()
+    uint32_t start_idx;
+  };
+
+  /**
+   * Reserves room for a packet of up to bytes in the queue and points spans
+   * at it, so the payload can be written in place. The packet is published
+   * by CommitWrite() or dropped by CancelWrite(), one of which must follow.
+   * Returns and fails like Write(). On a Locked queue the lock is held until
+   * then, so the payload should be ready to be filled in.
+   */
+  intptr_t ReserveWrite(RegionSignalingInterface* r, uint32_t bytes,
+                        PacketSpans* spans, bool non_blocking = false);
+
+  /**
+   * Like ReserveWrite(), but only waits for room for a packet of min_bytes,
+   * then reserves as much of max_bytes as fits. Returns the size reserved.
+   * For a writer that doesn't know how much it has until it fills the
+   * packet in, so that it isn't held up waiting for room it won't use.
+   */
+  intptr_t ReserveWriteUpTo(RegionSignalingInterface* r, uint32_t min_bytes,
+                            uint32_t max_bytes, PacketSpans* spans,
+                            bool non_blocking = false);
+
+  /**
+   * Publishes the packet reserved by ReserveWrite(), with the first bytes
+   * of its spans as the payload. bytes may be less than what was reserved.
+   */
+  void CommitWrite(RegionSignalingInterface* r, const PacketSpans& spans,
+                   uint32_t bytes);
+
+  /**
+   * Drops the packet reserved by ReserveWrite() without publishing it.
+   */
+  void CancelWrite();
+
+  /**
+   * Waits for a packet and points spans at its payload, so it can be read
+   * in place. Returns the size of the payload. The packet stays in the
+   * queue until ReleaseRead() or CancelRead() is called, one of which must
+   * follow. On a Locked queue the lock is held until then.
+   * If non_blocking is true and the queue is empty -EWOULDBLOCK is returned
+   * instead, and nothing needs to follow.
+   */
+  intptr_t PeekRead(RegionSignalingInterface* r, PacketSpans* spans,
+                    bool non_blocking = false);
+
+  /**
+   * Removes the packet returned by PeekRead() from the queue, handing its
+   * space back to the writers.
+   */
+  void ReleaseRead(RegionSignalingInterface* r, const PacketSpans& spans);
+
+  /**
+   * Leaves the packet returned by PeekRead() in the queue, so the next
+   * PeekRead() returns it again.
+   */
+  void CancelRead();
+
   bool Recover() {
     return this->RecoverBase();
   }
 
  protected:
-  static_assert(CircularQueueBase<SizeLog2>::BufferSize >= MaxPacketSize,
-                "Buffer is too small to hold the maximum sized packet");
-  using Range = typename CircularQueueBase<SizeLog2>::Range;
+  static_assert(
+      CircularQueueBase<SizeLog2, Access>::BufferSize >= MaxPacketSize,
+      "Buffer is too small to hold the maximum sized packet");
+  using Range = typename CircularQueueBase<SizeLog2, Access>::Range;
   intptr_t CalculateBufferedSize(size_t payload);
 };
 using CircularPacketQueue64k = CircularPacketQueue<16, 1024>;
 ASSERT_SHM_COMPATIBLE(CircularPacketQueue64k);
+using SpscCircularPacketQueue64k =
+    CircularPacketQueue<16, 1024, QueueAccess::SingleProducerSingleConsumer>;
+ASSERT_SHM_COMPATIBLE(SpscCircularPacketQueue64k);
 
 }  // namespace layout
 }  // namespace vsoc
@@ -26,6 +26,11 @@ namespace socket_forward {
 
 constexpr std::size_t kMaxPacketSize = 8192;
 constexpr std::size_t kNumQueues = 16;
+// Each queue has a single writer and a single reader per connection, and is
+// only handed to the next connection through queue_state_lock_. Changing
+// this changes the protocol on the shared memory, so it needs a new
+// region_name as well.
+constexpr QueueAccess kQueueAccess = QueueAccess::SingleProducerSingleConsumer;
 
 enum class QueueState : std::uint32_t {
   INACTIVE = 0,
@@ -41,9 +46,9 @@ static_assert(ShmTypeValidator<QueueState, 4>::valid,
 
 struct Queue {
   static constexpr size_t layout_size =
-      CircularPacketQueue<16, kMaxPacketSize>::layout_size + 4;
+      CircularPacketQueue<16, kMaxPacketSize, kQueueAccess>::layout_size + 4;
 
-  CircularPacketQueue<16, kMaxPacketSize> queue;
+  CircularPacketQueue<16, kMaxPacketSize, kQueueAccess> queue;
 
   QueueState queue_state_;
 
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera2_AuxBufferPool"
+
+#include <utils/Log.h>
+
+#include "AuxBufferPool.h"
+
+namespace android {
+
+AuxBufferPool &AuxBufferPool::getInstance() {
+  static AuxBufferPool instance;
+  return instance;
+}
+
+AuxBufferPool::AuxBufferPool() {}
+
+AuxBufferPool::~AuxBufferPool() {
+  for (size_t i = 0; i < mFree.size(); i++) {
+    delete[] mFree[i].data;
+  }
+}
+
+uint8_t *AuxBufferPool::acquire(size_t size) {
+  Mutex::Autolock lock(mLock);
+  Buffer buffer = {NULL, 0};
+  // Most recently released first, it is the likeliest to still be cached
+  for (size_t i = mFree.size(); i > 0; i--) {
+    if (mFree[i - 1].size == size) {
+      buffer = mFree[i - 1];
+      mFree.removeAt(i - 1);
+      break;
+    }
+  }
+  if (buffer.data == NULL) {
+    ALOGV("%s: Allocating %zu byte buffer", __FUNCTION__, size);
+    buffer.data = new uint8_t[size];
+    buffer.size = size;
+  }
+  mInUse.push_back(buffer);
+  return buffer.data;
+}
+
+void AuxBufferPool::release(uint8_t *data) {
+  Mutex::Autolock lock(mLock);
+  for (size_t i = 0; i < mInUse.size(); i++) {
+    if (mInUse[i].data != data) continue;
+    if (mFree.size() == kMaxFreeBuffers) {
+      // Drop the oldest, it is the least likely to match the next capture
+      delete[] mFree[0].data;
+      mFree.removeAt(0);
+    }
+    mFree.push_back(mInUse[i]);
+    mInUse.removeAt(i);
+    return;
+  }
+  ALOGE("%s: Buffer %p is not from this pool", __FUNCTION__, data);
+}
+
+}  // namespace android
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Recycles the full-frame auxiliary buffers the sensor renders JPEG input
+ * into. The sensor acquires one per still capture and the JPEG compressor
+ * releases it when done, so consecutive stills of the same size reuse the
+ * same few allocations.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_AUX_BUFFER_POOL_H
+#define HW_EMULATOR_CAMERA2_AUX_BUFFER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Mutex.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+class AuxBufferPool {
+ public:
+  static AuxBufferPool &getInstance();
+
+  // Get a buffer of at least size bytes. Its contents are undefined.
+  uint8_t *acquire(size_t size);
+  // Return a buffer from acquire() to the pool.
+  void release(uint8_t *buffer);
+
+ private:
+  AuxBufferPool();
+  ~AuxBufferPool();
+
+  // Idle buffers kept for reuse; one per JPEG compressor is enough
+  static const size_t kMaxFreeBuffers = 4;
+
+  struct Buffer {
+    uint8_t *data;
+    size_t size;
+  };
+
+  Mutex mLock;
+  // Every buffer handed out, so release() can find its size
+  Vector<Buffer> mInUse;
+  Vector<Buffer> mFree;
+};
+
+}  // namespace android
+
+#endif  // HW_EMULATOR_CAMERA2_AUX_BUFFER_POOL_H
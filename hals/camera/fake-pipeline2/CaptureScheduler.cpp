@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera2_CaptureScheduler"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
+#include <utils/Log.h>
+
+#include "CaptureScheduler.h"
+
+namespace android {
+
+const size_t CaptureScheduler::kMaxRenderThreads = 4;
+const char CaptureScheduler::kRenderThreadsProperty[] =
+    "persist.camera.render_threads";
+
+CaptureScheduler::CaptureScheduler() : mExiting(false), mNextSequence(0) {}
+
+CaptureScheduler::~CaptureScheduler() { shutDown(); }
+
+size_t CaptureScheduler::getConfiguredWorkerCount() {
+  long renderThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  char prop[PROPERTY_VALUE_MAX];
+  if (property_get(kRenderThreadsProperty, prop, NULL) > 0) {
+    renderThreads = atoi(prop);
+  }
+  if (renderThreads < 1) renderThreads = 1;
+  if (renderThreads > (long)kMaxRenderThreads) {
+    renderThreads = kMaxRenderThreads;
+  }
+  return renderThreads - 1;
+}
+
+status_t CaptureScheduler::startUp(size_t workerCount) {
+  ALOGV("%s: Starting %zu capture workers", __FUNCTION__, workerCount);
+  if (!mWorkers.isEmpty()) {
+    ALOGE("%s: Already started!", __FUNCTION__);
+    return INVALID_OPERATION;
+  }
+
+  mExiting = false;
+  for (size_t i = 0; i < workerCount; i++) {
+    sp<Worker> worker = new Worker(this);
+    status_t res = worker->run("EmulatedFakeCamera2::CaptureScheduler",
+                               ANDROID_PRIORITY_URGENT_DISPLAY);
+    if (res != OK) {
+      ALOGE("%s: Unable to start capture worker %zu: %d", __FUNCTION__, i,
+            res);
+      shutDown();
+      return res;
+    }
+    mWorkers.push_back(worker);
+  }
+  return OK;
+}
+
+status_t CaptureScheduler::shutDown() {
+  {
+    Mutex::Autolock lock(mMutex);
+    mExiting = true;
+    mWorkAvailable.broadcast();
+  }
+  for (size_t i = 0; i < mWorkers.size(); i++) {
+    mWorkers[i]->requestExitAndWait();
+  }
+  mWorkers.clear();
+  return OK;
+}
+
+size_t CaptureScheduler::getWorkerCount() const { return mWorkers.size(); }
+
+void CaptureScheduler::run(Job *job, uint32_t rows, uint32_t rowAlign,
+                           int priority, nsecs_t deadline) {
+  uint32_t bands = (mWorkers.size() + 1) * kBandsPerThread;
+  uint32_t bandRows = (rows + bands - 1) / bands;
+  bandRows = (bandRows + rowAlign - 1) / rowAlign * rowAlign;
+
+  if (mWorkers.isEmpty() || bandRows >= rows) {
+    job->renderRows(0, rows);
+    return;
+  }
+
+  Task task;
+  task.job = job;
+  task.rows = rows;
+  task.bandRows = bandRows;
+  task.nextBand = 0;
+  task.endBand = (rows + bandRows - 1) / bandRows;
+  task.bandsLeft = task.endBand;
+  task.priority = priority;
+  task.deadline = deadline;
+
+  Mutex::Autolock lock(mMutex);
+  task.sequence = mNextSequence++;
+  mTasks.push_back(&task);
+  mWorkAvailable.broadcast();
+
+  while (task.nextBand < task.endBand) {
+    renderBandLocked(&task, task.nextBand++);
+  }
+  while (task.bandsLeft > 0) {
+    task.done.wait(mMutex);
+  }
+  for (size_t i = 0; i < mTasks.size(); i++) {
+    if (mTasks[i] == &task) {
+      mTasks.removeAt(i);
+      break;
+    }
+  }
+}
+
+CaptureScheduler::Task *CaptureScheduler::getMostUrgentTaskLocked() {
+  Task *best = NULL;
+  for (size_t i = 0; i < mTasks.size(); i++) {
+    Task *task = mTasks[i];
+    if (task->nextBand >= task->endBand) continue;
+    if (best == NULL || task->priority > best->priority ||
+        (task->priority == best->priority &&
+         (task->deadline < best->deadline ||
+          (task->deadline == best->deadline &&
+           task->sequence < best->sequence)))) {
+      best = task;
+    }
+  }
+  return best;
+}
+
+void CaptureScheduler::renderBandLocked(Task *task, uint32_t band) {
+  uint32_t beginRow = band * task->bandRows;
+  uint32_t endRow = beginRow + task->bandRows;
+  if (endRow > task->rows) endRow = task->rows;
+
+  mMutex.unlock();
+  task->job->renderRows(beginRow, endRow);
+  mMutex.lock();
+
+  // The owner may return as soon as this is signaled
+  task->bandsLeft--;
+  if (task->bandsLeft == 0) task->done.signal();
+}
+
+CaptureScheduler::Worker::Worker(CaptureScheduler *scheduler)
+    : Thread(false), mScheduler(scheduler) {}
+
+bool CaptureScheduler::Worker::threadLoop() {
+  Mutex::Autolock lock(mScheduler->mMutex);
+  Task *task;
+  while (!mScheduler->mExiting &&
+         (task = mScheduler->getMostUrgentTaskLocked()) == NULL) {
+    mScheduler->mWorkAvailable.wait(mScheduler->mMutex);
+  }
+  if (mScheduler->mExiting) return false;
+  mScheduler->renderBandLocked(task, --task->endBand);
+  return true;
+}
+
+}  // namespace android
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Render threads shared by every fake camera sensor. A sensor thread renders
+ * its own frame as bands of rows, taking them from the top, while idle
+ * workers steal bands from the bottom of the most urgent frame in flight:
+ * the one with the highest priority, then the earliest deadline. Since each
+ * sensor thread keeps rendering its own frame, low priority cameras still
+ * make progress when the workers are busy elsewhere.
+ *
+ * The camera factory owns one scheduler, so the number of render threads
+ * doesn't grow with the number of cameras.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_CAPTURE_SCHEDULER_H
+#define HW_EMULATOR_CAMERA2_CAPTURE_SCHEDULER_H
+
+#include <stdint.h>
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "CaptureWorkerPool.h"
+
+namespace android {
+
+class CaptureScheduler {
+ public:
+  typedef CaptureWorkerPool::Job Job;
+
+  CaptureScheduler();
+  ~CaptureScheduler();
+
+  // Start workerCount worker threads. A count of zero makes run() render on
+  // the calling thread only.
+  status_t startUp(size_t workerCount);
+  status_t shutDown();
+
+  size_t getWorkerCount() const;
+
+  // Worker count for kRenderThreadsProperty render threads, one of which is
+  // the calling thread of run(). Without the property every online CPU
+  // renders. Capped to kMaxRenderThreads.
+  static size_t getConfiguredWorkerCount();
+
+  static const size_t kMaxRenderThreads;
+  static const char kRenderThreadsProperty[];
+
+  // Render rows [0, rows) of job and return once all of them are done. Band
+  // boundaries are multiples of rowAlign. Workers prefer the job with the
+  // highest priority, then the earliest deadline, then the oldest. Several
+  // threads may call run() at once.
+  void run(Job *job, uint32_t rows, uint32_t rowAlign, int priority,
+           nsecs_t deadline);
+
+ private:
+  // Bands per render thread; more than one evens out uneven row costs.
+  static const uint32_t kBandsPerThread = 2;
+
+  // A job in flight. Lives on the stack of its run() call.
+  struct Task {
+    Job *job;
+    uint32_t rows;
+    uint32_t bandRows;
+    // Bands [nextBand, endBand) are yet to be claimed; the owner claims
+    // from the front and workers from the back
+    uint32_t nextBand;
+    uint32_t endBand;
+    uint32_t bandsLeft;
+    int priority;
+    nsecs_t deadline;
+    uint64_t sequence;
+    Condition done;
+  };
+
+  class Worker : public Thread {
+   public:
+    Worker(CaptureScheduler *scheduler);
+
+   private:
+    virtual bool threadLoop();
+    CaptureScheduler *mScheduler;
+  };
+
+  // The task workers should steal from next, or NULL if no task has bands
+  // left to claim. Must be called with mMutex held.
+  Task *getMostUrgentTaskLocked();
+  // Render a claimed band of task. Must be called with mMutex held; the lock
+  // is dropped while rendering.
+  void renderBandLocked(Task *task, uint32_t band);
+
+  Mutex mMutex;
+  Condition mWorkAvailable;
+  bool mExiting;
+  Vector<Task *> mTasks;
+  uint64_t mNextSequence;
+
+  Vector<sp<Worker> > mWorkers;
+};
+
+}  // namespace android
+
+#endif  // HW_EMULATOR_CAMERA2_CAPTURE_SCHEDULER_H
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "CaptureScheduler.h"
+
+namespace {
+
+using android::CaptureScheduler;
+
+// Counts how many times each row is rendered
+class CountingJob : public CaptureScheduler::Job {
+ public:
+  explicit CountingJob(uint32_t rows) : mCounts(rows) {}
+
+  virtual void renderRows(uint32_t beginRow, uint32_t endRow) {
+    for (uint32_t row = beginRow; row < endRow; row++) mCounts[row]++;
+  }
+
+  bool renderedOnce() const {
+    for (size_t i = 0; i < mCounts.size(); i++) {
+      if (mCounts[i] != 1) return false;
+    }
+    return true;
+  }
+
+ private:
+  std::vector<std::atomic<int> > mCounts;
+};
+
+TEST(CaptureSchedulerTest, RendersInlineWithoutWorkers) {
+  CaptureScheduler scheduler;
+  ASSERT_EQ(android::OK, scheduler.startUp(0));
+  CountingJob job(480);
+  scheduler.run(&job, 480, 2, 0, 0);
+  EXPECT_TRUE(job.renderedOnce());
+}
+
+TEST(CaptureSchedulerTest, ConcurrentJobsRenderEveryRowOnce) {
+  CaptureScheduler scheduler;
+  ASSERT_EQ(android::OK, scheduler.startUp(3));
+  std::atomic<int> failures(0);
+  std::vector<std::thread> submitters;
+  for (int i = 0; i < 4; i++) {
+    submitters.push_back(std::thread([&scheduler, &failures, i]() {
+      for (int j = 0; j < 50; j++) {
+        // Odd row counts leave a short last band
+        uint32_t rows = 241 + i * 64 + j;
+        CountingJob job(rows);
+        scheduler.run(&job, rows, 1 + (j & 1), (i + j) % 3, j);
+        if (!job.renderedOnce()) failures++;
+      }
+    }));
+  }
+  for (size_t i = 0; i < submitters.size(); i++) submitters[i].join();
+  EXPECT_EQ(0, failures.load());
+}
+
+// Jobs whose bands block on a gate until the test opens it, and record the
+// order in which the worker renders them.
+class OrderTest : public ::testing::Test {
+ protected:
+  // With one worker and the calling thread, run() splits a job of kRows
+  // rows into 4 bands
+  static const uint32_t kRows = 8;
+  static const uint32_t kBands = 4;
+
+  class GatedJob : public CaptureScheduler::Job {
+   public:
+    GatedJob(OrderTest *test, char name) : mTest(test), mName(name) {}
+
+    virtual void renderRows(uint32_t beginRow, uint32_t endRow) {
+      mTest->onRender(mName, beginRow, endRow);
+    }
+
+   private:
+    OrderTest *mTest;
+    char mName;
+  };
+
+  OrderTest()
+      : mBlockerBands(0),
+        mBlockerOpen(false),
+        mOwnersOpen(false),
+        mOwnersBlocked(0) {}
+
+  void SetUp() { ASSERT_EQ(android::OK, mScheduler.startUp(1)); }
+
+  void onRender(char name, uint32_t beginRow, uint32_t endRow) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (name == 'A') {
+      // Holds the worker and its owner until the other jobs are queued
+      mBlockerBands++;
+      mChanged.notify_all();
+      mChanged.wait(lock, [this]() { return mBlockerOpen; });
+      return;
+    }
+    if (beginRow == 0) {
+      // First band, always rendered by the owner
+      mOwnersBlocked++;
+      mChanged.notify_all();
+      mChanged.wait(lock, [this]() { return mOwnersOpen; });
+      return;
+    }
+    (void)endRow;
+    mWorkerOrder.push_back(name);
+    mChanged.notify_all();
+  }
+
+  // Runs job A at the highest priority, then first and second, and
+  // returns the order in which the worker rendered bands of the latter.
+  std::string runJobs(char first, int firstPriority, nsecs_t firstDeadline,
+                      char second, int secondPriority,
+                      nsecs_t secondDeadline) {
+    GatedJob blocker(this, 'A'), firstJob(this, first),
+        secondJob(this, second);
+    std::thread blockerOwner(
+        [&]() { mScheduler.run(&blocker, kRows, 1, 100, 0); });
+    {
+      // Both the worker and the owner of A are busy before anything else
+      // is queued
+      std::unique_lock<std::mutex> lock(mMutex);
+      mChanged.wait(lock, [this]() { return mBlockerBands == 2; });
+    }
+    std::thread firstOwner([&]() {
+      mScheduler.run(&firstJob, kRows, 1, firstPriority, firstDeadline);
+    });
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mChanged.wait(lock, [this]() { return mOwnersBlocked == 1; });
+    }
+    std::thread secondOwner([&]() {
+      mScheduler.run(&secondJob, kRows, 1, secondPriority, secondDeadline);
+    });
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mChanged.wait(lock, [this]() { return mOwnersBlocked == 2; });
+    mBlockerOpen = true;
+    mChanged.notify_all();
+    // The owners are stuck in their first band, so the worker renders all
+    // the others
+    mChanged.wait(lock, [this]() {
+      return mWorkerOrder.size() == 2 * (kBands - 1);
+    });
+    mOwnersOpen = true;
+    mChanged.notify_all();
+    lock.unlock();
+
+    blockerOwner.join();
+    firstOwner.join();
+    secondOwner.join();
+    return mWorkerOrder;
+  }
+
+  CaptureScheduler mScheduler;
+  std::mutex mMutex;
+  std::condition_variable mChanged;
+  int mBlockerBands;
+  bool mBlockerOpen;
+  bool mOwnersOpen;
+  int mOwnersBlocked;
+  std::string mWorkerOrder;
+};
+
+TEST_F(OrderTest, HigherPriorityFirst) {
+  EXPECT_EQ("HHHLLL", runJobs('L', 0, 0, 'H', 1, 1000));
+}
+
+TEST_F(OrderTest, EarlierDeadlineFirst) {
+  EXPECT_EQ("EEELLL", runJobs('L', 0, 2000, 'E', 0, 1000));
+}
+
+}  // namespace
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera2_FramePacer"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include <utils/Log.h>
+
+#include "FramePacer.h"
+
+namespace android {
+
+FramePacer::FramePacer()
+    : mFreeRunning(false),
+      mFrameStart(0),
+      mFrameCount(0),
+      mMissedDeadlines(0),
+      mResyncs(0) {}
+
+void FramePacer::reset(nsecs_t now) {
+  mFrameStart = now;
+  mFrameCount = 0;
+  mMissedDeadlines = 0;
+  mResyncs = 0;
+}
+
+bool FramePacer::waitUntil(nsecs_t deadline) {
+  if (mFreeRunning) return true;
+
+  nsecs_t now = systemTime();
+  if (now > deadline + kTolerance) {
+    mMissedDeadlines++;
+    ALOGV("%s: Missed deadline by %" PRId64 " us", __FUNCTION__,
+          (now - deadline) / 1000);
+    return false;
+  }
+  if (now >= deadline) return true;
+
+  // systemTime() is CLOCK_MONOTONIC, so the deadline can be used as is
+  timespec t;
+  t.tv_sec = deadline / 1000000000L;
+  t.tv_nsec = deadline % 1000000000L;
+  int ret;
+  do {
+    ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+  } while (ret == EINTR);
+  if (ret != 0) {
+    ALOGE("%s: Unable to sleep: %s (%d)", __FUNCTION__, strerror(ret), ret);
+  }
+  return true;
+}
+
+nsecs_t FramePacer::endFrame(nsecs_t frameDuration) {
+  mFrameCount++;
+  if (mFreeRunning) {
+    mFrameStart = systemTime();
+    return mFrameStart;
+  }
+
+  nsecs_t nextStart = mFrameStart + frameDuration;
+  nsecs_t now = systemTime();
+  if (now - nextStart >= frameDuration) {
+    // A whole frame behind; catching up would only bunch frames together
+    mMissedDeadlines++;
+    mResyncs++;
+    ALOGV("%s: Sensor fell %" PRId64 " us behind, restarting schedule",
+          __FUNCTION__, (now - nextStart) / 1000);
+    mFrameStart = now;
+    return mFrameStart;
+  }
+  waitUntil(nextStart);
+  mFrameStart = nextStart;
+  return mFrameStart;
+}
+
+}  // namespace android
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Keeps the sensor thread on a fixed frame schedule. Frame starts lie on a
+ * grid advanced by each frame's duration, and events within a frame are
+ * waited for at absolute times on that grid, so time spent rendering or
+ * waiting on readout does not accumulate into drift. A deadline that has
+ * already passed by more than kTolerance is counted as missed. If the sensor
+ * falls a whole frame behind, the grid restarts from the current time rather
+ * than rushing through the backlog.
+ *
+ * When free running, deadlines are ignored and each frame starts as soon as
+ * the previous one ends, for measuring throughput.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_FRAME_PACER_H
+#define HW_EMULATOR_CAMERA2_FRAME_PACER_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include <utils/Timers.h>
+
+namespace android {
+
+class FramePacer {
+ public:
+  FramePacer();
+
+  void setFreeRunning(bool freeRunning) { mFreeRunning = freeRunning; }
+  bool isFreeRunning() const { return mFreeRunning; }
+
+  // Start a new schedule, with the first frame starting at now
+  void reset(nsecs_t now);
+
+  // Start time of the current frame
+  nsecs_t getFrameStart() const { return mFrameStart; }
+
+  // Sleep until the absolute time deadline. Returns false if the deadline
+  // was missed.
+  bool waitUntil(nsecs_t deadline);
+
+  // End the current frame after frameDuration, and wait for the next one to
+  // start. Returns the new frame's start time.
+  nsecs_t endFrame(nsecs_t frameDuration);
+
+  uint64_t getFrameCount() const { return mFrameCount; }
+  uint64_t getMissedDeadlines() const { return mMissedDeadlines; }
+  uint64_t getResyncs() const { return mResyncs; }
+
+  static const nsecs_t kTolerance = 2000000L;  // 2 ms
+
+ private:
+  bool mFreeRunning;
+  nsecs_t mFrameStart;
+
+  // Read by dump() on other threads
+  std::atomic<uint64_t> mFrameCount;
+  std::atomic<uint64_t> mMissedDeadlines;
+  std::atomic<uint64_t> mResyncs;
+};
+
+}  // namespace android
+
+#endif  // HW_EMULATOR_CAMERA2_FRAME_PACER_H
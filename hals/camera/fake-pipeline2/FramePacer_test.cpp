@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+
+#include "FramePacer.h"
+
+namespace {
+
+using android::FramePacer;
+
+const nsecs_t kFrameDuration = 10000000L;  // 10 ms
+
+TEST(FramePacerTest, FramesStayOnGrid) {
+  FramePacer pacer;
+  nsecs_t start = systemTime();
+  pacer.reset(start);
+  for (int i = 1; i <= 5; i++) {
+    EXPECT_EQ(start + i * kFrameDuration, pacer.endFrame(kFrameDuration));
+    EXPECT_GE(systemTime(), start + i * kFrameDuration);
+  }
+  EXPECT_EQ(5u, pacer.getFrameCount());
+  EXPECT_EQ(0u, pacer.getMissedDeadlines());
+}
+
+TEST(FramePacerTest, CountsMissedDeadline) {
+  FramePacer pacer;
+  nsecs_t now = systemTime();
+  pacer.reset(now);
+  EXPECT_TRUE(pacer.waitUntil(now + 1000000L));
+  EXPECT_FALSE(pacer.waitUntil(now - 2 * FramePacer::kTolerance));
+  EXPECT_EQ(1u, pacer.getMissedDeadlines());
+}
+
+TEST(FramePacerTest, RestartsScheduleWhenFrameBehind) {
+  FramePacer pacer;
+  nsecs_t start = systemTime() - 3 * kFrameDuration;
+  pacer.reset(start);
+  nsecs_t next = pacer.endFrame(kFrameDuration);
+  EXPECT_GE(next, start + 3 * kFrameDuration);
+  EXPECT_EQ(1u, pacer.getResyncs());
+  EXPECT_EQ(1u, pacer.getMissedDeadlines());
+}
+
+TEST(FramePacerTest, FreeRunningDoesNotSleep) {
+  FramePacer pacer;
+  pacer.setFreeRunning(true);
+  nsecs_t start = systemTime();
+  pacer.reset(start);
+  for (int i = 0; i < 5; i++) {
+    pacer.endFrame(1000000000L);
+  }
+  EXPECT_LT(systemTime() - start, 1000000000L);
+  EXPECT_EQ(5u, pacer.getFrameCount());
+  EXPECT_EQ(0u, pacer.getMissedDeadlines());
+}
+
+}  // namespace
@@ -17,20 +17,26 @@
 //#define LOG_NDEBUG 0
 #define LOG_TAG "EmulatedCamera2_JpegCompressor"
 
+#include <string.h>
 #include <utils/Log.h>
 
-#include "../EmulatedFakeCamera2.h"
-#include "../EmulatedFakeCamera3.h"
+#include <algorithm>
+#include <vector>
+
+#include "AuxBufferPool.h"
 #include "JpegCompressor.h"
 
 namespace android {
 
-JpegCompressor::JpegCompressor()
+JpegCompressor::JpegCompressor(IdleListener *idleListener)
     : Thread(false),
       mIsBusy(false),
       mSynchronous(false),
       mBuffers(NULL),
-      mListener(NULL) {}
+      mListener(NULL),
+      mIdleListener(idleListener),
+      mFoundJpeg(false),
+      mFoundAux(false) {}
 
 JpegCompressor::~JpegCompressor() { Mutex::Autolock lock(mMutex); }
 
@@ -44,6 +50,20 @@ status_t JpegCompressor::reserve() {
   return OK;
 }
 
+status_t JpegCompressor::unreserve() {
+  {
+    Mutex::Autolock busyLock(mBusyMutex);
+    if (!mIsBusy || mBuffers != NULL) {
+      ALOGE("%s: Not reserved, or already started!", __FUNCTION__);
+      return INVALID_OPERATION;
+    }
+    mIsBusy = false;
+    mDone.signal();
+  }
+  if (mIdleListener != NULL) mIdleListener->onJpegCompressorIdle();
+  return OK;
+}
+
 status_t JpegCompressor::start(Buffers *buffers, JpegListener *listener) {
   if (listener == NULL) {
     ALOGE("%s: NULL listener not allowed!", __FUNCTION__);
@@ -63,12 +83,17 @@ status_t JpegCompressor::start(Buffers *buffers, JpegListener *listener) {
     mListener = listener;
   }
 
+  // The thread of the previous compression may still be exiting after it
+  // marked the compressor idle; it has to be gone before run() can restart it
+  join();
+
   status_t res;
   res = run("EmulatedFakeCamera2::JpegCompressor");
   if (res != OK) {
     ALOGE("%s: Unable to start up compression thread: %s (%d)", __FUNCTION__,
           strerror(-res), res);
-    delete mBuffers;
+    listener->onJpegBuffersDone(mBuffers);
+    mBuffers = NULL;
   }
   return res;
 }
@@ -121,7 +146,8 @@ status_t JpegCompressor::compress() {
   // Find source and target buffers. Assumes only one buffer matches
   // each condition!
   ALOGV("%s: Compressing start", __FUNCTION__);
-  bool mFoundAux = false;
+  mFoundJpeg = false;
+  mFoundAux = false;
   for (size_t i = 0; i < mBuffers->size(); i++) {
     const StreamBuffer &b = (*mBuffers)[i];
     if (b.format == HAL_PIXEL_FORMAT_BLOB) {
@@ -163,19 +189,46 @@ status_t JpegCompressor::compress() {
 
   // Set up compression parameters
 
+  bool rawInput = mAuxBuffer.format == HAL_PIXEL_FORMAT_YCrCb_420_SP;
+
   mCInfo.image_width = mAuxBuffer.width;
   mCInfo.image_height = mAuxBuffer.height;
   mCInfo.input_components = 3;
-  mCInfo.in_color_space = JCS_RGB;
+  mCInfo.in_color_space = rawInput ? JCS_YCbCr : JCS_RGB;
 
   jpeg_set_defaults(&mCInfo);
   if (checkError("Error configuring defaults")) return NO_INIT;
 
+  if (rawInput) {
+    // Feed the NV21 planes straight to the DCT, skipping libjpeg's color
+    // conversion and downsampling
+    mCInfo.raw_data_in = TRUE;
+    mCInfo.comp_info[0].h_samp_factor = 2;
+    mCInfo.comp_info[0].v_samp_factor = 2;
+    mCInfo.comp_info[1].h_samp_factor = 1;
+    mCInfo.comp_info[1].v_samp_factor = 1;
+    mCInfo.comp_info[2].h_samp_factor = 1;
+    mCInfo.comp_info[2].v_samp_factor = 1;
+  }
+
   // Do compression
 
   jpeg_start_compress(&mCInfo, TRUE);
   if (checkError("Error starting compression")) return NO_INIT;
 
+  status_t res = rawInput ? compressNV21() : compressRGB();
+  if (res != OK) return res;
+
+  jpeg_finish_compress(&mCInfo);
+  if (checkError("Error while finishing compression")) return NO_INIT;
+
+  // All done
+  ALOGV("%s: Compressing done", __FUNCTION__);
+
+  return OK;
+}
+
+status_t JpegCompressor::compressRGB() {
   size_t rowStride = mAuxBuffer.stride * 3;
   const size_t kChunkSize = 32;
   while (mCInfo.next_scanline < mCInfo.image_height) {
@@ -191,13 +244,69 @@ status_t JpegCompressor::compress() {
       return TIMED_OUT;
     }
   }
+  return OK;
+}
 
-  jpeg_finish_compress(&mCInfo);
-  if (checkError("Error while finishing compression")) return NO_INIT;
-
-  // All done
-  ALOGV("%s: Compressing done", __FUNCTION__);
-
+status_t JpegCompressor::compressNV21() {
+  const uint32_t width = mAuxBuffer.width;
+  const uint32_t height = mAuxBuffer.height;
+  const uint32_t stride = mAuxBuffer.stride;
+  const uint8_t *yPlane = mAuxBuffer.img;
+  const uint8_t *chromaPlane = mAuxBuffer.img + height * stride;
+
+  // libjpeg reads whole 8x8 blocks from each row, so rows narrower than that
+  // are copied out and padded by repeating their last pixel. Chroma always
+  // has to be copied, to split the interleaved samples into planes.
+  const uint32_t chromaWidth = (width + 1) / 2;
+  const uint32_t chromaHeight = (height + 1) / 2;
+  const uint32_t lumaRowSize = (width + DCTSIZE - 1) / DCTSIZE * DCTSIZE;
+  const uint32_t chromaRowSize =
+      (chromaWidth + DCTSIZE - 1) / DCTSIZE * DCTSIZE;
+  const bool padLuma = lumaRowSize > stride;
+  std::vector<uint8_t> lumaRows(padLuma ? 2 * DCTSIZE * lumaRowSize : 0);
+  std::vector<uint8_t> uRows(DCTSIZE * chromaRowSize);
+  std::vector<uint8_t> vRows(DCTSIZE * chromaRowSize);
+
+  JSAMPROW y[2 * DCTSIZE], cb[DCTSIZE], cr[DCTSIZE];
+  JSAMPARRAY planes[3] = {y, cb, cr};
+
+  while (mCInfo.next_scanline < height) {
+    // One MCU row: 16 rows of luma and 8 of each chroma component. Rows past
+    // the bottom of the image repeat the last one.
+    for (uint32_t i = 0; i < 2 * DCTSIZE; i++) {
+      uint32_t row = std::min(mCInfo.next_scanline + i, height - 1);
+      const uint8_t *src = yPlane + row * stride;
+      if (padLuma) {
+        uint8_t *dst = &lumaRows[i * lumaRowSize];
+        memcpy(dst, src, width);
+        memset(dst + width, src[width - 1], lumaRowSize - width);
+        y[i] = dst;
+      } else {
+        y[i] = const_cast<JSAMPROW>(src);
+      }
+    }
+    for (uint32_t i = 0; i < DCTSIZE; i++) {
+      uint32_t row = std::min(mCInfo.next_scanline / 2 + i, chromaHeight - 1);
+      // Sensor::captureNV21 stores each chroma pair with Cb first
+      const uint8_t *chroma = chromaPlane + row * stride;
+      uint8_t *u = &uRows[i * chromaRowSize];
+      uint8_t *v = &vRows[i * chromaRowSize];
+      for (uint32_t x = 0; x < chromaWidth; x++) {
+        u[x] = chroma[2 * x];
+        v[x] = chroma[2 * x + 1];
+      }
+      memset(u + chromaWidth, u[chromaWidth - 1], chromaRowSize - chromaWidth);
+      memset(v + chromaWidth, v[chromaWidth - 1], chromaRowSize - chromaWidth);
+      cb[i] = u;
+      cr[i] = v;
+    }
+    jpeg_write_raw_data(&mCInfo, planes, 2 * DCTSIZE);
+    if (checkError("Error while compressing")) return NO_INIT;
+    if (exitPending()) {
+      ALOGV("%s: Cancel called, exiting early", __FUNCTION__);
+      return TIMED_OUT;
+    }
+  }
   return OK;
 }
 
@@ -239,23 +348,26 @@ bool JpegCompressor::checkError(const char *msg) {
 
 void JpegCompressor::cleanUp() {
   jpeg_destroy_compress(&mCInfo);
-  Mutex::Autolock lock(mBusyMutex);
-
-  if (mFoundAux) {
-    if (mAuxBuffer.streamId == 0) {
-      delete[] mAuxBuffer.img;
-    } else if (!mSynchronous) {
-      mListener->onJpegInputDone(mAuxBuffer);
+  {
+    Mutex::Autolock lock(mBusyMutex);
+
+    if (mFoundAux) {
+      if (mAuxBuffer.streamId == 0) {
+        AuxBufferPool::getInstance().release(mAuxBuffer.img);
+      } else if (!mSynchronous) {
+        mListener->onJpegInputDone(mAuxBuffer);
+      }
+    }
+    if (!mSynchronous) {
+      mListener->onJpegBuffersDone(mBuffers);
     }
-  }
-  if (!mSynchronous) {
-    delete mBuffers;
-  }
 
-  mBuffers = NULL;
+    mBuffers = NULL;
 
-  mIsBusy = false;
-  mDone.signal();
+    mIsBusy = false;
+    mDone.signal();
+  }
+  if (mIdleListener != NULL) mIdleListener->onJpegCompressorIdle();
 }
 
 void JpegCompressor::jpegErrorHandler(j_common_ptr cinfo) {
@@ -281,6 +393,12 @@ void JpegCompressor::jpegTermDestination(j_compress_ptr cinfo) {
         cinfo->dest->free_in_buffer);
 }
 
+void JpegCompressor::JpegListener::onJpegBuffersDone(Buffers *buffers) {
+  delete buffers;
+}
+
 JpegCompressor::JpegListener::~JpegListener() {}
 
+JpegCompressor::IdleListener::~IdleListener() {}
+
 }  // namespace android
@@ -16,8 +16,8 @@
 
 /**
  * This class simulates a hardware JPEG compressor.  It receives image buffers
- * in RGBA_8888 format, processes them in a worker thread, and then pushes them
- * out to their destination stream.
+ * in RGB_888 or NV21 format, processes them in a worker thread, and then
+ * pushes them out to their destination stream.
  */
 
 #ifndef HW_EMULATOR_CAMERA2_JPEG_H
@@ -39,7 +39,14 @@ namespace android {
 
 class JpegCompressor : private Thread, public virtual RefBase {
  public:
-  JpegCompressor();
+  struct IdleListener {
+    // Called once the compressor has finished a buffer and can be reserved
+    // again. No compressor locks are held during the call.
+    virtual void onJpegCompressorIdle() = 0;
+    virtual ~IdleListener();
+  };
+
+  explicit JpegCompressor(IdleListener *idleListener = NULL);
   ~JpegCompressor();
 
   struct JpegListener {
@@ -48,11 +55,15 @@ class JpegCompressor : private Thread, public virtual RefBase {
     // Called when the input buffer for JPEG is not needed any more,
     // if the buffer came from the framework.
     virtual void onJpegInputDone(const StreamBuffer &inputBuffer) = 0;
+    // Called when the compressor is done with the Buffers given to start(),
+    // including when start() fails. Deletes them unless overridden.
+    virtual void onJpegBuffersDone(Buffers *buffers);
     virtual ~JpegListener();
   };
 
   // Start compressing COMPRESSED format buffers; JpegCompressor takes
-  // ownership of the Buffers vector.
+  // ownership of the Buffers vector, and hands it back through
+  // JpegListener::onJpegBuffersDone().
   // Reserve() must be called first.
   status_t start(Buffers *buffers, JpegListener *listener);
 
@@ -68,6 +79,8 @@ class JpegCompressor : private Thread, public virtual RefBase {
 
   // Reserve the compressor for a later start() call.
   status_t reserve();
+  // Cancel a reservation that was never start()ed.
+  status_t unreserve();
 
   // TODO: Measure this
   static const size_t kMaxJpegSize = 300000;
@@ -82,6 +95,7 @@ class JpegCompressor : private Thread, public virtual RefBase {
 
   Buffers *mBuffers;
   JpegListener *mListener;
+  IdleListener *mIdleListener;
 
   StreamBuffer mJpegBuffer, mAuxBuffer;
   bool mFoundJpeg, mFoundAux;
@@ -105,6 +119,9 @@ class JpegCompressor : private Thread, public virtual RefBase {
 
   bool checkError(const char *msg);
   status_t compress();
+  // Write all scanlines of an RGB_888 or NV21 aux buffer
+  status_t compressRGB();
+  status_t compressNV21();
 
   void cleanUp();
 
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera2_JpegCompressorPool"
+
+#include <utils/Log.h>
+
+#include "JpegCompressorPool.h"
+
+namespace android {
+
+JpegCompressorPool::JpegCompressorPool() {}
+
+JpegCompressorPool::~JpegCompressorPool() { shutDown(); }
+
+status_t JpegCompressorPool::startUp(size_t count) {
+  Mutex::Autolock lock(mLock);
+  if (!mCompressors.isEmpty()) {
+    ALOGE("%s: Already started", __FUNCTION__);
+    return INVALID_OPERATION;
+  }
+  if (count == 0) {
+    ALOGE("%s: Need at least one compressor", __FUNCTION__);
+    return BAD_VALUE;
+  }
+  for (size_t i = 0; i < count; i++) {
+    mCompressors.push_back(new JpegCompressor(this));
+  }
+  ALOGV("%s: Started %zu JPEG compressors", __FUNCTION__, count);
+  return OK;
+}
+
+status_t JpegCompressorPool::shutDown() {
+  Vector<sp<JpegCompressor> > compressors;
+  {
+    Mutex::Autolock lock(mLock);
+    compressors = mCompressors;
+    mCompressors.clear();
+  }
+  // Cancelling joins the compressor threads, which call back into
+  // onJpegCompressorIdle, so mLock must not be held here
+  for (size_t i = 0; i < compressors.size(); i++) {
+    compressors[i]->cancel();
+  }
+  return OK;
+}
+
+sp<JpegCompressor> JpegCompressorPool::reserve(nsecs_t timeout) {
+  Mutex::Autolock lock(mLock);
+  nsecs_t deadline = systemTime() + timeout;
+  while (true) {
+    for (size_t i = 0; i < mCompressors.size(); i++) {
+      if (mCompressors[i]->isBusy()) continue;
+      // Reservations are serialized by mLock, so an idle one stays idle
+      if (mCompressors[i]->reserve() == OK) return mCompressors[i];
+    }
+    nsecs_t remaining = deadline - systemTime();
+    if (remaining <= 0 || mIdle.waitRelative(mLock, remaining) != OK) {
+      ALOGE("%s: Timed out waiting for a free JPEG compressor", __FUNCTION__);
+      return NULL;
+    }
+  }
+}
+
+void JpegCompressorPool::unreserve(const sp<JpegCompressor> &compressor) {
+  // Wakes up reserve() through onJpegCompressorIdle
+  compressor->unreserve();
+}
+
+bool JpegCompressorPool::waitForDone(nsecs_t timeout) {
+  Mutex::Autolock lock(mLock);
+  nsecs_t deadline = systemTime() + timeout;
+  while (isBusyLocked()) {
+    nsecs_t remaining = deadline - systemTime();
+    if (remaining <= 0 || mIdle.waitRelative(mLock, remaining) != OK) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool JpegCompressorPool::isBusy() {
+  Mutex::Autolock lock(mLock);
+  return isBusyLocked();
+}
+
+bool JpegCompressorPool::isBusyLocked() {
+  for (size_t i = 0; i < mCompressors.size(); i++) {
+    if (mCompressors[i]->isBusy()) return true;
+  }
+  return false;
+}
+
+bool JpegCompressorPool::isStreamInUse(uint32_t id) {
+  Mutex::Autolock lock(mLock);
+  for (size_t i = 0; i < mCompressors.size(); i++) {
+    if (mCompressors[i]->isStreamInUse(id)) return true;
+  }
+  return false;
+}
+
+void JpegCompressorPool::onJpegCompressorIdle() {
+  Mutex::Autolock lock(mLock);
+  mIdle.broadcast();
+}
+
+}  // namespace android
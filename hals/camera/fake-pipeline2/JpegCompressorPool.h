@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * A fixed set of JpegCompressors, so that several still captures can be
+ * compressed at the same time. Callers reserve() whichever compressor is
+ * free, then start() it as they would a single JpegCompressor.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_JPEG_POOL_H
+#define HW_EMULATOR_CAMERA2_JPEG_POOL_H
+
+#include "utils/Condition.h"
+#include "utils/Mutex.h"
+#include "utils/Timers.h"
+#include "utils/Vector.h"
+
+#include "JpegCompressor.h"
+
+namespace android {
+
+class JpegCompressorPool : private JpegCompressor::IdleListener {
+ public:
+  JpegCompressorPool();
+  ~JpegCompressorPool();
+
+  // Create count compressors. Must be called before any other method.
+  status_t startUp(size_t count);
+  // Cancel any compressions still running and release the compressors.
+  status_t shutDown();
+
+  size_t getSize() const { return mCompressors.size(); }
+
+  // Reserve an idle compressor, waiting up to timeout for one to finish.
+  // Returns NULL on timeout.
+  sp<JpegCompressor> reserve(nsecs_t timeout);
+  // Give back a compressor from reserve() that won't be started after all.
+  void unreserve(const sp<JpegCompressor> &compressor);
+
+  // Wait for every compressor to become idle.
+  bool waitForDone(nsecs_t timeout);
+
+  // True if any compressor is busy
+  bool isBusy();
+  bool isStreamInUse(uint32_t id);
+
+ private:
+  bool isBusyLocked();
+  virtual void onJpegCompressorIdle();
+
+  Mutex mLock;
+  // Signaled whenever a compressor becomes idle
+  Condition mIdle;
+  Vector<sp<JpegCompressor> > mCompressors;
+};
+
+}  // namespace android
+
+#endif  // HW_EMULATOR_CAMERA2_JPEG_POOL_H
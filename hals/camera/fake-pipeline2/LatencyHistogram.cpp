@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "LatencyHistogram.h"
+
+namespace android {
+
+LatencyHistogram::LatencyHistogram() { reset(); }
+
+uint32_t LatencyHistogram::getBucket(uint32_t us) {
+  if (us < (1u << kSubBucketBits)) return us;
+  uint32_t shift = (31 - __builtin_clz(us)) - kSubBucketBits;
+  return ((shift + 1) << kSubBucketBits) +
+         ((us >> shift) & ((1u << kSubBucketBits) - 1));
+}
+
+uint32_t LatencyHistogram::getBucketUpperBound(uint32_t bucket) {
+  if (bucket < (1u << kSubBucketBits)) return bucket;
+  uint32_t shift = (bucket >> kSubBucketBits) - 1;
+  uint32_t mantissa = (bucket & ((1u << kSubBucketBits) - 1)) |
+                      (1u << kSubBucketBits);
+  // Computed from the lower bound so the top bucket doesn't overflow
+  return (mantissa << shift) + ((1u << shift) - 1);
+}
+
+void LatencyHistogram::record(nsecs_t latency) {
+  if (latency < 0) latency = 0;
+  uint64_t us64 = latency / 1000;
+  uint32_t us = us64 > UINT32_MAX ? UINT32_MAX : (uint32_t)us64;
+
+  mBuckets[getBucket(us)].fetch_add(1, std::memory_order_relaxed);
+  uint32_t max = mMax.load(std::memory_order_relaxed);
+  while (us > max && !mMax.compare_exchange_weak(max, us,
+                                                 std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::reset() {
+  for (uint32_t i = 0; i < kNumBuckets; i++) {
+    mBuckets[i].store(0, std::memory_order_relaxed);
+  }
+  mMax.store(0, std::memory_order_relaxed);
+}
+
+uint32_t LatencyHistogram::getPercentile(const uint32_t *counts,
+                                         uint64_t total,
+                                         uint32_t percent) const {
+  // Smallest bucket with at least percent% of the samples at or below it
+  uint64_t target = (total * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < kNumBuckets; i++) {
+    seen += counts[i];
+    if (seen >= target) return getBucketUpperBound(i);
+  }
+  return getBucketUpperBound(kNumBuckets - 1);
+}
+
+LatencyHistogram::Summary LatencyHistogram::getSummary() const {
+  // Samples recorded while this runs may or may not be included
+  uint32_t counts[kNumBuckets];
+  Summary summary = {0, 0, 0, 0, 0};
+  for (uint32_t i = 0; i < kNumBuckets; i++) {
+    counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+    summary.count += counts[i];
+  }
+  if (summary.count == 0) return summary;
+
+  summary.max = mMax.load(std::memory_order_relaxed);
+  summary.p50 = getPercentile(counts, summary.count, 50);
+  summary.p95 = getPercentile(counts, summary.count, 95);
+  summary.p99 = getPercentile(counts, summary.count, 99);
+  // A bucket's upper bound can be past the largest sample in it
+  if (summary.p50 > summary.max) summary.p50 = summary.max;
+  if (summary.p95 > summary.max) summary.p95 = summary.max;
+  if (summary.p99 > summary.max) summary.p99 = summary.max;
+  return summary;
+}
+
+void LatencyHistogram::dump(int fd, const char *name) const {
+  Summary s = getSummary();
+  dprintf(fd,
+          "    %-16s %8" PRIu64 " samples, p50 %7u us, p95 %7u us,"
+          " p99 %7u us, max %7u us\n",
+          name, s.count, s.p50, s.p95, s.p99, s.max);
+}
+
+}  // namespace android
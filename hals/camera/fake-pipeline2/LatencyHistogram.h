@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Histogram of latencies, for dump() output. Recording is a couple of
+ * relaxed atomic increments, so it can stay on in production builds and be
+ * called from any thread without locking.
+ *
+ * Latencies are kept in microseconds, in buckets that are exact below 8 us
+ * and then split each power of two into 8, so percentiles are within 12.5%.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_LATENCY_HISTOGRAM_H
+#define HW_EMULATOR_CAMERA2_LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include <utils/Timers.h>
+
+namespace android {
+
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  void record(nsecs_t latency);
+  void reset();
+
+  struct Summary {
+    uint64_t count;
+    // Upper bounds of the buckets holding each percentile, in microseconds
+    uint32_t p50;
+    uint32_t p95;
+    uint32_t p99;
+    // Exact
+    uint32_t max;
+  };
+  Summary getSummary() const;
+
+  // Print a one line summary, labeled with name
+  void dump(int fd, const char *name) const;
+
+  // Exposed for testing
+  static uint32_t getBucket(uint32_t us);
+  static uint32_t getBucketUpperBound(uint32_t bucket);
+
+ private:
+  static const uint32_t kSubBucketBits = 3;
+  static const uint32_t kNumBuckets = (32 - kSubBucketBits + 1)
+                                      << kSubBucketBits;
+
+  uint32_t getPercentile(const uint32_t *counts, uint64_t total,
+                         uint32_t percent) const;
+
+  std::atomic<uint32_t> mBuckets[kNumBuckets];
+  std::atomic<uint32_t> mMax;
+};
+
+}  // namespace android
+
+#endif  // HW_EMULATOR_CAMERA2_LATENCY_HISTOGRAM_H
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+
+#include "LatencyHistogram.h"
+
+namespace {
+
+using android::LatencyHistogram;
+
+TEST(LatencyHistogramTest, BucketsCoverEveryValue) {
+  uint32_t previous = 0;
+  for (uint64_t us = 0; us <= UINT32_MAX; us = us * 5 / 4 + 1) {
+    uint32_t bucket = LatencyHistogram::getBucket(us);
+    EXPECT_GE(bucket, previous);
+    EXPECT_GE(LatencyHistogram::getBucketUpperBound(bucket), us);
+    if (bucket > 0) {
+      EXPECT_LT(LatencyHistogram::getBucketUpperBound(bucket - 1), us);
+    }
+    previous = bucket;
+  }
+  EXPECT_EQ(UINT32_MAX, LatencyHistogram::getBucketUpperBound(
+                            LatencyHistogram::getBucket(UINT32_MAX)));
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram histogram;
+  // 1..1000 us
+  for (int i = 1; i <= 1000; i++) {
+    histogram.record(i * 1000LL);
+  }
+  LatencyHistogram::Summary s = histogram.getSummary();
+  EXPECT_EQ(1000u, s.count);
+  EXPECT_EQ(1000u, s.max);
+  // Within a bucket's width above the exact value
+  EXPECT_GE(s.p50, 500u);
+  EXPECT_LE(s.p50, 500u * 9 / 8);
+  EXPECT_GE(s.p95, 950u);
+  EXPECT_LE(s.p95, 1000u);
+  EXPECT_GE(s.p99, 990u);
+  EXPECT_LE(s.p99, 1000u);
+}
+
+TEST(LatencyHistogramTest, EmptyAndReset) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(0u, histogram.getSummary().count);
+  histogram.record(-5);
+  histogram.record(5000);
+  EXPECT_EQ(2u, histogram.getSummary().count);
+  EXPECT_EQ(5u, histogram.getSummary().max);
+  histogram.reset();
+  LatencyHistogram::Summary s = histogram.getSummary();
+  EXPECT_EQ(0u, s.count);
+  EXPECT_EQ(0u, s.max);
+}
+
+}  // namespace
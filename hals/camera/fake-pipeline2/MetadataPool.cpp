@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera2_MetadataPool"
+
+#include <utils/Errors.h>
+#include <utils/Log.h>
+
+#include "MetadataPool.h"
+
+namespace android {
+
+MetadataPool::MetadataPool(size_t capacity)
+    : mCapacity(capacity), mHits(0), mMisses(0) {
+  mFree.setCapacity(capacity);
+}
+
+MetadataPool::~MetadataPool() {
+  for (size_t i = 0; i < mFree.size(); i++) {
+    free_camera_metadata(mFree[i]);
+  }
+}
+
+camera_metadata_t *MetadataPool::acquire(const camera_metadata_t *src) {
+  size_t entries = kExtraEntries;
+  size_t data = kExtraData;
+  if (src != NULL) {
+    entries += get_camera_metadata_entry_count(src);
+    data += get_camera_metadata_data_count(src);
+  }
+
+  camera_metadata_t *buffer = NULL;
+  {
+    Mutex::Autolock lock(mLock);
+    for (size_t i = mFree.size(); i > 0; i--) {
+      camera_metadata_t *candidate = mFree[i - 1];
+      if (get_camera_metadata_entry_capacity(candidate) >= entries &&
+          get_camera_metadata_data_capacity(candidate) >= data) {
+        buffer = candidate;
+        mFree.removeAt(i - 1);
+        break;
+      }
+    }
+    if (buffer != NULL) {
+      mHits++;
+    } else {
+      mMisses++;
+    }
+  }
+
+  if (buffer != NULL) {
+    // Reset to empty, keeping the same capacity
+    size_t entryCapacity = get_camera_metadata_entry_capacity(buffer);
+    size_t dataCapacity = get_camera_metadata_data_capacity(buffer);
+    buffer = place_camera_metadata(
+        buffer, calculate_camera_metadata_size(entryCapacity, dataCapacity),
+        entryCapacity, dataCapacity);
+  } else {
+    // Leave room to grow, like CameraMetadata does when it resizes
+    buffer = allocate_camera_metadata(entries * 2, data * 2);
+    if (buffer == NULL) {
+      ALOGE("%s: Unable to allocate metadata for %zu entries, %zu bytes",
+            __FUNCTION__, entries * 2, data * 2);
+      return NULL;
+    }
+  }
+
+  if (src != NULL && append_camera_metadata(buffer, src) != OK) {
+    ALOGE("%s: Unable to copy metadata", __FUNCTION__);
+    free_camera_metadata(buffer);
+    return NULL;
+  }
+  return buffer;
+}
+
+void MetadataPool::release(camera_metadata_t *buffer) {
+  if (buffer == NULL) return;
+  {
+    Mutex::Autolock lock(mLock);
+    if (mFree.size() < mCapacity) {
+      mFree.push_back(buffer);
+      return;
+    }
+  }
+  free_camera_metadata(buffer);
+}
+
+}  // namespace android
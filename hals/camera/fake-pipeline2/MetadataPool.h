@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Recycles camera_metadata_t buffers for per-request settings and results.
+ * A copy is placed into a released buffer that has room for it plus some
+ * headroom for the result keys added during readout, instead of cloning into
+ * a fresh allocation.
+ *
+ * Buffers are handed to a CameraMetadata with acquire(), and given back
+ * with release(). If the CameraMetadata had to grow in between, the bigger
+ * buffer is what comes back, so the pool settles on buffers large enough
+ * for the results.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_METADATA_POOL_H
+#define HW_EMULATOR_CAMERA2_METADATA_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include <system/camera_metadata.h>
+#include <utils/Mutex.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+class MetadataPool {
+ public:
+  explicit MetadataPool(size_t capacity);
+  ~MetadataPool();
+
+  // Get a buffer holding a copy of src, or an empty one if src is NULL.
+  // Returns NULL if a new buffer is needed and cannot be allocated.
+  camera_metadata_t *acquire(const camera_metadata_t *src);
+  // Return a buffer, from acquire() or any other allocation of
+  // libcamera_metadata, to the pool.
+  void release(camera_metadata_t *buffer);
+
+  uint64_t getHits() const { return mHits.load(); }
+  uint64_t getMisses() const { return mMisses.load(); }
+
+ private:
+  // Room left in every buffer handed out, for the keys added on readout
+  static const size_t kExtraEntries = 16;
+  static const size_t kExtraData = 256;
+
+  const size_t mCapacity;
+  Mutex mLock;
+  Vector<camera_metadata_t *> mFree;
+  // Atomic so that dump() can read them without mLock
+  std::atomic<uint64_t> mHits;
+  std::atomic<uint64_t> mMisses;
+};
+
+}  // namespace android
+
+#endif  // HW_EMULATOR_CAMERA2_METADATA_POOL_H
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+
+#include "MetadataPool.h"
+
+namespace {
+
+using android::MetadataPool;
+
+camera_metadata_t *makeSettings(size_t entries, int64_t exposureTime) {
+  camera_metadata_t *settings = allocate_camera_metadata(entries, sizeof(exposureTime));
+  add_camera_metadata_entry(settings, ANDROID_SENSOR_EXPOSURE_TIME,
+                            &exposureTime, 1);
+  for (size_t i = 1; i < entries; i++) {
+    uint8_t mode = ANDROID_CONTROL_MODE_AUTO;
+    add_camera_metadata_entry(settings, ANDROID_CONTROL_MODE, &mode, 1);
+  }
+  return settings;
+}
+
+TEST(MetadataPoolTest, MissesWhenEmpty) {
+  MetadataPool pool(2);
+  camera_metadata_t *buffer = pool.acquire(NULL);
+  ASSERT_TRUE(buffer != NULL);
+  EXPECT_EQ(0u, get_camera_metadata_entry_count(buffer));
+  EXPECT_EQ(0u, pool.getHits());
+  EXPECT_EQ(1u, pool.getMisses());
+  pool.release(buffer);
+}
+
+TEST(MetadataPoolTest, CopiesSource) {
+  MetadataPool pool(2);
+  camera_metadata_t *src = makeSettings(1, 1000);
+  camera_metadata_t *buffer = pool.acquire(src);
+  ASSERT_TRUE(buffer != NULL);
+  EXPECT_NE(src, buffer);
+  camera_metadata_ro_entry_t entry;
+  ASSERT_EQ(0, find_camera_metadata_ro_entry(
+                   buffer, ANDROID_SENSOR_EXPOSURE_TIME, &entry));
+  EXPECT_EQ(1000, entry.data.i64[0]);
+  pool.release(buffer);
+  free_camera_metadata(src);
+}
+
+TEST(MetadataPoolTest, ReusesReleasedBuffer) {
+  MetadataPool pool(2);
+  camera_metadata_t *src = makeSettings(1, 1000);
+  camera_metadata_t *first = pool.acquire(src);
+  pool.release(first);
+
+  camera_metadata_t *second = pool.acquire(src);
+  EXPECT_EQ(first, second);
+  // Reset before the copy, so the entry is not there twice
+  EXPECT_EQ(1u, get_camera_metadata_entry_count(second));
+  EXPECT_EQ(1u, pool.getHits());
+  EXPECT_EQ(1u, pool.getMisses());
+  pool.release(second);
+  free_camera_metadata(src);
+}
+
+TEST(MetadataPoolTest, MissesWhenReleasedBufferTooSmall) {
+  MetadataPool pool(2);
+  camera_metadata_t *small = pool.acquire(NULL);
+  pool.release(small);
+
+  camera_metadata_t *src = makeSettings(64, 1000);
+  camera_metadata_t *big = pool.acquire(src);
+  ASSERT_TRUE(big != NULL);
+  EXPECT_NE(small, big);
+  EXPECT_EQ(64u, get_camera_metadata_entry_count(big));
+  EXPECT_EQ(0u, pool.getHits());
+  EXPECT_EQ(2u, pool.getMisses());
+
+  // The small one is still there for requests it fits
+  EXPECT_EQ(small, pool.acquire(NULL));
+  EXPECT_EQ(1u, pool.getHits());
+  pool.release(small);
+  pool.release(big);
+  free_camera_metadata(src);
+}
+
+TEST(MetadataPoolTest, FreesBeyondCapacity) {
+  MetadataPool pool(1);
+  camera_metadata_t *a = pool.acquire(NULL);
+  camera_metadata_t *b = pool.acquire(NULL);
+  pool.release(a);
+  pool.release(b);
+
+  a = pool.acquire(NULL);
+  b = pool.acquire(NULL);
+  EXPECT_EQ(1u, pool.getHits());
+  EXPECT_EQ(3u, pool.getMisses());
+  pool.release(a);
+  pool.release(b);
+}
+
+}  // namespace
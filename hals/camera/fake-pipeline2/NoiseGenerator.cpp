@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_NoiseGenerator"
+
+#include "NoiseGenerator.h"
+
+#include <math.h>
+#include <utils/Log.h>
+
+namespace android {
+
+// SplitMix64, used to expand seeds into generator state
+static uint64_t splitMix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+// Standard normal quantile, found by bisection. Only used to build tables.
+static double normalQuantile(double p) {
+  double lo = -10, hi = 10;
+  for (int i = 0; i < 64; i++) {
+    double mid = (lo + hi) / 2;
+    if (0.5 * erfc(-mid / M_SQRT2) < p) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return (lo + hi) / 2;
+}
+
+NoiseGenerator::NoiseGenerator() : mGaussianTable(getGaussianTable()) {
+  seed(0, 0);
+}
+
+NoiseGenerator::NoiseGenerator(uint64_t seed, uint64_t stream)
+    : mGaussianTable(getGaussianTable()) {
+  this->seed(seed, stream);
+}
+
+void NoiseGenerator::seed(uint64_t seed, uint64_t stream) {
+  uint64_t x = stream;
+  x = seed ^ splitMix64(&x);
+  uint64_t a = splitMix64(&x);
+  uint64_t b = splitMix64(&x);
+  mState[0] = a;
+  mState[1] = a >> 32;
+  mState[2] = b;
+  mState[3] = b >> 32;
+  // xoshiro must not start from the all-zero state
+  if ((a | b) == 0) mState[0] = 1;
+}
+
+const float *NoiseGenerator::getGaussianTable() {
+  struct GaussianTable {
+    float entries[kGaussianTableSize + 1];
+
+    GaussianTable() {
+      // Quantiles at the midpoints of kGaussianTableSize + 1 equal bins, so
+      // the end points stay finite
+      double quantiles[kGaussianTableSize + 1];
+      for (uint32_t i = 0; i <= kGaussianTableSize; i++) {
+        quantiles[i] = normalQuantile((i + 0.5) / (kGaussianTableSize + 1));
+      }
+      // nextGaussian draws uniformly between neighboring entries; rescale so
+      // that distribution has unit variance
+      double variance = 0;
+      for (uint32_t i = 0; i < kGaussianTableSize; i++) {
+        double a = quantiles[i], b = quantiles[i + 1];
+        variance += (a * a + a * b + b * b) / 3;
+      }
+      double scale = 1 / sqrt(variance / kGaussianTableSize);
+      for (uint32_t i = 0; i <= kGaussianTableSize; i++) {
+        entries[i] = quantiles[i] * scale;
+      }
+    }
+  };
+  static const GaussianTable table;
+  return table.entries;
+}
+
+NoisePlane::NoisePlane() : mData(NULL), mMask(0) {}
+
+status_t NoisePlane::init(int sizeBits, uint64_t seed) {
+  if (sizeBits < 1 || sizeBits > 24) {
+    ALOGE("%s: Unsupported noise plane size 2^%d", __FUNCTION__, sizeBits);
+    return BAD_VALUE;
+  }
+  size_t size = 1u << sizeBits;
+  mSamples.clear();
+  if (mSamples.insertAt(0.0f, 0, size) < 0) {
+    ALOGE("%s: Unable to allocate %zu noise samples", __FUNCTION__, size);
+    mData = NULL;
+    return NO_MEMORY;
+  }
+  NoiseGenerator generator(seed, 0);
+  float *samples = mSamples.editArray();
+  for (size_t i = 0; i < size; i++) {
+    samples[i] = generator.nextGaussian();
+  }
+  mData = samples;
+  mMask = size - 1;
+  return OK;
+}
+
+}  // namespace android
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Seedable Gaussian noise sources for the fake sensor's RAW output. Unlike
+ * std::rand, a NoiseGenerator holds all of its state, so each capture thread
+ * can own one without any locking, and a given seed always reproduces the
+ * same noise no matter how rows are split across threads.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_NOISE_GENERATOR_H
+#define HW_EMULATOR_CAMERA2_NOISE_GENERATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Errors.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+class NoiseGenerator {
+ public:
+  NoiseGenerator();
+  NoiseGenerator(uint64_t seed, uint64_t stream);
+
+  // Restart the sequence. Generators with the same seed but different
+  // streams, e.g. one per sensor row, produce independent sequences.
+  void seed(uint64_t seed, uint64_t stream);
+
+  // Uniformly distributed 32-bit value (xoshiro128++)
+  inline uint32_t nextUint32();
+
+  // Sample from the standard normal distribution, looked up from a table of
+  // its inverse CDF. Tails are clipped at about 3.7 standard deviations.
+  inline float nextGaussian();
+
+ private:
+  static inline uint32_t rotl(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+  }
+
+  // Inverse CDF of the standard normal distribution, sampled at
+  // kGaussianTableSize + 1 evenly spaced probabilities
+  static const int kGaussianTableBits = 12;
+  static const uint32_t kGaussianTableSize = 1 << kGaussianTableBits;
+  static const float *getGaussianTable();
+
+  uint32_t mState[4];
+  const float *mGaussianTable;
+};
+
+// A fixed plane of precomputed standard normal samples. Reading from it is
+// much cheaper than generating fresh noise; callers pick a random offset for
+// each row so the pattern doesn't stay put from frame to frame.
+class NoisePlane {
+ public:
+  NoisePlane();
+
+  // Fill the plane with 2^sizeBits samples drawn using seed.
+  status_t init(int sizeBits, uint64_t seed);
+  bool isInitialized() const { return !mSamples.isEmpty(); }
+
+  // Sample at index, wrapping around the end of the plane
+  float getSample(uint32_t index) const { return mData[index & mMask]; }
+
+ private:
+  Vector<float> mSamples;
+  const float *mData;
+  uint32_t mMask;
+};
+
+uint32_t NoiseGenerator::nextUint32() {
+  const uint32_t result = rotl(mState[0] + mState[3], 7) + mState[0];
+  const uint32_t t = mState[1] << 9;
+
+  mState[2] ^= mState[0];
+  mState[3] ^= mState[1];
+  mState[1] ^= mState[2];
+  mState[0] ^= mState[3];
+  mState[2] ^= t;
+  mState[3] = rotl(mState[3], 11);
+
+  return result;
+}
+
+float NoiseGenerator::nextGaussian() {
+  // Top bits pick a table interval, the rest interpolate within it
+  uint32_t bits = nextUint32();
+  uint32_t index = bits >> (32 - kGaussianTableBits);
+  float frac = (bits & ((1u << (32 - kGaussianTableBits)) - 1)) *
+               (1.0f / (1u << (32 - kGaussianTableBits)));
+  const float *entry = mGaussianTable + index;
+  return entry[0] + (entry[1] - entry[0]) * frac;
+}
+
+}  // namespace android
+
+#endif  // HW_EMULATOR_CAMERA2_NOISE_GENERATOR_H
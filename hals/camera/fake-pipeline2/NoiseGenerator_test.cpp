@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <math.h>
+
+#include <gtest/gtest.h>
+
+#include "NoiseGenerator.h"
+
+namespace {
+
+using android::NoiseGenerator;
+using android::NoisePlane;
+
+const int kSamples = 1 << 20;
+
+TEST(NoiseGeneratorTest, SameSeedRepeats) {
+  NoiseGenerator a(1234, 5), b(1234, 5);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(a.nextUint32(), b.nextUint32()) << "sample " << i;
+  }
+  a.seed(1234, 5);
+  b.seed(1234, 5);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(a.nextGaussian(), b.nextGaussian()) << "sample " << i;
+  }
+}
+
+TEST(NoiseGeneratorTest, StreamsDiffer) {
+  NoiseGenerator a(1234, 0), b(1234, 1), c(1235, 0);
+  int sameB = 0, sameC = 0;
+  for (int i = 0; i < 1000; i++) {
+    uint32_t value = a.nextUint32();
+    if (value == b.nextUint32()) sameB++;
+    if (value == c.nextUint32()) sameC++;
+  }
+  EXPECT_EQ(0, sameB);
+  EXPECT_EQ(0, sameC);
+}
+
+TEST(NoiseGeneratorTest, GaussianMoments) {
+  NoiseGenerator noise(2018, 0);
+  double sum = 0, sumSq = 0;
+  float minValue = 0, maxValue = 0;
+  int withinOneSigma = 0;
+  for (int i = 0; i < kSamples; i++) {
+    float value = noise.nextGaussian();
+    sum += value;
+    sumSq += value * value;
+    minValue = fminf(minValue, value);
+    maxValue = fmaxf(maxValue, value);
+    if (fabsf(value) < 1) withinOneSigma++;
+  }
+  double mean = sum / kSamples;
+  double variance = sumSq / kSamples - mean * mean;
+  EXPECT_NEAR(0, mean, 0.01);
+  EXPECT_NEAR(1, variance, 0.01);
+  // 68.3% of a normal distribution lies within one standard deviation
+  EXPECT_NEAR(0.683, (double)withinOneSigma / kSamples, 0.005);
+  EXPECT_LT(minValue, -3);
+  EXPECT_GT(maxValue, 3);
+  EXPECT_GT(minValue, -4);
+  EXPECT_LT(maxValue, 4);
+}
+
+TEST(NoisePlaneTest, WrapsAndRepeats) {
+  NoisePlane a, b;
+  EXPECT_FALSE(a.isInitialized());
+  ASSERT_EQ(android::OK, a.init(10, 99));
+  ASSERT_EQ(android::OK, b.init(10, 99));
+  EXPECT_TRUE(a.isInitialized());
+  for (uint32_t i = 0; i < 1024; i++) {
+    ASSERT_EQ(a.getSample(i), b.getSample(i));
+    ASSERT_EQ(a.getSample(i), a.getSample(i + 1024));
+  }
+  EXPECT_EQ(a.getSample(0xffffffffu), a.getSample(1023));
+}
+
+TEST(NoisePlaneTest, RejectsBadSize) {
+  NoisePlane plane;
+  EXPECT_EQ(android::BAD_VALUE, plane.init(0, 1));
+  EXPECT_EQ(android::BAD_VALUE, plane.init(32, 1));
+  EXPECT_FALSE(plane.isInitialized());
+}
+
+}  // namespace
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * A fixed-capacity free list of heap objects, for the per-request containers
+ * that would otherwise be allocated for every capture and freed once its
+ * result is sent. T must be default constructible and have clear(); released
+ * objects are cleared but keep their storage.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_OBJECT_POOL_H
+#define HW_EMULATOR_CAMERA2_OBJECT_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include <utils/Mutex.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+template <typename T>
+class ObjectPool {
+ public:
+  explicit ObjectPool(size_t capacity)
+      : mCapacity(capacity), mHits(0), mMisses(0) {
+    mFree.setCapacity(capacity);
+  }
+
+  ~ObjectPool() {
+    for (size_t i = 0; i < mFree.size(); i++) {
+      delete mFree[i];
+    }
+  }
+
+  // Get an empty object, reusing a released one if there is any
+  T *acquire() {
+    Mutex::Autolock lock(mLock);
+    if (mFree.isEmpty()) {
+      mMisses++;
+      return new T();
+    }
+    T *object = mFree[mFree.size() - 1];
+    mFree.removeAt(mFree.size() - 1);
+    mHits++;
+    return object;
+  }
+
+  // Return an object from acquire(). Objects beyond the pool's capacity are
+  // deleted.
+  void release(T *object) {
+    if (object == NULL) return;
+    object->clear();
+    {
+      Mutex::Autolock lock(mLock);
+      if (mFree.size() < mCapacity) {
+        mFree.push_back(object);
+        return;
+      }
+    }
+    delete object;
+  }
+
+  uint64_t getHits() const { return mHits.load(); }
+  uint64_t getMisses() const { return mMisses.load(); }
+
+ private:
+  const size_t mCapacity;
+  Mutex mLock;
+  Vector<T *> mFree;
+  // Atomic so that dump() can read them without mLock
+  std::atomic<uint64_t> mHits;
+  std::atomic<uint64_t> mMisses;
+};
+
+}  // namespace android
+
+#endif  // HW_EMULATOR_CAMERA2_OBJECT_POOL_H
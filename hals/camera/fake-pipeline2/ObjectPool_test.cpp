@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+
+#include "ObjectPool.h"
+
+namespace {
+
+using android::ObjectPool;
+
+int gLiveObjects = 0;
+
+class Counted {
+ public:
+  Counted() : value(0), clears(0) { gLiveObjects++; }
+  ~Counted() { gLiveObjects--; }
+  void clear() {
+    value = 0;
+    clears++;
+  }
+
+  int value;
+  int clears;
+};
+
+TEST(ObjectPoolTest, MissesWhenEmpty) {
+  ObjectPool<Counted> pool(2);
+  Counted *a = pool.acquire();
+  Counted *b = pool.acquire();
+  ASSERT_TRUE(a != NULL);
+  ASSERT_TRUE(b != NULL);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(0u, pool.getHits());
+  EXPECT_EQ(2u, pool.getMisses());
+  pool.release(a);
+  pool.release(b);
+}
+
+TEST(ObjectPoolTest, ReusesReleasedObject) {
+  ObjectPool<Counted> pool(2);
+  Counted *a = pool.acquire();
+  a->value = 42;
+  pool.release(a);
+  Counted *b = pool.acquire();
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(0, b->value);
+  EXPECT_EQ(1, b->clears);
+  EXPECT_EQ(1u, pool.getHits());
+  EXPECT_EQ(1u, pool.getMisses());
+  pool.release(b);
+}
+
+TEST(ObjectPoolTest, DeletesBeyondCapacity) {
+  gLiveObjects = 0;
+  {
+    ObjectPool<Counted> pool(1);
+    Counted *a = pool.acquire();
+    Counted *b = pool.acquire();
+    EXPECT_EQ(2, gLiveObjects);
+    pool.release(a);
+    pool.release(b);
+    EXPECT_EQ(1, gLiveObjects);
+    EXPECT_EQ(a, pool.acquire());
+    EXPECT_EQ(1u, pool.getHits());
+    pool.release(a);
+  }
+  EXPECT_EQ(0, gLiveObjects);
+}
+
+TEST(ObjectPoolTest, IgnoresNullRelease) {
+  ObjectPool<Counted> pool(1);
+  pool.release(NULL);
+  pool.release(pool.acquire());
+  EXPECT_EQ(0u, pool.getHits());
+  EXPECT_EQ(1u, pool.getMisses());
+}
+
+}  // namespace
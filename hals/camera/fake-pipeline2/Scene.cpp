@@ -26,19 +26,18 @@
 
 namespace android {
 
-// Define single-letter shortcuts for scene definition, for directly indexing
-// mCurrentColors
-#define G (Scene::GRASS * Scene::NUM_CHANNELS)
-#define S (Scene::GRASS_SHADOW * Scene::NUM_CHANNELS)
-#define H (Scene::HILL * Scene::NUM_CHANNELS)
-#define W (Scene::WALL * Scene::NUM_CHANNELS)
-#define R (Scene::ROOF * Scene::NUM_CHANNELS)
-#define D (Scene::DOOR * Scene::NUM_CHANNELS)
-#define C (Scene::CHIMNEY * Scene::NUM_CHANNELS)
-#define I (Scene::WINDOW * Scene::NUM_CHANNELS)
-#define U (Scene::SUN * Scene::NUM_CHANNELS)
-#define K (Scene::SKY * Scene::NUM_CHANNELS)
-#define M (Scene::MOON * Scene::NUM_CHANNELS)
+// Define single-letter shortcuts for scene definition
+#define G Scene::GRASS
+#define S Scene::GRASS_SHADOW
+#define H Scene::HILL
+#define W Scene::WALL
+#define R Scene::ROOF
+#define D Scene::DOOR
+#define C Scene::CHIMNEY
+#define I Scene::WINDOW
+#define U Scene::SUN
+#define K Scene::SKY
+#define M Scene::MOON
 
 const int Scene::kSceneWidth = 20;
 const int Scene::kSceneHeight = 20;
@@ -108,6 +107,18 @@ Scene::Scene(int sensorWidthPx, int sensorHeightPx, float sensorSensitivity)
   mFilterB[0] = 0.0557f;
   mFilterB[1] = -0.2040f;
   mFilterB[2] = 1.0570f;
+
+  for (int i = 0; i < NUM_MATERIALS; i++) {
+    // Converting for xyY to XYZ:
+    // X = Y / y * x
+    // Y = Y
+    // Z = Y / y * (1 - x - y);
+    mMaterialXYZ[0][i] =
+        kMaterials_xyY[i][2] / kMaterials_xyY[i][1] * kMaterials_xyY[i][0];
+    mMaterialXYZ[1][i] = kMaterials_xyY[i][2];
+    mMaterialXYZ[2][i] = kMaterials_xyY[i][2] / kMaterials_xyY[i][1] *
+                         (1 - kMaterials_xyY[i][0] - kMaterials_xyY[i][1]);
+  }
 }
 
 Scene::~Scene() {}
@@ -248,52 +259,38 @@ void Scene::calculateScene(nsecs_t time) {
   ALOGV("Shade XYZ: %f, %f, %f", shadeIllumXYZ[0], shadeIllumXYZ[1],
         shadeIllumXYZ[2]);
 
+  // Light reaching the sensor from each material
+  float matXYZ[3][NUM_MATERIALS];
   for (int i = 0; i < NUM_MATERIALS; i++) {
-    // Converting for xyY to XYZ:
-    // X = Y / y * x
-    // Y = Y
-    // Z = Y / y * (1 - x - y);
-    float matXYZ[3] = {
-        kMaterials_xyY[i][2] / kMaterials_xyY[i][1] * kMaterials_xyY[i][0],
-        kMaterials_xyY[i][2],
-        kMaterials_xyY[i][2] / kMaterials_xyY[i][1] *
-            (1 - kMaterials_xyY[i][0] - kMaterials_xyY[i][1])};
-
+    const float *illumXYZ = NULL;
     if (kMaterialsFlags[i] == 0 || kMaterialsFlags[i] & kSky) {
-      matXYZ[0] *= directIllumXYZ[0];
-      matXYZ[1] *= directIllumXYZ[1];
-      matXYZ[2] *= directIllumXYZ[2];
+      illumXYZ = directIllumXYZ;
     } else if (kMaterialsFlags[i] & kShadowed) {
-      matXYZ[0] *= shadeIllumXYZ[0];
-      matXYZ[1] *= shadeIllumXYZ[1];
-      matXYZ[2] *= shadeIllumXYZ[2];
+      illumXYZ = shadeIllumXYZ;
     }  // else if (kMaterialsFlags[i] * kSelfLit), do nothing
+    for (int c = 0; c < 3; c++) {
+      matXYZ[c][i] = illumXYZ != NULL ? mMaterialXYZ[c][i] * illumXYZ[c]
+                                      : mMaterialXYZ[c][i];
+    }
+    ALOGV("Mat %d XYZ: %f, %f, %f", i, matXYZ[0][i], matXYZ[1][i],
+          matXYZ[2][i]);
+  }
 
-    ALOGV("Mat %d XYZ: %f, %f, %f", i, matXYZ[0], matXYZ[1], matXYZ[2]);
-    float luxToElectrons =
-        mSensorSensitivity * mExposureDuration / (kAperture * kAperture);
-    mCurrentColors[i * NUM_CHANNELS + 0] =
-        (mFilterR[0] * matXYZ[0] + mFilterR[1] * matXYZ[1] +
-         mFilterR[2] * matXYZ[2]) *
-        luxToElectrons;
-    mCurrentColors[i * NUM_CHANNELS + 1] =
-        (mFilterGr[0] * matXYZ[0] + mFilterGr[1] * matXYZ[1] +
-         mFilterGr[2] * matXYZ[2]) *
-        luxToElectrons;
-    mCurrentColors[i * NUM_CHANNELS + 2] =
-        (mFilterGb[0] * matXYZ[0] + mFilterGb[1] * matXYZ[1] +
-         mFilterGb[2] * matXYZ[2]) *
-        luxToElectrons;
-    mCurrentColors[i * NUM_CHANNELS + 3] =
-        (mFilterB[0] * matXYZ[0] + mFilterB[1] * matXYZ[1] +
-         mFilterB[2] * matXYZ[2]) *
-        luxToElectrons;
-
-    ALOGV("Color %d RGGB: %d, %d, %d, %d", i,
-          mCurrentColors[i * NUM_CHANNELS + 0],
-          mCurrentColors[i * NUM_CHANNELS + 1],
-          mCurrentColors[i * NUM_CHANNELS + 2],
-          mCurrentColors[i * NUM_CHANNELS + 3]);
+  float luxToElectrons =
+      mSensorSensitivity * mExposureDuration / (kAperture * kAperture);
+  const float *filters[B + 1] = {mFilterR, mFilterGr, mFilterGb, mFilterB};
+  for (int c = R; c <= B; c++) {
+    const float *filter = filters[c];
+    for (int i = 0; i < NUM_MATERIALS; i++) {
+      mCurrentColors[c][i] =
+          (filter[0] * matXYZ[0][i] + filter[1] * matXYZ[1][i] +
+           filter[2] * matXYZ[2][i]) *
+          luxToElectrons;
+    }
+  }
+  for (int i = 0; i < NUM_MATERIALS; i++) {
+    ALOGV("Color %d RGGB: %d, %d, %d, %d", i, mCurrentColors[R][i],
+          mCurrentColors[Gr][i], mCurrentColors[Gb][i], mCurrentColors[B][i]);
   }
   // Shake viewpoint; horizontal and vertical sinusoids at roughly
   // human handshake frequencies
@@ -305,37 +302,78 @@ void Scene::calculateScene(nsecs_t time) {
                  kFreq2Magnitude * std::sin(kVertShakeFreq2 * timeSinceIdx)) *
                 mMapDiv * kShakeFraction;
 
-  // Set starting pixel
-  setReadoutPixel(0, 0);
+  calculateMaterialRuns();
 }
 
-void Scene::setReadoutPixel(int x, int y) {
-  mCurrentX = x;
-  mCurrentY = y;
-  mSubX = (x + mOffsetX + mHandshakeX) % mMapDiv;
-  mSubY = (y + mOffsetY + mHandshakeY) % mMapDiv;
-  mSceneX = (x + mOffsetX + mHandshakeX) / mMapDiv;
-  mSceneY = (y + mOffsetY + mHandshakeY) / mMapDiv;
-  mSceneIdx = mSceneY * kSceneWidth + mSceneX;
-  mCurrentSceneMaterial = &(mCurrentColors[kScene[mSceneIdx]]);
+void Scene::calculateMaterialRuns() {
+  // Sensor row y sees scene row (y + mOffsetY + mHandshakeY) / mMapDiv, and
+  // column 0 falls sub-tile startSubX into scene column startSceneX.
+  int startY = mOffsetY + mHandshakeY;
+  int startX = mOffsetX + mHandshakeX;
+  int startSubX = startX % mMapDiv;
+  int startSceneX = startX / mMapDiv;
+  int firstTileWidth = mMapDiv - startSubX + 1;
+
+  mFirstSceneRow = startY / mMapDiv;
+  int lastSceneRow = (mSensorHeight - 1 + startY) / mMapDiv;
+
+  mRuns.clear();
+  mRowRuns.clear();
+  for (int sceneY = mFirstSceneRow; sceneY <= lastSceneRow; sceneY++) {
+    mRowRuns.push_back(mRuns.size());
+    int sceneIdx = sceneY * kSceneWidth + startSceneX;
+    int x = 0;
+    for (int tile = 0; x < mSensorWidth; tile++) {
+      int endX = (tile == 0) ? firstTileWidth : x + mMapDiv + 1;
+      if (endX > mSensorWidth) endX = mSensorWidth;
+      uint32_t material = kScene[sceneIdx + tile];
+      if (mRuns.size() > mRowRuns.top() && mRuns.top().material == material) {
+        // Same material as the tile to the left
+        mRuns.editTop().endX = endX;
+      } else {
+        MaterialRun run = {static_cast<uint32_t>(endX), material};
+        mRuns.push_back(run);
+      }
+      x = endX;
+    }
+  }
+  mRowRuns.push_back(mRuns.size());
 }
 
-const uint32_t *Scene::getPixelElectrons() {
-  const uint32_t *pixel = mCurrentSceneMaterial;
-  mCurrentX++;
-  mSubX++;
-  if (mCurrentX >= mSensorWidth) {
-    mCurrentX = 0;
-    mCurrentY++;
-    if (mCurrentY >= mSensorHeight) mCurrentY = 0;
-    setReadoutPixel(mCurrentX, mCurrentY);
-  } else if (mSubX > mMapDiv) {
-    mSceneIdx++;
-    mSceneX++;
-    mCurrentSceneMaterial = &(mCurrentColors[kScene[mSceneIdx]]);
-    mSubX = 0;
+size_t Scene::getSpans(uint32_t x, uint32_t y, uint32_t step, uint32_t count,
+                       Span *spans, size_t maxSpans) const {
+  const uint32_t width = mSensorWidth;
+  size_t numSpans = 0;
+  const MaterialRun *run = NULL;
+  const MaterialRun *rowEnd = NULL;
+  while (count > 0 && numSpans < maxSpans) {
+    if (x >= width || run == NULL) {
+      while (x >= width) {
+        x -= width;
+        y = (y + 1 < (uint32_t)mSensorHeight) ? y + 1 : 0;
+      }
+      int sceneY = ((int)y + mOffsetY + mHandshakeY) / mMapDiv;
+      size_t row = sceneY - mFirstSceneRow;
+      run = mRuns.array() + mRowRuns[row];
+      rowEnd = mRuns.array() + mRowRuns[row + 1];
+    }
+    while (run->endX <= x) run++;
+
+    // Pixels of the run that land on the sampling grid
+    uint32_t pixels = (run->endX - x + step - 1) / step;
+    if (pixels > count) pixels = count;
+    if (numSpans > 0 && spans[numSpans - 1].material == run->material) {
+      spans[numSpans - 1].count += pixels;
+    } else {
+      spans[numSpans].count = pixels;
+      spans[numSpans].material = run->material;
+      numSpans++;
+    }
+    count -= pixels;
+    x += pixels * step;
+    if (++run == rowEnd) run = NULL;
   }
-  return pixel;
+  return numSpans;
 }
 
 // Handshake model constants.
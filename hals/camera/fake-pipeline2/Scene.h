@@ -27,6 +27,7 @@
 #define HW_EMULATOR_CAMERA2_SCENE_H
 
 #include "utils/Timers.h"
+#include "utils/Vector.h"
 
 namespace android {
 
@@ -55,20 +56,35 @@ class Scene {
   void setExposureDuration(float seconds);
 
   // Calculate scene information for current hour and the time offset since
-  // the hour. Must be called at least once before calling getLuminousExposure.
-  // Resets pixel readout location to 0,0
+  // the hour. Must be called at least once before calling getSpans.
   void calculateScene(nsecs_t time);
 
-  // Set sensor pixel readout location.
-  void setReadoutPixel(int x, int y);
+  enum ColorChannels { R = 0, Gr, Gb, B, Y, Cb, Cr, NUM_CHANNELS };
+
+  // A run of output pixels that all see the same scene material.
+  struct Span {
+    uint32_t count;
+    // Index of the material, below getMaterialCount()
+    uint32_t material;
+  };
 
-  // Get sensor response in physical units (electrons) for light hitting the
-  // current readout pixel, after passing through color filters. The readout
-  // pixel will be auto-incremented. The returned array can be indexed with
-  // ColorChannels.
-  const uint32_t* getPixelElectrons();
+  static constexpr size_t getMaterialCount() { return NUM_MATERIALS; }
 
-  enum ColorChannels { R = 0, Gr, Gb, B, Y, Cb, Cr, NUM_CHANNELS };
+  // Sensor response in physical units (electrons) for light hitting each
+  // material, after passing through the color filter of channel R, Gr, Gb
+  // or B. Indexed by Span::material.
+  const uint32_t* getElectrons(ColorChannels channel) const {
+    return mCurrentColors[channel];
+  }
+
+  // Split count output pixels at sensor columns x, x + step, x + 2 * step...
+  // of row y into spans of equal material. Columns past the end of the row
+  // continue at the start of the next one, wrapping to row 0 at the bottom.
+  // Writes at most maxSpans spans, and returns how many were written; the
+  // pixels covered are the sum of their counts. Only reads the state computed
+  // by calculateScene, so it is safe to call concurrently.
+  size_t getSpans(uint32_t x, uint32_t y, uint32_t step, uint32_t count,
+                  Span* spans, size_t maxSpans) const;
 
  private:
   // Sensor color filtering coefficients in XYZ
@@ -84,14 +100,23 @@ class Scene {
 
   int mSensorWidth;
   int mSensorHeight;
-  int mCurrentX;
-  int mCurrentY;
-  int mSubX;
-  int mSubY;
-  int mSceneX;
-  int mSceneY;
-  int mSceneIdx;
-  uint32_t* mCurrentSceneMaterial;
+
+  // Run-length map of scene materials over the sensor, rebuilt for every
+  // frame with the handshake applied. Material tiles are sampled as a row
+  // readout starting at column 0 always has: the first tile in each row is
+  // shortened by the handshake, and the following ones are mMapDiv + 1 wide.
+  struct MaterialRun {
+    // Sensor column just past the end of the run
+    uint32_t endX;
+    uint32_t material;
+  };
+  void calculateMaterialRuns();
+  // Runs for each row of scene tiles covered by the sensor, starting at
+  // scene row mFirstSceneRow. mRowRuns[i] is the index of the first run of
+  // tile row i in mRuns, and mRowRuns[i + 1] the end of them.
+  Vector<MaterialRun> mRuns;
+  Vector<size_t> mRowRuns;
+  int mFirstSceneRow;
 
   int mHour;
   float mExposureDuration;
@@ -112,7 +137,11 @@ class Scene {
     NUM_MATERIALS
   };
 
-  uint32_t mCurrentColors[NUM_MATERIALS * NUM_CHANNELS];
+  // XYZ of each material under unit illumination, or for self-lit ones
+  // the XYZ they emit; computed once from kMaterials_xyY
+  float mMaterialXYZ[3][NUM_MATERIALS];
+  // Electron counts of each material for the R, Gr, Gb and B filters
+  uint32_t mCurrentColors[B + 1][NUM_MATERIALS];
 
   /**
    * Constants for scene definition. These are various degrees of approximate.
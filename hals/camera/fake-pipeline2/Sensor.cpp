@@ -24,11 +24,15 @@
 #define ALOGVV(...) ((void)0)
 #endif
 
+#include <cutils/properties.h>
+#include <inttypes.h>
+#include <string.h>
 #include <utils/Log.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
-#include "../EmulatedFakeCamera2.h"
+#include "AuxBufferPool.h"
 #include "Sensor.h"
 #include "guest/libs/platform_support/api_level_fixes.h"
 #include "system/camera_metadata.h"
@@ -75,6 +79,13 @@ const float Sensor::kReadNoiseVarAfterGain =
 const int32_t Sensor::kSensitivityRange[2] = {100, 1600};
 const uint32_t Sensor::kDefaultSensitivity = 100;
 
+const char Sensor::kJpegInputProperty[] = "persist.camera.jpeg_input";
+const char Sensor::kNoiseSeedProperty[] = "persist.camera.noise_seed";
+const char Sensor::kNoisePlaneProperty[] = "persist.camera.noise_plane";
+const char Sensor::kFreeRunProperty[] = "persist.camera.sensor_free_run";
+// 1 MB of samples, a little over 100 rows of the default sensor
+const int Sensor::kNoisePlaneBits = 18;
+
 /** A few utility functions for math, normal distributions */
 
 // Take advantage of IEEE floating-point format to calculate an approximate
@@ -86,13 +97,37 @@ float sqrtf_approx(float r) {
   // symmetric about the real answer.
   const int32_t modifier = 0x1FBB4000;
 
-  int32_t r_i = *(int32_t *)(&r);
+  // memcpy rather than a pointer cast, which breaks strict aliasing
+  int32_t r_i;
+  memcpy(&r_i, &r, sizeof(r_i));
   r_i = (r_i >> 1) + modifier;
 
-  return *(float *)(&r_i);
+  memcpy(&r, &r_i, sizeof(r));
+  return r;
+}
+
+// Number of output pixels the row kernels are fed at a time
+static const uint32_t kKernelChunk = 256;
+
+static_assert(Scene::getMaterialCount() <= MaterialCodes::kMaxMaterials,
+              "Scene materials don't fit the sensor's material tables");
+
+// Fetch the scene materials of count output pixels, sampled every inc
+// sensor pixels from column x of row y. Pixels of the same scene material
+// are filled as one run.
+static void gatherMaterials(const Scene &scene, uint32_t x, uint32_t y,
+                            uint32_t inc, uint32_t count,
+                            uint8_t materials[kKernelChunk]) {
+  Scene::Span spans[kKernelChunk];
+  size_t numSpans = scene.getSpans(x, y, inc, count, spans, kKernelChunk);
+  for (size_t s = 0; s < numSpans; s++) {
+    // TODO: Perfect demosaicing is a cheat
+    memset(materials, spans[s].material, spans[s].count);
+    materials += spans[s].count;
+  }
 }
 
-Sensor::Sensor(uint32_t width, uint32_t height)
+Sensor::Sensor(uint32_t width, uint32_t height, CaptureScheduler *scheduler)
     : Thread(false),
       mResolution{width, height},
       mActiveArray{0, 0, width, height},
@@ -105,17 +140,59 @@ Sensor::Sensor(uint32_t width, uint32_t height)
       mFrameNumber(0),
       mCapturedBuffers(NULL),
       mListener(NULL),
-      mScene(width, height, kElectronsPerLuxSecond) {
+      mScene(width, height, kElectronsPerLuxSecond),
+      mScheduler(scheduler),
+      mCapturePriority(0),
+      mCaptureDeadline(0),
+      mKernels(&getSensorKernels()),
+      mNoiseSeed(0),
+      mNoiseFrame(0),
+      mUseNoisePlane(false),
+      mJpegInputYUV(true),
+      mNV21Height(0) {
+  memset(&mTables, 0, sizeof(mTables));
   ALOGV("Sensor created with pixel array %d x %d", width, height);
 }
 
 Sensor::~Sensor() { shutDown(); }
 
+void Sensor::setCapturePriority(int priority) { mCapturePriority = priority; }
+
 status_t Sensor::startUp() {
   ALOGV("%s: E", __FUNCTION__);
 
   int res;
   mCapturedBuffers = NULL;
+
+  char prop[PROPERTY_VALUE_MAX];
+  if (property_get(kNoiseSeedProperty, prop, NULL) > 0) {
+    mNoiseSeed = strtoull(prop, NULL, 0);
+  } else {
+    mNoiseSeed = systemTime();
+  }
+  mNoiseFrame = 0;
+
+  property_get(kJpegInputProperty, prop, "yuv");
+  mJpegInputYUV = strcmp(prop, "rgb") != 0;
+  property_get(kNoisePlaneProperty, prop, "0");
+  mUseNoisePlane = atoi(prop) != 0;
+  if (mUseNoisePlane && !mNoisePlane.isInitialized()) {
+    res = mNoisePlane.init(kNoisePlaneBits, mNoiseSeed);
+    if (res != OK) {
+      ALOGW("Unable to precompute sensor noise, generating it instead: %d",
+            res);
+      mUseNoisePlane = false;
+    }
+  }
+  ALOGV("Sensor noise seed %" PRIu64 "%s", mNoiseSeed,
+        mUseNoisePlane ? ", from noise plane" : "");
+
+  property_get(kFreeRunProperty, prop, "0");
+  mPacer.setFreeRunning(atoi(prop) != 0);
+  if (mPacer.isFreeRunning()) {
+    ALOGI("Sensor free running, frame durations are ignored");
+  }
+
   res = run("EmulatedFakeCamera2::Sensor", ANDROID_PRIORITY_URGENT_DISPLAY);
 
   if (res != OK) {
@@ -210,6 +287,7 @@ status_t Sensor::readyToRun() {
   mStartupTime = systemTime();
   mNextCaptureTime = 0;
   mNextCapturedBuffers = NULL;
+  mPacer.reset(mStartupTime);
   return OK;
 }
 
@@ -221,6 +299,10 @@ bool Sensor::threadLoop() {
    * in-order in time.
    */
 
+  // Every event of this cycle is scheduled relative to its start, which the
+  // previous cycle has already waited for
+  const nsecs_t frameStart = mPacer.getFrameStart();
+
   /**
    * Stage 1: Read in latest control parameters
    */
@@ -254,23 +336,19 @@ bool Sensor::threadLoop() {
   Buffers *capturedBuffers = NULL;
   nsecs_t captureTime = 0;
 
-  nsecs_t startRealTime = systemTime();
-  // Stagefright cares about system time for timestamps, so base simulated
-  // time on that.
-  nsecs_t simulatedTime = startRealTime;
-  nsecs_t frameEndRealTime = startRealTime + frameDuration;
+  // Stagefright cares about system time for timestamps, so the schedule is
+  // kept in system time too.
+  const nsecs_t readoutDoneTime = frameStart + kMinVerticalBlank;
+  const nsecs_t exposureStartTime = readoutDoneTime + mRowReadoutTime;
 
   if (mNextCapturedBuffers != NULL) {
     ALOGVV("Sensor starting readout");
-    // Pretend we're doing readout now; will signal once enough time has elapsed
     capturedBuffers = mNextCapturedBuffers;
     captureTime = mNextCaptureTime;
   }
-  simulatedTime += mRowReadoutTime + kMinVerticalBlank;
 
-  // TODO: Move this signal to another thread to simulate readout
-  // time properly
   if (capturedBuffers != NULL) {
+    mPacer.waitUntil(readoutDoneTime);
     ALOGVV("Sensor readout complete");
     Mutex::Autolock lock(mReadoutMutex);
     if (mCapturedBuffers != NULL) {
@@ -287,18 +365,25 @@ bool Sensor::threadLoop() {
   /**
    * Stage 2: Capture new image
    */
-  mNextCaptureTime = simulatedTime;
+  mNextCaptureTime =
+      mPacer.isFreeRunning() ? systemTime() : exposureStartTime;
   mNextCapturedBuffers = nextBuffers;
 
   if (mNextCapturedBuffers != NULL) {
+    mPacer.waitUntil(mNextCaptureTime);
     if (listener != NULL) {
       listener->onSensorEvent(frameNumber, SensorListener::EXPOSURE_START,
                               mNextCaptureTime);
     }
     ALOGVV("Starting next capture: Exposure: %f ms, gain: %d",
            (float)exposureDuration / 1e6, gain);
+    nsecs_t captureStart = systemTime();
+    // Free running frames are due as soon as they start
+    mCaptureDeadline =
+        mPacer.isFreeRunning() ? captureStart : frameStart + frameDuration;
     mScene.setExposureDuration((float)exposureDuration / 1e9);
     mScene.calculateScene(mNextCaptureTime);
+    updateMaterialTables(gain);
 
     // Might be adding more buffers, so size isn't constant
     for (size_t i = 0; i < mNextCapturedBuffers->size(); i++) {
@@ -331,11 +416,19 @@ bool Sensor::threadLoop() {
             bAux.streamId = 0;
             bAux.width = b.width;
             bAux.height = b.height;
-            bAux.format = HAL_PIXEL_FORMAT_RGB_888;
             bAux.stride = b.width;
             bAux.buffer = NULL;
-            // TODO: Reuse these
-            bAux.img = new uint8_t[b.width * b.height * 3];
+            size_t auxSize;
+            if (mJpegInputYUV) {
+              // NV21, which the compressor can encode without converting
+              bAux.format = HAL_PIXEL_FORMAT_YCrCb_420_SP;
+              auxSize = b.width * (b.height + (b.height + 1) / 2);
+            } else {
+              bAux.format = HAL_PIXEL_FORMAT_RGB_888;
+              auxSize = b.width * b.height * 3;
+            }
+            // Released by the JPEG compressor
+            bAux.img = AuxBufferPool::getInstance().acquire(auxSize);
             mNextCapturedBuffers->push_back(bAux);
 #if defined HAL_DATASPACE_DEPTH
           } else {
@@ -345,7 +438,12 @@ bool Sensor::threadLoop() {
           break;
         case HAL_PIXEL_FORMAT_YCrCb_420_SP:
         case HAL_PIXEL_FORMAT_YCbCr_420_888:
-          captureNV21(b.img, gain, b.stride);
+          if (b.streamId == 0) {
+            // JPEG input, laid out exactly as the compressor reads it
+            captureNV21(b.img, gain, b.stride, b.height);
+          } else {
+            captureNV21(b.img, gain, b.stride);
+          }
           break;
         case HAL_PIXEL_FORMAT_YV12:
           // TODO:
@@ -359,43 +457,78 @@ bool Sensor::threadLoop() {
           break;
       }
     }
+    mCaptureLatency.record(systemTime() - captureStart);
   }
 
   ALOGVV("Sensor vertical blanking interval");
-  nsecs_t workDoneRealTime = systemTime();
-  const nsecs_t timeAccuracy = 2e6;  // 2 ms of imprecision is ok
-  if (workDoneRealTime < frameEndRealTime - timeAccuracy) {
-    timespec t;
-    t.tv_sec = (frameEndRealTime - workDoneRealTime) / 1000000000L;
-    t.tv_nsec = (frameEndRealTime - workDoneRealTime) % 1000000000L;
-
-    int ret;
-    do {
-      ret = nanosleep(&t, &t);
-    } while (ret != 0);
-  }
-  nsecs_t endRealTime __unused = systemTime();
-  ALOGVV("Frame cycle took %d ms, target %d ms",
-         (int)((endRealTime - startRealTime) / 1000000),
+  nsecs_t workDoneRealTime __unused = systemTime();
+  mPacer.endFrame(frameDuration);
+  ALOGVV("Frame cycle work took %d ms, target %d ms",
+         (int)((workDoneRealTime - frameStart) / 1000000),
          (int)(frameDuration / 1000000));
   return true;
 };
 
-void Sensor::captureRaw(uint8_t *img, uint32_t gain, uint32_t stride) {
+/** Banded capture plumbing */
+
+class Sensor::CaptureJob : public CaptureScheduler::Job {
+ public:
+  CaptureJob(Sensor *sensor, RowCapture capture, uint8_t *img, uint32_t gain,
+             uint32_t stride)
+      : mSensor(sensor),
+        mCapture(capture),
+        mImg(img),
+        mGain(gain),
+        mStride(stride) {}
+
+  virtual void renderRows(uint32_t beginRow, uint32_t endRow) {
+    (mSensor->*mCapture)(mImg, mGain, mStride, beginRow, endRow);
+  }
+
+ private:
+  Sensor *mSensor;
+  RowCapture mCapture;
+  uint8_t *mImg;
+  uint32_t mGain;
+  uint32_t mStride;
+};
+
+void Sensor::runCapture(RowCapture capture, uint8_t *img, uint32_t gain,
+                        uint32_t stride, uint32_t rows, uint32_t rowAlign) {
+  CaptureJob job(this, capture, img, gain, stride);
+  mScheduler->run(&job, rows, rowAlign, mCapturePriority, mCaptureDeadline);
+}
+
+void Sensor::updateMaterialTables(uint32_t gain) {
+  const size_t numMaterials = Scene::getMaterialCount();
+  bool changed = !mTables.valid || mTables.gain != gain;
+  for (int c = Scene::R; c <= Scene::B; c++) {
+    const uint32_t *electrons =
+        mScene.getElectrons(static_cast<Scene::ColorChannels>(c));
+    if (memcmp(mTables.electrons[c], electrons,
+               numMaterials * sizeof(*electrons)) != 0) {
+      memcpy(mTables.electrons[c], electrons,
+             numMaterials * sizeof(*electrons));
+      changed = true;
+    }
+  }
+  if (!changed) return;
+  mTables.valid = true;
+  mTables.gain = gain;
+
   float totalGain = gain / 100.0 * kBaseGainFactor;
+  // In fixed-point math, calculate total scaling from electrons to 8bpp
+  int scale64x = 64 * totalGain * 255 / kMaxRawValue;
+  buildMaterialCodes(mTables.electrons[Scene::R], mTables.electrons[Scene::Gr],
+                     mTables.electrons[Scene::B], numMaterials, scale64x,
+                     &mTables.codes);
+
   float noiseVarGain = totalGain * totalGain;
   float readNoiseVar =
       kReadNoiseVarBeforeGain * noiseVarGain + kReadNoiseVarAfterGain;
-
-  int bayerSelect[4] = {Scene::R, Scene::Gr, Scene::Gb, Scene::B};  // RGGB
-  mScene.setReadoutPixel(0, 0);
-  for (unsigned int y = 0; y < mResolution[1]; y++) {
-    int *bayerRow = bayerSelect + (y & 0x1) * 2;
-    uint16_t *px = (uint16_t *)img + y * stride;
-    for (unsigned int x = 0; x < mResolution[0]; x++) {
-      uint32_t electronCount;
-      electronCount = mScene.getPixelElectrons()[bayerRow[x & 0x1]];
-
+  for (int c = Scene::R; c <= Scene::B; c++) {
+    for (size_t m = 0; m < numMaterials; m++) {
+      uint32_t electronCount = mTables.electrons[c][m];
       // TODO: Better pixel saturation curve?
       electronCount = (electronCount < kSaturationElectrons)
                           ? electronCount
@@ -404,160 +537,199 @@ void Sensor::captureRaw(uint8_t *img, uint32_t gain, uint32_t stride) {
       // TODO: Better A/D saturation curve?
       uint16_t rawCount = electronCount * totalGain;
       rawCount = (rawCount < kMaxRawValue) ? rawCount : kMaxRawValue;
+      rawCount += kBlackLevel;
+      mTables.rawCounts[c][m] = rawCount;
 
       // Calculate noise value
-      // TODO: Use more-correct Gaussian instead of uniform noise
       float photonNoiseVar = electronCount * noiseVarGain;
-      float noiseStddev = sqrtf_approx(readNoiseVar + photonNoiseVar);
-      // Scaled to roughly match gaussian/uniform noise stddev
-      float noiseSample = std::rand() * (2.5 / (1.0 + RAND_MAX)) - 1.25;
+      mTables.rawNoiseStddev[c][m] =
+          sqrtf_approx(readNoiseVar + photonNoiseVar);
+    }
+  }
 
-      rawCount += kBlackLevel;
-      rawCount += noiseStddev * noiseSample;
+  // In fixed-point math, calculate scaling factor to 13bpp millimeters
+  int depthScale64x = 64 * totalGain * 8191 / kMaxRawValue;
+  for (size_t m = 0; m < numMaterials; m++) {
+    // TODO: Make up real depth scene instead of using green channel
+    // as depth
+    uint32_t depthCount = mTables.electrons[Scene::Gr][m] * depthScale64x;
+    mTables.depth[m] = depthCount < 8191 * 64 ? depthCount / 64 : 0;
+  }
+}
+
+uint32_t Sensor::getScaledRows(uint32_t stride) const {
+  uint32_t inc = ceil((float)mResolution[0] / stride);
+  return (mResolution[1] + inc - 1) / inc;
+}
+
+void Sensor::captureRaw(uint8_t *img, uint32_t gain, uint32_t stride) {
+  mNoiseFrame++;
+  runCapture(&Sensor::captureRawRows, img, gain, stride, mResolution[1], 2);
+  ALOGVV("Raw sensor image captured");
+}
+
+void Sensor::captureRGBA(uint8_t *img, uint32_t gain, uint32_t stride) {
+  runCapture(&Sensor::captureRGBARows, img, gain, stride,
+             getScaledRows(stride), 1);
+  ALOGVV("RGBA sensor image captured");
+}
+
+void Sensor::captureRGB(uint8_t *img, uint32_t gain, uint32_t stride) {
+  runCapture(&Sensor::captureRGBRows, img, gain, stride,
+             getScaledRows(stride), 1);
+  ALOGVV("RGB sensor image captured");
+}
+
+void Sensor::captureNV21(uint8_t *img, uint32_t gain, uint32_t stride) {
+  uint32_t rows = getScaledRows(stride);
+  uint32_t inc = ceil((float)mResolution[0] / stride);
+  uint32_t outH = mResolution[1] / inc;
+  captureNV21(img, gain, stride, outH);
+  // When the sensor height isn't a multiple of inc, the last luma row lands
+  // on top of the chroma plane. Draw it last, as a serial capture would.
+  if (rows > outH) captureNV21Rows(img, gain, stride, outH, rows);
+  ALOGVV("NV21 sensor image captured");
+}
+
+void Sensor::captureNV21(uint8_t *img, uint32_t gain, uint32_t stride,
+                         uint32_t height) {
+  mNV21Height = height;
+  // Keep each pair of luma rows sharing a chroma row in one band
+  runCapture(&Sensor::captureNV21Rows, img, gain, stride,
+             std::min(getScaledRows(stride), height), 2);
+}
+
+void Sensor::captureDepth(uint8_t *img, uint32_t gain, uint32_t stride) {
+  runCapture(&Sensor::captureDepthRows, img, gain, stride,
+             getScaledRows(stride), 1);
+  ALOGVV("Depth sensor image captured");
+}
+
+void Sensor::captureRawRows(uint8_t *img, uint32_t /*gain*/,
+                            uint32_t stride, uint32_t beginRow,
+                            uint32_t endRow) {
+  int bayerSelect[4] = {Scene::R, Scene::Gr, Scene::Gb, Scene::B};  // RGGB
+  Scene::Span spans[kKernelChunk];
+  NoiseGenerator noise;
+  for (unsigned int y = beginRow; y < endRow; y++) {
+    int *bayerRow = bayerSelect + (y & 0x1) * 2;
+    noise.seed(mNoiseSeed, (uint64_t)mNoiseFrame << 32 | y);
+    // Each row reads the noise plane from its own random starting point
+    uint32_t planeOffset = noise.nextUint32();
+    uint16_t *px = (uint16_t *)img + y * stride;
+    size_t numSpans = 0, s = 0;
+    for (unsigned int x = 0; x < mResolution[0]; x++) {
+      if (s == numSpans) {
+        numSpans = mScene.getSpans(x, y, 1, mResolution[0] - x, spans,
+                                   kKernelChunk);
+        s = 0;
+      }
+      int channel = bayerRow[x & 0x1];
+      uint32_t material = spans[s].material;
+      if (--spans[s].count == 0) s++;
+
+      float noiseSample = mUseNoisePlane
+                              ? mNoisePlane.getSample(planeOffset + x)
+                              : noise.nextGaussian();
+
+      uint16_t rawCount = mTables.rawCounts[channel][material];
+      rawCount += mTables.rawNoiseStddev[channel][material] * noiseSample;
 
       *px++ = rawCount;
     }
     // TODO: Handle this better
     // simulatedTime += mRowReadoutTime;
   }
-  ALOGVV("Raw sensor image captured");
 }
 
-void Sensor::captureRGBA(uint8_t *img, uint32_t gain, uint32_t stride) {
-  float totalGain = gain / 100.0 * kBaseGainFactor;
-  // In fixed-point math, calculate total scaling from electrons to 8bpp
-  int scale64x = 64 * totalGain * 255 / kMaxRawValue;
+void Sensor::captureRGBARows(uint8_t *img, uint32_t /*gain*/,
+                             uint32_t stride, uint32_t beginRow,
+                             uint32_t endRow) {
   uint32_t inc = ceil((float)mResolution[0] / stride);
+  uint32_t outW = (mResolution[0] + inc - 1) / inc;
+  uint8_t materials[kKernelChunk];
 
-  for (unsigned int y = 0, outY = 0; y < mResolution[1]; y += inc, outY++) {
+  for (unsigned int outY = beginRow, y = outY * inc; outY < endRow;
+       y += inc, outY++) {
     uint8_t *px = img + outY * stride * 4;
-    mScene.setReadoutPixel(0, y);
-    for (unsigned int x = 0; x < mResolution[0]; x += inc) {
-      uint32_t rCount, gCount, bCount;
-      // TODO: Perfect demosaicing is a cheat
-      const uint32_t *pixel = mScene.getPixelElectrons();
-      rCount = pixel[Scene::R] * scale64x;
-      gCount = pixel[Scene::Gr] * scale64x;
-      bCount = pixel[Scene::B] * scale64x;
-
-      *px++ = rCount < 255 * 64 ? rCount / 64 : 255;
-      *px++ = gCount < 255 * 64 ? gCount / 64 : 255;
-      *px++ = bCount < 255 * 64 ? bCount / 64 : 255;
-      *px++ = 255;
-      for (unsigned int j = 1; j < inc; j++) mScene.getPixelElectrons();
+    for (unsigned int outX = 0; outX < outW; outX += kKernelChunk) {
+      uint32_t count = std::min(kKernelChunk, outW - outX);
+      gatherMaterials(mScene, outX * inc, y, inc, count, materials);
+      mKernels->materialsToRGBA(materials, count, &mTables.codes, px);
+      px += count * 4;
     }
     // TODO: Handle this better
     // simulatedTime += mRowReadoutTime;
   }
-  ALOGVV("RGBA sensor image captured");
 }
 
-void Sensor::captureRGB(uint8_t *img, uint32_t gain, uint32_t stride) {
-  float totalGain = gain / 100.0 * kBaseGainFactor;
-  // In fixed-point math, calculate total scaling from electrons to 8bpp
-  int scale64x = 64 * totalGain * 255 / kMaxRawValue;
+void Sensor::captureRGBRows(uint8_t *img, uint32_t /*gain*/,
+                            uint32_t stride, uint32_t beginRow,
+                            uint32_t endRow) {
   uint32_t inc = ceil((float)mResolution[0] / stride);
+  uint32_t outW = (mResolution[0] + inc - 1) / inc;
+  uint8_t materials[kKernelChunk];
 
-  for (unsigned int y = 0, outY = 0; y < mResolution[1]; y += inc, outY++) {
-    mScene.setReadoutPixel(0, y);
+  for (unsigned int outY = beginRow, y = outY * inc; outY < endRow;
+       y += inc, outY++) {
     uint8_t *px = img + outY * stride * 3;
-    for (unsigned int x = 0; x < mResolution[0]; x += inc) {
-      uint32_t rCount, gCount, bCount;
-      // TODO: Perfect demosaicing is a cheat
-      const uint32_t *pixel = mScene.getPixelElectrons();
-      rCount = pixel[Scene::R] * scale64x;
-      gCount = pixel[Scene::Gr] * scale64x;
-      bCount = pixel[Scene::B] * scale64x;
-
-      *px++ = rCount < 255 * 64 ? rCount / 64 : 255;
-      *px++ = gCount < 255 * 64 ? gCount / 64 : 255;
-      *px++ = bCount < 255 * 64 ? bCount / 64 : 255;
-      for (unsigned int j = 1; j < inc; j++) mScene.getPixelElectrons();
+    for (unsigned int outX = 0; outX < outW; outX += kKernelChunk) {
+      uint32_t count = std::min(kKernelChunk, outW - outX);
+      gatherMaterials(mScene, outX * inc, y, inc, count, materials);
+      mKernels->materialsToRGB(materials, count, &mTables.codes, px);
+      px += count * 3;
     }
     // TODO: Handle this better
     // simulatedTime += mRowReadoutTime;
   }
-  ALOGVV("RGB sensor image captured");
 }
 
-void Sensor::captureNV21(uint8_t *img, uint32_t gain, uint32_t stride) {
-  float totalGain = gain / 100.0 * kBaseGainFactor;
-  // Using fixed-point math with 6 bits of fractional precision.
-  // In fixed-point math, calculate total scaling from electrons to 8bpp
-  const int scale64x = 64 * totalGain * 255 / kMaxRawValue;
-  // In fixed-point math, saturation point of sensor after gain
-  const int saturationPoint = 64 * 255;
-  // Fixed-point coefficients for RGB-YUV transform
-  // Based on JFIF RGB->YUV transform.
-  // Cb/Cr offset scaled by 64x twice since they're applied post-multiply
-  const int rgbToY[] = {19, 37, 7};
-  const int rgbToCb[] = {-10, -21, 32, 524288};
-  const int rgbToCr[] = {32, -26, -5, 524288};
-  // Scale back to 8bpp non-fixed-point
-  const int scaleOut = 64;
-  const int scaleOutSq = scaleOut * scaleOut;  // after multiplies
+void Sensor::captureNV21Rows(uint8_t *img, uint32_t /*gain*/,
+                             uint32_t stride, uint32_t beginRow,
+                             uint32_t endRow) {
+  uint8_t materials[kKernelChunk];
 
   // inc = how many pixels to skip while reading every next pixel
   // horizontally.
   uint32_t inc = ceil((float)mResolution[0] / stride);
-  // outH = projected vertical resolution based on stride.
-  uint32_t outH = mResolution[1] / inc;
-  for (unsigned int y = 0, outY = 0; y < mResolution[1]; y += inc, outY++) {
+  for (unsigned int outY = beginRow, y = outY * inc; outY < endRow;
+       y += inc, outY++) {
     uint8_t *pxY = img + outY * stride;
-    uint8_t *pxVU = img + (outH + outY / 2) * stride;
-    mScene.setReadoutPixel(0, y);
-    for (unsigned int outX = 0; outX < stride; outX++) {
-      int32_t rCount, gCount, bCount;
-      // TODO: Perfect demosaicing is a cheat
-      const uint32_t *pixel = mScene.getPixelElectrons();
-      rCount = pixel[Scene::R] * scale64x;
-      rCount = rCount < saturationPoint ? rCount : saturationPoint;
-      gCount = pixel[Scene::Gr] * scale64x;
-      gCount = gCount < saturationPoint ? gCount : saturationPoint;
-      bCount = pixel[Scene::B] * scale64x;
-      bCount = bCount < saturationPoint ? bCount : saturationPoint;
-
-      *pxY++ = (rgbToY[0] * rCount + rgbToY[1] * gCount + rgbToY[2] * bCount) /
-               scaleOutSq;
-      if (outY % 2 == 0 && outX % 2 == 0) {
-        *pxVU++ = (rgbToCb[0] * rCount + rgbToCb[1] * gCount +
-                   rgbToCb[2] * bCount + rgbToCb[3]) /
-                  scaleOutSq;
-        *pxVU++ = (rgbToCr[0] * rCount + rgbToCr[1] * gCount +
-                   rgbToCr[2] * bCount + rgbToCr[3]) /
-                  scaleOutSq;
-      }
-
-      // Skip unprocessed pixels from sensor.
-      for (unsigned int j = 1; j < inc; j++) mScene.getPixelElectrons();
+    // Chroma is subsampled 2x2, taken from the even pixels of even rows
+    uint8_t *pxVU =
+        outY % 2 == 0 ? img + (mNV21Height + outY / 2) * stride : NULL;
+    for (unsigned int outX = 0; outX < stride; outX += kKernelChunk) {
+      uint32_t count = std::min(kKernelChunk, stride - outX);
+      gatherMaterials(mScene, outX * inc, y, inc, count, materials);
+      mKernels->materialsToNV21(materials, count, &mTables.codes, pxY, pxVU);
+      pxY += count;
+      if (pxVU != NULL) pxVU += count;
     }
   }
-  ALOGVV("NV21 sensor image captured");
 }
 
-void Sensor::captureDepth(uint8_t *img, uint32_t gain, uint32_t stride) {
-  float totalGain = gain / 100.0 * kBaseGainFactor;
-  // In fixed-point math, calculate scaling factor to 13bpp millimeters
-  int scale64x = 64 * totalGain * 8191 / kMaxRawValue;
+void Sensor::captureDepthRows(uint8_t *img, uint32_t /*gain*/,
+                              uint32_t stride, uint32_t beginRow,
+                              uint32_t endRow) {
   uint32_t inc = ceil((float)mResolution[0] / stride);
+  uint32_t outW = (mResolution[0] + inc - 1) / inc;
+  Scene::Span spans[kKernelChunk];
 
-  for (unsigned int y = 0, outY = 0; y < mResolution[1]; y += inc, outY++) {
-    mScene.setReadoutPixel(0, y);
+  for (unsigned int outY = beginRow, y = outY * inc; outY < endRow;
+       y += inc, outY++) {
     uint16_t *px = ((uint16_t *)img) + outY * stride;
-    for (unsigned int x = 0; x < mResolution[0]; x += inc) {
-      uint32_t depthCount;
-      // TODO: Make up real depth scene instead of using green channel
-      // as depth
-      const uint32_t *pixel = mScene.getPixelElectrons();
-      depthCount = pixel[Scene::Gr] * scale64x;
-
-      *px++ = depthCount < 8191 * 64 ? depthCount / 64 : 0;
-      for (unsigned int j = 1; j < inc; j++) mScene.getPixelElectrons();
+    for (unsigned int outX = 0; outX < outW;) {
+      size_t numSpans = mScene.getSpans(outX * inc, y, inc, outW - outX,
+                                        spans, kKernelChunk);
+      for (size_t s = 0; s < numSpans; s++) {
+        std::fill_n(px, spans[s].count, mTables.depth[spans[s].material]);
+        px += spans[s].count;
+        outX += spans[s].count;
+      }
     }
     // TODO: Handle this better
     // simulatedTime += mRowReadoutTime;
   }
-  ALOGVV("Depth sensor image captured");
 }
 
 void Sensor::captureDepthCloud(uint8_t * /*img*/) {
@@ -80,7 +80,12 @@
 #include "utils/Timers.h"
 
 #include "Base.h"
+#include "CaptureScheduler.h"
+#include "FramePacer.h"
+#include "LatencyHistogram.h"
+#include "NoiseGenerator.h"
 #include "Scene.h"
+#include "SensorKernels.h"
 
 namespace android {
 
@@ -90,9 +95,14 @@ class Sensor : private Thread, public virtual RefBase {
  public:
   // width: Width of pixel array
   // height: Height of pixel array
-  Sensor(uint32_t width, uint32_t height);
+  // scheduler: Render threads shared with the other sensors
+  Sensor(uint32_t width, uint32_t height, CaptureScheduler *scheduler);
   ~Sensor();
 
+  // Priority of this sensor's frames on the shared render threads, higher
+  // first. Set before startUp().
+  void setCapturePriority(int priority);
+
   /*
    * Power control
    */
@@ -154,6 +164,15 @@ class Sensor : private Thread, public virtual RefBase {
 
   void setSensorListener(SensorListener *listener);
 
+  /*
+   * Frame pacing statistics
+   */
+
+  uint64_t getFrameCount() const { return mPacer.getFrameCount(); }
+  uint64_t getMissedDeadlines() const { return mPacer.getMissedDeadlines(); }
+  // Time taken to render each frame into its buffers
+  const LatencyHistogram &getCaptureLatency() const { return mCaptureLatency; }
+
   /**
    * Static sensor characteristics
    */
@@ -192,6 +211,21 @@ class Sensor : private Thread, public virtual RefBase {
   static const int32_t kSensitivityRange[2];
   static const uint32_t kDefaultSensitivity;
 
+  // Set to "rgb" to render JPEG input as RGB_888 rather than NV21
+  static const char kJpegInputProperty[];
+
+  // RAW noise is reproducible for a given kNoiseSeedProperty; without it the
+  // seed changes on every startup. Setting kNoisePlaneProperty to 1 reads
+  // the noise from a precomputed plane of 2^kNoisePlaneBits samples instead
+  // of generating it for every pixel.
+  static const char kNoiseSeedProperty[];
+  static const char kNoisePlaneProperty[];
+  static const int kNoisePlaneBits;
+
+  // Set to 1 to ignore frame durations and produce frames as fast as they
+  // can be rendered
+  static const char kFreeRunProperty[];
+
  private:
   Mutex mControlMutex;  // Lock before accessing control parameters
   // Start of control parameters
@@ -229,14 +263,92 @@ class Sensor : private Thread, public virtual RefBase {
   nsecs_t mNextCaptureTime;
   Buffers *mNextCapturedBuffers;
 
+  // Schedules VSync, readout and exposure start
+  FramePacer mPacer;
+  LatencyHistogram mCaptureLatency;
+
   Scene mScene;
 
+  // Helper threads that render row bands alongside the sensor thread,
+  // shared by every sensor
+  CaptureScheduler *mScheduler;
+  int mCapturePriority;
+  // When the frame being rendered is due, for ordering it against the other
+  // sensors' frames
+  nsecs_t mCaptureDeadline;
+
+  // Pixel conversion kernels for this CPU
+  const SensorKernels *mKernels;
+
+  // Output of each scene material at the frame's gain, so the capture*Rows
+  // methods turn a pixel's material into output values with lookups instead
+  // of scaling and clamping its electron counts. Rebuilt by
+  // updateMaterialTables only when the scene's electron counts or the gain
+  // change.
+  struct MaterialTables {
+    bool valid;
+    // What the tables were built from: gain, and electrons of each material
+    // for the R, Gr, Gb and B filters
+    uint32_t gain;
+    uint32_t electrons[4][MaterialCodes::kMaxMaterials];
+    // 8-bit RGB and NV21 output
+    MaterialCodes codes;
+    // RAW16 count including the black level, before noise, and the standard
+    // deviation of the noise, for each Bayer channel
+    uint16_t rawCounts[4][MaterialCodes::kMaxMaterials];
+    float rawNoiseStddev[4][MaterialCodes::kMaxMaterials];
+    // 13-bit depth in millimeters
+    uint16_t depth[MaterialCodes::kMaxMaterials];
+  };
+  MaterialTables mTables;
+  void updateMaterialTables(uint32_t gain);
+
+  // RAW noise state. Each row seeds its own generator from mNoiseSeed and
+  // mNoiseFrame, so the noise doesn't depend on how rows are banded.
+  uint64_t mNoiseSeed;
+  uint32_t mNoiseFrame;
+  bool mUseNoisePlane;
+  NoisePlane mNoisePlane;
+
+  // Render the JPEG compressor's input as NV21 instead of RGB_888
+  bool mJpegInputYUV;
+  // Luma plane height of the NV21 capture in progress; the chroma plane
+  // starts right after it
+  uint32_t mNV21Height;
+
+  // Captures are split into bands of output rows, rendered by the
+  // capture*Rows methods on the sensor thread and the scheduler.
+  typedef void (Sensor::*RowCapture)(uint8_t *img, uint32_t gain,
+                                     uint32_t stride, uint32_t beginRow,
+                                     uint32_t endRow);
+  class CaptureJob;
+  void runCapture(RowCapture capture, uint8_t *img, uint32_t gain,
+                  uint32_t stride, uint32_t rows, uint32_t rowAlign);
+  // Number of output rows for a downscaled capture into a buffer of the
+  // given stride.
+  uint32_t getScaledRows(uint32_t stride) const;
+
   void captureRaw(uint8_t *img, uint32_t gain, uint32_t stride);
   void captureRGBA(uint8_t *img, uint32_t gain, uint32_t stride);
   void captureRGB(uint8_t *img, uint32_t gain, uint32_t stride);
   void captureNV21(uint8_t *img, uint32_t gain, uint32_t stride);
+  // NV21 capture into a buffer with a luma plane of the given height.
+  // Rows past the scaled sensor height are left untouched.
+  void captureNV21(uint8_t *img, uint32_t gain, uint32_t stride,
+                   uint32_t height);
   void captureDepth(uint8_t *img, uint32_t gain, uint32_t stride);
   void captureDepthCloud(uint8_t *img);
+
+  void captureRawRows(uint8_t *img, uint32_t gain, uint32_t stride,
+                      uint32_t beginRow, uint32_t endRow);
+  void captureRGBARows(uint8_t *img, uint32_t gain, uint32_t stride,
+                       uint32_t beginRow, uint32_t endRow);
+  void captureRGBRows(uint8_t *img, uint32_t gain, uint32_t stride,
+                      uint32_t beginRow, uint32_t endRow);
+  void captureNV21Rows(uint8_t *img, uint32_t gain, uint32_t stride,
+                       uint32_t beginRow, uint32_t endRow);
+  void captureDepthRows(uint8_t *img, uint32_t gain, uint32_t stride,
+                        uint32_t beginRow, uint32_t endRow);
 };
 
 }  // namespace android
@@ -0,0 +1,798 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera2_SensorKernels"
+
+#include <string.h>
+
+#include <utils/Log.h>
+
+#include "SensorKernels.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SENSOR_KERNELS_NEON 1
+#include <arm_neon.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#define SENSOR_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace android {
+
+namespace {
+
+// In fixed-point math, saturation point of sensor after gain
+const int kSaturationPoint = 64 * 255;
+// Fixed-point coefficients for RGB-YUV transform
+// Based on JFIF RGB->YUV transform.
+// Cb/Cr offset scaled by 64x twice since they're applied post-multiply
+const int kRgbToY[] = {19, 37, 7};
+const int kRgbToCb[] = {-10, -21, 32, 524288};
+const int kRgbToCr[] = {32, -26, -5, 524288};
+// Scale back to 8bpp non-fixed-point, after multiplies
+const int kScaleOutSq = 64 * 64;
+
+/** Scalar reference */
+
+inline uint8_t electronsTo8bpp(uint32_t electrons, int scale64x) {
+  uint32_t count = electrons * scale64x;
+  return count < 255 * 64 ? count / 64 : 255;
+}
+
+inline int32_t electronsToSaturated(uint32_t electrons, int scale64x) {
+  int32_t count = electrons * scale64x;
+  return count < kSaturationPoint ? count : kSaturationPoint;
+}
+
+void electronsToRGBScalar(const uint32_t *r, const uint32_t *g,
+                          const uint32_t *b, uint32_t count, int scale64x,
+                          uint8_t *rgb) {
+  for (uint32_t i = 0; i < count; i++) {
+    *rgb++ = electronsTo8bpp(r[i], scale64x);
+    *rgb++ = electronsTo8bpp(g[i], scale64x);
+    *rgb++ = electronsTo8bpp(b[i], scale64x);
+  }
+}
+
+void electronsToRGBAScalar(const uint32_t *r, const uint32_t *g,
+                           const uint32_t *b, uint32_t count, int scale64x,
+                           uint8_t *rgba) {
+  for (uint32_t i = 0; i < count; i++) {
+    *rgba++ = electronsTo8bpp(r[i], scale64x);
+    *rgba++ = electronsTo8bpp(g[i], scale64x);
+    *rgba++ = electronsTo8bpp(b[i], scale64x);
+    *rgba++ = 255;
+  }
+}
+
+void electronsToNV21Scalar(const uint32_t *r, const uint32_t *g,
+                           const uint32_t *b, uint32_t count, int scale64x,
+                           uint8_t *y, uint8_t *vu) {
+  for (uint32_t i = 0; i < count; i++) {
+    int32_t rCount = electronsToSaturated(r[i], scale64x);
+    int32_t gCount = electronsToSaturated(g[i], scale64x);
+    int32_t bCount = electronsToSaturated(b[i], scale64x);
+
+    *y++ = (kRgbToY[0] * rCount + kRgbToY[1] * gCount + kRgbToY[2] * bCount) /
+           kScaleOutSq;
+    if (vu != NULL && i % 2 == 0) {
+      *vu++ = (kRgbToCb[0] * rCount + kRgbToCb[1] * gCount +
+               kRgbToCb[2] * bCount + kRgbToCb[3]) /
+              kScaleOutSq;
+      *vu++ = (kRgbToCr[0] * rCount + kRgbToCr[1] * gCount +
+               kRgbToCr[2] * bCount + kRgbToCr[3]) /
+              kScaleOutSq;
+    }
+  }
+}
+
+void materialsToRGBScalar(const uint8_t *materials, uint32_t count,
+                          const MaterialCodes *codes, uint8_t *rgb) {
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t m = materials[i];
+    *rgb++ = codes->r[m];
+    *rgb++ = codes->g[m];
+    *rgb++ = codes->b[m];
+  }
+}
+
+void materialsToRGBAScalar(const uint8_t *materials, uint32_t count,
+                           const MaterialCodes *codes, uint8_t *rgba) {
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t m = materials[i];
+    *rgba++ = codes->r[m];
+    *rgba++ = codes->g[m];
+    *rgba++ = codes->b[m];
+    *rgba++ = 255;
+  }
+}
+
+void materialsToNV21Scalar(const uint8_t *materials, uint32_t count,
+                           const MaterialCodes *codes, uint8_t *y,
+                           uint8_t *vu) {
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t m = materials[i];
+    *y++ = codes->y[m];
+    if (vu != NULL && i % 2 == 0) {
+      *vu++ = codes->vu[0][m];
+      *vu++ = codes->vu[1][m];
+    }
+  }
+}
+
+const SensorKernels kScalarKernels = {
+    "scalar",
+    electronsToRGBScalar,
+    electronsToRGBAScalar,
+    electronsToNV21Scalar,
+    materialsToRGBScalar,
+    materialsToRGBAScalar,
+    materialsToNV21Scalar,
+};
+
+#if defined(SENSOR_KERNELS_NEON)
+
+/** NEON, 16 pixels per iteration */
+
+// Saturating electrons to 8bpp conversion of 8 pixels
+inline uint8x8_t electronsTo8bppNeon(const uint32_t *e, uint32_t scale64x) {
+  uint32x4_t lo = vshrq_n_u32(vmulq_n_u32(vld1q_u32(e), scale64x), 6);
+  uint32x4_t hi = vshrq_n_u32(vmulq_n_u32(vld1q_u32(e + 4), scale64x), 6);
+  return vqmovn_u16(vcombine_u16(vqmovn_u32(lo), vqmovn_u32(hi)));
+}
+
+void electronsToRGBNeon(const uint32_t *r, const uint32_t *g,
+                        const uint32_t *b, uint32_t count, int scale64x,
+                        uint8_t *rgb) {
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8, rgb += 8 * 3) {
+    uint8x8x3_t px;
+    px.val[0] = electronsTo8bppNeon(r + i, scale64x);
+    px.val[1] = electronsTo8bppNeon(g + i, scale64x);
+    px.val[2] = electronsTo8bppNeon(b + i, scale64x);
+    vst3_u8(rgb, px);
+  }
+  electronsToRGBScalar(r + i, g + i, b + i, count - i, scale64x, rgb);
+}
+
+void electronsToRGBANeon(const uint32_t *r, const uint32_t *g,
+                         const uint32_t *b, uint32_t count, int scale64x,
+                         uint8_t *rgba) {
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8, rgba += 8 * 4) {
+    uint8x8x4_t px;
+    px.val[0] = electronsTo8bppNeon(r + i, scale64x);
+    px.val[1] = electronsTo8bppNeon(g + i, scale64x);
+    px.val[2] = electronsTo8bppNeon(b + i, scale64x);
+    px.val[3] = vdup_n_u8(255);
+    vst4_u8(rgba, px);
+  }
+  electronsToRGBAScalar(r + i, g + i, b + i, count - i, scale64x, rgba);
+}
+
+inline int32x4_t saturateNeon(uint32x4_t e, uint32_t scale64x) {
+  int32x4_t count = vreinterpretq_s32_u32(vmulq_n_u32(e, scale64x));
+  return vminq_s32(count, vdupq_n_s32(kSaturationPoint));
+}
+
+// Truncating division by kScaleOutSq, matching C integer division
+inline int32x4_t scaleOutNeon(int32x4_t v) {
+  int32x4_t bias =
+      vandq_s32(vshrq_n_s32(v, 31), vdupq_n_s32(kScaleOutSq - 1));
+  return vshrq_n_s32(vaddq_s32(v, bias), 12);
+}
+
+inline int32x4_t transformNeon(const int *coeffs, int32_t offset,
+                               int32x4_t r, int32x4_t g, int32x4_t b) {
+  int32x4_t v = vdupq_n_s32(offset);
+  v = vmlaq_n_s32(v, r, coeffs[0]);
+  v = vmlaq_n_s32(v, g, coeffs[1]);
+  v = vmlaq_n_s32(v, b, coeffs[2]);
+  return scaleOutNeon(v);
+}
+
+// Keep the low byte of each lane, as a store to uint8_t would
+inline uint8x8_t narrowNeon(int32x4_t lo, int32x4_t hi) {
+  return vmovn_u16(vreinterpretq_u16_s16(
+      vcombine_s16(vmovn_s32(lo), vmovn_s32(hi))));
+}
+
+void electronsToNV21Neon(const uint32_t *r, const uint32_t *g,
+                         const uint32_t *b, uint32_t count, int scale64x,
+                         uint8_t *y, uint8_t *vu) {
+  uint32_t i = 0;
+  for (; i + 16 <= count; i += 16, y += 16) {
+    int32x4_t luma[4];
+    for (int j = 0; j < 4; j++) {
+      luma[j] = transformNeon(kRgbToY, 0,
+                              saturateNeon(vld1q_u32(r + i + j * 4), scale64x),
+                              saturateNeon(vld1q_u32(g + i + j * 4), scale64x),
+                              saturateNeon(vld1q_u32(b + i + j * 4), scale64x));
+    }
+    vst1q_u8(y, vcombine_u8(narrowNeon(luma[0], luma[1]),
+                            narrowNeon(luma[2], luma[3])));
+
+    if (vu != NULL) {
+      int32x4_t cb[2], cr[2];
+      for (int j = 0; j < 2; j++) {
+        // De-interleaving loads; val[0] holds the even pixels
+        const uint32_t offset = i + j * 8;
+        int32x4_t rc = saturateNeon(vld2q_u32(r + offset).val[0], scale64x);
+        int32x4_t gc = saturateNeon(vld2q_u32(g + offset).val[0], scale64x);
+        int32x4_t bc = saturateNeon(vld2q_u32(b + offset).val[0], scale64x);
+        cb[j] = transformNeon(kRgbToCb, kRgbToCb[3], rc, gc, bc);
+        cr[j] = transformNeon(kRgbToCr, kRgbToCr[3], rc, gc, bc);
+      }
+      uint8x8x2_t chroma;
+      chroma.val[0] = narrowNeon(cb[0], cb[1]);
+      chroma.val[1] = narrowNeon(cr[0], cr[1]);
+      vst2_u8(vu, chroma);
+      vu += 16;
+    }
+  }
+  electronsToNV21Scalar(r + i, g + i, b + i, count - i, scale64x, y, vu);
+}
+
+inline uint8x8x2_t loadCodesNeon(const uint8_t *codes) {
+  uint8x8x2_t table;
+  table.val[0] = vld1_u8(codes);
+  table.val[1] = vld1_u8(codes + 8);
+  return table;
+}
+
+void materialsToRGBNeon(const uint8_t *materials, uint32_t count,
+                        const MaterialCodes *codes, uint8_t *rgb) {
+  const uint8x8x2_t rTable = loadCodesNeon(codes->r);
+  const uint8x8x2_t gTable = loadCodesNeon(codes->g);
+  const uint8x8x2_t bTable = loadCodesNeon(codes->b);
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8, rgb += 8 * 3) {
+    uint8x8_t m = vld1_u8(materials + i);
+    uint8x8x3_t px;
+    px.val[0] = vtbl2_u8(rTable, m);
+    px.val[1] = vtbl2_u8(gTable, m);
+    px.val[2] = vtbl2_u8(bTable, m);
+    vst3_u8(rgb, px);
+  }
+  materialsToRGBScalar(materials + i, count - i, codes, rgb);
+}
+
+void materialsToRGBANeon(const uint8_t *materials, uint32_t count,
+                         const MaterialCodes *codes, uint8_t *rgba) {
+  const uint8x8x2_t rTable = loadCodesNeon(codes->r);
+  const uint8x8x2_t gTable = loadCodesNeon(codes->g);
+  const uint8x8x2_t bTable = loadCodesNeon(codes->b);
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8, rgba += 8 * 4) {
+    uint8x8_t m = vld1_u8(materials + i);
+    uint8x8x4_t px;
+    px.val[0] = vtbl2_u8(rTable, m);
+    px.val[1] = vtbl2_u8(gTable, m);
+    px.val[2] = vtbl2_u8(bTable, m);
+    px.val[3] = vdup_n_u8(255);
+    vst4_u8(rgba, px);
+  }
+  materialsToRGBAScalar(materials + i, count - i, codes, rgba);
+}
+
+void materialsToNV21Neon(const uint8_t *materials, uint32_t count,
+                         const MaterialCodes *codes, uint8_t *y,
+                         uint8_t *vu) {
+  const uint8x8x2_t yTable = loadCodesNeon(codes->y);
+  const uint8x8x2_t vTable = loadCodesNeon(codes->vu[0]);
+  const uint8x8x2_t uTable = loadCodesNeon(codes->vu[1]);
+  uint32_t i = 0;
+  for (; i + 16 <= count; i += 16, y += 16) {
+    // De-interleaving load; val[0] holds the even pixels
+    uint8x8x2_t m = vld2_u8(materials + i);
+    uint8x8x2_t luma;
+    luma.val[0] = vtbl2_u8(yTable, m.val[0]);
+    luma.val[1] = vtbl2_u8(yTable, m.val[1]);
+    vst2_u8(y, luma);
+
+    if (vu != NULL) {
+      uint8x8x2_t chroma;
+      chroma.val[0] = vtbl2_u8(vTable, m.val[0]);
+      chroma.val[1] = vtbl2_u8(uTable, m.val[0]);
+      vst2_u8(vu, chroma);
+      vu += 16;
+    }
+  }
+  materialsToNV21Scalar(materials + i, count - i, codes, y, vu);
+}
+
+const SensorKernels kNeonKernels = {
+    "neon",
+    electronsToRGBNeon,
+    electronsToRGBANeon,
+    electronsToNV21Neon,
+    materialsToRGBNeon,
+    materialsToRGBANeon,
+    materialsToNV21Neon,
+};
+
+#elif defined(SENSOR_KERNELS_X86)
+
+/** SSE2, 8 pixels per iteration */
+
+// Low 32 bits of a 32x32 bit multiply; SSE2 has no pmulld
+inline __m128i mullo32Sse2(__m128i a, __m128i b) {
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// Saturating conversion of 16 unsigned 32-bit values below 2^31 to bytes
+inline __m128i packUnsignedSse2(__m128i v0, __m128i v1, __m128i v2,
+                                __m128i v3) {
+  return _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+}
+
+// Keep the low byte of each lane, as a store to uint8_t would
+inline __m128i packLowBytesSse2(__m128i v0, __m128i v1, __m128i v2,
+                                __m128i v3) {
+  const __m128i mask = _mm_set1_epi32(0xff);
+  return packUnsignedSse2(_mm_and_si128(v0, mask), _mm_and_si128(v1, mask),
+                          _mm_and_si128(v2, mask), _mm_and_si128(v3, mask));
+}
+
+// electrons * scale64x / 64 for 4 pixels; not yet clamped to 255
+inline __m128i electronsTo8bppSse2(const uint32_t *e, __m128i scale) {
+  __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(e));
+  return _mm_srli_epi32(mullo32Sse2(v, scale), 6);
+}
+
+// Stores 8 RGB bytes for each channel of 8 pixels in r8, g8 and b8
+inline void electronsTo8bppSse2(const uint32_t *r, const uint32_t *g,
+                                const uint32_t *b, __m128i scale,
+                                __m128i *r8, __m128i *g8, __m128i *b8) {
+  *r8 = packUnsignedSse2(electronsTo8bppSse2(r, scale),
+                         electronsTo8bppSse2(r + 4, scale), _mm_setzero_si128(),
+                         _mm_setzero_si128());
+  *g8 = packUnsignedSse2(electronsTo8bppSse2(g, scale),
+                         electronsTo8bppSse2(g + 4, scale), _mm_setzero_si128(),
+                         _mm_setzero_si128());
+  *b8 = packUnsignedSse2(electronsTo8bppSse2(b, scale),
+                         electronsTo8bppSse2(b + 4, scale), _mm_setzero_si128(),
+                         _mm_setzero_si128());
+}
+
+void electronsToRGBSse2(const uint32_t *r, const uint32_t *g,
+                        const uint32_t *b, uint32_t count, int scale64x,
+                        uint8_t *rgb) {
+  const __m128i scale = _mm_set1_epi32(scale64x);
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i r8, g8, b8;
+    electronsTo8bppSse2(r + i, g + i, b + i, scale, &r8, &g8, &b8);
+    // SSE2 has no byte shuffle; interleave the three planes by hand
+    uint8_t planes[3][16];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(planes[0]), r8);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(planes[1]), g8);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(planes[2]), b8);
+    for (int j = 0; j < 8; j++) {
+      *rgb++ = planes[0][j];
+      *rgb++ = planes[1][j];
+      *rgb++ = planes[2][j];
+    }
+  }
+  electronsToRGBScalar(r + i, g + i, b + i, count - i, scale64x, rgb);
+}
+
+void electronsToRGBASse2(const uint32_t *r, const uint32_t *g,
+                         const uint32_t *b, uint32_t count, int scale64x,
+                         uint8_t *rgba) {
+  const __m128i scale = _mm_set1_epi32(scale64x);
+  const __m128i alpha = _mm_set1_epi8(-1);
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8, rgba += 8 * 4) {
+    __m128i r8, g8, b8;
+    electronsTo8bppSse2(r + i, g + i, b + i, scale, &r8, &g8, &b8);
+    __m128i rg = _mm_unpacklo_epi8(r8, g8);
+    __m128i ba = _mm_unpacklo_epi8(b8, alpha);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(rgba),
+                     _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(rgba + 16),
+                     _mm_unpackhi_epi16(rg, ba));
+  }
+  electronsToRGBAScalar(r + i, g + i, b + i, count - i, scale64x, rgba);
+}
+
+inline __m128i saturateSse2(__m128i e, __m128i scale) {
+  const __m128i saturation = _mm_set1_epi32(kSaturationPoint);
+  __m128i count = mullo32Sse2(e, scale);
+  __m128i over = _mm_cmpgt_epi32(count, saturation);
+  return _mm_or_si128(_mm_andnot_si128(over, count),
+                      _mm_and_si128(over, saturation));
+}
+
+inline __m128i loadSaturatedSse2(const uint32_t *e, __m128i scale) {
+  return saturateSse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(e)),
+                      scale);
+}
+
+// Truncating division by kScaleOutSq, matching C integer division
+inline __m128i scaleOutSse2(__m128i v) {
+  __m128i bias = _mm_and_si128(_mm_srai_epi32(v, 31),
+                               _mm_set1_epi32(kScaleOutSq - 1));
+  return _mm_srai_epi32(_mm_add_epi32(v, bias), 12);
+}
+
+inline __m128i transformSse2(const int *coeffs, int32_t offset, __m128i r,
+                             __m128i g, __m128i b) {
+  __m128i v = _mm_set1_epi32(offset);
+  v = _mm_add_epi32(v, mullo32Sse2(r, _mm_set1_epi32(coeffs[0])));
+  v = _mm_add_epi32(v, mullo32Sse2(g, _mm_set1_epi32(coeffs[1])));
+  v = _mm_add_epi32(v, mullo32Sse2(b, _mm_set1_epi32(coeffs[2])));
+  return scaleOutSse2(v);
+}
+
+// Even lanes of a, then even lanes of b
+inline __m128i evenLanesSse2(__m128i a, __m128i b) {
+  return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a),
+                                         _mm_castsi128_ps(b),
+                                         _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+void electronsToNV21Sse2(const uint32_t *r, const uint32_t *g,
+                         const uint32_t *b, uint32_t count, int scale64x,
+                         uint8_t *y, uint8_t *vu) {
+  const __m128i scale = _mm_set1_epi32(scale64x);
+  const __m128i zero = _mm_setzero_si128();
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8, y += 8) {
+    __m128i rc[2], gc[2], bc[2];
+    for (int j = 0; j < 2; j++) {
+      rc[j] = loadSaturatedSse2(r + i + j * 4, scale);
+      gc[j] = loadSaturatedSse2(g + i + j * 4, scale);
+      bc[j] = loadSaturatedSse2(b + i + j * 4, scale);
+    }
+    __m128i luma = packLowBytesSse2(
+        transformSse2(kRgbToY, 0, rc[0], gc[0], bc[0]),
+        transformSse2(kRgbToY, 0, rc[1], gc[1], bc[1]), zero, zero);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(y), luma);
+
+    if (vu != NULL) {
+      __m128i re = evenLanesSse2(rc[0], rc[1]);
+      __m128i ge = evenLanesSse2(gc[0], gc[1]);
+      __m128i be = evenLanesSse2(bc[0], bc[1]);
+      __m128i cb = transformSse2(kRgbToCb, kRgbToCb[3], re, ge, be);
+      __m128i cr = transformSse2(kRgbToCr, kRgbToCr[3], re, ge, be);
+      __m128i chroma = packLowBytesSse2(_mm_unpacklo_epi32(cb, cr),
+                                        _mm_unpackhi_epi32(cb, cr), zero, zero);
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(vu), chroma);
+      vu += 8;
+    }
+  }
+  electronsToNV21Scalar(r + i, g + i, b + i, count - i, scale64x, y, vu);
+}
+
+// SSE2 has no byte shuffle to look codes up with, so the material kernels
+// are the scalar ones
+const SensorKernels kSse2Kernels = {
+    "sse2",
+    electronsToRGBSse2,
+    electronsToRGBASse2,
+    electronsToNV21Sse2,
+    materialsToRGBScalar,
+    materialsToRGBAScalar,
+    materialsToNV21Scalar,
+};
+
+/** AVX2, 16 pixels per iteration */
+
+#define SENSOR_KERNELS_AVX2 __attribute__((target("avx2")))
+
+SENSOR_KERNELS_AVX2 inline __m256i loadAvx2(const uint32_t *e) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(e));
+}
+
+// Saturating conversion of 16 unsigned 32-bit values below 2^31 to bytes
+SENSOR_KERNELS_AVX2 inline __m128i packUnsignedAvx2(__m256i lo, __m256i hi) {
+  return packUnsignedSse2(_mm256_castsi256_si128(lo),
+                          _mm256_extracti128_si256(lo, 1),
+                          _mm256_castsi256_si128(hi),
+                          _mm256_extracti128_si256(hi, 1));
+}
+
+SENSOR_KERNELS_AVX2 inline __m128i electronsTo8bppAvx2(const uint32_t *e,
+                                                       __m256i scale) {
+  __m256i lo = _mm256_srli_epi32(_mm256_mullo_epi32(loadAvx2(e), scale), 6);
+  __m256i hi =
+      _mm256_srli_epi32(_mm256_mullo_epi32(loadAvx2(e + 8), scale), 6);
+  return packUnsignedAvx2(lo, hi);
+}
+
+// Stores the R, G and B planes of 16 pixels as 48 bytes of RGB triples
+SENSOR_KERNELS_AVX2 inline void storeRGBAvx2(__m128i r8, __m128i g8,
+                                             __m128i b8, uint8_t *rgb) {
+  // Byte shuffles gathering R, G and B planes of 16 pixels into RGB triples
+  const __m128i kShuffleR = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3,
+                                          -1, -1, 4, -1, -1, 5);
+  const __m128i kShuffleG = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1,
+                                          3, -1, -1, 4, -1, -1);
+  const __m128i kShuffleB = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1,
+                                          -1, 3, -1, -1, 4, -1);
+  // Each 16 output bytes start one channel later than the previous ones:
+  // the second block starts with G of pixel 5, the third with B of pixel
+  // 10. Rotate and shift the planes so the same shuffles apply to each.
+  for (int part = 0; part < 3; part++) {
+    __m128i out = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r8, kShuffleR),
+                                            _mm_shuffle_epi8(g8, kShuffleG)),
+                               _mm_shuffle_epi8(b8, kShuffleB));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(rgb + part * 16), out);
+    __m128i nextR = _mm_srli_si128(g8, 5);
+    __m128i nextG = _mm_srli_si128(b8, 5);
+    __m128i nextB = _mm_srli_si128(r8, 6);
+    r8 = nextR;
+    g8 = nextG;
+    b8 = nextB;
+  }
+}
+
+// Stores the R, G and B planes of 16 pixels as 64 bytes of opaque RGBA
+SENSOR_KERNELS_AVX2 inline void storeRGBAAvx2(__m128i r8, __m128i g8,
+                                              __m128i b8, uint8_t *rgba) {
+  const __m128i alpha = _mm_set1_epi8(-1);
+  __m128i rgLo = _mm_unpacklo_epi8(r8, g8);
+  __m128i rgHi = _mm_unpackhi_epi8(r8, g8);
+  __m128i baLo = _mm_unpacklo_epi8(b8, alpha);
+  __m128i baHi = _mm_unpackhi_epi8(b8, alpha);
+  __m128i *out = reinterpret_cast<__m128i *>(rgba);
+  _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(rgLo, baLo));
+  _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rgLo, baLo));
+  _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rgHi, baHi));
+  _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rgHi, baHi));
+}
+
+SENSOR_KERNELS_AVX2 void electronsToRGBAvx2(const uint32_t *r,
+                                            const uint32_t *g,
+                                            const uint32_t *b, uint32_t count,
+                                            int scale64x, uint8_t *rgb) {
+  const __m256i scale = _mm256_set1_epi32(scale64x);
+  uint32_t i = 0;
+  for (; i + 16 <= count; i += 16, rgb += 16 * 3) {
+    storeRGBAvx2(electronsTo8bppAvx2(r + i, scale),
+                 electronsTo8bppAvx2(g + i, scale),
+                 electronsTo8bppAvx2(b + i, scale), rgb);
+  }
+  electronsToRGBScalar(r + i, g + i, b + i, count - i, scale64x, rgb);
+}
+
+SENSOR_KERNELS_AVX2 void electronsToRGBAAvx2(const uint32_t *r,
+                                             const uint32_t *g,
+                                             const uint32_t *b,
+                                             uint32_t count, int scale64x,
+                                             uint8_t *rgba) {
+  const __m256i scale = _mm256_set1_epi32(scale64x);
+  uint32_t i = 0;
+  for (; i + 16 <= count; i += 16, rgba += 16 * 4) {
+    storeRGBAAvx2(electronsTo8bppAvx2(r + i, scale),
+                  electronsTo8bppAvx2(g + i, scale),
+                  electronsTo8bppAvx2(b + i, scale), rgba);
+  }
+  electronsToRGBAScalar(r + i, g + i, b + i, count - i, scale64x, rgba);
+}
+
+SENSOR_KERNELS_AVX2 inline __m256i loadSaturatedAvx2(const uint32_t *e,
+                                                     __m256i scale) {
+  return _mm256_min_epi32(_mm256_mullo_epi32(loadAvx2(e), scale),
+                          _mm256_set1_epi32(kSaturationPoint));
+}
+
+SENSOR_KERNELS_AVX2 inline __m256i transformAvx2(const int *coeffs,
+                                                 int32_t offset, __m256i r,
+                                                 __m256i g, __m256i b) {
+  __m256i v = _mm256_set1_epi32(offset);
+  v = _mm256_add_epi32(v, _mm256_mullo_epi32(r, _mm256_set1_epi32(coeffs[0])));
+  v = _mm256_add_epi32(v, _mm256_mullo_epi32(g, _mm256_set1_epi32(coeffs[1])));
+  v = _mm256_add_epi32(v, _mm256_mullo_epi32(b, _mm256_set1_epi32(coeffs[2])));
+  // Truncating division by kScaleOutSq, matching C integer division
+  __m256i bias = _mm256_and_si256(_mm256_srai_epi32(v, 31),
+                                  _mm256_set1_epi32(kScaleOutSq - 1));
+  return _mm256_srai_epi32(_mm256_add_epi32(v, bias), 12);
+}
+
+// Keep the low byte of each lane, as a store to uint8_t would
+SENSOR_KERNELS_AVX2 inline __m128i packLowBytesAvx2(__m256i lo, __m256i hi) {
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  return packUnsignedAvx2(_mm256_and_si256(lo, mask),
+                          _mm256_and_si256(hi, mask));
+}
+
+// Even lanes of a, then even lanes of b
+SENSOR_KERNELS_AVX2 inline __m256i evenLanesAvx2(__m256i a, __m256i b) {
+  __m256i even = _mm256_castps_si256(_mm256_shuffle_ps(
+      _mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+  return _mm256_permute4x64_epi64(even, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+SENSOR_KERNELS_AVX2 void electronsToNV21Avx2(const uint32_t *r,
+                                             const uint32_t *g,
+                                             const uint32_t *b,
+                                             uint32_t count, int scale64x,
+                                             uint8_t *y, uint8_t *vu) {
+  const __m256i scale = _mm256_set1_epi32(scale64x);
+  uint32_t i = 0;
+  for (; i + 16 <= count; i += 16, y += 16) {
+    __m256i rc[2], gc[2], bc[2];
+    for (int j = 0; j < 2; j++) {
+      rc[j] = loadSaturatedAvx2(r + i + j * 8, scale);
+      gc[j] = loadSaturatedAvx2(g + i + j * 8, scale);
+      bc[j] = loadSaturatedAvx2(b + i + j * 8, scale);
+    }
+    __m128i luma =
+        packLowBytesAvx2(transformAvx2(kRgbToY, 0, rc[0], gc[0], bc[0]),
+                         transformAvx2(kRgbToY, 0, rc[1], gc[1], bc[1]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y), luma);
+
+    if (vu != NULL) {
+      __m256i re = evenLanesAvx2(rc[0], rc[1]);
+      __m256i ge = evenLanesAvx2(gc[0], gc[1]);
+      __m256i be = evenLanesAvx2(bc[0], bc[1]);
+      __m256i cb = transformAvx2(kRgbToCb, kRgbToCb[3], re, ge, be);
+      __m256i cr = transformAvx2(kRgbToCr, kRgbToCr[3], re, ge, be);
+      // unpack works within 128-bit lanes, which keeps pixels in order here
+      __m256i lo = _mm256_unpacklo_epi32(cb, cr);
+      __m256i hi = _mm256_unpackhi_epi32(cb, cr);
+      __m128i chroma =
+          packLowBytesAvx2(_mm256_permute2x128_si256(lo, hi, 0x20),
+                           _mm256_permute2x128_si256(lo, hi, 0x31));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(vu), chroma);
+      vu += 16;
+    }
+  }
+  electronsToNV21Scalar(r + i, g + i, b + i, count - i, scale64x, y, vu);
+}
+
+SENSOR_KERNELS_AVX2 inline __m128i loadCodesAvx2(const uint8_t *codes) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(codes));
+}
+
+SENSOR_KERNELS_AVX2 void materialsToRGBAvx2(const uint8_t *materials,
+                                            uint32_t count,
+                                            const MaterialCodes *codes,
+                                            uint8_t *rgb) {
+  const __m128i rTable = loadCodesAvx2(codes->r);
+  const __m128i gTable = loadCodesAvx2(codes->g);
+  const __m128i bTable = loadCodesAvx2(codes->b);
+  uint32_t i = 0;
+  for (; i + 16 <= count; i += 16, rgb += 16 * 3) {
+    __m128i m = loadCodesAvx2(materials + i);
+    storeRGBAvx2(_mm_shuffle_epi8(rTable, m), _mm_shuffle_epi8(gTable, m),
+                 _mm_shuffle_epi8(bTable, m), rgb);
+  }
+  materialsToRGBScalar(materials + i, count - i, codes, rgb);
+}
+
+SENSOR_KERNELS_AVX2 void materialsToRGBAAvx2(const uint8_t *materials,
+                                             uint32_t count,
+                                             const MaterialCodes *codes,
+                                             uint8_t *rgba) {
+  const __m128i rTable = loadCodesAvx2(codes->r);
+  const __m128i gTable = loadCodesAvx2(codes->g);
+  const __m128i bTable = loadCodesAvx2(codes->b);
+  uint32_t i = 0;
+  for (; i + 16 <= count; i += 16, rgba += 16 * 4) {
+    __m128i m = loadCodesAvx2(materials + i);
+    storeRGBAAvx2(_mm_shuffle_epi8(rTable, m), _mm_shuffle_epi8(gTable, m),
+                  _mm_shuffle_epi8(bTable, m), rgba);
+  }
+  materialsToRGBAScalar(materials + i, count - i, codes, rgba);
+}
+
+SENSOR_KERNELS_AVX2 void materialsToNV21Avx2(const uint8_t *materials,
+                                             uint32_t count,
+                                             const MaterialCodes *codes,
+                                             uint8_t *y, uint8_t *vu) {
+  const __m128i yTable = loadCodesAvx2(codes->y);
+  const __m128i vTable = loadCodesAvx2(codes->vu[0]);
+  const __m128i uTable = loadCodesAvx2(codes->vu[1]);
+  // Materials of the 8 even pixels in the low half
+  const __m128i kEvenPixels = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1,
+                                            -1, -1, -1, -1, -1, -1);
+  uint32_t i = 0;
+  for (; i + 16 <= count; i += 16, y += 16) {
+    __m128i m = loadCodesAvx2(materials + i);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y),
+                     _mm_shuffle_epi8(yTable, m));
+
+    if (vu != NULL) {
+      __m128i even = _mm_shuffle_epi8(m, kEvenPixels);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(vu),
+                       _mm_unpacklo_epi8(_mm_shuffle_epi8(vTable, even),
+                                         _mm_shuffle_epi8(uTable, even)));
+      vu += 16;
+    }
+  }
+  materialsToNV21Scalar(materials + i, count - i, codes, y, vu);
+}
+
+#undef SENSOR_KERNELS_AVX2
+
+const SensorKernels kAvx2Kernels = {
+    "avx2",
+    electronsToRGBAvx2,
+    electronsToRGBAAvx2,
+    electronsToNV21Avx2,
+    materialsToRGBAvx2,
+    materialsToRGBAAvx2,
+    materialsToNV21Avx2,
+};
+
+#endif
+
+class KernelRegistry {
+ public:
+  KernelRegistry() : mCount(0) {
+    mKernels[mCount++] = &kScalarKernels;
+#if defined(SENSOR_KERNELS_NEON)
+    mKernels[mCount++] = &kNeonKernels;
+#elif defined(SENSOR_KERNELS_X86)
+    mKernels[mCount++] = &kSse2Kernels;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      mKernels[mCount++] = &kAvx2Kernels;
+    }
+#endif
+    ALOGV("Using %s sensor kernels", mKernels[mCount - 1]->name);
+  }
+
+  const SensorKernels *const *kernels() const { return mKernels; }
+  size_t count() const { return mCount; }
+
+ private:
+  const SensorKernels *mKernels[3];
+  size_t mCount;
+};
+
+const KernelRegistry &getRegistry() {
+  static const KernelRegistry registry;
+  return registry;
+}
+
+}  // namespace
+
+void buildMaterialCodes(const uint32_t *r, const uint32_t *g,
+                        const uint32_t *b, size_t count, int scale64x,
+                        MaterialCodes *codes) {
+  memset(codes, 0, sizeof(*codes));
+  for (size_t m = 0; m < count; m++) {
+    uint8_t rgb[3], vu[2];
+    electronsToRGBScalar(r + m, g + m, b + m, 1, scale64x, rgb);
+    electronsToNV21Scalar(r + m, g + m, b + m, 1, scale64x, &codes->y[m], vu);
+    codes->r[m] = rgb[0];
+    codes->g[m] = rgb[1];
+    codes->b[m] = rgb[2];
+    codes->vu[0][m] = vu[0];
+    codes->vu[1][m] = vu[1];
+  }
+}
+
+const SensorKernels &getSensorKernels() {
+  const KernelRegistry &registry = getRegistry();
+  return *registry.kernels()[registry.count() - 1];
+}
+
+size_t getAvailableSensorKernels(const SensorKernels *const **kernels) {
+  const KernelRegistry &registry = getRegistry();
+  *kernels = registry.kernels();
+  return registry.count();
+}
+
+}  // namespace android
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Row kernels that turn the fake sensor's per-pixel electron counts into
+ * processed output pixels. Every implementation produces exactly the same
+ * bytes as the scalar one, which is the reference for the fixed-point math
+ * the sensor has always used; the SIMD variants only change the speed.
+ *
+ * The scene only has a handful of materials, so the sensor converts each
+ * material's electron counts once per frame with buildMaterialCodes, and the
+ * materialsTo* kernels then look up every pixel's output bytes by material.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_SENSOR_KERNELS_H
+#define HW_EMULATOR_CAMERA2_SENSOR_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// Output bytes of each scene material, as the electronsTo* kernels of the
+// scalar reference produce them for the material's electron counts.
+struct MaterialCodes {
+  static const size_t kMaxMaterials = 16;
+
+  uint8_t r[kMaxMaterials];
+  uint8_t g[kMaxMaterials];
+  uint8_t b[kMaxMaterials];
+  uint8_t y[kMaxMaterials];
+  // The chroma pair electronsToNV21 writes for an even pixel, first byte in
+  // vu[0] and second in vu[1]
+  uint8_t vu[2][kMaxMaterials];
+};
+
+// Fill codes for count materials with the given R, G and B electron counts.
+// count must not exceed MaterialCodes::kMaxMaterials; unused entries are
+// zeroed.
+void buildMaterialCodes(const uint32_t *r, const uint32_t *g,
+                        const uint32_t *b, size_t count, int scale64x,
+                        MaterialCodes *codes);
+
+struct SensorKernels {
+  // Short name of the implementation, e.g. "scalar" or "neon"
+  const char *name;
+
+  // Convert count pixels of R, G and B electron counts to packed 8-bit RGB.
+  // scale64x is the electrons to 8bpp scaling, in 6-bit fixed point.
+  void (*electronsToRGB)(const uint32_t *r, const uint32_t *g,
+                         const uint32_t *b, uint32_t count, int scale64x,
+                         uint8_t *rgb);
+  // As electronsToRGB, with an opaque alpha byte after each pixel.
+  void (*electronsToRGBA)(const uint32_t *r, const uint32_t *g,
+                          const uint32_t *b, uint32_t count, int scale64x,
+                          uint8_t *rgba);
+  // Convert count pixels to JFIF luma in y. If vu is not NULL, also write one
+  // interleaved chroma pair for every even pixel, (count + 1) / 2 in total.
+  void (*electronsToNV21)(const uint32_t *r, const uint32_t *g,
+                          const uint32_t *b, uint32_t count, int scale64x,
+                          uint8_t *y, uint8_t *vu);
+
+  // As the electronsTo* kernels, for count pixels given as indices into the
+  // tables of codes, each below MaterialCodes::kMaxMaterials.
+  void (*materialsToRGB)(const uint8_t *materials, uint32_t count,
+                         const MaterialCodes *codes, uint8_t *rgb);
+  void (*materialsToRGBA)(const uint8_t *materials, uint32_t count,
+                          const MaterialCodes *codes, uint8_t *rgba);
+  void (*materialsToNV21)(const uint8_t *materials, uint32_t count,
+                          const MaterialCodes *codes, uint8_t *y,
+                          uint8_t *vu);
+};
+
+// Kernels best suited to the CPU we are running on.
+const SensorKernels &getSensorKernels();
+
+// All kernel implementations the CPU supports, the scalar reference first.
+// Returns the number of entries in *kernels.
+size_t getAvailableSensorKernels(const SensorKernels *const **kernels);
+
+}  // namespace android
+
+#endif  // HW_EMULATOR_CAMERA2_SENSOR_KERNELS_H
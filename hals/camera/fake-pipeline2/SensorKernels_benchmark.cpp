@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "SensorKernels.h"
+
+namespace {
+
+using android::MaterialCodes;
+using android::SensorKernels;
+
+// One row of the default 2592x1944 sensor
+const uint32_t kRowPixels = 2592;
+// scale64x at ISO 400
+const int kScale64x = 65;
+
+enum Kernel {
+  RGB,
+  RGBA,
+  NV21,
+  MATERIALS_RGB,
+  MATERIALS_RGBA,
+  MATERIALS_NV21,
+};
+
+void BM_SensorKernel(benchmark::State &state, const SensorKernels *kernels,
+                     Kernel kernel) {
+  std::vector<uint32_t> r(kRowPixels), g(kRowPixels), b(kRowPixels);
+  for (uint32_t i = 0; i < kRowPixels; i++) {
+    r[i] = rand() % 4096;
+    g[i] = rand() % 4096;
+    b[i] = rand() % 4096;
+  }
+  std::vector<uint8_t> materials(kRowPixels);
+  for (uint32_t i = 0; i < kRowPixels; i++) {
+    materials[i] = rand() % MaterialCodes::kMaxMaterials;
+  }
+  MaterialCodes codes;
+  android::buildMaterialCodes(r.data(), g.data(), b.data(),
+                              MaterialCodes::kMaxMaterials, kScale64x, &codes);
+  std::vector<uint8_t> out(kRowPixels * 4), vu(kRowPixels);
+
+  for (auto _ : state) {
+    switch (kernel) {
+      case RGB:
+        kernels->electronsToRGB(r.data(), g.data(), b.data(), kRowPixels,
+                                kScale64x, out.data());
+        break;
+      case RGBA:
+        kernels->electronsToRGBA(r.data(), g.data(), b.data(), kRowPixels,
+                                 kScale64x, out.data());
+        break;
+      case NV21:
+        kernels->electronsToNV21(r.data(), g.data(), b.data(), kRowPixels,
+                                 kScale64x, out.data(), vu.data());
+        break;
+      case MATERIALS_RGB:
+        kernels->materialsToRGB(materials.data(), kRowPixels, &codes,
+                                out.data());
+        break;
+      case MATERIALS_RGBA:
+        kernels->materialsToRGBA(materials.data(), kRowPixels, &codes,
+                                 out.data());
+        break;
+      case MATERIALS_NV21:
+        kernels->materialsToNV21(materials.data(), kRowPixels, &codes,
+                                 out.data(), vu.data());
+        break;
+    }
+    benchmark::ClobberMemory();
+  }
+  state.counters["MPix/s"] = benchmark::Counter(
+      state.iterations() * kRowPixels / 1e6, benchmark::Counter::kIsRate);
+}
+
+void RegisterBenchmarks() {
+  const SensorKernels *const *kernels;
+  size_t count = android::getAvailableSensorKernels(&kernels);
+  for (size_t i = 0; i < count; i++) {
+    std::string name = kernels[i]->name;
+    benchmark::RegisterBenchmark(("BM_RGB/" + name).c_str(), BM_SensorKernel,
+                                 kernels[i], RGB);
+    benchmark::RegisterBenchmark(("BM_RGBA/" + name).c_str(), BM_SensorKernel,
+                                 kernels[i], RGBA);
+    benchmark::RegisterBenchmark(("BM_NV21/" + name).c_str(), BM_SensorKernel,
+                                 kernels[i], NV21);
+    benchmark::RegisterBenchmark(("BM_MaterialsToRGB/" + name).c_str(),
+                                 BM_SensorKernel, kernels[i], MATERIALS_RGB);
+    benchmark::RegisterBenchmark(("BM_MaterialsToRGBA/" + name).c_str(),
+                                 BM_SensorKernel, kernels[i], MATERIALS_RGBA);
+    benchmark::RegisterBenchmark(("BM_MaterialsToNV21/" + name).c_str(),
+                                 BM_SensorKernel, kernels[i], MATERIALS_NV21);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  RegisterBenchmarks();
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "SensorKernels.h"
+
+namespace {
+
+using android::MaterialCodes;
+using android::SensorKernels;
+
+// Row lengths around the 8 and 16 pixel vector widths, and a sensor row
+const uint32_t kCounts[] = {0, 1, 2, 7, 8, 9, 15, 16, 17, 31, 33, 2592};
+// Gains across the sensitivity range, as the sensor computes scale64x
+const int kScales[] = {8, 16, 32, 65, 130};
+
+// Electron counts covering dark, mid-tone and saturated pixels, and the
+// wrapped-around values a negative float-to-unsigned conversion leaves.
+uint32_t randomElectrons() {
+  switch (rand() % 8) {
+    case 0:
+      return rand() % 16;
+    case 1:
+      return 0xffffffffu - rand() % 1024;
+    case 2:
+      return rand();
+    default:
+      return rand() % 4096;
+  }
+}
+
+class SensorKernelsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    srand(2018);
+    const SensorKernels *const *kernels;
+    size_t count = android::getAvailableSensorKernels(&kernels);
+    ASSERT_GE(count, 1u);
+    reference_ = kernels[0];
+    kernels_.assign(kernels + 1, kernels + count);
+  }
+
+  void FillElectrons(uint32_t count) {
+    // Offset by one so vector loads are not always aligned
+    r_.assign(count + 1, 0);
+    g_.assign(count + 1, 0);
+    b_.assign(count + 1, 0);
+    for (uint32_t i = 0; i < count + 1; i++) {
+      r_[i] = randomElectrons();
+      g_[i] = randomElectrons();
+      b_[i] = randomElectrons();
+    }
+  }
+
+  // Pixels of random materials, with their electron counts in r_, g_ and b_
+  void FillMaterials(uint32_t count, MaterialCodes *codes, int scale) {
+    uint32_t electrons[3][MaterialCodes::kMaxMaterials];
+    for (size_t m = 0; m < MaterialCodes::kMaxMaterials; m++) {
+      for (int c = 0; c < 3; c++) electrons[c][m] = randomElectrons();
+    }
+    android::buildMaterialCodes(electrons[0], electrons[1], electrons[2],
+                                MaterialCodes::kMaxMaterials, scale, codes);
+    materials_.assign(count + 1, 0);
+    r_.assign(count + 1, 0);
+    g_.assign(count + 1, 0);
+    b_.assign(count + 1, 0);
+    for (uint32_t i = 0; i < count + 1; i++) {
+      materials_[i] = rand() % MaterialCodes::kMaxMaterials;
+      r_[i] = electrons[0][materials_[i]];
+      g_[i] = electrons[1][materials_[i]];
+      b_[i] = electrons[2][materials_[i]];
+    }
+  }
+
+  // Every implementation, the scalar reference included
+  std::vector<const SensorKernels *> AllKernels() const {
+    std::vector<const SensorKernels *> all(1, reference_);
+    all.insert(all.end(), kernels_.begin(), kernels_.end());
+    return all;
+  }
+
+  const uint8_t *materials() const { return materials_.data() + 1; }
+  const uint32_t *r() const { return r_.data() + 1; }
+  const uint32_t *g() const { return g_.data() + 1; }
+  const uint32_t *b() const { return b_.data() + 1; }
+
+  const SensorKernels *reference_;
+  std::vector<const SensorKernels *> kernels_;
+  std::vector<uint8_t> materials_;
+  std::vector<uint32_t> r_, g_, b_;
+};
+
+TEST_F(SensorKernelsTest, ScalarIsReference) {
+  EXPECT_STREQ("scalar", reference_->name);
+}
+
+TEST_F(SensorKernelsTest, RGBMatchesScalar) {
+  for (const SensorKernels *kernels : kernels_) {
+    for (uint32_t count : kCounts) {
+      for (int scale : kScales) {
+        FillElectrons(count);
+        // One guard byte past the end catches overruns
+        std::vector<uint8_t> expected(count * 3 + 1, 0x5a);
+        std::vector<uint8_t> actual(count * 3 + 1, 0x5a);
+        reference_->electronsToRGB(r(), g(), b(), count, scale,
+                                   expected.data());
+        kernels->electronsToRGB(r(), g(), b(), count, scale, actual.data());
+        EXPECT_EQ(expected, actual)
+            << kernels->name << " count " << count << " scale " << scale;
+      }
+    }
+  }
+}
+
+TEST_F(SensorKernelsTest, RGBAMatchesScalar) {
+  for (const SensorKernels *kernels : kernels_) {
+    for (uint32_t count : kCounts) {
+      for (int scale : kScales) {
+        FillElectrons(count);
+        std::vector<uint8_t> expected(count * 4 + 1, 0x5a);
+        std::vector<uint8_t> actual(count * 4 + 1, 0x5a);
+        reference_->electronsToRGBA(r(), g(), b(), count, scale,
+                                    expected.data());
+        kernels->electronsToRGBA(r(), g(), b(), count, scale, actual.data());
+        EXPECT_EQ(expected, actual)
+            << kernels->name << " count " << count << " scale " << scale;
+      }
+    }
+  }
+}
+
+TEST_F(SensorKernelsTest, NV21MatchesScalar) {
+  for (const SensorKernels *kernels : kernels_) {
+    for (uint32_t count : kCounts) {
+      for (int scale : kScales) {
+        FillElectrons(count);
+        uint32_t chromaBytes = (count + 1) / 2 * 2;
+        std::vector<uint8_t> expectedY(count + 1, 0x5a);
+        std::vector<uint8_t> actualY(count + 1, 0x5a);
+        std::vector<uint8_t> expectedVU(chromaBytes + 1, 0x5a);
+        std::vector<uint8_t> actualVU(chromaBytes + 1, 0x5a);
+        reference_->electronsToNV21(r(), g(), b(), count, scale,
+                                    expectedY.data(), expectedVU.data());
+        kernels->electronsToNV21(r(), g(), b(), count, scale, actualY.data(),
+                                 actualVU.data());
+        EXPECT_EQ(expectedY, actualY)
+            << kernels->name << " count " << count << " scale " << scale;
+        EXPECT_EQ(expectedVU, actualVU)
+            << kernels->name << " count " << count << " scale " << scale;
+      }
+    }
+  }
+}
+
+TEST_F(SensorKernelsTest, NV21LumaOnlyMatchesScalar) {
+  for (const SensorKernels *kernels : kernels_) {
+    for (uint32_t count : kCounts) {
+      FillElectrons(count);
+      std::vector<uint8_t> expected(count + 1, 0x5a);
+      std::vector<uint8_t> actual(count + 1, 0x5a);
+      reference_->electronsToNV21(r(), g(), b(), count, 32, expected.data(),
+                                  NULL);
+      kernels->electronsToNV21(r(), g(), b(), count, 32, actual.data(), NULL);
+      EXPECT_EQ(expected, actual) << kernels->name << " count " << count;
+    }
+  }
+}
+
+// The material kernels, including the scalar ones, must produce what the
+// scalar electron kernels do for the materials' electron counts
+TEST_F(SensorKernelsTest, MaterialsToRGBMatchesElectrons) {
+  for (const SensorKernels *kernels : AllKernels()) {
+    for (uint32_t count : kCounts) {
+      for (int scale : kScales) {
+        MaterialCodes codes;
+        FillMaterials(count, &codes, scale);
+        std::vector<uint8_t> expected(count * 3 + 1, 0x5a);
+        std::vector<uint8_t> actual(count * 3 + 1, 0x5a);
+        reference_->electronsToRGB(r(), g(), b(), count, scale,
+                                   expected.data());
+        kernels->materialsToRGB(materials(), count, &codes, actual.data());
+        EXPECT_EQ(expected, actual)
+            << kernels->name << " count " << count << " scale " << scale;
+      }
+    }
+  }
+}
+
+TEST_F(SensorKernelsTest, MaterialsToRGBAMatchesElectrons) {
+  for (const SensorKernels *kernels : AllKernels()) {
+    for (uint32_t count : kCounts) {
+      for (int scale : kScales) {
+        MaterialCodes codes;
+        FillMaterials(count, &codes, scale);
+        std::vector<uint8_t> expected(count * 4 + 1, 0x5a);
+        std::vector<uint8_t> actual(count * 4 + 1, 0x5a);
+        reference_->electronsToRGBA(r(), g(), b(), count, scale,
+                                    expected.data());
+        kernels->materialsToRGBA(materials(), count, &codes, actual.data());
+        EXPECT_EQ(expected, actual)
+            << kernels->name << " count " << count << " scale " << scale;
+      }
+    }
+  }
+}
+
+TEST_F(SensorKernelsTest, MaterialsToNV21MatchesElectrons) {
+  for (const SensorKernels *kernels : AllKernels()) {
+    for (uint32_t count : kCounts) {
+      for (int scale : kScales) {
+        MaterialCodes codes;
+        FillMaterials(count, &codes, scale);
+        uint32_t chromaBytes = (count + 1) / 2 * 2;
+        std::vector<uint8_t> expectedY(count + 1, 0x5a);
+        std::vector<uint8_t> actualY(count + 1, 0x5a);
+        std::vector<uint8_t> expectedVU(chromaBytes + 1, 0x5a);
+        std::vector<uint8_t> actualVU(chromaBytes + 1, 0x5a);
+        reference_->electronsToNV21(r(), g(), b(), count, scale,
+                                    expectedY.data(), expectedVU.data());
+        kernels->materialsToNV21(materials(), count, &codes, actualY.data(),
+                                 actualVU.data());
+        EXPECT_EQ(expectedY, actualY)
+            << kernels->name << " count " << count << " scale " << scale;
+        EXPECT_EQ(expectedVU, actualVU)
+            << kernels->name << " count " << count << " scale " << scale;
+
+        std::vector<uint8_t> lumaOnly(count + 1, 0x5a);
+        kernels->materialsToNV21(materials(), count, &codes, lumaOnly.data(),
+                                 NULL);
+        EXPECT_EQ(expectedY, lumaOnly)
+            << kernels->name << " count " << count << " scale " << scale;
+      }
+    }
+  }
+}
+
+}  // namespace
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * NV21JpegCompressor for the host pipeline benchmark. The device build
+ * dlopen()s the JPEG stub library from the vendor partition; on the host the
+ * stub is linked in, so its entry points are called directly.
+ */
+
+#include "JpegCompressor.h"
+
+namespace android {
+
+void* NV21JpegCompressor::mDl = NULL;
+
+NV21JpegCompressor::NV21JpegCompressor() { JpegStub_init(&mStub); }
+
+NV21JpegCompressor::~NV21JpegCompressor() { JpegStub_cleanup(&mStub); }
+
+status_t NV21JpegCompressor::compressRawImage(const void* image,
+                                              ExifData* exifData, int quality,
+                                              int width, int height) {
+  mStrides[0] = width;
+  mStrides[1] = width;
+  return (status_t)JpegStub_compress(&mStub, image, width, height, quality,
+                                     exifData);
+}
+
+size_t NV21JpegCompressor::getCompressedSize() {
+  return JpegStub_getCompressedSize(&mStub);
+}
+
+void NV21JpegCompressor::getCompressedImage(void* buff) {
+  JpegStub_getCompressedImage(&mStub, buff);
+}
+
+}  // namespace android
@@ -0,0 +1,670 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs the fake-pipeline2 sensor and the stages behind it on a build host,
+ * and reports frames/s, per-stage latency percentiles and allocations per
+ * frame as JSON.
+ *
+ * Each workload configures a set of output streams, like a camera client
+ * would: a preview stream, plus a video, JPEG or RAW16 stream at the capture
+ * size. Frames are requested back to back, with one frame being processed
+ * while the sensor renders the next. The sensor free-runs by default, so the
+ * frame rate is bounded by rendering and processing rather than by frame
+ * durations.
+ *
+ * Stream buffers are plain aligned allocations standing in for gralloc, and
+ * the Android utilities come from the stubs in host/include. See
+ * host/Makefile to build it outside of the Android tree.
+ */
+
+#define LOG_TAG "EmulatedCamera_PipelineBenchmark"
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <libexif/exif-data.h>
+
+#include "Converters.h"
+#include "Thumbnail.h"
+#include "fake-pipeline2/CaptureScheduler.h"
+#include "fake-pipeline2/JpegCompressor.h"
+#include "fake-pipeline2/LatencyHistogram.h"
+#include "fake-pipeline2/Sensor.h"
+
+/*
+ * Allocation counting. glibc lets the executable interpose malloc, which
+ * also catches operator new and the C libraries (libjpeg allocates its
+ * working memory per image). Elsewhere allocations are not counted.
+ */
+
+static std::atomic<uint64_t> gAllocations(0);
+static std::atomic<uint64_t> gAllocatedBytes(0);
+
+#ifdef __GLIBC__
+static const bool kCountsAllocations = true;
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+extern "C" void* malloc(size_t size) {
+  gAllocations.fetch_add(1, std::memory_order_relaxed);
+  gAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+  gAllocations.fetch_add(1, std::memory_order_relaxed);
+  gAllocatedBytes.fetch_add(count * size, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+  gAllocations.fetch_add(1, std::memory_order_relaxed);
+  gAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+#else
+static const bool kCountsAllocations = false;
+#endif
+
+namespace android {
+namespace {
+
+const nsecs_t kFrameTimeout = seconds_to_nanoseconds(10);
+
+const int kThumbnailWidth = 320;
+const int kThumbnailHeight = 240;
+const int kThumbnailQuality = 90;
+
+// Frames requested ahead of the one being processed
+const size_t kPipelineDepth = 2;
+
+enum Workload {
+  WORKLOAD_PREVIEW,
+  WORKLOAD_PREVIEW_VIDEO,
+  WORKLOAD_BURST_JPEG,
+  WORKLOAD_RAW16,
+  NUM_WORKLOADS
+};
+
+const char* const kWorkloadNames[NUM_WORKLOADS] = {
+    "preview",
+    "preview_video",
+    "burst_jpeg",
+    "raw16",
+};
+
+enum Stage {
+  // Frame request to readout, as seen by the camera
+  STAGE_SENSOR,
+  // Preview NV21 to RGB32, as for a preview window
+  STAGE_PREVIEW_CONVERT,
+  STAGE_THUMBNAIL,
+  STAGE_JPEG,
+  // Frame request to the end of processing
+  STAGE_TOTAL,
+  NUM_STAGES
+};
+
+const char* const kStageNames[NUM_STAGES] = {
+    "sensor",
+    "preview_convert",
+    "thumbnail",
+    "jpeg",
+    "total",
+};
+
+struct Options {
+  Workload workload;
+  uint32_t width, height;
+  uint32_t previewWidth, previewHeight;
+  uint32_t frames;
+  uint32_t warmupFrames;
+  uint32_t threads;
+  bool paced;
+  const char* output;
+  // KEY=VALUE system properties, set before the pipeline starts
+  std::vector<std::string> properties;
+};
+
+struct StreamConfig {
+  const char* name;
+  int format;
+  uint32_t width, height;
+};
+
+/*
+ * Stands in for gralloc: one buffer per stream for every frame in flight,
+ * allocated up front like the buffers a camera client registers.
+ */
+class StreamBuffers {
+ public:
+  StreamBuffers() {}
+  ~StreamBuffers() {
+    for (size_t i = 0; i < mMemory.size(); i++) free(mMemory[i]);
+  }
+
+  bool allocate(const std::vector<StreamConfig>& streams, size_t depth) {
+    mStreams = streams;
+    mImages.resize(depth);
+    for (size_t slot = 0; slot < depth; slot++) {
+      for (size_t i = 0; i < streams.size(); i++) {
+        void* memory = NULL;
+        size_t size = getBufferSize(streams[i]);
+        if (posix_memalign(&memory, kAlignment, size) != 0) {
+          ALOGE("%s: Unable to allocate %zu bytes for %s", __FUNCTION__, size,
+                streams[i].name);
+          return false;
+        }
+        memset(memory, 0, size);
+        mMemory.push_back(memory);
+        mImages[slot].push_back(static_cast<uint8_t*>(memory));
+      }
+    }
+    return true;
+  }
+
+  // Fill buffers with the streams of the given slot. Clearing keeps the
+  // capacity, so this doesn't allocate once every slot has been used.
+  void getBuffers(size_t slot, Buffers* buffers) const {
+    buffers->clear();
+    for (size_t i = 0; i < mStreams.size(); i++) {
+      StreamBuffer b;
+      b.streamId = i + 1;
+      b.width = mStreams[i].width;
+      b.height = mStreams[i].height;
+      b.format = mStreams[i].format;
+      b.dataSpace = 0;
+      b.stride = mStreams[i].width;
+      b.buffer = NULL;
+      b.img = mImages[slot][i];
+      buffers->push_back(b);
+    }
+  }
+
+ private:
+  static const size_t kAlignment = 64;
+
+  static size_t getBufferSize(const StreamConfig& stream) {
+    size_t pixels = stream.width * stream.height;
+    switch (stream.format) {
+      case HAL_PIXEL_FORMAT_RAW16:
+        return pixels * 2;
+      case HAL_PIXEL_FORMAT_BLOB:
+        // The compressor doesn't stop at the end of its buffer, so leave
+        // room for an incompressible image
+        return std::max(pixels * 3, JpegCompressor::kMaxJpegSize);
+      case HAL_PIXEL_FORMAT_RGBA_8888:
+        return pixels * 4;
+      default:
+        return pixels * 3 / 2;
+    }
+  }
+
+  std::vector<StreamConfig> mStreams;
+  std::vector<void*> mMemory;
+  std::vector<std::vector<uint8_t*> > mImages;
+};
+
+std::vector<StreamConfig> getStreams(const Options& options) {
+  std::vector<StreamConfig> streams;
+  StreamConfig preview = {"preview", HAL_PIXEL_FORMAT_YCbCr_420_888,
+                          options.previewWidth, options.previewHeight};
+  streams.push_back(preview);
+  switch (options.workload) {
+    case WORKLOAD_PREVIEW_VIDEO: {
+      StreamConfig video = {"video", HAL_PIXEL_FORMAT_YCbCr_420_888,
+                            options.width, options.height};
+      streams.push_back(video);
+      break;
+    }
+    case WORKLOAD_BURST_JPEG: {
+      StreamConfig jpeg = {"jpeg", HAL_PIXEL_FORMAT_BLOB, options.width,
+                           options.height};
+      streams.push_back(jpeg);
+      break;
+    }
+    case WORKLOAD_RAW16: {
+      StreamConfig raw = {"raw", HAL_PIXEL_FORMAT_RAW16, options.width,
+                          options.height};
+      streams.push_back(raw);
+      break;
+    }
+    default:
+      break;
+  }
+  return streams;
+}
+
+class PipelineBenchmark {
+ public:
+  explicit PipelineBenchmark(const Options& options)
+      : mOptions(options), mPreviewRGB(NULL), mMeasuredTime(0),
+        mAllocations(0), mAllocatedBytes(0) {}
+  ~PipelineBenchmark() {
+    if (mSensor != NULL) mSensor->shutDown();
+    free(mPreviewRGB);
+  }
+
+  status_t setUp();
+  status_t run();
+  void report(FILE* out) const;
+
+ private:
+  status_t submit(size_t frame);
+  status_t process(size_t frame);
+
+  const Options mOptions;
+  // Outlives mSensor, which renders on it
+  CaptureScheduler mScheduler;
+  sp<Sensor> mSensor;
+  sp<JpegCompressor> mJpegCompressor;
+  YUVConverter mConverter;
+
+  StreamBuffers mStreamBuffers;
+  Buffers mBuffers[kPipelineDepth];
+  nsecs_t mSubmitTime[kPipelineDepth];
+  void* mPreviewRGB;
+  std::vector<unsigned char> mThumbnailBuffer;
+
+  LatencyHistogram mLatency[NUM_STAGES];
+  nsecs_t mMeasuredTime;
+  uint64_t mAllocations;
+  uint64_t mAllocatedBytes;
+};
+
+status_t PipelineBenchmark::setUp() {
+  property_set(Sensor::kFreeRunProperty, mOptions.paced ? "0" : "1");
+  // Same noise on every run
+  property_set(Sensor::kNoiseSeedProperty, "1");
+  for (size_t i = 0; i < mOptions.properties.size(); i++) {
+    const std::string& property = mOptions.properties[i];
+    size_t split = property.find('=');
+    if (split == std::string::npos ||
+        property_set(property.substr(0, split).c_str(),
+                     property.substr(split + 1).c_str()) != 0) {
+      ALOGE("%s: Bad property %s", __FUNCTION__, property.c_str());
+      return BAD_VALUE;
+    }
+  }
+
+  status_t res = mConverter.setThreadCount(mOptions.threads);
+  if (res != OK) return res;
+  mPreviewRGB = malloc(mOptions.previewWidth * mOptions.previewHeight * 4);
+  if (mPreviewRGB == NULL) return NO_MEMORY;
+
+  if (!mStreamBuffers.allocate(getStreams(mOptions), kPipelineDepth)) {
+    return NO_MEMORY;
+  }
+  mJpegCompressor = new JpegCompressor();
+  res = mScheduler.startUp(mOptions.threads - 1);
+  if (res != OK) return res;
+  mSensor = new Sensor(mOptions.width, mOptions.height, &mScheduler);
+  return mSensor->startUp();
+}
+
+status_t PipelineBenchmark::submit(size_t frame) {
+  const size_t slot = frame % kPipelineDepth;
+  mStreamBuffers.getBuffers(slot, &mBuffers[slot]);
+  mSubmitTime[slot] = systemTime();
+  mSensor->setDestinationBuffers(&mBuffers[slot]);
+  mSensor->setFrameNumber(frame);
+  // Like the HAL, wait for the buffers to be latched before the next
+  // request can replace them
+  if (!mSensor->waitForVSync(kFrameTimeout)) {
+    ALOGE("%s: Timed out waiting for VSync of frame %zu", __FUNCTION__,
+          frame);
+    return TIMED_OUT;
+  }
+  return OK;
+}
+
+status_t PipelineBenchmark::process(size_t frame) {
+  const size_t slot = frame % kPipelineDepth;
+  Buffers& buffers = mBuffers[slot];
+  const bool measured = frame >= mOptions.warmupFrames;
+  nsecs_t stageStart = systemTime();
+  if (measured) mLatency[STAGE_SENSOR].record(stageStart - mSubmitTime[slot]);
+
+  status_t res = OK;
+  const StreamBuffer* aux = NULL;
+  for (size_t i = 0; i < buffers.size(); i++) {
+    const StreamBuffer& b = buffers[i];
+    if (b.streamId == 0) {
+      aux = &b;
+    } else if (b.streamId == 1) {
+      mConverter.toRGB32(YUV_LAYOUT_NV21, b.img, mPreviewRGB, b.width,
+                         b.height);
+      nsecs_t stageEnd = systemTime();
+      if (measured) {
+        mLatency[STAGE_PREVIEW_CONVERT].record(stageEnd - stageStart);
+      }
+      stageStart = stageEnd;
+    }
+  }
+
+  if (aux != NULL) {
+    // The thumbnail is made from the same NV21 image as the picture, before
+    // the compressor returns it to the pool
+    if (aux->format == HAL_PIXEL_FORMAT_YCrCb_420_SP) {
+      ExifData* exifData = exif_data_new();
+      if (exifData == NULL ||
+          !createThumbnail(aux->img, aux->width, aux->height, kThumbnailWidth,
+                           kThumbnailHeight, kThumbnailQuality, exifData,
+                           &mThumbnailBuffer)) {
+        ALOGE("%s: Frame %zu: Unable to create thumbnail", __FUNCTION__,
+              frame);
+        res = UNKNOWN_ERROR;
+      }
+      exif_data_unref(exifData);
+      nsecs_t stageEnd = systemTime();
+      if (measured) mLatency[STAGE_THUMBNAIL].record(stageEnd - stageStart);
+      stageStart = stageEnd;
+    }
+    status_t jpegRes = mJpegCompressor->compressSynchronous(&buffers);
+    if (jpegRes != OK) {
+      ALOGE("%s: Frame %zu: Unable to compress JPEG: %d", __FUNCTION__, frame,
+            jpegRes);
+      res = jpegRes;
+    }
+    nsecs_t stageEnd = systemTime();
+    if (measured) mLatency[STAGE_JPEG].record(stageEnd - stageStart);
+    stageStart = stageEnd;
+  }
+
+  if (measured) mLatency[STAGE_TOTAL].record(stageStart - mSubmitTime[slot]);
+  return res;
+}
+
+status_t PipelineBenchmark::run() {
+  const size_t totalFrames = mOptions.warmupFrames + mOptions.frames;
+  nsecs_t measureStart = systemTime();
+  uint64_t allocations = 0;
+  uint64_t allocatedBytes = 0;
+
+  status_t res = submit(0);
+  if (res != OK) return res;
+  for (size_t frame = 0; frame < totalFrames; frame++) {
+    if (frame == mOptions.warmupFrames) {
+      measureStart = systemTime();
+      allocations = gAllocations.load();
+      allocatedBytes = gAllocatedBytes.load();
+    }
+    // The next frame is latched at the VSync that starts this one's
+    // readout, and rendered while this one is processed
+    if (frame + 1 < totalFrames) {
+      res = submit(frame + 1);
+      if (res != OK) return res;
+    }
+    nsecs_t captureTime;
+    if (!mSensor->waitForNewFrame(kFrameTimeout, &captureTime)) {
+      ALOGE("%s: Timed out waiting for frame %zu", __FUNCTION__, frame);
+      return TIMED_OUT;
+    }
+    res = process(frame);
+    if (res != OK) return res;
+  }
+
+  mMeasuredTime = systemTime() - measureStart;
+  mAllocations = gAllocations.load() - allocations;
+  mAllocatedBytes = gAllocatedBytes.load() - allocatedBytes;
+  return OK;
+}
+
+void printLatency(FILE* out, const char* name,
+                  const LatencyHistogram::Summary& summary, bool last) {
+  fprintf(out,
+          "    \"%s\": {\"count\": %" PRIu64
+          ", \"p50_us\": %u, \"p95_us\": %u, \"p99_us\": %u, "
+          "\"max_us\": %u}%s\n",
+          name, summary.count, summary.p50, summary.p95, summary.p99,
+          summary.max, last ? "" : ",");
+}
+
+void PipelineBenchmark::report(FILE* out) const {
+  const double seconds = mMeasuredTime / 1e9;
+  const uint32_t frames = mOptions.frames;
+  fprintf(out, "{\n");
+  fprintf(out, "  \"workload\": \"%s\",\n", kWorkloadNames[mOptions.workload]);
+  fprintf(out, "  \"width\": %u,\n  \"height\": %u,\n", mOptions.width,
+          mOptions.height);
+  fprintf(out, "  \"preview_width\": %u,\n  \"preview_height\": %u,\n",
+          mOptions.previewWidth, mOptions.previewHeight);
+  fprintf(out, "  \"threads\": %u,\n", mOptions.threads);
+  fprintf(out, "  \"paced\": %s,\n", mOptions.paced ? "true" : "false");
+  fprintf(out, "  \"frames\": %u,\n  \"warmup_frames\": %u,\n", frames,
+          mOptions.warmupFrames);
+  fprintf(out, "  \"elapsed_ms\": %.3f,\n", seconds * 1e3);
+  fprintf(out, "  \"frames_per_second\": %.3f,\n",
+          seconds > 0 ? frames / seconds : 0);
+  fprintf(out, "  \"missed_deadlines\": %" PRIu64 ",\n",
+          mSensor->getMissedDeadlines());
+  if (kCountsAllocations) {
+    fprintf(out, "  \"allocations_per_frame\": %.3f,\n",
+            double(mAllocations) / frames);
+    fprintf(out, "  \"allocated_bytes_per_frame\": %.1f,\n",
+            double(mAllocatedBytes) / frames);
+  } else {
+    fprintf(out, "  \"allocations_per_frame\": null,\n");
+    fprintf(out, "  \"allocated_bytes_per_frame\": null,\n");
+  }
+  fprintf(out, "  \"latency\": {\n");
+  // Sensor rendering is timed by the sensor, warm-up frames included
+  printLatency(out, "render", mSensor->getCaptureLatency().getSummary(),
+               false);
+  // Only the stages this workload goes through
+  std::vector<size_t> stages;
+  for (size_t i = 0; i < NUM_STAGES; i++) {
+    if (mLatency[i].getSummary().count > 0) stages.push_back(i);
+  }
+  for (size_t i = 0; i < stages.size(); i++) {
+    printLatency(out, kStageNames[stages[i]],
+                 mLatency[stages[i]].getSummary(), i + 1 == stages.size());
+  }
+  fprintf(out, "  }\n}\n");
+}
+
+bool parseSize(const char* arg, uint32_t* width, uint32_t* height) {
+  char* end;
+  unsigned long w = strtoul(arg, &end, 10);
+  if (*end != 'x') return false;
+  unsigned long h = strtoul(end + 1, &end, 10);
+  // Chroma is subsampled 2x2, so NV21 buffers need even dimensions
+  if (*end != '\0' || w < 2 || h < 2 || w % 2 || h % 2 || w > 8192 ||
+      h > 8192) {
+    return false;
+  }
+  *width = w;
+  *height = h;
+  return true;
+}
+
+bool parseCount(const char* arg, uint32_t min, uint32_t max,
+                uint32_t* count) {
+  char* end;
+  errno = 0;
+  unsigned long value = strtoul(arg, &end, 10);
+  if (errno != 0 || *end != '\0' || value < min || value > max) return false;
+  *count = value;
+  return true;
+}
+
+void usage(const char* name) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --workload=NAME      preview, preview_video, burst_jpeg or raw16"
+          " (preview)\n"
+          "  --size=WxH           sensor and capture size (1600x1200)\n"
+          "  --preview-size=WxH   preview stream size (640x480)\n"
+          "  --frames=N           measured frames (100)\n"
+          "  --warmup=N           frames run before measuring (5)\n"
+          "  --threads=N          sensor render and preview conversion"
+          " threads (CPUs, at most %zu)\n"
+          "  --paced              keep to the sensor frame durations\n"
+          "  --property=KEY=VAL   set a system property, may be repeated\n"
+          "  --output=FILE        write the JSON report to FILE (stdout)\n",
+          name, CaptureScheduler::kMaxRenderThreads);
+}
+
+bool parseOptions(int argc, char** argv, Options* options) {
+  options->workload = WORKLOAD_PREVIEW;
+  options->width = 1600;
+  options->height = 1200;
+  options->previewWidth = 640;
+  options->previewHeight = 480;
+  options->frames = 100;
+  options->warmupFrames = 5;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  options->threads = std::min<long>(std::max<long>(cpus, 1),
+                                    CaptureScheduler::kMaxRenderThreads);
+  options->paced = false;
+  options->output = NULL;
+
+  enum {
+    OPT_WORKLOAD,
+    OPT_SIZE,
+    OPT_PREVIEW_SIZE,
+    OPT_FRAMES,
+    OPT_WARMUP,
+    OPT_THREADS,
+    OPT_PACED,
+    OPT_PROPERTY,
+    OPT_OUTPUT,
+  };
+  static const struct option kOptions[] = {
+      {"workload", required_argument, NULL, OPT_WORKLOAD},
+      {"size", required_argument, NULL, OPT_SIZE},
+      {"preview-size", required_argument, NULL, OPT_PREVIEW_SIZE},
+      {"frames", required_argument, NULL, OPT_FRAMES},
+      {"warmup", required_argument, NULL, OPT_WARMUP},
+      {"threads", required_argument, NULL, OPT_THREADS},
+      {"paced", no_argument, NULL, OPT_PACED},
+      {"property", required_argument, NULL, OPT_PROPERTY},
+      {"output", required_argument, NULL, OPT_OUTPUT},
+      {NULL, 0, NULL, 0},
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", kOptions, NULL)) != -1) {
+    bool valid = true;
+    switch (opt) {
+      case OPT_WORKLOAD: {
+        int i = 0;
+        while (i < NUM_WORKLOADS && strcmp(optarg, kWorkloadNames[i]) != 0) {
+          i++;
+        }
+        valid = i < NUM_WORKLOADS;
+        if (valid) options->workload = static_cast<Workload>(i);
+        break;
+      }
+      case OPT_SIZE:
+        valid = parseSize(optarg, &options->width, &options->height);
+        break;
+      case OPT_PREVIEW_SIZE:
+        valid = parseSize(optarg, &options->previewWidth,
+                          &options->previewHeight);
+        break;
+      case OPT_FRAMES:
+        valid = parseCount(optarg, 1, 1000000, &options->frames);
+        break;
+      case OPT_WARMUP:
+        valid = parseCount(optarg, 0, 1000000, &options->warmupFrames);
+        break;
+      case OPT_THREADS:
+        valid = parseCount(optarg, 1, CaptureScheduler::kMaxRenderThreads,
+                           &options->threads);
+        break;
+      case OPT_PACED:
+        options->paced = true;
+        break;
+      case OPT_PROPERTY:
+        options->properties.push_back(optarg);
+        break;
+      case OPT_OUTPUT:
+        options->output = optarg;
+        break;
+      default:
+        valid = false;
+        break;
+    }
+    if (!valid) {
+      if (optarg != NULL) fprintf(stderr, "Invalid value: %s\n", optarg);
+      return false;
+    }
+  }
+  if (optind != argc) return false;
+  // The sensor downscales by whole factors; the preview has to fit
+  if (options->previewWidth > options->width ||
+      options->previewHeight > options->height) {
+    fprintf(stderr, "The preview can't be larger than the sensor\n");
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+}  // namespace android
+
+using namespace android;
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  PipelineBenchmark benchmark(options);
+  status_t res = benchmark.setUp();
+  if (res != OK) {
+    ALOGE("Unable to set up the pipeline: %d", res);
+    return 1;
+  }
+  res = benchmark.run();
+  if (res != OK) {
+    ALOGE("Pipeline benchmark failed: %d", res);
+    return 1;
+  }
+
+  FILE* out = stdout;
+  if (options.output != NULL) {
+    out = fopen(options.output, "w");
+    if (out == NULL) {
+      ALOGE("Unable to open %s: %s", options.output, strerror(errno));
+      return 1;
+    }
+  }
+  benchmark.report(out);
+  if (out != stdout && fclose(out) != 0) {
+    ALOGE("Unable to write %s: %s", options.output, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for liblog, for the pipeline benchmark. Errors and warnings
+ * go to stderr, so they don't mix with the JSON report on stdout; verbose,
+ * debug and info messages are dropped.
+ */
+
+#ifndef HOST_CUTILS_LOG_H
+#define HOST_CUTILS_LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef LOG_TAG
+#define LOG_TAG NULL
+#endif
+
+#define HOST_LOG(prio, ...)                                        \
+  (fprintf(stderr, "%s %s: ", prio, LOG_TAG ? LOG_TAG : "camera"), \
+   fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+
+#define ALOGE(...) HOST_LOG("E", __VA_ARGS__)
+#define ALOGW(...) HOST_LOG("W", __VA_ARGS__)
+#define ALOGI(...) ((void)0)
+#define ALOGD(...) ((void)0)
+#define ALOGV(...) ((void)0)
+
+#define ALOGE_IF(cond, ...) ((cond) ? (void)ALOGE(__VA_ARGS__) : (void)0)
+#define ALOGW_IF(cond, ...) ((cond) ? (void)ALOGW(__VA_ARGS__) : (void)0)
+
+#define LOG_ALWAYS_FATAL(...) (ALOGE(__VA_ARGS__), abort())
+#define LOG_ALWAYS_FATAL_IF(cond, ...) \
+  ((cond) ? (void)LOG_ALWAYS_FATAL(__VA_ARGS__) : (void)0)
+
+#endif  // HOST_CUTILS_LOG_H
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for system properties, for the pipeline benchmark. Properties
+ * live in the process only; the benchmark sets the ones it needs with
+ * property_set() before starting the pipeline.
+ */
+
+#ifndef HOST_CUTILS_PROPERTIES_H
+#define HOST_CUTILS_PROPERTIES_H
+
+#include <pthread.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+
+#define PROPERTY_KEY_MAX 32
+#define PROPERTY_VALUE_MAX 92
+
+namespace host_properties {
+
+inline pthread_mutex_t* getLock() {
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  return &lock;
+}
+
+inline std::map<std::string, std::string>& getValues() {
+  static std::map<std::string, std::string> values;
+  return values;
+}
+
+}  // namespace host_properties
+
+inline int property_get(const char* key, char* value,
+                        const char* default_value) {
+  std::string found;
+  pthread_mutex_lock(host_properties::getLock());
+  std::map<std::string, std::string>::const_iterator it =
+      host_properties::getValues().find(key);
+  bool set = it != host_properties::getValues().end();
+  if (set) found = it->second;
+  pthread_mutex_unlock(host_properties::getLock());
+
+  if (!set) {
+    if (default_value == NULL) {
+      value[0] = '\0';
+      return 0;
+    }
+    found = default_value;
+  }
+  size_t len = found.copy(value, PROPERTY_VALUE_MAX - 1);
+  value[len] = '\0';
+  return len;
+}
+
+inline int property_set(const char* key, const char* value) {
+  if (strlen(value) >= PROPERTY_VALUE_MAX) return -1;
+  pthread_mutex_lock(host_properties::getLock());
+  host_properties::getValues()[key] = value;
+  pthread_mutex_unlock(host_properties::getLock());
+  return 0;
+}
+
+#endif  // HOST_CUTILS_PROPERTIES_H
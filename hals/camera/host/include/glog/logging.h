@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for glog, for the vsoc tests. Everything goes to stderr;
+ * FATAL messages and failed CHECKs abort once they are written.
+ */
+
+#ifndef HOST_GLOG_LOGGING_H
+#define HOST_GLOG_LOGGING_H
+
+#include <stdlib.h>
+
+#include <iostream>
+
+namespace host_glog {
+
+enum Severity { INFO, WARNING, ERROR, FATAL };
+
+class LogMessage {
+ public:
+  LogMessage(Severity severity, const char* file, int line)
+      : severity_(severity) {
+    static const char kLetters[] = "IWEF";
+    std::cerr << kLetters[severity] << " " << file << ":" << line << "] ";
+  }
+  ~LogMessage() {
+    std::cerr << std::endl;
+    if (severity_ == FATAL) abort();
+  }
+  std::ostream& stream() { return std::cerr; }
+
+ private:
+  Severity severity_;
+};
+
+// Turns the stream expression into void, so that it can be the second
+// operand of ?:
+struct Voidify {
+  void operator&(std::ostream&) {}
+};
+
+}  // namespace host_glog
+
+#define LOG(severity) \
+  host_glog::LogMessage(host_glog::severity, __FILE__, __LINE__).stream()
+
+#define CHECK(condition)                  \
+  (condition) ? (void)0                   \
+              : host_glog::Voidify() &    \
+                    LOG(FATAL) << "Check failed: " #condition " "
+
+#define CHECK_OP(a, op, b) CHECK((a)op(b))
+#define CHECK_EQ(a, b) CHECK_OP(a, ==, b)
+#define CHECK_NE(a, b) CHECK_OP(a, !=, b)
+#define CHECK_LE(a, b) CHECK_OP(a, <=, b)
+#define CHECK_LT(a, b) CHECK_OP(a, <, b)
+#define CHECK_GE(a, b) CHECK_OP(a, >=, b)
+#define CHECK_GT(a, b) CHECK_OP(a, >, b)
+
+#endif  // HOST_GLOG_LOGGING_H
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for the camera2 HAL header, for the pipeline benchmark. Only
+ * the pixel formats and opaque types fake-pipeline2/Base.h refers to; stream
+ * buffers come from the benchmark, so there is no gralloc behind them.
+ */
+
+#ifndef HOST_HARDWARE_CAMERA2_H
+#define HOST_HARDWARE_CAMERA2_H
+
+#include <stdint.h>
+
+typedef const struct native_handle* buffer_handle_t;
+
+typedef struct camera2_stream_ops camera2_stream_ops_t;
+typedef struct camera2_stream_in_ops camera2_stream_in_ops_t;
+
+enum {
+  HAL_PIXEL_FORMAT_RGBA_8888 = 1,
+  HAL_PIXEL_FORMAT_RGB_888 = 3,
+  HAL_PIXEL_FORMAT_RGB_565 = 4,
+  HAL_PIXEL_FORMAT_YCrCb_420_SP = 0x11,
+  HAL_PIXEL_FORMAT_YCbCr_422_I = 0x14,
+  HAL_PIXEL_FORMAT_RAW16 = 0x20,
+  HAL_PIXEL_FORMAT_BLOB = 0x21,
+  HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED = 0x22,
+  HAL_PIXEL_FORMAT_YCbCr_420_888 = 0x23,
+  HAL_PIXEL_FORMAT_Y16 = 0x20363159,
+  HAL_PIXEL_FORMAT_YV12 = 0x32315659,
+};
+
+#endif  // HOST_HARDWARE_CAMERA2_H
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for libexif, for the pipeline benchmark. Thumbnail.cpp stores
+ * the compressed thumbnail in data and size, and saving produces a minimal
+ * TIFF header, so the JPEG encoder still writes an APP1 segment.
+ */
+
+#ifndef HOST_LIBEXIF_EXIF_DATA_H
+#define HOST_LIBEXIF_EXIF_DATA_H
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _ExifData {
+  unsigned char* data;
+  unsigned int size;
+} ExifData;
+
+static inline ExifData* exif_data_new(void) {
+  return (ExifData*)calloc(1, sizeof(ExifData));
+}
+
+static inline void exif_data_unref(ExifData* data) {
+  if (data == NULL) return;
+  free(data->data);
+  free(data);
+}
+
+static inline void exif_data_save_data(ExifData* /*data*/, unsigned char** d,
+                                       unsigned int* ds) {
+  static const unsigned char kHeader[] = {
+      'E', 'x', 'i', 'f', 0, 0, 'I', 'I', 0x2a, 0, 8, 0, 0, 0, 0, 0, 0, 0};
+  *ds = sizeof(kHeader);
+  *d = (unsigned char*)malloc(*ds);
+  if (*d == NULL) {
+    *ds = 0;
+    return;
+  }
+  memcpy(*d, kHeader, *ds);
+}
+
+#endif  // HOST_LIBEXIF_EXIF_DATA_H
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for libutils' Condition, for the pipeline benchmark. Relative
+ * waits are measured on the monotonic clock, like on the device.
+ */
+
+#ifndef HOST_UTILS_CONDITION_H
+#define HOST_UTILS_CONDITION_H
+
+#include <pthread.h>
+#include <time.h>
+
+#include <utils/Errors.h>
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+class Condition {
+ public:
+  Condition() {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&mCond, &attr);
+    pthread_condattr_destroy(&attr);
+  }
+  ~Condition() { pthread_cond_destroy(&mCond); }
+
+  status_t wait(Mutex& mutex) {
+    return -pthread_cond_wait(&mCond, &mutex.mMutex);
+  }
+
+  status_t waitRelative(Mutex& mutex, nsecs_t reltime) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    nsecs_t nsec = ts.tv_nsec + reltime;
+    ts.tv_sec += nsec / 1000000000LL;
+    ts.tv_nsec = nsec % 1000000000LL;
+    return -pthread_cond_timedwait(&mCond, &mutex.mMutex, &ts);
+  }
+
+  void signal() { pthread_cond_signal(&mCond); }
+  void broadcast() { pthread_cond_broadcast(&mCond); }
+
+ private:
+  Condition(const Condition&);
+  Condition& operator=(const Condition&);
+
+  pthread_cond_t mCond;
+};
+
+}  // namespace android
+
+#endif  // HOST_UTILS_CONDITION_H
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for libutils' Mutex, for the pipeline benchmark.
+ */
+
+#ifndef HOST_UTILS_MUTEX_H
+#define HOST_UTILS_MUTEX_H
+
+#include <pthread.h>
+
+#include <utils/Errors.h>
+
+namespace android {
+
+class Condition;
+
+class Mutex {
+ public:
+  Mutex() { pthread_mutex_init(&mMutex, NULL); }
+  ~Mutex() { pthread_mutex_destroy(&mMutex); }
+
+  status_t lock() { return -pthread_mutex_lock(&mMutex); }
+  void unlock() { pthread_mutex_unlock(&mMutex); }
+  status_t tryLock() { return -pthread_mutex_trylock(&mMutex); }
+
+  class Autolock {
+   public:
+    explicit Autolock(Mutex& mutex) : mLock(mutex) { mLock.lock(); }
+    ~Autolock() { mLock.unlock(); }
+
+   private:
+    Mutex& mLock;
+  };
+
+ private:
+  friend class Condition;
+
+  Mutex(const Mutex&);
+  Mutex& operator=(const Mutex&);
+
+  pthread_mutex_t mMutex;
+};
+
+typedef Mutex::Autolock AutoMutex;
+
+}  // namespace android
+
+// libutils' Mutex.h makes Condition available too
+#include <utils/Condition.h>
+
+#endif  // HOST_UTILS_MUTEX_H
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for libutils' strong pointers, for the pipeline benchmark.
+ * Only strong references are supported.
+ */
+
+#ifndef HOST_UTILS_REFBASE_H
+#define HOST_UTILS_REFBASE_H
+
+#include <stddef.h>
+
+#include <atomic>
+
+namespace android {
+
+class RefBase {
+ public:
+  void incStrong(const void* /*id*/) const {
+    mStrong.fetch_add(1, std::memory_order_relaxed);
+  }
+  void decStrong(const void* /*id*/) const {
+    if (mStrong.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+  int32_t getStrongCount() const { return mStrong.load(); }
+
+ protected:
+  RefBase() : mStrong(0) {}
+  virtual ~RefBase() {}
+
+ private:
+  RefBase(const RefBase&);
+  RefBase& operator=(const RefBase&);
+
+  mutable std::atomic<int32_t> mStrong;
+};
+
+template <typename T>
+class sp {
+ public:
+  sp() : mPtr(NULL) {}
+  sp(T* other) : mPtr(other) {
+    if (mPtr) mPtr->incStrong(this);
+  }
+  sp(const sp<T>& other) : mPtr(other.mPtr) {
+    if (mPtr) mPtr->incStrong(this);
+  }
+  template <typename U>
+  sp(const sp<U>& other) : mPtr(other.get()) {
+    if (mPtr) mPtr->incStrong(this);
+  }
+  ~sp() {
+    if (mPtr) mPtr->decStrong(this);
+  }
+
+  sp& operator=(const sp<T>& other) { return *this = other.mPtr; }
+  sp& operator=(T* other) {
+    if (other) other->incStrong(this);
+    if (mPtr) mPtr->decStrong(this);
+    mPtr = other;
+    return *this;
+  }
+
+  void clear() { *this = NULL; }
+
+  T* get() const { return mPtr; }
+  T* operator->() const { return mPtr; }
+  T& operator*() const { return *mPtr; }
+  bool operator==(const T* other) const { return mPtr == other; }
+  bool operator!=(const T* other) const { return mPtr != other; }
+
+ private:
+  T* mPtr;
+};
+
+}  // namespace android
+
+#endif  // HOST_UTILS_REFBASE_H
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for libutils' Thread, for the pipeline benchmark. Priorities
+ * are accepted and ignored; a thread can be run again once its loop exits.
+ */
+
+#ifndef HOST_UTILS_THREAD_H
+#define HOST_UTILS_THREAD_H
+
+#include <pthread.h>
+
+#include <atomic>
+
+#include <utils/Condition.h>
+#include <utils/Errors.h>
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+
+namespace android {
+
+enum {
+  ANDROID_PRIORITY_NORMAL = 0,
+  ANDROID_PRIORITY_FOREGROUND = -2,
+  ANDROID_PRIORITY_DISPLAY = -4,
+  ANDROID_PRIORITY_URGENT_DISPLAY = -8,
+};
+
+class Thread : virtual public RefBase {
+ public:
+  explicit Thread(bool /*canCallJava*/ = true)
+      : mRunning(false), mExitPending(false) {}
+  virtual ~Thread() {}
+
+  virtual status_t run(const char* /*name*/ = NULL, int32_t /*priority*/ = 0,
+                       size_t /*stack*/ = 0) {
+    Mutex::Autolock lock(mLock);
+    if (mRunning) return INVALID_OPERATION;
+    mExitPending = false;
+    mRunning = true;
+    // The thread holds a reference to itself until its loop exits
+    mHoldSelf = this;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, entry, this) != 0) {
+      mRunning = false;
+      mHoldSelf.clear();
+      return UNKNOWN_ERROR;
+    }
+    pthread_detach(thread);
+    mThread = thread;
+    return OK;
+  }
+
+  virtual void requestExit() { mExitPending = true; }
+
+  virtual status_t readyToRun() { return OK; }
+
+  status_t requestExitAndWait() {
+    Mutex::Autolock lock(mLock);
+    if (mRunning && pthread_equal(mThread, pthread_self())) {
+      return WOULD_BLOCK;
+    }
+    mExitPending = true;
+    while (mRunning) mDone.wait(mLock);
+    mExitPending = false;
+    return OK;
+  }
+
+  status_t join() {
+    Mutex::Autolock lock(mLock);
+    if (mRunning && pthread_equal(mThread, pthread_self())) {
+      return WOULD_BLOCK;
+    }
+    while (mRunning) mDone.wait(mLock);
+    return OK;
+  }
+
+  bool isRunning() const { return mRunning; }
+
+ protected:
+  bool exitPending() const { return mExitPending; }
+
+ private:
+  virtual bool threadLoop() = 0;
+
+  static void* entry(void* arg) {
+    Thread* self = static_cast<Thread*>(arg);
+    sp<Thread> strong;
+    {
+      Mutex::Autolock lock(self->mLock);
+      strong = self->mHoldSelf;
+      self->mHoldSelf.clear();
+    }
+    bool again = self->readyToRun() == OK && !self->exitPending();
+    while (again) {
+      again = self->threadLoop() && !self->exitPending();
+    }
+    Mutex::Autolock lock(self->mLock);
+    self->mRunning = false;
+    self->mDone.broadcast();
+    return NULL;
+  }
+
+  Mutex mLock;
+  Condition mDone;
+  pthread_t mThread;
+  std::atomic<bool> mRunning;
+  std::atomic<bool> mExitPending;
+  sp<Thread> mHoldSelf;
+};
+
+}  // namespace android
+
+#endif  // HOST_UTILS_THREAD_H
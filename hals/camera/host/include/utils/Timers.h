@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for libutils' timers, for the pipeline benchmark. Only the
+ * monotonic clock is used by the camera pipeline.
+ */
+
+#ifndef HOST_UTILS_TIMERS_H
+#define HOST_UTILS_TIMERS_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef int64_t nsecs_t;
+
+#define SYSTEM_TIME_MONOTONIC CLOCK_MONOTONIC
+
+static inline nsecs_t systemTime(int clock = SYSTEM_TIME_MONOTONIC) {
+  struct timespec t;
+  clock_gettime(clock, &t);
+  return nsecs_t(t.tv_sec) * 1000000000LL + t.tv_nsec;
+}
+
+static inline nsecs_t seconds_to_nanoseconds(nsecs_t secs) {
+  return secs * 1000000000LL;
+}
+
+static inline nsecs_t milliseconds_to_nanoseconds(nsecs_t msecs) {
+  return msecs * 1000000LL;
+}
+
+static inline nsecs_t ns2ms(nsecs_t v) { return v / 1000000; }
+
+#endif  // HOST_UTILS_TIMERS_H
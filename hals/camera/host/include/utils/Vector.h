@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for libutils' Vector, for the pipeline benchmark. Backed by
+ * std::vector, so clear() keeps the capacity just like the real one.
+ */
+
+#ifndef HOST_UTILS_VECTOR_H
+#define HOST_UTILS_VECTOR_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <vector>
+
+namespace android {
+
+template <typename T>
+class Vector {
+ public:
+  typedef T* iterator;
+  typedef const T* const_iterator;
+
+  size_t size() const { return mItems.size(); }
+  bool isEmpty() const { return mItems.empty(); }
+  size_t capacity() const { return mItems.capacity(); }
+  ssize_t setCapacity(size_t size) {
+    mItems.reserve(size);
+    return size;
+  }
+  void clear() { mItems.clear(); }
+
+  const T& operator[](size_t index) const { return mItems[index]; }
+  T& operator[](size_t index) { return mItems[index]; }
+  const T& itemAt(size_t index) const { return mItems[index]; }
+  T& editItemAt(size_t index) { return mItems[index]; }
+  const T& top() const { return mItems.back(); }
+  T& editTop() { return mItems.back(); }
+  const T* array() const { return mItems.data(); }
+  T* editArray() { return mItems.data(); }
+
+  ssize_t add(const T& item) { return push_back(item); }
+  ssize_t push_back(const T& item) {
+    mItems.push_back(item);
+    return mItems.size() - 1;
+  }
+  ssize_t insertAt(const T& item, size_t index, size_t numItems = 1) {
+    mItems.insert(mItems.begin() + index, numItems, item);
+    return index;
+  }
+  ssize_t removeAt(size_t index) {
+    mItems.erase(mItems.begin() + index);
+    return index;
+  }
+  void pop() { mItems.pop_back(); }
+
+  iterator begin() { return mItems.data(); }
+  iterator end() { return mItems.data() + mItems.size(); }
+  const_iterator begin() const { return mItems.data(); }
+  const_iterator end() const { return mItems.data() + mItems.size(); }
+
+ private:
+  std::vector<T> mItems;
+};
+
+}  // namespace android
+
+#endif  // HOST_UTILS_VECTOR_H